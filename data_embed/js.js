@@ -6,6 +6,11 @@ function scanWifi() {
   scanBtn.disabled = true;
   var xhttp = new XMLHttpRequest();
   xhttp.onreadystatechange = function() {
+    if (this.readyState == 4 && this.status == 202) {
+      // still scanning
+      setTimeout(scanWifi, 1000);
+      return;
+    }
     scanBtn.disabled = false;
     if (this.readyState == 4 && this.status == 200) {
       wifiListContainer.innerHTML = this.responseText;
@@ -20,7 +25,8 @@ function scanWifi() {
   xhttp.send();
 }
 
-window.onload = function () {
+// sets the form elements with the ids of the keys
+function loadValues(url) {
     var xhttp = new XMLHttpRequest();
     xhttp.onreadystatechange = function() {
       if (this.readyState == 4 && this.status == 200) {
@@ -37,21 +43,65 @@ window.onload = function () {
         }
       }
     };
-    xhttp.open("GET", "/cfg", true);
+    xhttp.open("GET", url, true);
     xhttp.send();
+}
+
+window.onload = function () {
+    // settings (cached by the browser while unchanged), and the current status
+    loadValues("/cfg");
+    loadValues("/status");
+    loadReceivedList();
+    if (window.EventSource) {
+      liveFrames();
+    } else {
+      setInterval(loadReceivedList, 10000);
+    }
+};
+
+// frames received and sent, pushed by the device (/events). A received one also updates the received list
+const LIVE_FRAMES_MAX = 20;
+function liveFrames() {
+    const source = new EventSource('/events');
+    source.addEventListener('frame', function(e) {
+      const frame = JSON.parse(e.data);
+      let tbody = document.getElementById('liveFrames');
+      let tr = document.createElement('tr');
+      const time = frame['time'] ? new Date(frame['time'] * 1000).toISOString().substr(11, 8) : (frame['up'] / 1000).toFixed(0) + 's';
+      for (const value of [time, frame['dir'], frame['frame'], frame['freq'], frame['rssi'], frame['snr']]) {
+        let td = document.createElement('td');
+        td.textContent = (value === undefined) ? '' : value;
+        tr.appendChild(td);
+      }
+      tbody.insertBefore(tr, tbody.firstChild);
+      while (tbody.rows.length > LIVE_FRAMES_MAX) {
+        tbody.deleteRow(-1);
+      }
+      if (frame['dir'] == 'RX') {
+        loadReceivedList();
+      }
+    });
+}
+
+// received frames: only the new ones since the last call ("last" of the answer)
+var receivedLast = 0;
+function loadReceivedList() {
     var xhttpFramesList = new XMLHttpRequest();
     xhttpFramesList.onreadystatechange = function() {
       if (this.readyState == 4 && this.status == 200) {
         const response = JSON.parse(this.responseText);
         let tbody = document.getElementById('receivedFrames');
-        tbody.innerHTML = '';
+        // first call, or the device restarted: we got all of them
+        if (receivedLast == 0 || response['last'] < receivedLast) {
+          tbody.innerHTML = '';
+        }
         for (const frameInfo of response['received']) {
             let tr = document.createElement('tr');
             let td_t = document.createElement('td');
             td_t.innerHTML = frameInfo['time'];
             tr.appendChild(td_t);
             let td_p = document.createElement('td');
-            td_p.innerHTML = frameInfo['packet'];
+            td_p.textContent = frameInfo['packet'];
             tr.appendChild(td_p);
             let td_r = document.createElement('td');
             td_r.innerHTML = frameInfo['rssi'];
@@ -61,11 +111,15 @@ window.onload = function () {
             tr.appendChild(td_s);
             tbody.appendChild(tr);
         }
+        while (tbody.rows.length > response['capacity']) {
+          tbody.deleteRow(0);
+        }
+        receivedLast = response['last'];
       }
     };
-    xhttpFramesList.open("GET", "/received_list", true);
+    xhttpFramesList.open("GET", "/received_list?since=" + receivedLast, true);
     xhttpFramesList.send();
-};
+}
 
 function onFileChange(obj){
   var fileName = obj.value.split('\\');
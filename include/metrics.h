@@ -0,0 +1,84 @@
+#include <Arduino.h>
+
+#ifndef METRICS_H
+#define METRICS_H
+
+// Runtime counters, for http://<device>/metrics. They only count up (wrap at 2^32).
+// Counters of loraSend() and web_events_dropped are written by loop() and taskAPRSIS: under metrics_mux
+
+// metrics.rx_frames[]
+#define METRICS_QRG_MAIN 0
+#define METRICS_QRG_CROSS 1
+
+// metrics.tx_frames[], by the kind passed to loraSend()
+#define METRICS_TX_OWN 0           // "TX": own beacon
+#define METRICS_TX_KISS 1          // "KISS": from a KISS client
+#define METRICS_TX_DIGI 2          // "digi"
+#define METRICS_TX_IS 3            // "IS": gated from APRS-IS
+#define METRICS_TX_KINDS 4
+
+// metrics.kiss_*_bytes[]
+#define METRICS_KISS_SERIAL 0
+#define METRICS_KISS_BLUETOOTH 1
+#define METRICS_KISS_TCP 2         // all TCP clients
+#define METRICS_KISS_PORTS 3
+
+typedef struct {
+  uint32_t rx_frames[2];           // LoRa frames read from the radio
+  uint32_t rx_invalid;             // packet_is_valid() failed
+  uint32_t rx_blacklisted;
+  uint32_t digi_too_late;          // digipeat skipped, due time passed
+  uint32_t tx_frames[METRICS_TX_KINDS];
+  uint32_t csma_slots;             // loraSend(): slots waited before TX
+  uint32_t csma_busy;              // ... of them with a signal detected
+  uint32_t csma_gave_up;           // channel never free: sent anyway
+  uint32_t airtime_ms;
+  uint32_t kiss_rx_bytes[METRICS_KISS_PORTS];
+  uint32_t kiss_tx_bytes[METRICS_KISS_PORTS];
+  uint32_t kiss_in_dropped;        // frames from KISS clients: queue to loop() full
+  uint32_t kiss_out_dropped;       // frames to KISS clients: queue to taskTNC full
+  uint32_t weblist_dropped;        // queue to the received list full
+  uint32_t web_events_dropped;     // queue to /events listeners full
+  uint32_t nmea_invalid;           // GPS sentences too long or with a bad checksum
+  uint32_t nmea_dropped;           // sentences not sent to an NMEA client: it was still behind
+  uint32_t ubx_invalid;            // UBX frames from the GPS with a bad checksum
+  uint32_t gps_sleeps;             // GPS put to sleep between beacons
+  uint32_t gps_slept_ms;
+  uint32_t gps_time_to_fix_ms;     // after a wake, smoothed
+} tMetrics;
+
+extern tMetrics metrics;
+extern portMUX_TYPE metrics_mux;
+
+#define METRICS_TASKS_MAX 8
+
+/**
+ * Report the stack high water mark of the calling task in /metrics. Call once, at the start of the task.
+ */
+void metrics_register_task();
+
+/**
+ * Registered tasks. Returns their number
+ */
+uint8_t metrics_tasks(TaskHandle_t *tasks, uint8_t max);
+
+/**
+ * Index into metrics.tx_frames[] of a loraSend() kind
+ */
+uint8_t metrics_tx_kind(const char *kind);
+
+#define METRICS_BOOT_PHASES_MAX 12
+
+/**
+ * An init phase is done: ms since the start of the firmware (not counting the boot loader), on the serial
+ * console and in /metrics. Only the first call of each phase counts; any task
+ * @param phase a string literal
+ */
+void metrics_boot_phase(const char *phase);
+
+/**
+ * Init phases done so far, in the order of their end. Returns their number
+ */
+uint8_t metrics_boot_phases(const char **phases, uint32_t *ms, uint8_t max);
+
+#endif
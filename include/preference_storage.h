@@ -1,10 +1,75 @@
-#include <Preferences.h>
+#include <Arduino.h>
 
 #ifndef PREF_STORAGE
 #define PREF_STORAGE
 
 #define ENABLE_PREFERENCES
-extern Preferences preferences;
+
+/*
+ * All settings in RAM, persisted as one versioned, CRC checked blob in NVS.
+ * Same interface as Preferences, so the PREF_* keys below work as before; but
+ * begin() reads NVS once, and put*() only change RAM. commit() writes the blob
+ * (one NVS write), poll() does it once the settings did not change for a while.
+ * Between beginTransaction() and commitTransaction(), other tasks wait for the
+ * store: they see the settings of a save either all or not at all.
+ *
+ * Values are typed like in NVS: get*() of a key stored with another type returns the default.
+ * On the first start after an update, the settings in the old layout (one NVS
+ * key per setting) are read into RAM, written as blob and removed.
+ */
+#define CFG_STORE_VERSION 1
+#define CFG_STORE_COMMIT_DELAY 2000   // ms. poll(): no change for that long
+// Blob limit. IDF 3.3 spreads a blob over pages (at most 97.6% of the partition less 4000 bytes:
+// 15988 with our 20k nvs), but a save needs room for the old and the new blob, beside WiFi and
+// PHY data. All settings with typical values take about 3k
+#define CFG_STORE_MAX_LEN 6000
+
+struct cfg_entry;
+
+class ConfigStore {
+public:
+  bool begin(const char *name, bool readOnly = false);
+  void end();
+  bool clear();
+
+  bool commit();
+  void poll();
+  void beginTransaction();
+  bool commitTransaction();
+
+  size_t putBool(const char *key, bool value);
+  size_t putInt(const char *key, int32_t value);
+  size_t putUInt(const char *key, uint32_t value);
+  size_t putDouble(const char *key, double value);
+  size_t putString(const char *key, const char *value);
+  size_t putString(const char *key, const String &value);
+
+  bool getBool(const char *key, bool defaultValue = false);
+  int32_t getInt(const char *key, int32_t defaultValue = 0);
+  uint32_t getUInt(const char *key, uint32_t defaultValue = 0);
+  double getDouble(const char *key, double defaultValue = NAN);
+  String getString(const char *key, const String &defaultValue = String());
+
+private:
+  struct cfg_entry *find(const char *key);
+  struct cfg_entry *add(const char *key);
+  void set(struct cfg_entry *e, uint8_t type);
+  void drop_all();
+  bool load();
+  bool migrate_legacy();
+  void lock();
+  void unlock();
+
+  uint32_t handle = 0;
+  SemaphoreHandle_t mutex = nullptr;
+  struct cfg_entry *entries = nullptr;
+  uint16_t count = 0;
+  uint16_t allocated = 0;
+  bool dirty = false;
+  uint32_t t_changed = 0;
+};
+
+extern ConfigStore preferences;
 
 // MAX 15 chars for preference key!!!
 static const char *const PREF_WIFI_SSID = "wifi_ssid";
@@ -56,6 +121,8 @@ static const char *const PREF_APRS_DIGIPEATING_MODE_PRESET_INIT = "lora_dig_mode
 static const char *const PREF_APRS_DIGIPEATING_MODE_PRESET = "lora_dig_mode";
 static const char *const PREF_APRS_CROSS_DIGIPEATING_MODE_PRESET_INIT = "lora_dig_x_m_i";
 static const char *const PREF_APRS_CROSS_DIGIPEATING_MODE_PRESET = "lora_dig_x_m";
+static const char *const PREF_APRS_DIGIPEATING_RULES_INIT = "lora_dig_rul_i";
+static const char *const PREF_APRS_DIGIPEATING_RULES = "lora_dig_rules";
 
 // Station settings
 static const char *const PREF_APRS_CALLSIGN = "aprs_callsign";
@@ -120,6 +187,12 @@ static const char *const PREF_ACCEPT_OWN_POSITION_REPORTS_VIA_KISS = "kiss_myloc
 static const char *const PREF_ACCEPT_OWN_POSITION_REPORTS_VIA_KISS_INIT = "kiss_myloc_ok_i";
 static const char *const PREF_GPS_ALLOW_SLEEP_WHILE_KISS = "gps_sleep_ok";
 static const char *const PREF_GPS_ALLOW_SLEEP_WHILE_KISS_INIT = "gps_sleep_ok_i";
+static const char *const PREF_GPS_UBX_PVT = "gps_ubx_pvt";
+static const char *const PREF_GPS_UBX_PVT_INIT = "gps_ubx_pvt_i";
+static const char *const PREF_GPS_UBX_RATE = "gps_ubx_rate";
+static const char *const PREF_GPS_UBX_RATE_INIT = "gps_ubx_rate_i";
+static const char *const PREF_GPS_POWER_SAVE = "gps_pwr_save";
+static const char *const PREF_GPS_POWER_SAVE_INIT = "gps_pwr_save_i";
 static const char *const PREF_APRS_SHOW_CMT = "show_cmt";
 static const char *const PREF_APRS_SHOW_CMT_INIT = "show_cmt_init";
 static const char *const PREF_DEV_BT_EN = "bt_enabled";
@@ -138,6 +211,8 @@ static const char *const PREF_DEV_SHOW_OLED_TIME = "sh_oledtime"; // set OLED ti
 static const char *const PREF_DEV_SHOW_OLED_TIME_INIT = "sh_oledtime_i";
 static const char *const PREF_DEV_CPU_FREQ = "cpufreq";
 static const char *const PREF_DEV_CPU_FREQ_INIT = "cpufreq_i";
+static const char *const PREF_DEV_FAST_BOOT = "fast_boot";
+static const char *const PREF_DEV_FAST_BOOT_INIT = "fast_boot_i";
 
 
 // APRSIS settings
@@ -155,5 +230,7 @@ static const char *const PREF_APRSIS_PASSWORD_INIT = "aprsis_pw_i";
 static const char *const PREF_APRSIS_PASSWORD = "aprsis_pw";
 static const char *const PREF_APRSIS_ALLOW_INET_TO_RF_INIT = "aprsis_2rf_i";
 static const char *const PREF_APRSIS_ALLOW_INET_TO_RF = "aprsis_2rf";
+static const char *const PREF_APRSIS_RF_FILTER_INIT = "aprsis_rffltr_i";
+static const char *const PREF_APRSIS_RF_FILTER = "aprsis_rffltr";
 
 #endif
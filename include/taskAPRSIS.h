@@ -0,0 +1,106 @@
+#include <Arduino.h>
+#include <WiFi.h>
+#include <AprsFilter.h>
+#include "taskWebServer.h"
+
+#ifndef TASK_APRSIS
+#define TASK_APRSIS
+
+// APRS-IS uplink: TNC2 frames, from loop() to taskAPRSIS
+#define APRSIS_UPLINK_QUEUE_LEN 16
+extern QueueHandle_t aprsisUplinkQueue;
+
+typedef struct {
+  String *frame;
+  uint32_t t_rx_us;          // micros() of LoRa RX, or when queued
+} tAprsisUplinkFrame;
+
+// Each counter is written by one task only
+typedef struct {
+  uint32_t queued;           // send_to_aprsis()
+  uint32_t dropped_full;     // send_to_aprsis(): queue full
+  uint32_t dropped_offline;  // not connected to APRS-IS, or connection lost
+  uint32_t not_gated;        // aprsis_uplink_line(): third party TCPIP/TCPXX, no valid frame, or too long
+  uint32_t sent;             // lines written to the server
+  uint32_t writes;           // batches: several lines per write
+} tAprsisUplinkStats;
+
+extern tAprsisUplinkStats aprsisUplinkStats;
+
+// upload latency (RX until written to the socket): < 10ms, < 100ms, < 1s, < 10s, more
+#define APRSIS_LATENCY_BUCKETS 5
+
+// Written by taskAPRSIS only, read by the webserver
+typedef struct {
+  uint8_t server;            // index of the server in use, in the list of aprsis_host
+  uint32_t failovers;        // switched to the next server without backoff
+  uint32_t connects;         // logged in
+  uint32_t connect_failures; // connect, greeting or login failed
+  uint32_t disconnects;      // connection lost after login
+  uint32_t lines_in;
+  uint32_t bytes_in;
+  uint32_t bytes_out;
+  uint32_t t_last_rx;        // millis() of the last line from the server. 0: none yet
+  uint32_t t_last_keepalive; // millis() of the last server comment line ('#')
+  // downlink lines, by what happened to them
+  uint32_t dl_comment;       // server comments
+  uint32_t dl_invalid;       // no valid frame
+  uint32_t dl_own;           // sent or digipeated by us
+  uint32_t dl_to_us;         // message to us: KISS only
+  uint32_t gated_kiss;
+  uint32_t gated_rf;
+  uint32_t rf_filter_no_match;               // no accepting term matched
+  uint32_t rf_filter_not_heard;              // h/: message to a station not heard recently
+  uint32_t rf_filter_rejected[APRS_FILTER_TERMS_MAX];  // by '-' term. Reset with a new filter
+  // uplink latency
+  uint32_t latency_count;
+  uint64_t latency_sum_us;
+  uint32_t latency_max_us;
+  uint32_t latency_bucket[APRSIS_LATENCY_BUCKETS];
+} tAprsisStats;
+
+extern tAprsisStats aprsisStats;
+
+/**
+ * All APRS-IS counters as JSON. Returns the length, or 0 if buf was too small.
+ */
+size_t aprsis_stats_json(char *buf, size_t len);
+
+/**
+ * Copy of the connection status text, for the web interface
+ */
+void aprsis_status_get(char *buf, size_t len);
+
+/**
+ * Compile the local filter for gating APRS-IS traffic to RF (see lib/AprsFilter).
+ * On error, the filter in use is kept; until one compiled, nothing is gated to RF.
+ * Returns 0 on success, -1 on error (message in err).
+ */
+int aprsis_rf_filter_set(const char *text, char *err, size_t errlen);
+
+/**
+ * Check of the APRS-IS settings; an empty APRS-IS callsign becomes aprs_callsign.
+ * Returns aprsis_enabled: false if they are not usable.
+ */
+bool aprsis_settings_check(const String &aprs_callsign);
+
+/**
+ * Start taskAPRSIS, if APRS-IS is enabled. By taskWebServer, once.
+ * @param cfg kept, for starting the task later
+ */
+void aprsis_start(tWebServerCfg *cfg);
+
+/**
+ * APRS-IS settings were saved: the client reloads them, and logs in again if needed.
+ * Starts the client if it has just been enabled. By loop() (apply_settings()), not by the webserver:
+ * while the client does not run, the settings are loaded right here.
+ */
+void aprsis_settings_changed();
+
+/**
+ * APRS-IS client. Started by aprsis_start().
+ * @param parameter tWebServerCfg *
+ */
+[[noreturn]] void taskAPRSIS(void *parameter);
+
+#endif
@@ -1,6 +1,7 @@
 #include <Arduino.h>
 #include <WiFi.h>
-#include <WebServer.h>
+#include <AsyncTCP.h>
+#include <ESPAsyncWebServer.h>
 #include <ESPmDNS.h>
 #include <Update.h>
 #include <BG_RF95.h>
@@ -27,5 +28,20 @@ typedef struct {
 
 extern QueueHandle_t webListReceivedQueue;
 
+/**
+ * Settings in NVS were changed: /cfg renders them again, and they are written to flash.
+ * False if writing failed: they are only in effect until the next reboot.
+ */
+bool web_cfg_changed();
+
+/**
+ * A frame for the live stream of the web interface (/events). Copied into a queue, never blocks;
+ * dropped if nobody is listening or the queue is full.
+ * @param kind "RX", "TX", "digi" or "IS". A string literal
+ * @param rssi, snr only for "RX"
+ * @param freq MHz
+ */
+void web_event_frame(const char *kind, const String &frame, int rssi, int snr, double freq);
+
 [[noreturn]] void taskWebServer(void *parameter);
 #endif
\ No newline at end of file
@@ -0,0 +1,307 @@
+#include "AprsFilter.h"
+#include <HeardStations.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+// decimal degrees, "-48.1234"
+static bool aprs_filter_degrees(const char *s, int32_t max_deg, int32_t *v)
+{
+  char *end;
+  double d = strtod(s, &end);
+
+  if (end == s || *end || d < -max_deg || d > max_deg)
+    return false;
+  *v = (int32_t) lround(d * 1000000.0);
+  return true;
+}
+
+static uint32_t aprs_distance_m(int32_t lat1, int32_t lon1, int32_t lat2, int32_t lon2)
+{
+  const double rad = M_PI / 180.0 / 1000000.0;
+  double s_lat = sin((lat2 - lat1) * rad / 2);
+  double s_lon = sin((lon2 - lon1) * rad / 2);
+  double a = s_lat * s_lat + cos(lat1 * rad) * cos(lat2 * rad) * s_lon * s_lon;
+
+  return (uint32_t) (2 * 6371000.0 * asin(sqrt(a)));
+}
+
+int aprs_filter_compile(const char *text, struct aprs_filter *f, char *err, size_t errlen)
+{
+  char buf[APRS_FILTER_TEXT_MAX+1];
+  char *tok;
+  char *tok_save;
+
+  memset(f, 0, sizeof(*f));
+  if (err && errlen)
+    *err = 0;
+  if (!text)
+    return 0;
+  if (strlen(text) > sizeof(buf)-1) {
+    snprintf(err, errlen, "filter too long (max %d chars)", APRS_FILTER_TEXT_MAX);
+    return -1;
+  }
+  strcpy(buf, text);
+
+  for (tok = strtok_r(buf, " \t\r\n", &tok_save); tok; tok = strtok_r(0, " \t\r\n", &tok_save)) {
+    bool reject = (*tok == '-');
+    char kind;
+    char *args[APRS_FILTER_CALLS_MAX + 1];
+    int nargs = 0;
+    char *arg_save;
+    char *arg;
+
+    if (reject)
+      tok++;
+    kind = *tok;
+    if (!kind || tok[1] != '/') {
+      snprintf(err, errlen, "'%s': expected x/...", tok);
+      return -1;
+    }
+    for (arg = strtok_r(tok + 2, "/", &arg_save); arg; arg = strtok_r(0, "/", &arg_save)) {
+      if (nargs == APRS_FILTER_CALLS_MAX + 1) {
+        snprintf(err, errlen, "%c/: too many arguments", kind);
+        return -1;
+      }
+      args[nargs++] = arg;
+    }
+
+    if (kind == 'h') {
+      char *end;
+      long n = nargs == 1 ? strtol(args[0], &end, 10) : 0;
+      if (reject || nargs != 1 || *end || n < 1 || n > 1440 || f->heard_minutes) {
+        snprintf(err, errlen, "h/: expected once, 1..1440 minutes");
+        return -1;
+      }
+      f->heard_minutes = n;
+      continue;
+    }
+
+    if (f->terms == APRS_FILTER_TERMS_MAX) {
+      snprintf(err, errlen, "too many terms (max %d)", APRS_FILTER_TERMS_MAX);
+      return -1;
+    }
+    struct aprs_filter_term *t = &f->term[f->terms];
+    t->reject = reject;
+
+    switch (kind) {
+    case 'r': {
+      char *end = 0;
+      double km = (nargs == 3) ? strtod(args[2], &end) : 0;
+      t->kind = APRS_FILTER_RANGE;
+      if (nargs != 3 || !aprs_filter_degrees(args[0], 90, &t->lat1) || !aprs_filter_degrees(args[1], 180, &t->lon1) ||
+          *end || km <= 0 || km > 20000) {
+        snprintf(err, errlen, "r/: expected r/lat/lon/km");
+        return -1;
+      }
+      t->dist_m = (uint32_t) (km * 1000);
+      break;
+    }
+    case 'a':
+      t->kind = APRS_FILTER_AREA;
+      if (nargs != 4 || !aprs_filter_degrees(args[0], 90, &t->lat1) || !aprs_filter_degrees(args[1], 180, &t->lon1) ||
+          !aprs_filter_degrees(args[2], 90, &t->lat2) || !aprs_filter_degrees(args[3], 180, &t->lon2) ||
+          t->lat1 < t->lat2 || t->lon1 > t->lon2) {
+        snprintf(err, errlen, "a/: expected a/latN/lonW/latS/lonE");
+        return -1;
+      }
+      break;
+    case 'p':
+    case 'b':
+      t->kind = (kind == 'p') ? APRS_FILTER_PREFIX : APRS_FILTER_BUDDY;
+      if (!nargs || nargs > APRS_FILTER_CALLS_MAX) {
+        snprintf(err, errlen, "%c/: 1..%d calls expected", kind, APRS_FILTER_CALLS_MAX);
+        return -1;
+      }
+      for (int i = 0; i < nargs; i++) {
+        size_t len = strlen(args[i]);
+        if (len > AX_ADDR_LEN + (kind == 'b' ? 1 : 0) || (kind == 'p' && strchr(args[i], '*'))) {
+          snprintf(err, errlen, "%c/: invalid call '%s'", kind, args[i]);
+          return -1;
+        }
+        for (char *p = args[i]; *p; p++) {
+          if (*p >= 'a' && *p <= 'z')
+            *p -= 'a' - 'A';
+        }
+        strcpy(t->call[i], args[i]);
+      }
+      t->calls = nargs;
+      break;
+    case 't':
+      t->kind = APRS_FILTER_TYPE;
+      if (nargs != 1) {
+        snprintf(err, errlen, "t/: expected t/poimqstunw");
+        return -1;
+      }
+      for (const char *p = args[0]; *p; p++) {
+        const char *types = "poimqstunw";
+        const char *q = strchr(types, *p);
+        if (!q) {
+          snprintf(err, errlen, "t/: unknown type '%c'", *p);
+          return -1;
+        }
+        t->types |= 1 << (q - types);
+      }
+      break;
+    default:
+      snprintf(err, errlen, "unknown filter '%c/'", kind);
+      return -1;
+    }
+    f->terms++;
+    if (!reject)
+      f->accepting++;
+  }
+  return 0;
+}
+
+
+uint16_t aprs_frame_types(const char *frame)
+{
+  const char *info = strchr(frame, ':');
+  const char *pos;
+
+  if (!info)
+    return 0;
+  info++;
+
+  switch (*info) {
+  case '!':
+  case '=':
+  case '/':
+  case '@':
+    // weather reports are positions with symbol '_'
+    pos = info + ((*info == '/' || *info == '@') ? 8 : 1);
+    if (strlen(pos) >= 19 && *pos >= '0' && *pos <= '9')
+      return (pos[18] == '_') ? (APRS_TYPE_POSITION | APRS_TYPE_WEATHER) : APRS_TYPE_POSITION;
+    if (strlen(pos) >= 10)
+      return (pos[9] == '_') ? (APRS_TYPE_POSITION | APRS_TYPE_WEATHER) : APRS_TYPE_POSITION;
+    return APRS_TYPE_POSITION;
+  case '`':
+  case '\'':
+  case 0x1c:
+  case 0x1d:
+  case '$':
+    return APRS_TYPE_POSITION;
+  case '_':
+    return APRS_TYPE_WEATHER;
+  case ';':
+    return APRS_TYPE_OBJECT;
+  case ')':
+    return APRS_TYPE_ITEM;
+  case '?':
+    return APRS_TYPE_QUERY;
+  case '>':
+    return APRS_TYPE_STATUS;
+  case 'T':
+    return APRS_TYPE_TELEMETRY;
+  case '{':
+    return APRS_TYPE_USERDEF;
+  case ':':
+    // ":ADDRESSEE:text"
+    if (strlen(info) < 11 || info[10] != ':')
+      return 0;
+    if (!strncmp(info+1, "NWS", 3) || !strncmp(info+1, "SKY", 3) || !strncmp(info+1, "BOM", 3))
+      return APRS_TYPE_NWS;
+    if (!strncmp(info+11, "PARM.", 5) || !strncmp(info+11, "UNIT.", 5) || !strncmp(info+11, "EQNS.", 5) || !strncmp(info+11, "BITS.", 5))
+      return APRS_TYPE_TELEMETRY;
+    if (info[11] == '?')
+      return APRS_TYPE_QUERY;
+    return APRS_TYPE_MESSAGE;
+  }
+  return 0;
+}
+
+static bool aprs_filter_term_match(const struct aprs_filter_term *t, const char *frame, size_t src_len,
+                                   bool has_pos, int32_t lat, int32_t lon, uint16_t types)
+{
+  switch (t->kind) {
+  case APRS_FILTER_RANGE:
+    return has_pos && aprs_distance_m(t->lat1, t->lon1, lat, lon) <= t->dist_m;
+  case APRS_FILTER_AREA:
+    return has_pos && lat <= t->lat1 && lat >= t->lat2 && lon >= t->lon1 && lon <= t->lon2;
+  case APRS_FILTER_PREFIX:
+    for (int i = 0; i < t->calls; i++) {
+      size_t len = strlen(t->call[i]);
+      if (len <= src_len && !strncmp(frame, t->call[i], len))
+        return true;
+    }
+    return false;
+  case APRS_FILTER_BUDDY:
+    for (int i = 0; i < t->calls; i++) {
+      size_t len = strlen(t->call[i]);
+      if (len && t->call[i][len-1] == '*') {
+        if (len - 1 <= src_len && !strncmp(frame, t->call[i], len - 1))
+          return true;
+      } else if (len == src_len && !strncmp(frame, t->call[i], len)) {
+        return true;
+      }
+    }
+    return false;
+  case APRS_FILTER_TYPE:
+    return (t->types & types) != 0;
+  }
+  return false;
+}
+
+// addressee of a message heard on RF within minutes?
+static bool aprs_filter_addressee_heard(const char *info, uint16_t minutes, uint32_t now)
+{
+  char call[AX_ADDR_LEN+1];
+  struct heard_station e;
+  int len = 0;
+
+  while (len < AX_ADDR_LEN && info[1+len] != ' ' && info[1+len] != ':') {
+    call[len] = info[1+len];
+    len++;
+  }
+  call[len] = 0;
+  if (!heard_stations_lookup(ax25_addr_key(call), &e))
+    return false;
+  return (now - e.last_heard) <= (uint32_t) minutes * 60000;
+}
+
+bool aprs_filter_match(const struct aprs_filter *f, const char *frame, uint32_t now, int *reason)
+{
+  const char *src_end = strchr(frame, '>');
+  const char *info = strchr(frame, ':');
+  bool has_pos = false;
+  bool pos_parsed = false;
+  int32_t lat = 0;
+  int32_t lon = 0;
+  uint16_t types;
+  bool accepted;
+
+  if (reason)
+    *reason = APRS_FILTER_NO_MATCH;
+  if (!src_end || !info || info < src_end)
+    return false;
+  types = aprs_frame_types(frame);
+
+  if (f->heard_minutes && (types & APRS_TYPE_MESSAGE) && !aprs_filter_addressee_heard(info + 1, f->heard_minutes, now)) {
+    if (reason)
+      *reason = APRS_FILTER_NOT_HEARD;
+    return false;
+  }
+
+  accepted = !f->accepting;
+  for (int i = 0; i < f->terms; i++) {
+    const struct aprs_filter_term *t = &f->term[i];
+    // an accepting term already matched: only rejecting terms are of interest
+    if (accepted && !t->reject)
+      continue;
+    if ((t->kind == APRS_FILTER_RANGE || t->kind == APRS_FILTER_AREA) && !pos_parsed) {
+      has_pos = aprs_frame_position(frame, &lat, &lon);
+      pos_parsed = true;
+    }
+    if (aprs_filter_term_match(t, frame, src_end - frame, has_pos, lat, lon, types)) {
+      if (t->reject) {
+        if (reason)
+          *reason = i;
+        return false;
+      }
+      accepted = true;
+    }
+  }
+  return accepted;
+}
@@ -0,0 +1,93 @@
+#ifndef APRS_FILTER_H
+#define APRS_FILTER_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <Digipeater.h>
+
+/*
+ * Local filter for frames we gate from APRS-IS to RF.
+ *
+ * Subset of the APRS-IS server side filter syntax
+ * (http://www.aprs-is.net/javAPRSFilter.aspx), terms separated by spaces:
+ *
+ *   r/lat/lon/dist          sender position within dist km of lat/lon
+ *   a/latN/lonW/latS/lonE   sender position inside the box
+ *   p/aa/bb/cc              source call starts with aa, bb or cc
+ *   b/call1/call2*          source call is call1, or starts with call2
+ *   t/poimqstunw            type: position, object, item, message, query,
+ *                           status, telemetry, user defined, NWS, weather
+ *   h/minutes               messages (and acks) only to stations we heard on
+ *                           RF within the last minutes. Not a server filter.
+ *
+ * A term with a leading '-' (-p/DB0) rejects what it matches. A frame passes
+ * if it matches no rejecting term, and at least one of the other terms if
+ * there are any. h/ applies on top of that. An empty filter passes everything.
+ *
+ * The position is the one of the sender, as aprs_frame_position() decodes it;
+ * objects and items do not match r/ and a/.
+ */
+
+#define APRS_FILTER_TERMS_MAX 16
+#define APRS_FILTER_CALLS_MAX 8
+#define APRS_FILTER_TEXT_MAX 256
+
+#define APRS_FILTER_RANGE 1
+#define APRS_FILTER_AREA 2
+#define APRS_FILTER_PREFIX 3
+#define APRS_FILTER_BUDDY 4
+#define APRS_FILTER_TYPE 5
+
+// t/ type bits
+#define APRS_TYPE_POSITION 0x001
+#define APRS_TYPE_OBJECT 0x002
+#define APRS_TYPE_ITEM 0x004
+#define APRS_TYPE_MESSAGE 0x008
+#define APRS_TYPE_QUERY 0x010
+#define APRS_TYPE_STATUS 0x020
+#define APRS_TYPE_TELEMETRY 0x040
+#define APRS_TYPE_USERDEF 0x080
+#define APRS_TYPE_NWS 0x100
+#define APRS_TYPE_WEATHER 0x200
+
+struct aprs_filter_term {
+  uint8_t kind;
+  bool reject;
+  int32_t lat1;          // 1/1000000 degree. range: center. area: north west corner
+  int32_t lon1;
+  int32_t lat2;          // area: south east corner
+  int32_t lon2;
+  uint32_t dist_m;       // range
+  uint16_t types;        // APRS_TYPE_* mask
+  uint8_t calls;
+  char call[APRS_FILTER_CALLS_MAX][AX_ADDR_LEN+2];  // buddy: trailing '*' is a wildcard
+};
+
+struct aprs_filter {
+  uint8_t terms;
+  uint8_t accepting;     // terms without '-'
+  uint16_t heard_minutes; // h/. 0: off
+  struct aprs_filter_term term[APRS_FILTER_TERMS_MAX];
+};
+
+/**
+ * Compile text into f. Returns 0 on success, -1 on syntax error (message in err).
+ */
+int aprs_filter_compile(const char *text, struct aprs_filter *f, char *err, size_t errlen);
+
+/**
+ * APRS_TYPE_* bits of a frame (TNC2 format).
+ */
+uint16_t aprs_frame_types(const char *frame);
+
+// aprs_filter_match() reasons, besides the index of a rejecting term
+#define APRS_FILTER_NO_MATCH -1    // there are accepting terms, but none matched
+#define APRS_FILTER_NOT_HEARD -2   // h/
+
+/**
+ * Does frame (TNC2 format) pass the filter? now: millis(), for h/.
+ * If not, *reason (if not nullptr) is the index of the rejecting term, or one of the above.
+ */
+bool aprs_filter_match(const struct aprs_filter *f, const char *frame, uint32_t now, int *reason);
+
+#endif //APRS_FILTER_H
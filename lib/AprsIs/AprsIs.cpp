@@ -0,0 +1,189 @@
+#include "AprsIs.h"
+#include <ctype.h>
+#include <stdio.h>
+#include <string.h>
+
+void aprsis_reader_reset(struct aprsis_reader *r)
+{
+  r->len = 0;
+  r->pos = 0;
+  r->skip = false;
+}
+
+char *aprsis_reader_space(struct aprsis_reader *r, size_t *room)
+{
+  *room = sizeof(r->buf) - 1 - r->len;
+  return r->buf + r->len;
+}
+
+void aprsis_reader_added(struct aprsis_reader *r, size_t n)
+{
+  r->len += n;
+}
+
+char *aprsis_reader_next(struct aprsis_reader *r, size_t *line_len)
+{
+  for (;;) {
+    char *start = r->buf + r->pos;
+    char *nl = (char *) memchr(start, '\n', r->len - r->pos);
+    if (!nl) {
+      // move the incomplete line to the beginning
+      if (r->pos) {
+        memmove(r->buf, start, r->len - r->pos);
+        r->len -= r->pos;
+        r->pos = 0;
+      }
+      if (r->len == sizeof(r->buf) - 1) {
+        r->len = 0;
+        r->skip = true;
+      }
+      return 0;
+    }
+    *nl = 0;
+    r->pos = nl + 1 - r->buf;
+    if (r->skip) {
+      r->skip = false;
+      continue;
+    }
+    size_t n = nl - start;
+    while (n && isspace((unsigned char ) start[n-1]))
+      start[--n] = 0;
+    *line_len = n;
+    return start;
+  }
+}
+
+size_t aprsis_login_line(const char *callsign, const char *password, const char *filter, char *out, size_t outlen)
+{
+  bool has_filter = filter && *filter;
+  int len = snprintf(out, outlen, "user %s pass %s TTGO-T-Beam-LoRa-APRS 0.1%s%s\r\n", callsign, password,
+    has_filter ? " filter " : "", has_filter ? filter : "");
+  if (len < 0 || (size_t ) len >= outlen)
+    return 0;
+  return len;
+}
+
+/**
+ * ",call" followed by one of the characters in term, starting before end
+ */
+static const char *aprsis_find_call(const char *s, const char *end, const char *call, size_t call_len, const char *term)
+{
+  for (const char *q = s; q < end && (q = (const char *) memchr(q, ',', end - q)); q++) {
+    if (q + 1 + call_len <= end && !strncmp(q+1, call, call_len) && q[1+call_len] && strchr(term, q[1+call_len]))
+      return q;
+  }
+  return 0;
+}
+
+/**
+ * Plausible frame: source call with at most 6 chars and SSID 0..15, header and payload.
+ */
+static bool aprsis_downlink_valid(const char *s)
+{
+  if (!isalnum((unsigned char ) *s)) return false;
+  const char *header_end = strchr(s, ':');
+  if (!header_end) return false;
+  const char *src_call_end = strchr(s, '>');
+  if (!src_call_end) return false;
+  if (src_call_end > header_end-2) return false;
+  const char *q = strchr(s, '-');
+  if (q && q < src_call_end) {
+    // len callsign > 6?
+    if (q-s > 6) return false;
+    // SSID optional, only 0..15
+    if (q[2] == '>') {
+      if (q[1] < '0' || q[1] > '9') return false;
+    } else if (q[3] == '>') {
+      if (q[1] != '1' || q[2] < '0' || q[2] > '5') return false;
+    } else return false;
+  } else {
+    if (src_call_end-s > 6) return false;
+  }
+  return true;
+}
+
+int aprsis_downlink_check(const char *s, const char *aprs_call, const char *igate_call)
+{
+  const char *calls[2] = { aprs_call, igate_call };
+  const char *q;
+
+  if (!*s || *s == '#')
+    return APRSIS_DL_COMMENT;
+  if (!aprsis_downlink_valid(s))
+    return APRSIS_DL_INVALID;
+  const char *header_end = strchr(s, ':');
+
+  // do not interprete packets coming back from aprs-is net (either our source call, or if we have repeated it with one of our calls
+  for (int i = 0; i < 2; i++) {
+    size_t call_len = strlen(calls[i]);
+    // sender is our call?
+    if (!strncmp(s, calls[i], call_len) && s[call_len] == '>')
+      return APRSIS_DL_OWN;
+    // digipeated frames look like "..,DL9SAU,DL1AAA,DL1BBB*,...", or "..,DL9SAU*,DL1AAA,DL1BBB,.."
+    if ((q = aprsis_find_call(s, header_end, calls[i], call_len, "*,")) && memchr(q, '*', header_end - q))
+      return APRSIS_DL_OWN;
+  }
+  // packet has our call in i.E. ...,qAR,OURCALL:...
+  if (aprsis_find_call(s, header_end, igate_call, strlen(igate_call), ":"))
+    return APRSIS_DL_OWN;
+  return APRSIS_DL_FRAME;
+}
+
+bool aprsis_downlink_to_us(const char *s, size_t len, const char *aprs_call, const char *igate_call)
+{
+  const char *calls[2] = { aprs_call, igate_call };
+  const char *header_end = strchr(s, ':');
+
+  // Format: "..::DL9SAU-15:..."
+  if (!header_end)
+    return false;
+  const char *q = header_end + 1;
+  if (*q != ':' || (size_t ) (s + len - q) <= 10 || q[10] != ':')
+    return false;
+  for (int i = 0; i < 2; i++) {
+    size_t call_len = strlen(calls[i]);
+    if (!strncmp(q+1, calls[i], call_len) && (call_len == 9 || q[1+call_len] == ' '))
+      return true;
+  }
+  return false;
+}
+
+size_t aprsis_third_party(const char *callsign, const char *dest, const char *line, char *out, size_t outlen)
+{
+  const char *p = strchr(line, '>');
+  const char *q = strchr(line, ',');
+  const char *r = strchr(line, ':');
+  // (due to spec) max 'DL9SAU-15>APRSXX-NN'
+  if (!(p > line && p < q && q < r && (q-line) < 20))
+    return 0;
+  // 3rd party traffic should be addressed directly (-> not to WIDE2-1 or so)
+  int len = snprintf(out, outlen, "%s>%s:}%.*s,TCPIP,%s*:%s", callsign, dest, (int ) (q-line), line, callsign, r+1);
+  if (len < 0 || (size_t ) len >= outlen)
+    return 0;
+  return len;
+}
+
+size_t aprsis_uplink_line(const char *frame, bool tx_enabled, const char *igate_call, char *out, size_t outlen)
+{
+  // trimmed
+  while (isspace((unsigned char ) *frame))
+    frame++;
+  size_t n = strlen(frame);
+  while (n && isspace((unsigned char ) frame[n-1]))
+    n--;
+  const char *end = frame + n;
+  const char *p = (const char *) memchr(frame, '>', n);
+  const char *q;
+  // some plausibility checks.
+  if (!p || p == frame || !(q = (const char *) memchr(p+1, ':', end - (p+1))))
+    return 0;
+  // Due to http://www.aprs-is.net/IGateDetails.aspx , never gate third-party traffic contining TCPIP or TCPXX
+  // IGATECALL>APRS,GATEPATH:}FROMCALL>TOCALL,TCPIP,IGATECALL*:original packet data
+  const char *r; const char *s; const char *t;
+  if (q[1] == '}' && (r = strchr(q+2, '>')) && ((s = strstr(r+1, ",TCPIP,")) || (s = strstr(r+1, ",TCPXX,"))) && (t = strstr(s+6, "*:")) && t < end)
+    return 0;
+  int len = snprintf(out, outlen, "%.*s%s%s%.*s\r\n", (int ) (q - frame), frame, tx_enabled ? ",qAR," : ",qAO,", igate_call, (int ) (end - q), q);
+  if (len < 0 || (size_t ) len >= outlen)
+    return 0;
+  return len;
+}
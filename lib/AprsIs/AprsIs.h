@@ -0,0 +1,80 @@
+#ifndef APRS_IS_H
+#define APRS_IS_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+/*
+ * The APRS-IS protocol side of the iGate: login line, downlink line reader,
+ * what to do with a downlink line, third party frames for RF and KISS, and
+ * uplink lines with q construct.
+ *
+ * No sockets and no Arduino types: taskAPRSIS feeds it from its WiFiClient,
+ * tools/aprsis_client.cpp from a socket on the host (see tools/aprsis_standin.py).
+ */
+
+// APRS-IS lines are at most 512 bytes
+#define APRSIS_LINE_MAX 512
+
+struct aprsis_reader {
+  char buf[APRSIS_LINE_MAX * 2];
+  size_t len;    // bytes in buf
+  size_t pos;    // start of the next line
+  bool skip;     // line was too long: drop up to the next newline
+};
+
+void aprsis_reader_reset(struct aprsis_reader *r);
+
+/**
+ * Where to append what the server has sent, and how much fits (may be 0).
+ * Only call after aprsis_reader_next() returned 0. Then tell the length by aprsis_reader_added().
+ */
+char *aprsis_reader_space(struct aprsis_reader *r, size_t *room);
+
+void aprsis_reader_added(struct aprsis_reader *r, size_t n);
+
+/**
+ * Next complete line in the buffer, '\0' terminated, without "\r\n".
+ * Valid until the next call. 0 if there is no complete line.
+ */
+char *aprsis_reader_next(struct aprsis_reader *r, size_t *line_len);
+
+/**
+ * "user .. pass .. TTGO-T-Beam-LoRa-APRS 0.1 [filter ..]\r\n". Returns the length, or 0 if out is too small.
+ * @param filter server side filter. 0 or "": none
+ */
+size_t aprsis_login_line(const char *callsign, const char *password, const char *filter, char *out, size_t outlen);
+
+// aprsis_downlink_check()
+#define APRSIS_DL_COMMENT 0     // server comment ('#'), or empty
+#define APRSIS_DL_INVALID 1     // no plausible frame
+#define APRSIS_DL_OWN 2         // sent or digipeated by us, or gated by our igate call
+#define APRSIS_DL_FRAME 3       // to gate
+
+/**
+ * What a line from the server is.
+ * @param aprs_call our call on RF
+ * @param igate_call our call on APRS-IS (may be the same)
+ */
+int aprsis_downlink_check(const char *line, const char *aprs_call, const char *igate_call);
+
+/**
+ * APRS message (or query) addressed to aprs_call or igate_call. Not for RF: we are the addressee.
+ */
+bool aprsis_downlink_to_us(const char *line, size_t len, const char *aprs_call, const char *igate_call);
+
+/**
+ * Third party frame: CALLSIGN>DEST:}FROMCALL>TOCALL,TCPIP,CALLSIGN*:payload
+ * @return length, or 0 if line is no valid frame or out is too small
+ */
+size_t aprsis_third_party(const char *callsign, const char *dest, const char *line, char *out, size_t outlen);
+
+/**
+ * APRS-IS line for a frame heard on RF: path with q construct and our igate call, "\r\n" terminated.
+ * @param tx_enabled we may transmit: qAR (bidirectional igate), else qAO
+ * Returns the length, or 0 if the frame must not be gated.
+ */
+size_t aprsis_uplink_line(const char *frame, bool tx_enabled, const char *igate_call, char *out, size_t outlen);
+
+#endif //APRS_IS_H
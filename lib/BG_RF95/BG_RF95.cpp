@@ -6,6 +6,7 @@
 #include <BG_RF95.h>
 
 byte _lastSNR = 0;
+volatile uint32_t _lastRxTime = 0;
 
 // Interrupt vectors for the 3 Arduino interrupt pins
 // Each interrupt can be handled by a different instance of BG_RF95, allowing you to have
@@ -156,6 +157,8 @@ void BG_RF95::handleInterrupt()
 
 	_lastSNR = spiRead(BG_RF95_REG_19_PKT_SNR_VALUE);
 
+	_lastRxTime = micros();
+
 	// We have received a message.
 	validateRxBuf();
 	if (_rxBufValid)
@@ -267,6 +270,11 @@ uint8_t BG_RF95::lastSNR()
 	return(_lastSNR);
 }
 
+uint32_t BG_RF95::lastRxTime()
+{
+	return(_lastRxTime);
+}
+
 
 bool BG_RF95::send(const uint8_t* data, uint8_t len)
 {
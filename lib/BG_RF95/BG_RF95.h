@@ -634,6 +634,9 @@ public:
 
 virtual uint8_t	lastSNR();
 
+    /// micros() of the RxDone interrupt of the last received message
+virtual uint32_t	lastRxTime();
+
     /// Sets the length of the preamble
     /// in bytes. 
     /// Caution: this should be set to the same 
@@ -0,0 +1,21 @@
+#include "BufAppend.h"
+#include <stdarg.h>
+#include <stdio.h>
+
+bool buf_append(char *buf, size_t len, size_t *pos, const char *fmt, ...)
+{
+  va_list ap;
+  int n;
+
+  if (*pos >= len)
+    return false;
+  va_start(ap, fmt);
+  n = vsnprintf(buf + *pos, len - *pos, fmt, ap);
+  va_end(ap);
+  if (n < 0 || (size_t ) n >= len - *pos) {
+    *pos = len;
+    return false;
+  }
+  *pos += n;
+  return true;
+}
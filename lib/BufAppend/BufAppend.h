@@ -0,0 +1,18 @@
+#ifndef BUF_APPEND_H
+#define BUF_APPEND_H
+
+#include <stddef.h>
+#include <stdbool.h>
+
+/*
+ * printf into a fixed buffer, piece by piece: the status pages (/metrics,
+ * /aprsis, /profile) are formatted this way into one allocation.
+ */
+
+/**
+ * Append to buf at *pos and advance *pos. buf stays '\0' terminated.
+ * Returns false if it did not fit; *pos is then len, so all further appends fail too.
+ */
+bool buf_append(char *buf, size_t len, size_t *pos, const char *fmt, ...) __attribute__((format(printf, 4, 5)));
+
+#endif //BUF_APPEND_H
@@ -0,0 +1,830 @@
+#include "Digipeater.h"
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static uint8_t ax25_char_code(char c)
+{
+  if (c >= '0' && c <= '9')
+    return c - '0' + 1;
+  if (c >= 'A' && c <= 'Z')
+    return c - 'A' + 11;
+  return 0;
+}
+
+uint64_t ax25_addr_key(const char *addr)
+{
+  uint64_t key = 0;
+  uint8_t ssid = 0;
+  uint8_t code;
+  int i;
+
+  if (!addr)
+    return 0;
+  for (i = 0; i < 6 && (code = ax25_char_code(addr[i])); i++)
+    key = (key << 6) | code;
+  if (!i)
+    return 0;
+  // pad to 6 chars. This way, a prefix like "WIDE" is a simple right shift
+  key <<= 6 * (6-i);
+  addr += i;
+  if (*addr == '-') {
+    addr++;
+    if (!isdigit(*addr))
+      return 0;
+    ssid = *addr++ - '0';
+    if (isdigit(*addr)) {
+      ssid = ssid * 10 + (*addr++ - '0');
+      if (ssid > 15)
+        return 0;
+    }
+  }
+  if (*addr)
+    return 0;
+  return (key << 4) | ssid;
+}
+
+char *ax25_key_to_addr(uint64_t key, char *buf)
+{
+  uint64_t call = DIGI_KEY_CALL(key);
+  char *p = buf;
+
+  for (int i = 5; i >= 0; i--) {
+    uint8_t code = (call >> (6*i)) & 0x3f;
+    if (!code)
+      break;
+    *p++ = (code <= 10) ? ('0' + code - 1) : ('A' + code - 11);
+  }
+  if (DIGI_KEY_SSID(key))
+    p += sprintf(p, "-%d", DIGI_KEY_SSID(key));
+  *p = 0;
+  return buf;
+}
+
+static const uint64_t key_wide_prefix = DIGI_KEY_CALL(ax25_addr_key("WIDE")) >> 12;
+
+static bool ax25_key_is_wide(uint64_t key)
+{
+  return key && (DIGI_KEY_CALL(key) >> 12) == key_wide_prefix;
+}
+
+
+struct ax25_frame *tnc_format_to_ax25_frame(const char *s)
+{
+  static char data[AX25_FRAME_MAX_LEN+1];
+  static struct ax25_frame frame;
+  char *p;
+  char *q;
+  char *next_digi = 0;
+
+  memset(&frame, 0, sizeof(frame));
+  *data = 0;
+
+  if (strlen(s) > sizeof(data) -1)
+    return 0;
+  strcpy(data, s);
+
+  p = strchr(data, ':');
+  if (!p || strlen(p) > sizeof(data)-1)
+    return 0;
+  // skip leading ':'
+  frame.data = p+1;
+  *p = 0;
+
+  p = data;
+  if (!(q = strchr(p, '>')))
+    return 0;
+  *q = 0;
+  if (!*p || strlen(p) > AX_ADDR_LEN)
+    return 0;
+  strcpy(frame.src.addr, p);
+
+  p = q+1;
+  if ((q = strchr(p, ','))) {
+    next_digi = q+1;
+    *q = 0;
+  }
+  if (!*p || strlen(p) > AX_ADDR_LEN)
+    return 0;
+  strcpy(frame.dst.addr, p);
+
+  int digi;
+  for (digi = 0; digi < AX_DIGIS_MAX && next_digi; digi++) {
+    p = next_digi;
+    if ((q = strchr(p, ','))) {
+      next_digi = q+1;
+      *q = 0;
+    } else
+      next_digi = 0;
+
+    if ((q = strchr(p, '*'))) {
+      frame.digis[digi].repeated = true;
+      *q = 0;
+    }
+    if (!*p || strlen(p) > AX_ADDR_LEN)
+      return 0;
+    strcpy(frame.digis[digi].addr, p);
+    // max digi cound reached, but frame had more digis in path
+    if (digi == AX_DIGIS_MAX-1 && next_digi)
+      return 0;
+  }
+
+  // sanity check
+  for (digi = 0; digi < AX_DIGIS_MAX && *(frame.digis[digi].addr); digi++) {
+    if (!frame.digis[digi].repeated && !strncmp(frame.digis[digi].addr, "WIDE", 4) && strlen(frame.digis[digi].addr) == 5)
+        frame.digis[digi].repeated = true;
+  }
+  bool last_repeated_found = false;
+  for (digi = AX_DIGIS_MAX-1; digi >= 0; digi--) {
+    if (!*(frame.digis[digi].addr))
+      continue;
+    // once: set n_digis
+    if (!frame.n_digis)
+      frame.n_digis = digi+1;
+    if (!last_repeated_found && frame.digis[digi].repeated)
+      last_repeated_found = true;
+    else if (last_repeated_found && !frame.digis[digi].repeated)
+      frame.digis[digi].repeated = true;
+  }
+
+  return &frame;
+}
+
+
+int packet_is_valid(const char *frame_start) {
+  const char *p = frame_start;
+  if (!*p || !((*p >= 'A' && *p <= 'Z') || (*p >= '0' && *p <= '9')))
+    return 0;
+  for (p++; *p && *p != ':'; p++) {
+    if (! ((*p >= 'A' && *p <= 'Z') || (*p >= '0' && *p <= '9') || *p == '-' || *p == '*' || *p == ',' || *p == '>') )
+      return 0;
+  }
+  if (!*p || *p != ':')
+    return 0;
+  // do it again. Now we know the header is ok, which makes it parseable more easy, without race conditions (no need to check p[1] == 0 or so..)
+  bool src_call_end = 0;
+  bool to_call_end = 0;
+  for (p = frame_start; *p && *p != ':'; p++) {
+    if (*p == '>') { if (src_call_end || !isalnum(*(p-1))) return 0; src_call_end = true; } // '>' twice?
+    else if (*p == ',') { if (!src_call_end || (to_call_end ? (!(isalnum(*(p-1)) || *(p-1) == '*')) : !(isalnum(*(p-1))))  || !isalnum(p[1])) return 0; to_call_end = true; } // -,call or ,- is not valid
+    else if (*p == '-') {
+      // not call-1-2 or call-- or -call or ..>-1 or ,-1 or --15
+      if (!isalnum(*(p-1)) || !isdigit(p[1])) return 0;
+      char c_after_ssid = p[2];
+      if (isdigit(c_after_ssid)) {
+        if (p[1] != '1' || c_after_ssid > '5') return 0; // max "-15".
+        c_after_ssid = p[3];
+      }
+      if (!(c_after_ssid == '>' || c_after_ssid == '*' || c_after_ssid == ',' || c_after_ssid == ':')) return 0; // After ssid (pos 3) only '>', '*', ',', ':', are allowed.
+    }
+  }
+  if (!to_call_end && isalnum(*(p-1)))
+    to_call_end = true;
+  if (!src_call_end || !to_call_end) return 0;
+  return 1;
+}
+
+
+int is_call_blacklisted(const char *frame_start, const char *blacklist) {
+  // src-call_validation
+  const char *p_call = frame_start;
+  int i = 0;
+  if (!p_call || !*p_call) return 1;
+  if (isdigit(p_call[1]) && isalpha(p_call[2])) {
+    // left-shift g1abc -> _g1abc
+    i = 1;
+    p_call--; // warning, beyond start of pointer
+  }
+  for (; i <= 7; i++) {
+    if (i == 7) return 1;
+    else if (!p_call[i] || p_call[i] == '>' || p_call[i] == '-') {
+      if (i < 4) return 1;
+      break;
+    } else if (i < 2 && !isalnum(p_call[i])) return 1;
+    else if (i == 2 && !isdigit(p_call[i])) return 1;
+    else if (i > 2 && !isalpha(p_call[i])) return 1;
+  }
+
+  // list empty? we may leave here
+  if (!blacklist || !*blacklist || !strcmp(blacklist, ",,"))
+    return 0;
+
+  bool ssid_present = false;
+  char buf[12]; // room for ",DL1AAA-15," + \0
+  char *p = buf;
+  *p++ = ',';
+  for (i = 0; i < 9; i++) {
+    if (!frame_start[i] || /* frame_start[i] == '>' || */ ! (frame_start[i] == '-' || isalnum(frame_start[i]))) {
+      break;
+    }
+    if (frame_start[i] == '-')
+      ssid_present = true;
+    // callvalidation above prevents calls (excl. ssid) with len > 6.
+    // this loop goes over all positions in DL1AAA-15 (9). But if someone modifies the assurance above, we'll have
+    // a race condition here. If user input is DL1AAAAAA (9 bytes; no ssid present), and we add '-0' afterwards,
+    // the result will be ",DL1AAAAAA-00," -> 13, plus \0. But buf is len 12.
+    // If we are here at position i==6 (behind "DL1AAA"), that means at '-', and we did not found the ssid,
+    // well' enforce a break here.
+    if (i == 6 && !ssid_present)
+      break;
+    *p++ = frame_start[i];
+  }
+  if (!ssid_present) {
+    // for being able to filter out DL1AAA but not DL1AAA-1. -> DL1AAA is DL1AAA-0 by AX.25 definition. Blacklist lists DL1AAA-0. DL1AAA means: filter all variants.:w
+    *p++ = '-'; *p++ = '0';
+  }
+  *p++ = ',';
+  *p = 0;
+
+  // exact match?
+  if (strstr(blacklist, buf))
+    return 2;
+  // filter call completely?
+  if ((p = strchr(buf, '-'))) {
+    *p++ = ','; *p++ = 0;
+    if (strstr(blacklist, buf))
+      return 3;
+  }
+
+  const char *header_end = strchr(frame_start, ':');
+  const char *path;
+  // check for blacklisted digi in path
+  if (header_end && (path = strchr(frame_start, ','))) {
+    for (;;) {
+      const char *q = strchr(path+1, ',');
+      if (!q || q > header_end)
+        q = header_end;
+      // copy ",DL1AAA,.." to buf as ",DL1AAA"
+      // but before: length check. len ",DL1AAA-15*," is 12; sizeof(buf) is 12 (due to \0); we copy until trailing ','.
+      if ((size_t ) (q-path) > sizeof(buf)-1)
+        break;
+      strncpy(buf, path, q-path);
+      buf[q-path] = 0;
+      char *r = strchr(buf, '*');
+      if (r)
+        *r = 0;
+      // our ssid filter construct: -0 means search for call with ssid 0 zero.
+      if (!(r = strchr(buf, '-')))
+        strcat(buf, "-0");
+      // after modifications above, is len(buf) still < 10 (space for ',' and \0)?
+      if (strlen(buf) > 10)
+        return 0;
+      strcat(buf, ",");
+      // exact match?
+      if (strstr(blacklist, buf))
+        return 4;
+      // filter call completely?
+      if ((r = strchr(buf, '-'))) {
+        *r++ = ','; *r++ = 0;
+        if (strstr(blacklist, buf))
+          return 5;
+      }
+      if (q == header_end)
+        break;
+      path = q;
+    }
+  }
+  
+  return 0;
+}
+
+
+char *encode_snr_rssi(int snr, int rssi)
+{
+  static char buf[7]; // length for "Q2373X" == 6 + 1 (\0) == 7
+  *buf = 0;
+  if (snr > 99) snr = 99;			// snr will not go upper 31
+  else if (snr < -99) snr = -99;		// snr will not go below -32
+  if (rssi > 0) rssi = 0;			// rssi is always negative
+  else if (rssi < -259) rssi = -259;		// rssi will not be below -174 anyway ;)
+  // Make SNR >= 0 human readable:
+  //   First position: SNR < 0: replace -1 by A1, -10 by B0, ...
+  //   This way, we reduce "-10" to two letters: B0.
+  // Make RSSI  > -100 RSSI human readable.
+  //   First position: rssi < -99 -> 0. We'll use 91 for rssi -91 instead of J1 for better readibility.
+  //   K means -10x, L means -11x, M means -12x, N means -13x, ...   (everone knows, 'N' is #13 in alphabet out of 26 chars ;)
+  //   => With this, we reduce "-110" to two letters: L0.
+  // Last position of call (6) is left empty for future use. As well as SSID 1-15. Could be used for BER, RX antenna gain, EIRP, ..
+  // => This is a good compromise between efficiency and being able to quickly interprete snr and rssi
+  sprintf(buf, "Q%c%01d%c%01d",
+    ((snr >= 0 ? snr : -snr) / 10) + (snr >= 0 ? '0' : 'A'),
+    (snr >= 0 ? snr : -snr) % 10,
+    (-rssi / 10) + (rssi > -100 ? '0' : 'A'),
+    (-rssi) % 10);
+ 
+  return buf;
+}
+
+
+const char *digi_rules_for_mode(uint8_t lora_digipeating_mode)
+{
+  switch (lora_digipeating_mode) {
+  case 2:
+    return "trace WIDE1-1";
+  case 3:
+    return "trace WIDE1-1; onehop WIDE2-2 WIDE3-3";
+  }
+  // 0: the caller does not digipeat at all. 1: own call only
+  return "";
+}
+
+
+int digi_rules_compile(const char *text, const char *mycall, struct digi_rules *rules, char *err, size_t errlen)
+{
+  char buf[DIGI_RULES_TEXT_MAX+1];
+  char *stmt;
+  char *stmt_save;
+  uint8_t qrg = DIGI_QRG_MAIN;
+
+  memset(rules, 0, sizeof(*rules));
+  rules->suppress.snr = DIGI_SUPPRESS_OFF;
+  rules->suppress.rssi = DIGI_SUPPRESS_OFF;
+  if (err && errlen)
+    *err = 0;
+
+  if (!mycall || !(rules->mycall = ax25_addr_key(mycall))) {
+    snprintf(err, errlen, "invalid own call '%s'", mycall ? mycall : "");
+    return -1;
+  }
+  snprintf(rules->mycall_str, sizeof(rules->mycall_str), "%s", mycall);
+  // own call is always served on the main frequency
+  rules->qrg = DIGI_QRG_MAIN;
+
+  if (!text)
+    return 0;
+  if (strlen(text) > sizeof(buf)-1) {
+    snprintf(err, errlen, "rules too long (max %d chars)", DIGI_RULES_TEXT_MAX);
+    return -1;
+  }
+  strcpy(buf, text);
+
+  for (stmt = strtok_r(buf, ";\r\n", &stmt_save); stmt; stmt = strtok_r(0, ";\r\n", &stmt_save)) {
+    char *tok_save;
+    char *keyword = strtok_r(stmt, " \t", &tok_save);
+    char *arg;
+    uint8_t action;
+
+    // empty statement
+    if (!keyword)
+      continue;
+    for (char *p = keyword; *p; p++)
+      *p = tolower(*p);
+
+    if (!strcmp(keyword, "maxhops")) {
+      arg = strtok_r(0, " \t", &tok_save);
+      int n = arg ? atoi(arg) : 0;
+      if (n < 1 || n > 7) {
+        snprintf(err, errlen, "maxhops: expected 1..7");
+        return -1;
+      }
+      rules->max_hops = n;
+      continue;
+    }
+    if (!strcmp(keyword, "qrg")) {
+      arg = strtok_r(0, " \t", &tok_save);
+      if (arg && !strcasecmp(arg, "main"))
+        qrg = DIGI_QRG_MAIN;
+      else if (arg && !strcasecmp(arg, "cross"))
+        qrg = DIGI_QRG_CROSS;
+      else if (arg && !strcasecmp(arg, "both"))
+        qrg = DIGI_QRG_BOTH;
+      else {
+        snprintf(err, errlen, "qrg: expected main, cross or both");
+        return -1;
+      }
+      continue;
+    }
+    if (!strcmp(keyword, "suppress")) {
+      struct digi_suppress *sp = &rules->suppress;
+      if (sp->enabled) {
+        snprintf(err, errlen, "suppress: defined twice");
+        return -1;
+      }
+      sp->enabled = true;
+      while ((arg = strtok_r(0, " \t", &tok_save))) {
+        char *val = strtok_r(0, " \t", &tok_save);
+        char *end;
+        long n = val ? strtol(val, &end, 10) : 0;
+        if (!val || *end) {
+          snprintf(err, errlen, "suppress: %s: number expected", arg);
+          return -1;
+        }
+        if (!strcasecmp(arg, "snr") && n >= -30 && n <= 30)
+          sp->snr = n;
+        else if (!strcasecmp(arg, "rssi") && n >= -150 && n <= 0)
+          sp->rssi = n;
+        else if (!strcasecmp(arg, "count") && n >= 0 && n <= 100)
+          sp->count = n;
+        else if (!strcasecmp(arg, "hold") && n >= 1 && n <= 30)
+          sp->hold = n;
+        else {
+          snprintf(err, errlen, "suppress: expected snr -30..30, rssi -150..0, count 0..100, hold 1..30");
+          return -1;
+        }
+      }
+      if (sp->snr == DIGI_SUPPRESS_OFF && sp->rssi == DIGI_SUPPRESS_OFF) {
+        snprintf(err, errlen, "suppress: snr or rssi threshold missing");
+        return -1;
+      }
+      continue;
+    }
+
+    if (!strcmp(keyword, "alias"))
+      action = DIGI_ACTION_ALIAS;
+    else if (!strcmp(keyword, "trace"))
+      action = DIGI_ACTION_TRACE;
+    else if (!strcmp(keyword, "wide"))
+      action = DIGI_ACTION_WIDE;
+    else if (!strcmp(keyword, "onehop"))
+      action = DIGI_ACTION_ONEHOP;
+    else {
+      snprintf(err, errlen, "unknown keyword '%s'", keyword);
+      return -1;
+    }
+
+    if (!(arg = strtok_r(0, " \t", &tok_save))) {
+      snprintf(err, errlen, "%s: alias missing", keyword);
+      return -1;
+    }
+    for (; arg; arg = strtok_r(0, " \t", &tok_save)) {
+      for (char *p = arg; *p; p++)
+        *p = toupper(*p);
+      uint64_t key = ax25_addr_key(arg);
+      if (!key) {
+        snprintf(err, errlen, "%s: invalid alias '%s'", keyword, arg);
+        return -1;
+      }
+      if (action != DIGI_ACTION_ALIAS && (DIGI_KEY_SSID(key) < 1 || DIGI_KEY_SSID(key) > 7)) {
+        snprintf(err, errlen, "%s: '%s' needs max. hops, like WIDE2-2", keyword, arg);
+        return -1;
+      }
+      if (key == rules->mycall) {
+        snprintf(err, errlen, "%s: own call is always served", keyword);
+        return -1;
+      }
+      for (int i = 0; i < rules->n_rules; i++) {
+        const struct digi_rule *r = &rules->rule[i];
+        if (r->call == DIGI_KEY_CALL(key) && (r->qrg & qrg) &&
+            (r->action != DIGI_ACTION_ALIAS || action != DIGI_ACTION_ALIAS || r->ssid == DIGI_KEY_SSID(key))) {
+          snprintf(err, errlen, "%s: '%s' defined twice", keyword, arg);
+          return -1;
+        }
+      }
+      if (rules->n_rules >= DIGI_RULES_MAX) {
+        snprintf(err, errlen, "too many aliases (max %d)", DIGI_RULES_MAX);
+        return -1;
+      }
+      struct digi_rule *r = &rules->rule[rules->n_rules++];
+      r->call = DIGI_KEY_CALL(key);
+      r->ssid = DIGI_KEY_SSID(key);
+      r->action = action;
+      r->qrg = qrg;
+      rules->qrg |= qrg;
+    }
+  }
+
+  return 0;
+}
+
+
+static const struct digi_rule *digi_rules_lookup(const struct digi_rules *rules, uint64_t key, uint8_t rx_qrg)
+{
+  uint64_t call = DIGI_KEY_CALL(key);
+
+  if (!key)
+    return 0;
+  for (int i = 0; i < rules->n_rules; i++) {
+    const struct digi_rule *r = &rules->rule[i];
+    if (r->call != call || !(r->qrg & rx_qrg))
+      continue;
+    if (r->action == DIGI_ACTION_ALIAS && r->ssid != DIGI_KEY_SSID(key))
+      continue;
+    return r;
+  }
+  return 0;
+}
+
+// set the remaining hops of an n-N alias. 0: alias is used up -> "WIDE2*"
+static void ax25_addr_set_hops(struct axaddr *a, uint8_t n)
+{
+  char *p = strchr(a->addr, '-');
+  if (!p)
+    return;
+  if (n) {
+    sprintf(p+1, "%d", n);
+  } else {
+    *p = 0;
+    a->repeated = true;
+  }
+}
+
+
+int digi_rules_apply(const struct digi_rules *rules, const char *received_frame, uint8_t rx_qrg, const char *snr_rssi, char *out, size_t outlen)
+{
+  struct ax25_frame *frame;
+  uint64_t key[AX_DIGIS_MAX];
+  const struct digi_rule *rule;
+  int ret = 1;
+  int i;
+
+  if (!rules || !(rules->qrg & rx_qrg))
+    return 0;
+
+  if (snr_rssi && !*snr_rssi)
+    snr_rssi = 0;
+
+  frame = tnc_format_to_ax25_frame(received_frame);
+  if (!frame)
+    return 0;
+
+  // no room left for adding our call in path during repeating
+  if (frame->n_digis > AX_DIGIS_MAX)
+    return 0;
+
+  // aprs-message / query addressed to us? Format: ":DL9SAU-15:..."
+  size_t mycall_len = strlen(rules->mycall_str);
+  if (frame->data[0] == ':' && strlen(frame->data) > 10 && frame->data[10] == ':' &&
+       !strncmp((frame->data)+1, rules->mycall_str, mycall_len) && (mycall_len == 9 || frame->data[1+mycall_len] == ' '))
+    return 0;
+
+  // If DST-call-ssid-digipeating: rewrite before adding path, because WIDE in path and DST-SSID-digipeating are mutual exclusive
+  uint8_t dst_ssid = DIGI_KEY_SSID(ax25_addr_key(frame->dst.addr));
+  if (dst_ssid) {
+    if (frame->n_digis && frame->digis[0].repeated)
+      return 0;
+    if (frame->n_digis > AX_DIGIS_MAX-1)
+      return 0;
+    if (dst_ssid > 7)
+      return 0;
+    for (i = 0; i < frame->n_digis; i++) {
+      uint64_t k = ax25_addr_key(frame->digis[i].addr);
+      if (ax25_key_is_wide(k) || k == rules->mycall)
+        return 0;
+    }
+    *strchr(frame->dst.addr, '-') = 0;
+    // move digi path one right
+    for (i = frame->n_digis-1; i >= 0; i--)
+      frame->digis[i+1] = frame->digis[i];
+    sprintf(frame->digis[0].addr, "WIDE%d-%d", dst_ssid, dst_ssid);
+    frame->digis[0].repeated = false;
+    frame->n_digis++;
+  }
+
+  // nothing to repeat:
+  if (!frame->n_digis)
+    return 0;
+
+  // we do not digipeat our own packets
+  if (ax25_addr_key(frame->src.addr) == rules->mycall)
+    return 0;
+
+  int curr_not_repeated = frame->n_digis;
+  for (i = 0; i < frame->n_digis; i++) {
+    key[i] = ax25_addr_key(frame->digis[i].addr);
+    if (curr_not_repeated == frame->n_digis && !frame->digis[i].repeated)
+      curr_not_repeated = i;
+    // our call with digipeated marker in header?
+    if (curr_not_repeated == frame->n_digis && key[i] == rules->mycall)
+      return 0;
+  }
+  // path used up
+  if (curr_not_repeated == frame->n_digis)
+    return 0;
+
+  bool add_our_call = true;
+  int insert_our_data_before = curr_not_repeated;
+  struct axaddr *curr = &frame->digis[curr_not_repeated];
+
+  // our call in path?
+  if (key[curr_not_repeated] == rules->mycall) {
+    // digi path too long for adding snr_rssi? skip adding snr_rssi
+    if (snr_rssi && frame->n_digis == AX_DIGIS_MAX)
+      snr_rssi = 0;
+    curr->repeated = true;
+    add_our_call = false;
+    ret = 2;
+    goto add_our_data;
+  }
+
+  if (!(rule = digi_rules_lookup(rules, key[curr_not_repeated], rx_qrg)))
+    return 0;
+
+  // n-N alias: requested hops within our limit?
+  if (rule->action != DIGI_ACTION_ALIAS) {
+    uint8_t n = DIGI_KEY_SSID(key[curr_not_repeated]);
+    if (!n || n > rule->ssid)
+      return 0;
+  }
+
+  if (rules->max_hops) {
+    int hops = 0;
+    for (i = curr_not_repeated; i < frame->n_digis; i++) {
+      if (!frame->digis[i].repeated && (ax25_key_is_wide(key[i]) || digi_rules_lookup(rules, key[i], DIGI_QRG_BOTH)))
+        hops += DIGI_KEY_SSID(key[i]);
+    }
+    if (hops > rules->max_hops)
+      return 0;
+  }
+
+  if (rule->action == DIGI_ACTION_WIDE) {
+    // no tracing: neither our call nor snr_rssi
+    add_our_call = false;
+    snr_rssi = 0;
+  } else {
+    // digi path too long for adding our call
+    if (frame->n_digis == AX_DIGIS_MAX)
+      return 0;
+    // digi path too long for adding snr_rssi and our call? skip adding snr_rssi
+    if (snr_rssi && frame->n_digis +1 == AX_DIGIS_MAX)
+      snr_rssi = 0;
+  }
+
+  switch (rule->action) {
+  case DIGI_ACTION_ALIAS:
+    curr->repeated = true;
+    break;
+  case DIGI_ACTION_TRACE:
+  case DIGI_ACTION_WIDE:
+    ax25_addr_set_hops(curr, DIGI_KEY_SSID(key[curr_not_repeated]) - 1);
+    break;
+  case DIGI_ACTION_ONEHOP:
+    // prevent abuse
+    if (curr_not_repeated+1 < frame->n_digis && ax25_key_is_wide(key[curr_not_repeated+1]))
+      return 0;
+    ax25_addr_set_hops(curr, 0);
+    break;
+  }
+
+  // alias used up? A onehop alias directly behind may be served in the same transmission (WIDE1-1,WIDE2-1)
+  if (curr->repeated && rule->action != DIGI_ACTION_WIDE && curr_not_repeated+1 < frame->n_digis &&
+      (rule = digi_rules_lookup(rules, key[curr_not_repeated+1], rx_qrg)) && rule->action == DIGI_ACTION_ONEHOP) {
+    uint8_t n = DIGI_KEY_SSID(key[curr_not_repeated+1]);
+    if (!n || n > rule->ssid)
+      return 0;
+    if (curr_not_repeated+2 < frame->n_digis && ax25_key_is_wide(key[curr_not_repeated+2]))
+      return 0;
+    ax25_addr_set_hops(&frame->digis[curr_not_repeated+1], 0);
+  }
+
+add_our_data:
+
+  // Build txbuff:
+  const char *path[AX_DIGIS_MAX+2];
+  bool path_repeated[AX_DIGIS_MAX+2];
+  int n_path = 0;
+  int last_repeated = -1;
+
+  for (i = 0; i < frame->n_digis; i++) {
+    if (i == insert_our_data_before) {
+      if (snr_rssi) {
+        path[n_path] = snr_rssi;
+        path_repeated[n_path++] = true;
+      }
+      if (add_our_call) {
+        path[n_path] = rules->mycall_str;
+        path_repeated[n_path++] = true;
+      }
+    }
+    path[n_path] = frame->digis[i].addr;
+    path_repeated[n_path++] = frame->digis[i].repeated;
+  }
+  for (i = 0; i < n_path; i++) {
+    if (path_repeated[i])
+      last_repeated = i;
+  }
+
+  char buf[AX25_FRAME_MAX_LEN+1];
+  size_t len = snprintf(buf, sizeof(buf), "%s>%s", frame->src.addr, frame->dst.addr);
+  for (i = 0; i < n_path && len < sizeof(buf); i++)
+    len += snprintf(buf + len, sizeof(buf) - len, ",%s%s", path[i], (i == last_repeated) ? "*" : "");
+  if (len < sizeof(buf))
+    len += snprintf(buf + len, sizeof(buf) - len, ":%s", frame->data);
+
+  // length check:
+  if (len > sizeof(buf)-1 || len > outlen-1)
+    return 0;
+
+  strcpy(out, buf);
+  return ret;
+}
+
+
+// header has digipeated flag?
+static bool frame_is_digipeated(const char *frame)
+{
+  const char *r = strchr(frame, '*');
+  const char *header_end = strchr(frame, ':');
+  return r && header_end && r < header_end;
+}
+
+// same source call and same payload?
+static bool frame_is_same_packet(const char *a, const char *b)
+{
+  const char *pa = strchr(a, '>');
+  const char *pb = strchr(b, '>');
+  const char *da = strchr(a, ':');
+  const char *db = strchr(b, ':');
+
+  if (!pa || !pb || !da || !db || pa-a != pb-b || strncmp(a, b, pa-a))
+    return false;
+  return !strcmp(da, db);
+}
+
+static bool digi_suppress_strong(const struct digi_suppress *sp, const struct digi_link *link)
+{
+  if (sp->snr != DIGI_SUPPRESS_OFF && link->snr < sp->snr)
+    return false;
+  if (sp->rssi != DIGI_SUPPRESS_OFF && link->rssi < sp->rssi)
+    return false;
+  if (!sp->count)
+    return true;
+  // not by chance: consistently heard strong
+  if (link->packets_direct < sp->count)
+    return false;
+  if (sp->snr != DIGI_SUPPRESS_OFF && link->snr_avg < sp->snr)
+    return false;
+  if (sp->rssi != DIGI_SUPPRESS_OFF && link->rssi_avg < sp->rssi)
+    return false;
+  return true;
+}
+
+int digi_queue_frame(struct digi_queue *queue, const struct digi_rules *rules, uint8_t lora_digipeating_mode,
+                     const char *received_frame, uint8_t rx_qrg, const char *snr_rssi, const struct digi_link *link, uint32_t now)
+{
+  char buf[AX25_FRAME_MAX_LEN+1];
+  int ret;
+
+  // wide1-digi case
+  if (lora_digipeating_mode == 2) {
+    const char *p = strchr(received_frame, '>');
+    const char *q = strchr(received_frame, ','); // digis, optional 
+    const char *r = strchr(received_frame, '*');
+    const char *header_end = strchr(received_frame, ':');
+    // we hear an packet, digipeated from another digipeater (same source call, digipeated flag '*' in header)
+    // and have the original packet in our digipeating queue? -> clear queue.
+    // If we are a WIDE2 digi, it may be desired that we digipeat him.
+    // We'll throw that frame away if further down the new frame is worth digipeating. We don't build up Digipeating-TX-queues
+    if (p && strncmp(queue->frame, received_frame, p-received_frame) && r && r > q && r < header_end && *(header_end+1))
+      *queue->frame = 0;
+  }
+
+  // suppressed frame has been digipeated by someone else -> we are not needed
+  if (queue->held && *queue->frame && frame_is_digipeated(received_frame) && frame_is_same_packet(queue->frame, received_frame))
+    *queue->frame = 0;
+
+  ret = digi_rules_apply(rules, received_frame, rx_qrg, snr_rssi, buf, sizeof(buf));
+  if (!ret)
+    return DIGI_QUEUE_NONE;
+
+  // frames addressed to our call are always served. So are frames from the cross digi freq: not heard by the others
+  if (ret == 1 && link && rules->suppress.enabled && rx_qrg == DIGI_QRG_MAIN && !frame_is_digipeated(received_frame) &&
+      digi_suppress_strong(&rules->suppress, link)) {
+    if (!rules->suppress.hold)
+      return DIGI_QUEUE_SUPPRESSED;
+    strcpy(queue->frame, buf);
+    queue->filled = now + rules->suppress.hold * 1000L;
+    queue->held = true;
+    return DIGI_QUEUE_HELD;
+  }
+
+  strcpy(queue->frame, buf);
+  queue->filled = now;
+  queue->held = false;
+  return DIGI_QUEUE_QUEUED;
+}
+
+int digi_queue_due(const struct digi_queue *queue, uint8_t lora_digipeating_mode, uint8_t lora_cross_digipeating_mode, uint32_t now)
+{
+  // signed: filled is in the future while a suppressed frame is held
+  if ((int32_t ) (queue->filled + 5*lora_digipeating_mode*1000L + (now % 250) - now) >= 0)
+    return 0;
+  if (lora_cross_digipeating_mode < 2 && (int32_t ) (queue->filled + 2* 5*lora_digipeating_mode*1000L - now) > 0)
+    return 1;
+  // too late. skip TX
+  return -1;
+}
+
+
+uint32_t lora_airtime_ms(uint16_t lora_speed, uint16_t len)
+{
+  // see lora_set_speed() and the modem configs in BG_RF95. All BW 125kHz, explicit header, CRC on, preamble 8
+  int sf = 12;
+  int cr = 1;     // 4/5
+  int ldro = 1;   // low data rate optimize: on for SF12
+  switch (lora_speed) {
+  case 1200: sf = 9; cr = 3; ldro = 0; break;
+  case 610: sf = 10; cr = 4; ldro = 0; break;
+  case 180: cr = 4; break;
+  case 210: cr = 3; break;
+  case 240: cr = 2; break;
+  }
+  // BG_RF95 adds a 3 byte header
+  int payload_len = len + 3;
+  double t_sym = (double ) (1L << sf) / 125.0;
+  double t_preamble = (8 + 4.25) * t_sym;
+  int n = 8 * payload_len - 4 * sf + 28 + 16;
+  int d = 4 * (sf - 2 * ldro);
+  int payload_symbols = 8 + ((n > 0) ? ((n + d - 1) / d) * (cr + 4) : 0);
+  return (uint32_t ) (t_preamble + payload_symbols * t_sym + 0.5);
+}
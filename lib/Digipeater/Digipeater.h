@@ -0,0 +1,199 @@
+#ifndef DIGIPEATER_H
+#define DIGIPEATER_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+ * Table driven digipeater.
+ *
+ * The rules are written in an APRX / Dire Wolf like syntax. Statements are
+ * separated by ';' or newline:
+ *
+ *   alias RELAY ECHO        substitute alias: MYCALL,RELAY*
+ *   trace WIDE1-1 WIDE2-2   new-n paradigm with tracing. -N is the max. hop
+ *                           count we accept for this alias (WIDE2-3 is dropped).
+ *                           WIDE2-2 -> MYCALL*,WIDE2-1 ; WIDE2-1 -> MYCALL,WIDE2*
+ *   wide WIDE3-3            new-n paradigm without tracing: WIDE3-3 -> WIDE3-2
+ *   onehop WIDE2-2          act as simple WIDEn digi: insert our call and mark the
+ *                           whole alias as used. WIDE2-2 -> MYCALL,WIDE2*.
+ *                           May be chained behind a trace/alias (WIDE1-1,WIDE2-1).
+ *   maxhops 3               drop frames which request more than 3 hops in total
+ *   qrg main|cross|both     following rules apply to frames heard on this rx freq
+ *   suppress snr 8 rssi -90 count 3 hold 10
+ *                           do not digipeat stations we hear strongly and direct on
+ *                           the main freq: a wide area digi will have heard them, too.
+ *                           snr/rssi: thresholds (dB/dBm), at least one of them.
+ *                           count: also require an average above the thresholds over
+ *                           at least that many direct frames of the station (default 0:
+ *                           this frame only). hold: instead of dropping, delay the
+ *                           frame by that many seconds and drop it if we hear it
+ *                           digipeated by someone else meanwhile. Cross digipeating
+ *                           of a held frame waits for its release, too.
+ *
+ * Our own call is always served. DST-SSID digipeating (APRS-1 -> WIDE1-1) is
+ * always rewritten before the rules are applied.
+ *
+ * The rules are compiled into a digi_rules table by digi_rules_compile(). Aliases
+ * and callsigns are packed into integers, so the per frame evaluation in
+ * digi_rules_apply() is a walk over that table without string compares.
+ * This library does not depend on Arduino; it also builds on the host.
+ */
+
+#define AX_ADDR_LEN 9   // room for "DL9SAU-15" == 9
+#define AX_DIGIS_MAX 8
+#define AX25_FRAME_MAX_LEN 251   // == BG_RF95_MAX_MESSAGE_LEN
+
+#define DIGI_RULES_MAX 16
+#define DIGI_RULES_TEXT_MAX 256
+
+// rx frequency masks
+#define DIGI_QRG_MAIN 0x01
+#define DIGI_QRG_CROSS 0x02
+#define DIGI_QRG_BOTH (DIGI_QRG_MAIN | DIGI_QRG_CROSS)
+
+// actions
+#define DIGI_ACTION_ALIAS 1
+#define DIGI_ACTION_TRACE 2
+#define DIGI_ACTION_WIDE 3
+#define DIGI_ACTION_ONEHOP 4
+
+// packed address: 6 chars base call (6 bit each, first char most significant) << 4 | ssid
+#define DIGI_KEY_CALL(key) ((key) >> 4)
+#define DIGI_KEY_SSID(key) ((uint8_t ) ((key) & 0x0f))
+
+struct axaddr {
+  char addr[AX_ADDR_LEN+1];
+  bool repeated;
+};
+
+struct ax25_frame {
+  struct axaddr src;
+  struct axaddr dst;
+  struct axaddr digis[AX_DIGIS_MAX];
+  uint8_t n_digis;
+  char *data;
+};
+
+struct digi_rule {
+  uint64_t call;      // DIGI_KEY_CALL() of the alias
+  uint8_t ssid;       // alias: exact ssid. n-N aliases: max. N
+  uint8_t action;     // DIGI_ACTION_*
+  uint8_t qrg;        // DIGI_QRG_* mask
+};
+
+#define DIGI_SUPPRESS_OFF -128   // threshold not checked
+
+struct digi_suppress {
+  bool enabled;
+  int8_t snr;         // dB, or DIGI_SUPPRESS_OFF
+  int16_t rssi;       // dBm, or DIGI_SUPPRESS_OFF
+  uint8_t count;      // min. direct frames in history. 0: this frame only
+  uint8_t hold;       // s. 0: drop
+};
+
+struct digi_rules {
+  uint64_t mycall;    // packed own call incl. ssid
+  char mycall_str[AX_ADDR_LEN+1];
+  uint8_t max_hops;   // 0: no limit
+  uint8_t qrg;        // all rx frequencies we have rules for
+  uint8_t n_rules;
+  struct digi_rule rule[DIGI_RULES_MAX];
+  struct digi_suppress suppress;
+};
+
+// link quality of a received frame, and history of its source call (see heard_stations_digi_link())
+struct digi_link {
+  int snr;
+  int rssi;
+  uint16_t packets_direct;    // frames heard direct from the source call, incl. this one
+  int snr_avg;
+  int rssi_avg;
+};
+
+// one frame digipeat queue
+struct digi_queue {
+  char frame[AX25_FRAME_MAX_LEN+1];
+  uint32_t filled;    // millis() when queued, plus hold time
+  bool held;          // suppressed frame: drop if someone else digipeats it
+};
+
+// digi_queue_frame() results
+#define DIGI_QUEUE_NONE 0
+#define DIGI_QUEUE_QUEUED 1
+#define DIGI_QUEUE_HELD 2
+#define DIGI_QUEUE_SUPPRESSED 3
+
+/**
+ * Pack an address like "WIDE2-1" into an integer. Returns 0 if it is not a valid ax25 address.
+ */
+uint64_t ax25_addr_key(const char *addr);
+
+/**
+ * Inverse of ax25_addr_key(). buf needs room for AX_ADDR_LEN+1 chars.
+ */
+char *ax25_key_to_addr(uint64_t key, char *buf);
+
+/**
+ * Parse a TNC2 formated frame. Returns a pointer to a static buffer, or 0 on error.
+ */
+struct ax25_frame *tnc_format_to_ax25_frame(const char *s);
+
+/**
+ * Rules we used before they became configurable, for lora_digipeating_mode 0..3.
+ */
+const char *digi_rules_for_mode(uint8_t lora_digipeating_mode);
+
+/**
+ * Compile rules text to the table. On error, returns -1 and a human readable reason in err.
+ * @param text rules; empty string means "own call only"
+ * @param mycall our call, e.g. DL9SAU-15
+ */
+int digi_rules_compile(const char *text, const char *mycall, struct digi_rules *rules, char *err, size_t errlen);
+
+/**
+ * Decide if a frame is digipeated. If so, the frame to send is written to out and 1 is returned
+ * (2 if it has been addressed to our call).
+ * @param rx_qrg DIGI_QRG_MAIN or DIGI_QRG_CROSS: the frequency the frame has been heard on
+ * @param snr_rssi path element which is added before our call, or 0
+ */
+int digi_rules_apply(const struct digi_rules *rules, const char *received_frame, uint8_t rx_qrg, const char *snr_rssi, char *out, size_t outlen);
+
+/**
+ * Sanity check of a TNC2 frame header. Returns 1 if valid.
+ */
+int packet_is_valid(const char *frame_start);
+
+/**
+ * Source call validation and blacklist check.
+ * @param blacklist ",DL1AAA,DL1BBB-0,DL1CCC-1," style list
+ * @return 0: ok. 1: invalid src call. 2/3: src call blacklisted (exact/all ssids). 4/5: digi in path blacklisted
+ */
+int is_call_blacklisted(const char *frame_start, const char *blacklist);
+
+/**
+ * Encode SNR and RSSI as path element, like "QA1L0". Returns a pointer to a static buffer.
+ */
+char *encode_snr_rssi(int snr, int rssi);
+
+/**
+ * Digipeat queue. There's only one frame in the queue; a new frame which is worth
+ * digipeating replaces the old one.
+ * @param link link quality and history for the suppress rule, or 0
+ * @return DIGI_QUEUE_*. QUEUED and HELD: received_frame has been put to the queue.
+ */
+int digi_queue_frame(struct digi_queue *queue, const struct digi_rules *rules, uint8_t lora_digipeating_mode,
+                     const char *received_frame, uint8_t rx_qrg, const char *snr_rssi, const struct digi_link *link, uint32_t now);
+
+/**
+ * Time to send the queued frame? 5s grace time (plus up to 250ms random) for digipeating, 10s if we are a fill-in digi.
+ * Returns 0: wait. 1: send now. -1: too late, or only cross-digipeating -> discard.
+ */
+int digi_queue_due(const struct digi_queue *queue, uint8_t lora_digipeating_mode, uint8_t lora_cross_digipeating_mode, uint32_t now);
+
+/**
+ * Time on air in ms of a frame with len bytes, sent with lora_speed (see lora_set_speed()).
+ */
+uint32_t lora_airtime_ms(uint16_t lora_speed, uint16_t len);
+
+#endif //DIGIPEATER_H
@@ -0,0 +1,83 @@
+#include "GpsPower.h"
+#include <string.h>
+
+// time to fix assumed before the first wake
+#define GPS_POWER_TTF_DEFAULT 10000
+
+static bool after(uint32_t a, uint32_t b)
+{
+  return (int32_t) (a - b) >= 0;
+}
+
+void gps_power_init(struct gps_power *p, uint32_t now)
+{
+  memset(p, 0, sizeof(*p));
+  p->t_on = now;
+  p->t_refresh = now - GPS_POWER_REFRESH_INTERVAL;
+}
+
+uint32_t gps_power_lead(const struct gps_power *p)
+{
+  uint32_t ttf = p->ttf_avg ? p->ttf_avg : GPS_POWER_TTF_DEFAULT;
+  // half again for the spread of the fix times, plus the settle time
+  uint32_t lead = ttf + ttf / 2 + GPS_POWER_ON_AFTER_FIX;
+
+  if (lead < GPS_POWER_LEAD_MIN)
+    return GPS_POWER_LEAD_MIN;
+  if (lead > GPS_POWER_LEAD_MAX)
+    return GPS_POWER_LEAD_MAX;
+  return lead;
+}
+
+int gps_power_update(struct gps_power *p, uint32_t now, uint32_t beacon_due, bool keep_on, bool fix, uint32_t *sleep_ms)
+{
+  if (p->asleep) {
+    if (!keep_on && !after(now, p->t_wake) && !(beacon_due && after(now, beacon_due - gps_power_lead(p))))
+      return GPS_POWER_NONE;
+    p->slept_ms += now - p->t_sleep;
+    p->asleep = false;
+    p->waiting_for_fix = true;
+    p->t_on = now;
+    p->t_fix = 0;
+    return GPS_POWER_WAKE;
+  }
+
+  if (p->waiting_for_fix) {
+    if (fix) {
+      uint32_t ttf = now - p->t_on;
+      p->ttf_avg = p->ttf_avg ? (3 * p->ttf_avg + ttf) / 4 : ttf;
+      p->waiting_for_fix = false;
+      p->t_fix = now;
+    } else if (after(now, p->t_on + GPS_POWER_TTF_MAX)) {
+      // cold start. Does not tell how long the next hot start takes
+      p->waiting_for_fix = false;
+    }
+  } else if (fix && !p->t_fix) {
+    p->t_fix = now;
+  }
+
+  if (!fix) {
+    p->t_fix = 0;
+    return GPS_POWER_NONE;
+  }
+  // fix held long enough to have loaded the ephemeris
+  if (after(now, p->t_fix + GPS_POWER_REFRESH_TIME))
+    p->t_refresh = now;
+  if (keep_on || !beacon_due || p->waiting_for_fix || !after(now, p->t_fix + GPS_POWER_ON_AFTER_FIX))
+    return GPS_POWER_NONE;
+  // beacon due (or passed): it still needs this fix
+  if (!after(beacon_due, now + gps_power_lead(p) + GPS_POWER_SLEEP_MIN))
+    return GPS_POWER_NONE;
+  if (after(now, p->t_refresh + GPS_POWER_REFRESH_INTERVAL))
+    return GPS_POWER_NONE;
+
+  uint32_t ms = beacon_due - gps_power_lead(p) - now;
+  if (ms > GPS_POWER_SLEEP_MAX)
+    ms = GPS_POWER_SLEEP_MAX;
+  p->asleep = true;
+  p->t_sleep = now;
+  p->t_wake = now + ms;
+  p->sleeps++;
+  *sleep_ms = ms;
+  return GPS_POWER_SLEEP;
+}
@@ -0,0 +1,62 @@
+#ifndef GPS_POWER_H
+#define GPS_POWER_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/*
+ * When to put the GPS to sleep between beacons, and when to wake it.
+ *
+ * After a fix, the GPS sleeps until the next beacon is due, less a lead
+ * time for the next fix. The lead time follows the time to fix measured
+ * after each wake (smoothed, with margin), so a receiver with fresh
+ * ephemeris (hot start, a few seconds) sleeps longer than one that needs
+ * a warm start. Every GPS_POWER_REFRESH_INTERVAL it stays on long enough
+ * to load fresh ephemeris, else the hot starts would get ever slower.
+ *
+ * Times are millis(); all comparisons survive its wrap.
+ */
+
+#define GPS_POWER_SLEEP_MIN 30000         // not worth it below: the wake costs a fix
+#define GPS_POWER_SLEEP_MAX 600000        // wake at least every 10 min, e.g. to notice motion
+#define GPS_POWER_LEAD_MIN 5000
+#define GPS_POWER_LEAD_MAX 90000
+#define GPS_POWER_TTF_MAX 120000          // no fix by then: no sample, stays on until one
+#define GPS_POWER_ON_AFTER_FIX 5000       // let the position settle before the beacon uses it
+#define GPS_POWER_REFRESH_INTERVAL 1800000
+#define GPS_POWER_REFRESH_TIME 60000      // ephemeris: 30s of one subframe cycle, twice
+
+#define GPS_POWER_NONE 0
+#define GPS_POWER_SLEEP 1                 // *sleep_ms set
+#define GPS_POWER_WAKE 2
+
+struct gps_power {
+  bool asleep;
+  bool waiting_for_fix;
+  uint32_t t_on;                          // woke up (or stopped sleeping)
+  uint32_t t_fix;                         // first fix since t_on
+  uint32_t t_sleep;                       // asleep: since
+  uint32_t t_wake;                        // asleep: until
+  uint32_t t_refresh;                     // on long enough for ephemeris last
+  uint32_t ttf_avg;                       // ms, smoothed time to fix after a wake. 0: no sample yet
+  uint32_t sleeps;
+  uint32_t slept_ms;
+};
+
+void gps_power_init(struct gps_power *p, uint32_t now);
+
+/**
+ * How long before a beacon the GPS has to be woken
+ */
+uint32_t gps_power_lead(const struct gps_power *p);
+
+/**
+ * Call often, with the state of the GPS and the beacon schedule.
+ * @param beacon_due millis() the next beacon needing a fix is due. 0: none planned, stay on
+ * @param keep_on GPS needed continuously (e.g. moving: smart beaconing watches the course)
+ * @param fix current position from the GPS
+ * @return GPS_POWER_SLEEP: sleep for *sleep_ms. GPS_POWER_WAKE: wake it now
+ */
+int gps_power_update(struct gps_power *p, uint32_t now, uint32_t beacon_due, bool keep_on, bool fix, uint32_t *sleep_ms);
+
+#endif //GPS_POWER_H
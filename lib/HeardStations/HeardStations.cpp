@@ -0,0 +1,329 @@
+#include "HeardStations.h"
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef ESP32
+  #include <freertos/FreeRTOS.h>
+  #include <esp_heap_caps.h>
+  // loop() writes, the webserver task reads
+  static portMUX_TYPE heard_stations_mux = portMUX_INITIALIZER_UNLOCKED;
+  #define HEARD_LOCK() portENTER_CRITICAL(&heard_stations_mux)
+  #define HEARD_UNLOCK() portEXIT_CRITICAL(&heard_stations_mux)
+#else
+  #define HEARD_LOCK() do{}while(0)
+  #define HEARD_UNLOCK() do{}while(0)
+#endif
+
+static struct heard_station *heard_stations = 0;
+static uint16_t heard_stations_size = 0;
+static uint8_t heard_stations_bits = 0;
+
+int heard_stations_init(uint16_t capacity)
+{
+  uint8_t bits = 1;
+  while ((1U << bits) < capacity && bits < 15)
+    bits++;
+  size_t n = 1U << bits;
+
+  struct heard_station *table = 0;
+#ifdef ESP32
+  table = (struct heard_station *) heap_caps_calloc(n, sizeof(struct heard_station), MALLOC_CAP_SPIRAM);
+#endif
+  if (!table)
+    table = (struct heard_station *) calloc(n, sizeof(struct heard_station));
+  if (!table)
+    return -1;
+
+  heard_stations = table;
+  heard_stations_bits = bits;
+  heard_stations_size = n;
+  return 0;
+}
+
+uint16_t heard_stations_capacity()
+{
+  return heard_stations_size;
+}
+
+static uint16_t heard_stations_hash(uint64_t key)
+{
+  // fibonacci hashing
+  return (uint16_t) ((key * 0x9E3779B97F4A7C15ULL) >> (64 - heard_stations_bits));
+}
+
+// slot of key, or -1. Caller holds the lock.
+static int heard_stations_find(uint64_t key)
+{
+  uint16_t mask = heard_stations_size - 1;
+  uint16_t h = heard_stations_hash(key);
+
+  for (int i = 0; i < HEARD_STATIONS_PROBE_MAX && i < heard_stations_size; i++) {
+    struct heard_station *e = &heard_stations[(h + i) & mask];
+    if (e->key == key)
+      return (h + i) & mask;
+    if (!e->key)
+      break;
+  }
+  return -1;
+}
+
+// slot for a new key: first free one, or the least recently heard in the probe window
+static int heard_stations_alloc(uint64_t key, uint32_t now)
+{
+  uint16_t mask = heard_stations_size - 1;
+  uint16_t h = heard_stations_hash(key);
+  int oldest = -1;
+
+  for (int i = 0; i < HEARD_STATIONS_PROBE_MAX && i < heard_stations_size; i++) {
+    uint16_t slot = (h + i) & mask;
+    if (!heard_stations[slot].key)
+      return slot;
+    if (oldest < 0 || (now - heard_stations[slot].last_heard) > (now - heard_stations[oldest].last_heard))
+      oldest = slot;
+  }
+  return oldest;
+}
+
+
+void heard_stations_update(const char *frame, bool direct, int rssi, int snr, uint32_t now)
+{
+  char call[AX_ADDR_LEN+1];
+  const char *p;
+  int32_t lat, lon;
+  bool has_position;
+
+  if (!heard_stations || !(p = strchr(frame, '>')) || (p - frame) > AX_ADDR_LEN)
+    return;
+  strncpy(call, frame, p - frame);
+  call[p - frame] = 0;
+  uint64_t key = ax25_addr_key(call);
+  if (!key)
+    return;
+
+  // parse outside of the lock
+  has_position = aprs_frame_position(frame, &lat, &lon);
+
+  HEARD_LOCK();
+  int slot = heard_stations_find(key);
+  if (slot < 0) {
+    slot = heard_stations_alloc(key, now);
+    memset(&heard_stations[slot], 0, sizeof(struct heard_station));
+    heard_stations[slot].key = key;
+    heard_stations[slot].first_heard = now;
+  }
+  struct heard_station *e = &heard_stations[slot];
+  e->last_heard = now;
+  if (e->packets < UINT16_MAX)
+    e->packets++;
+  if (direct) {
+    if (!e->packets_direct || rssi < e->rssi_min) e->rssi_min = rssi;
+    if (!e->packets_direct || rssi > e->rssi_max) e->rssi_max = rssi;
+    if (!e->packets_direct || snr < e->snr_min) e->snr_min = snr;
+    if (!e->packets_direct || snr > e->snr_max) e->snr_max = snr;
+    // keep averages meaningful: restart the sums before they could overflow
+    if (e->packets_direct == UINT16_MAX) {
+      e->rssi_sum /= e->packets_direct;
+      e->snr_sum /= e->packets_direct;
+      e->packets_direct = 1;
+    }
+    e->packets_direct++;
+    e->rssi_sum += rssi;
+    e->snr_sum += snr;
+    e->last_heard_direct = now;
+  }
+  if (has_position) {
+    e->lat = lat;
+    e->lon = lon;
+    e->last_position = now;
+  }
+  HEARD_UNLOCK();
+}
+
+bool heard_stations_lookup(uint64_t key, struct heard_station *station)
+{
+  bool found = false;
+
+  if (!heard_stations || !key)
+    return false;
+  HEARD_LOCK();
+  int slot = heard_stations_find(key);
+  if (slot >= 0) {
+    *station = heard_stations[slot];
+    found = true;
+  }
+  HEARD_UNLOCK();
+  return found;
+}
+
+bool heard_stations_get(uint16_t i, struct heard_station *station)
+{
+  if (!heard_stations || i >= heard_stations_size)
+    return false;
+  HEARD_LOCK();
+  *station = heard_stations[i];
+  HEARD_UNLOCK();
+  return station->key != 0;
+}
+
+void heard_stations_digi_link(const char *frame, int rssi, int snr, struct digi_link *link)
+{
+  char call[AX_ADDR_LEN+1];
+  struct heard_station e;
+  const char *p = strchr(frame, '>');
+
+  memset(link, 0, sizeof(*link));
+  link->snr = snr;
+  link->rssi = rssi;
+  if (!p || (p - frame) > AX_ADDR_LEN)
+    return;
+  strncpy(call, frame, p - frame);
+  call[p - frame] = 0;
+  if (!heard_stations_lookup(ax25_addr_key(call), &e) || !e.packets_direct)
+    return;
+  link->packets_direct = e.packets_direct;
+  link->snr_avg = e.snr_sum / e.packets_direct;
+  link->rssi_avg = e.rssi_sum / e.packets_direct;
+}
+
+
+// "4903.50N" / "07201.75W". Position ambiguity (spaces) is read as 0
+static bool aprs_parse_uncompressed_coord(const char *s, int deg_digits, char pos, char neg, int32_t *v)
+{
+  int32_t deg = 0;
+  int32_t min_100 = 0;
+  int i;
+
+  for (i = 0; i < deg_digits + 5; i++) {
+    char c = s[i];
+    if (i == deg_digits + 2) {
+      if (c != '.')
+        return false;
+      continue;
+    }
+    if (c == ' ')
+      c = '0';
+    if (c < '0' || c > '9')
+      return false;
+    if (i < deg_digits)
+      deg = deg * 10 + (c - '0');
+    else
+      min_100 = min_100 * 10 + (c - '0');
+  }
+  if (min_100 >= 6000)
+    return false;
+  *v = deg * 1000000 + min_100 * 10000 / 60;
+  if (s[i] == neg)
+    *v = -*v;
+  else if (s[i] != pos)
+    return false;
+  return true;
+}
+
+static bool aprs_parse_position(const char *s, int32_t *lat, int32_t *lon)
+{
+  if (*s >= '0' && *s <= '9') {
+    // uncompressed: 4903.50N/07201.75W-
+    if (strlen(s) < 19)
+      return false;
+    if (!aprs_parse_uncompressed_coord(s, 2, 'N', 'S', lat) || !aprs_parse_uncompressed_coord(s + 9, 3, 'E', 'W', lon))
+      return false;
+    return *lat >= -90000000 && *lat <= 90000000 && *lon >= -180000000 && *lon <= 180000000;
+  }
+  // compressed: /YYYYXXXX$csT
+  if (*s == '/' || *s == '\\' || (*s >= 'A' && *s <= 'Z') || (*s >= 'a' && *s <= 'j')) {
+    uint32_t y = 0;
+    uint32_t x = 0;
+    if (strlen(s) < 10)
+      return false;
+    for (int i = 1; i <= 8; i++) {
+      if (s[i] < '!' || s[i] > '{')
+        return false;
+      if (i <= 4)
+        y = y * 91 + (s[i] - 33);
+      else
+        x = x * 91 + (s[i] - 33);
+    }
+    // lat = 90 - y / 380926. lon = -180 + x / 190463
+    *lat = 90000000 - (int32_t) ((uint64_t) y * 1000000 / 380926);
+    *lon = -180000000 + (int32_t) ((uint64_t) x * 1000000 / 190463);
+    return true;
+  }
+  return false;
+}
+
+// Mic-E: latitude in the destination call, longitude in the info field
+static bool aprs_parse_mic_e(const char *dst, const char *info, int32_t *lat, int32_t *lon)
+{
+  int digits[6];
+
+  if (strlen(info) < 9)
+    return false;
+  for (int i = 0; i < 6; i++) {
+    char c = dst[i];
+    if (c >= '0' && c <= '9') digits[i] = c - '0';
+    else if (c >= 'A' && c <= 'J') digits[i] = c - 'A';
+    else if (c >= 'P' && c <= 'Y') digits[i] = c - 'P';
+    else if (c == 'K' || c == 'L' || c == 'Z') digits[i] = 0;
+    else return false;
+  }
+  bool north = dst[3] >= 'P';
+  bool lon_offset = dst[4] >= 'P';
+  bool west = dst[5] >= 'P';
+
+  int32_t min_100 = (digits[2] * 10 + digits[3]) * 100 + digits[4] * 10 + digits[5];
+  if (min_100 >= 6000)
+    return false;
+  *lat = (digits[0] * 10 + digits[1]) * 1000000 + min_100 * 10000 / 60;
+  if (!north)
+    *lat = -*lat;
+
+  int d = info[1] - 28;
+  int m = info[2] - 28;
+  int h = info[3] - 28;
+  if (d < 0 || m < 0 || h < 0 || h > 99)
+    return false;
+  if (lon_offset)
+    d += 100;
+  if (d >= 180 && d <= 189)
+    d -= 80;
+  else if (d >= 190 && d <= 199)
+    d -= 190;
+  if (m >= 60)
+    m -= 60;
+  if (d > 179 || m > 59)
+    return false;
+  *lon = d * 1000000 + (m * 100 + h) * 10000 / 60;
+  if (west)
+    *lon = -*lon;
+  return true;
+}
+
+bool aprs_frame_position(const char *frame, int32_t *lat, int32_t *lon)
+{
+  const char *dst = strchr(frame, '>');
+  const char *info = strchr(frame, ':');
+
+  if (!dst || !info || info < dst)
+    return false;
+  dst++;
+  info++;
+
+  switch (*info) {
+  case '!':
+  case '=':
+    return aprs_parse_position(info + 1, lat, lon);
+  case '/':
+  case '@':
+    // 7 chars timestamp
+    if (strlen(info) < 8)
+      return false;
+    return aprs_parse_position(info + 8, lat, lon);
+  case '`':
+  case '\'':
+  case 0x1c:
+  case 0x1d:
+    return aprs_parse_mic_e(dst, info, lat, lon);
+  }
+  // objects, items, third party frames: not the position of the sender
+  return false;
+}
@@ -0,0 +1,75 @@
+#ifndef HEARD_STATIONS_H
+#define HEARD_STATIONS_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <Digipeater.h>
+
+/*
+ * Table of stations we heard on RF, with per station link statistics.
+ *
+ * Fixed capacity open addressing hash table, keyed by the packed source call
+ * (ax25_addr_key()). Allocated once, in PSRAM if present. If the probe window
+ * of a new call is full, the entry heard least recently in that window is
+ * replaced; entries are never moved, so no tombstones are needed.
+ *
+ * RSSI/SNR statistics are only recorded for frames heard direct; for
+ * digipeated frames they would describe the last digipeater, not the station.
+ */
+
+#define HEARD_STATIONS_PROBE_MAX 16
+
+struct heard_station {
+  uint64_t key;               // ax25_addr_key() of the source call. 0: free slot
+  uint32_t first_heard;       // millis()
+  uint32_t last_heard;        // millis()
+  uint32_t last_heard_direct; // millis(). 0: never heard direct
+  uint32_t last_position;     // millis() of lat/lon. 0: no position
+  uint16_t packets;           // all frames
+  uint16_t packets_direct;    // frames without digipeated flag
+  int16_t rssi_min;
+  int16_t rssi_max;
+  int32_t rssi_sum;           // avg: rssi_sum / packets_direct
+  int8_t snr_min;
+  int8_t snr_max;
+  int32_t snr_sum;
+  int32_t lat;                // 1/1000000 degree
+  int32_t lon;
+};
+
+/**
+ * Allocate the table. capacity is rounded up to a power of two. Returns -1 if out of memory.
+ */
+int heard_stations_init(uint16_t capacity);
+
+uint16_t heard_stations_capacity();
+
+/**
+ * Account a received frame (TNC2 format) to its source call.
+ * @param direct frame has no digipeated flag in its header
+ */
+void heard_stations_update(const char *frame, bool direct, int rssi, int snr, uint32_t now);
+
+/**
+ * Copy of the entry of call key. Returns false if not heard.
+ */
+bool heard_stations_lookup(uint64_t key, struct heard_station *station);
+
+/**
+ * Copy of slot i, 0 <= i < heard_stations_capacity(). Returns false for free slots.
+ */
+bool heard_stations_get(uint16_t i, struct heard_station *station);
+
+/**
+ * Link quality of a received frame plus the direct history of its source call,
+ * for the digipeater suppress rule. Call after heard_stations_update().
+ */
+void heard_stations_digi_link(const char *frame, int rssi, int snr, struct digi_link *link);
+
+/**
+ * Position of an APRS frame (TNC2 format): uncompressed, compressed and Mic-E.
+ * lat/lon in 1/1000000 degree. Returns false if the frame has no position of the sender.
+ */
+bool aprs_frame_position(const char *frame, int32_t *lat, int32_t *lon);
+
+#endif //HEARD_STATIONS_H
@@ -19,6 +19,7 @@
 #define CMD_HARDWARE      0x06
 
 #define HW_RSSI           0x21
+#define HW_PROFILE        0x50            // pipeline profile (ENABLE_PIPELINE_PROFILING)
 
 #define CMD_ERROR         0x90
 #define ERROR_INITRADIO   0x01
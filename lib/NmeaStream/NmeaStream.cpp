@@ -0,0 +1,166 @@
+#include "NmeaStream.h"
+#include <string.h>
+#include <ctype.h>
+
+static const struct {
+  const char *name;
+  uint16_t type;
+} nmea_types[] = {
+  { "RMC", NMEA_RMC },
+  { "GGA", NMEA_GGA },
+  { "GSA", NMEA_GSA },
+  { "GSV", NMEA_GSV },
+  { "GLL", NMEA_GLL },
+  { "VTG", NMEA_VTG },
+  { "ZDA", NMEA_ZDA },
+  { "TXT", NMEA_TXT },
+};
+
+#define NMEA_TYPES (sizeof(nmea_types) / sizeof(nmea_types[0]))
+
+void nmea_reader_init(struct nmea_reader *r)
+{
+  memset(r, 0, sizeof(*r));
+}
+
+static int hex_value(char c)
+{
+  if (c >= '0' && c <= '9')
+    return c - '0';
+  if (c >= 'A' && c <= 'F')
+    return c - 'A' + 10;
+  if (c >= 'a' && c <= 'f')
+    return c - 'a' + 10;
+  return -1;
+}
+
+// "$...*HH", without line end
+static bool nmea_checksum_ok(const char *s, size_t len)
+{
+  uint8_t sum = 0;
+  size_t i;
+
+  if (len < 4 || s[len-3] != '*')
+    return false;
+  for (i = 1; i < len - 3; i++)
+    sum ^= (uint8_t) s[i];
+  int hi = hex_value(s[len-2]);
+  int lo = hex_value(s[len-1]);
+  return hi >= 0 && lo >= 0 && sum == (hi << 4 | lo);
+}
+
+const char *nmea_reader_feed(struct nmea_reader *r, char c, size_t *len)
+{
+  if (c == '$') {
+    // the one before had no line end
+    if (r->in_sentence)
+      r->invalid++;
+    r->line[0] = c;
+    r->len = 1;
+    r->in_sentence = true;
+    return 0;
+  }
+  if (!r->in_sentence)
+    return 0;
+  if (c == '\r')
+    return 0;
+  if (c != '\n') {
+    // room for CR LF is kept
+    if (r->len >= NMEA_LINE_MAX - 2) {
+      r->invalid++;
+      r->in_sentence = false;
+      return 0;
+    }
+    r->line[r->len++] = c;
+    return 0;
+  }
+
+  r->in_sentence = false;
+  if (!nmea_checksum_ok(r->line, r->len)) {
+    r->invalid++;
+    return 0;
+  }
+  r->line[r->len++] = '\r';
+  r->line[r->len++] = '\n';
+  r->line[r->len] = 0;
+  *len = r->len;
+  return r->line;
+}
+
+size_t nmea_sentence_finish(char *buf, size_t len, size_t size)
+{
+  static const char hex[] = "0123456789ABCDEF";
+  uint8_t sum = 0;
+  size_t i;
+
+  if (len < 1 || len + 6 > size)
+    return 0;
+  for (i = 1; i < len; i++)
+    sum ^= (uint8_t) buf[i];
+  buf[len++] = '*';
+  buf[len++] = hex[sum >> 4];
+  buf[len++] = hex[sum & 0x0f];
+  buf[len++] = '\r';
+  buf[len++] = '\n';
+  buf[len] = 0;
+  return len;
+}
+
+// "RMC" of "GPRMC", or 0
+static uint16_t nmea_type_of(const char *s, size_t n)
+{
+  size_t i;
+
+  if (n == 5) {
+    s += 2;
+    n = 3;
+  }
+  if (n != 3)
+    return 0;
+  for (i = 0; i < NMEA_TYPES; i++) {
+    if (toupper((unsigned char) s[0]) == nmea_types[i].name[0] &&
+        toupper((unsigned char) s[1]) == nmea_types[i].name[1] &&
+        toupper((unsigned char) s[2]) == nmea_types[i].name[2])
+      return nmea_types[i].type;
+  }
+  return 0;
+}
+
+uint16_t nmea_sentence_type(const char *sentence)
+{
+  const char *comma;
+  uint16_t type;
+
+  if (sentence[0] != '$' || sentence[1] == 'P')
+    return NMEA_OTHER;
+  comma = strchr(sentence, ',');
+  if (!comma || comma - sentence != 6)
+    return NMEA_OTHER;
+  type = nmea_type_of(sentence + 1, 5);
+  return type ? type : NMEA_OTHER;
+}
+
+uint16_t nmea_filter_parse(const char *s)
+{
+  uint16_t mask = 0;
+
+  for (;;) {
+    while (*s == ',' || *s == ' ' || *s == ';' || *s == '$')
+      s++;
+    if (!*s)
+      break;
+    const char *end = s;
+    while (*end && *end != ',' && *end != ' ' && *end != ';')
+      end++;
+    if (end - s == 3 && !strncasecmp(s, "ALL", 3)) {
+      mask = NMEA_ALL;
+    } else {
+      uint16_t type = nmea_type_of(s, end - s);
+      if (!type)
+        return 0;
+      mask |= type;
+    }
+    s = end;
+  }
+  return mask ? mask : NMEA_ALL;
+}
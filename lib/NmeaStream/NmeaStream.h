@@ -0,0 +1,61 @@
+#ifndef NMEA_STREAM_H
+#define NMEA_STREAM_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+/*
+ * NMEA 0183 sentences from the GPS byte stream, for the NMEA TCP clients.
+ *
+ * Bytes are collected in a fixed line buffer; a sentence is only handed
+ * out if it is complete and its checksum is right. Sentences are told
+ * apart by their type (the talker ID is ignored: GPRMC and GNRMC are both
+ * RMC), as a bit in a mask, so each client can pick the types it wants.
+ */
+
+#define NMEA_LINE_MAX 82            // NMEA 0183: at most 82 characters, "$" and CR LF included
+
+#define NMEA_RMC    0x0001
+#define NMEA_GGA    0x0002
+#define NMEA_GSA    0x0004
+#define NMEA_GSV    0x0008
+#define NMEA_GLL    0x0010
+#define NMEA_VTG    0x0020
+#define NMEA_ZDA    0x0040
+#define NMEA_TXT    0x0080
+#define NMEA_OTHER  0x8000          // any other type, proprietary ($P...) ones too
+#define NMEA_ALL    0xffff
+
+struct nmea_reader {
+  char line[NMEA_LINE_MAX + 1];
+  uint8_t len;
+  bool in_sentence;                 // '$' seen, no line end yet
+  uint32_t invalid;                 // sentences too long or with a bad checksum
+};
+
+void nmea_reader_init(struct nmea_reader *r);
+
+/**
+ * Next byte from the GPS. Returns the sentence it completes, ending in CR LF and 0-terminated, or 0.
+ * The sentence is valid until the next call.
+ * @param len length of the sentence
+ */
+const char *nmea_reader_feed(struct nmea_reader *r, char c, size_t *len);
+
+/**
+ * Append "*HH" and CR LF to a sentence "$...". Returns the new length, or 0 if size is too small.
+ */
+size_t nmea_sentence_finish(char *buf, size_t len, size_t size);
+
+/**
+ * NMEA_* bit of a sentence
+ */
+uint16_t nmea_sentence_type(const char *sentence);
+
+/**
+ * Mask of a list of types like "RMC,GGA" (or "GPRMC GPGGA"). Empty or "ALL": all types. Returns 0 if a type is unknown.
+ */
+uint16_t nmea_filter_parse(const char *s);
+
+#endif //NMEA_STREAM_H
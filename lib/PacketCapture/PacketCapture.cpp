@@ -0,0 +1,313 @@
+#include "PacketCapture.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+#ifdef ESP32
+  #include <freertos/FreeRTOS.h>
+  #include <esp_heap_caps.h>
+  // loop() and taskAPRSIS write, the webserver reads
+  static portMUX_TYPE capture_mux = portMUX_INITIALIZER_UNLOCKED;
+  #define CAPTURE_LOCK() portENTER_CRITICAL(&capture_mux)
+  #define CAPTURE_UNLOCK() portEXIT_CRITICAL(&capture_mux)
+#else
+  #define CAPTURE_LOCK() do{}while(0)
+  #define CAPTURE_UNLOCK() do{}while(0)
+#endif
+
+#define LINKTYPE_AX25_KISS 202
+
+#define PCAPNG_SHB 0x0A0D0D0A
+#define PCAPNG_IDB 0x00000001
+#define PCAPNG_EPB 0x00000006
+#define PCAPNG_BYTE_ORDER_MAGIC 0x1A2B3C4D
+#define PCAPNG_OPT_END 0
+#define PCAPNG_OPT_COMMENT 1
+#define PCAPNG_IF_NAME 2
+#define PCAPNG_EPB_FLAGS 2
+
+static struct capture_frame *capture_ring = 0;
+static uint16_t capture_size = 0;
+static uint32_t capture_seq = 0;
+
+int capture_init(uint16_t capacity)
+{
+  struct capture_frame *ring = 0;
+
+  if (!capacity)
+    return -1;
+#ifdef ESP32
+  ring = (struct capture_frame *) heap_caps_calloc(capacity, sizeof(struct capture_frame), MALLOC_CAP_SPIRAM);
+#endif
+  if (!ring)
+    ring = (struct capture_frame *) calloc(capacity, sizeof(struct capture_frame));
+  if (!ring)
+    return -1;
+
+  CAPTURE_LOCK();
+  capture_ring = ring;
+  capture_size = capacity;
+  CAPTURE_UNLOCK();
+  return 0;
+}
+
+uint16_t capture_capacity()
+{
+  return capture_size;
+}
+
+uint32_t capture_last_seq()
+{
+  uint32_t seq;
+
+  CAPTURE_LOCK();
+  seq = capture_seq;
+  CAPTURE_UNLOCK();
+  return seq;
+}
+
+uint32_t capture_oldest_seq()
+{
+  uint32_t seq = capture_last_seq();
+
+  return seq >= capture_size ? seq - capture_size + 1 : 1;
+}
+
+// "WIDE2-1*" -> 7 bytes. flags: bits of the ssid byte (command / has been repeated)
+static int ax25_encode_addr(const char *s, size_t n, uint8_t flags, uint8_t *out)
+{
+  int ssid = 0;
+  size_t i;
+  size_t call_len = n;
+  const char *dash = (const char *) memchr(s, '-', n);
+
+  if (dash) {
+    call_len = dash - s;
+    if (n - call_len < 2 || n - call_len > 3)
+      return -1;
+    for (i = call_len + 1; i < n; i++) {
+      if (!isdigit((unsigned char) s[i]))
+        return -1;
+      ssid = ssid * 10 + (s[i] - '0');
+    }
+    if (ssid > 15)
+      return -1;
+  }
+  if (!call_len || call_len > 6)
+    return -1;
+  for (i = 0; i < 6; i++) {
+    char c = i < call_len ? s[i] : ' ';
+    if (i < call_len && !isalnum((unsigned char) c))
+      return -1;
+    out[i] = (uint8_t) (toupper((unsigned char) c) << 1);
+  }
+  out[6] = 0x60 | flags | (ssid << 1);
+  return 7;
+}
+
+int capture_ax25_encode(const char *frame, uint8_t *buf, size_t len)
+{
+  const char *header_end = strchr(frame, ':');
+  const char *p = frame;
+  const char *q;
+  const char *last_repeated = 0;
+  size_t pos = 14;
+  int addrs = 0;
+
+  if (!header_end || len < 16)
+    return -1;
+  // digis up to the last one marked with '*' have been repeated
+  for (q = frame; q < header_end; q++) {
+    if (*q == '*')
+      last_repeated = q;
+  }
+
+  // TNC2: SRC>DST,DIGI,...  AX.25: DST SRC DIGI ...
+  q = (const char *) memchr(p, '>', header_end - p);
+  if (!q || ax25_encode_addr(p, q - p, 0, buf + 7) < 0)
+    return -1;
+  p = q + 1;
+  for (;;) {
+    bool is_dst = (addrs == 0);
+    size_t n;
+    uint8_t flags = 0;
+
+    for (q = p; q < header_end && *q != ','; q++)
+      ;
+    n = q - p;
+    if (!is_dst) {
+      if (n && p[n-1] == '*')
+        n--;
+      if (last_repeated && p <= last_repeated)
+        flags = 0x80;
+      if (pos + 7 > len)
+        return -1;
+    } else {
+      // command frame: C bit in the destination
+      flags = 0x80;
+    }
+    if (ax25_encode_addr(p, n, flags, is_dst ? buf : buf + pos) < 0)
+      return -1;
+    if (!is_dst)
+      pos += 7;
+    addrs++;
+    if (q >= header_end)
+      break;
+    p = q + 1;
+  }
+  if (addrs > 9)
+    return -1;
+  buf[pos-1] |= 0x01;
+
+  size_t info_len = strlen(header_end + 1);
+  if (pos + 2 + info_len > len)
+    return -1;
+  buf[pos++] = 0x03;    // UI
+  buf[pos++] = 0xf0;    // no layer 3
+  memcpy(buf + pos, header_end + 1, info_len);
+  return pos + info_len;
+}
+
+uint32_t capture_add(const char *kind, const char *frame, int rssi, int snr, double freq, uint32_t tv_sec, uint32_t tv_usec)
+{
+  struct capture_frame e;
+  uint32_t seq;
+
+  if (!capture_ring)
+    return 0;
+  memset(&e, 0, sizeof(e));
+  // KISS type byte: data frame, port 0
+  e.data[0] = 0x00;
+  int n = capture_ax25_encode(frame, e.data + 1, sizeof(e.data) - 1);
+  if (n < 0)
+    return 0;
+  e.len = n + 1;
+  e.tv_sec = tv_sec;
+  e.tv_usec = tv_usec;
+  e.freq_hz = (uint32_t) (freq * 1000000.0 + 0.5);
+  e.rssi = rssi;
+  e.snr = snr;
+  e.dir = strcmp(kind, "RX") ? CAPTURE_DIR_OUT : CAPTURE_DIR_IN;
+  strncpy(e.kind, kind, sizeof(e.kind) - 1);
+
+  CAPTURE_LOCK();
+  seq = ++capture_seq;
+  e.seq = seq;
+  capture_ring[seq % capture_size] = e;
+  CAPTURE_UNLOCK();
+  return seq;
+}
+
+bool capture_get(uint32_t seq, struct capture_frame *frame)
+{
+  bool found = false;
+
+  if (!capture_ring || !seq)
+    return false;
+  CAPTURE_LOCK();
+  const struct capture_frame *e = &capture_ring[seq % capture_size];
+  if (e->seq == seq) {
+    *frame = *e;
+    found = true;
+  }
+  CAPTURE_UNLOCK();
+  return found;
+}
+
+static size_t put16(uint8_t *buf, uint16_t v)
+{
+  memcpy(buf, &v, 2);
+  return 2;
+}
+
+static size_t put32(uint8_t *buf, uint32_t v)
+{
+  memcpy(buf, &v, 4);
+  return 4;
+}
+
+// option with its value padded to 32 bit
+static size_t put_option(uint8_t *buf, uint16_t code, const void *value, uint16_t len)
+{
+  size_t padded = (len + 3) & ~3;
+
+  put16(buf, code);
+  put16(buf + 2, len);
+  memcpy(buf + 4, value, len);
+  memset(buf + 4 + len, 0, padded - len);
+  return 4 + padded;
+}
+
+// block type and length, and the length again at the end. Host byte order, as the byte order magic says
+static size_t block_finish(uint8_t *block, uint32_t type, size_t len)
+{
+  len += 4;
+  put32(block, type);
+  put32(block + 4, len);
+  put32(block + len - 4, len);
+  return len;
+}
+
+size_t capture_pcapng_header(uint8_t *buf, size_t len)
+{
+  static const char if_name[] = "lora";
+  size_t pos;
+  size_t shb;
+
+  if (len < 28 + 32)
+    return 0;
+  // section header: version 1.0, section length unknown
+  pos = 8;
+  pos += put32(buf + pos, PCAPNG_BYTE_ORDER_MAGIC);
+  pos += put16(buf + pos, 1);
+  pos += put16(buf + pos, 0);
+  pos += put32(buf + pos, 0xffffffff);
+  pos += put32(buf + pos, 0xffffffff);
+  shb = block_finish(buf, PCAPNG_SHB, pos);
+
+  // interface description, microsecond timestamps (default)
+  uint8_t *idb = buf + shb;
+  pos = 8;
+  pos += put16(idb + pos, LINKTYPE_AX25_KISS);
+  pos += put16(idb + pos, 0);
+  pos += put32(idb + pos, 0);
+  pos += put_option(idb + pos, PCAPNG_IF_NAME, if_name, sizeof(if_name) - 1);
+  pos += put32(idb + pos, PCAPNG_OPT_END);
+  return shb + block_finish(idb, PCAPNG_IDB, pos);
+}
+
+size_t capture_pcapng_packet(const struct capture_frame *frame, uint8_t *buf, size_t len)
+{
+  char comment[80];
+  uint64_t ts = (uint64_t) frame->tv_sec * 1000000 + frame->tv_usec;
+  uint32_t flags = frame->dir;    // bits 0-1: 1 inbound, 2 outbound
+  size_t pos;
+  int n;
+
+  if (frame->dir == CAPTURE_DIR_IN)
+    n = snprintf(comment, sizeof(comment), "%s %lu.%06lu MHz, RSSI %d dBm, SNR %d dB", frame->kind,
+      (unsigned long) (frame->freq_hz / 1000000), (unsigned long) (frame->freq_hz % 1000000), frame->rssi, frame->snr);
+  else
+    n = snprintf(comment, sizeof(comment), "%s %lu.%06lu MHz", frame->kind,
+      (unsigned long) (frame->freq_hz / 1000000), (unsigned long) (frame->freq_hz % 1000000));
+  if (n < 0 || n >= (int) sizeof(comment))
+    n = sizeof(comment) - 1;
+
+  // header, data, comment, flags, end of options, length
+  if (len < 28 + (size_t) ((frame->len + 3) & ~3) + 4 + (size_t) ((n + 3) & ~3) + 8 + 4 + 4)
+    return 0;
+  pos = 8;
+  pos += put32(buf + pos, 0);
+  pos += put32(buf + pos, (uint32_t) (ts >> 32));
+  pos += put32(buf + pos, (uint32_t) ts);
+  pos += put32(buf + pos, frame->len);
+  pos += put32(buf + pos, frame->len);
+  memcpy(buf + pos, frame->data, frame->len);
+  memset(buf + pos + frame->len, 0, ((frame->len + 3) & ~3) - frame->len);
+  pos += (frame->len + 3) & ~3;
+  pos += put_option(buf + pos, PCAPNG_OPT_COMMENT, comment, n);
+  pos += put_option(buf + pos, PCAPNG_EPB_FLAGS, &flags, 4);
+  pos += put32(buf + pos, PCAPNG_OPT_END);
+  return block_finish(buf, PCAPNG_EPB, pos);
+}
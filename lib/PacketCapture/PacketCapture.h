@@ -0,0 +1,83 @@
+#ifndef PACKET_CAPTURE_H
+#define PACKET_CAPTURE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+/*
+ * Capture of the radio traffic, for Wireshark and offline analysis.
+ *
+ * Frames (TNC2 format) are converted to AX.25 when captured and kept in a
+ * ring of fixed size slots, allocated once, in PSRAM if present. Each frame
+ * gets a sequence number, so readers can follow the ring and notice what
+ * was overwritten meanwhile.
+ *
+ * Output is pcapng with link type LINKTYPE_AX25_KISS (a KISS type byte, then
+ * the AX.25 frame). Classic pcap has no per packet metadata; in pcapng the
+ * direction goes to the epb_flags option and RSSI, SNR, frequency and the
+ * kind of frame to the packet comment, both shown by Wireshark.
+ */
+
+#define CAPTURE_DATA_MAX 332        // KISS byte + 10 addresses + control, PID + 251 bytes info
+
+#define CAPTURE_DIR_IN 1
+#define CAPTURE_DIR_OUT 2
+
+struct capture_frame {
+  uint32_t seq;                     // 1, 2, ... 0: free slot
+  uint32_t tv_sec;
+  uint32_t tv_usec;
+  uint32_t freq_hz;
+  int16_t rssi;                     // dBm. 0: not known (TX)
+  int8_t snr;
+  uint8_t dir;                      // CAPTURE_DIR_*
+  char kind[6];                     // "RX", "TX", "KISS", "digi", "IS"
+  uint16_t len;
+  uint8_t data[CAPTURE_DATA_MAX];
+};
+
+/**
+ * Allocate the ring. Returns -1 if out of memory.
+ */
+int capture_init(uint16_t capacity);
+
+uint16_t capture_capacity();
+
+/**
+ * Sequence number of the newest frame. 0: none yet
+ */
+uint32_t capture_last_seq();
+
+/**
+ * Sequence number of the oldest frame still in the ring
+ */
+uint32_t capture_oldest_seq();
+
+/**
+ * Capture a frame in TNC2 format. Frames which are no valid AX.25 are skipped. Returns the sequence number, or 0.
+ * @param kind "RX" is inbound, anything else outbound
+ */
+uint32_t capture_add(const char *kind, const char *frame, int rssi, int snr, double freq, uint32_t tv_sec, uint32_t tv_usec);
+
+/**
+ * Copy of frame seq. Returns false if not captured yet, or already overwritten.
+ */
+bool capture_get(uint32_t seq, struct capture_frame *frame);
+
+/**
+ * TNC2 frame to AX.25 UI frame. Returns the length, or -1 if the frame is invalid or buf too small.
+ */
+int capture_ax25_encode(const char *frame, uint8_t *buf, size_t len);
+
+/**
+ * pcapng section header and interface description. Returns the length, or 0 if buf is too small.
+ */
+size_t capture_pcapng_header(uint8_t *buf, size_t len);
+
+/**
+ * pcapng enhanced packet block of a frame. Returns the length, or 0 if buf is too small.
+ */
+size_t capture_pcapng_packet(const struct capture_frame *frame, uint8_t *buf, size_t len);
+
+#endif //PACKET_CAPTURE_H
@@ -0,0 +1,182 @@
+#include "PipelineProfile.h"
+
+#ifdef ENABLE_PIPELINE_PROFILING
+
+#include <BufAppend.h>
+#include <stdio.h>
+#include <string.h>
+
+#ifdef ESP32
+  #include <freertos/FreeRTOS.h>
+  #include <esp_timer.h>
+  #include <rom/ets_sys.h>
+  #include <xtensa/hal.h>
+  // loop() and taskTNC write, the webserver task reads
+  static portMUX_TYPE profile_mux = portMUX_INITIALIZER_UNLOCKED;
+  #define PROFILE_LOCK() portENTER_CRITICAL(&profile_mux)
+  #define PROFILE_UNLOCK() portEXIT_CRITICAL(&profile_mux)
+#else
+  #include <time.h>
+  #define PROFILE_LOCK() do{}while(0)
+  #define PROFILE_UNLOCK() do{}while(0)
+#endif
+
+static struct profile_histogram profile_hist[PROFILE_STAGES];
+
+static const char *profile_stage_names[PROFILE_STAGES] = {
+  "isr_to_recv",
+  "validate",
+  "blacklist",
+  "digi_decision",
+  "kiss_encode",
+  "weblist",
+  "aprsis",
+  "csma",
+  "airtime",
+};
+
+static uint32_t profile_cpu_mhz()
+{
+#ifdef ESP32
+  return ets_get_cpu_frequency();
+#else
+  // host: profile_cycles() counts ns
+  return 1000;
+#endif
+}
+
+uint32_t profile_cycles()
+{
+#ifdef ESP32
+  return xthal_get_ccount();
+#else
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint32_t ) (ts.tv_sec * 1000000000ULL + ts.tv_nsec);
+#endif
+}
+
+uint32_t profile_micros()
+{
+#ifdef ESP32
+  return (uint32_t ) esp_timer_get_time();
+#else
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint32_t ) (ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000);
+#endif
+}
+
+void profile_record_cycles(enum profile_stage stage, uint32_t cycles)
+{
+  profile_record_ns(stage, (uint64_t ) cycles * 1000 / profile_cpu_mhz());
+}
+
+void profile_record_ns(enum profile_stage stage, uint64_t ns)
+{
+  uint8_t b = 0;
+
+  if (stage >= PROFILE_STAGES)
+    return;
+  while (b < PROFILE_BUCKETS-1 && (ns >> (b+1)))
+    b++;
+
+  PROFILE_LOCK();
+  struct profile_histogram *h = &profile_hist[stage];
+  if (!h->count || ns < h->min_ns)
+    h->min_ns = ns;
+  if (ns > h->max_ns)
+    h->max_ns = ns;
+  h->count++;
+  h->sum_ns += ns;
+  h->bucket[b]++;
+  PROFILE_UNLOCK();
+}
+
+const char *profile_stage_name(enum profile_stage stage)
+{
+  return (stage < PROFILE_STAGES) ? profile_stage_names[stage] : "";
+}
+
+void profile_get(enum profile_stage stage, struct profile_histogram *h)
+{
+  if (stage >= PROFILE_STAGES)
+    return;
+  PROFILE_LOCK();
+  *h = profile_hist[stage];
+  PROFILE_UNLOCK();
+}
+
+uint64_t profile_percentile_ns(const struct profile_histogram *h, uint8_t p)
+{
+  uint64_t seen = 0;
+  // rank of the percentile, rounded up
+  uint64_t rank = ((uint64_t ) h->count * p + 99) / 100;
+
+  if (!h->count)
+    return 0;
+  if (!rank)
+    rank = 1;
+  for (int i = 0; i < PROFILE_BUCKETS; i++) {
+    seen += h->bucket[i];
+    if (seen >= rank) {
+      uint64_t upper = 1ULL << (i+1);
+      // the max is a better bound for the last bucket
+      return (upper < h->max_ns) ? upper : h->max_ns;
+    }
+  }
+  return h->max_ns;
+}
+
+void profile_reset()
+{
+  PROFILE_LOCK();
+  memset(profile_hist, 0, sizeof(profile_hist));
+  PROFILE_UNLOCK();
+}
+
+size_t profile_format_json(char *buf, size_t len)
+{
+  struct profile_histogram h;
+  size_t pos = 0;
+
+  if (!buf_append(buf, len, &pos, "{\"cpu_mhz\":%lu,\"stages\":[", (unsigned long ) profile_cpu_mhz()))
+    return 0;
+  for (int s = 0; s < PROFILE_STAGES; s++) {
+    profile_get((enum profile_stage ) s, &h);
+    int last = PROFILE_BUCKETS-1;
+    while (last >= 0 && !h.bucket[last])
+      last--;
+    if (!buf_append(buf, len, &pos, "%s{\"name\":\"%s\",\"count\":%lu,\"avg_us\":%.3f,\"min_us\":%.3f,\"max_us\":%.3f,\"p50_us\":%.3f,\"p99_us\":%.3f,\"hist\":[",
+                        s ? "," : "", profile_stage_names[s], (unsigned long ) h.count,
+                        h.count ? h.sum_ns / 1000.0 / h.count : 0.0, h.min_ns / 1000.0, h.max_ns / 1000.0,
+                        profile_percentile_ns(&h, 50) / 1000.0, profile_percentile_ns(&h, 99) / 1000.0))
+      return 0;
+    for (int i = 0; i <= last; i++) {
+      if (!buf_append(buf, len, &pos, "%s%lu", i ? "," : "", (unsigned long ) h.bucket[i]))
+        return 0;
+    }
+    if (!buf_append(buf, len, &pos, "]}"))
+      return 0;
+  }
+  if (!buf_append(buf, len, &pos, "]}"))
+    return 0;
+  return pos;
+}
+
+size_t profile_format_text(char *buf, size_t len)
+{
+  struct profile_histogram h;
+  size_t pos = 0;
+
+  for (int s = 0; s < PROFILE_STAGES; s++) {
+    profile_get((enum profile_stage ) s, &h);
+    if (!buf_append(buf, len, &pos, "%s n=%lu avg=%.1fus p50<%.1fus p99<%.1fus max=%.1fus\n",
+                        profile_stage_names[s], (unsigned long ) h.count, h.count ? h.sum_ns / 1000.0 / h.count : 0.0,
+                        profile_percentile_ns(&h, 50) / 1000.0, profile_percentile_ns(&h, 99) / 1000.0, h.max_ns / 1000.0))
+      return 0;
+  }
+  return pos;
+}
+
+#endif // ENABLE_PIPELINE_PROFILING
@@ -0,0 +1,96 @@
+#ifndef PIPELINE_PROFILE_H
+#define PIPELINE_PROFILE_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+ * Time spent in the stages of the RX and TX path, measured on the device.
+ *
+ * Only compiled in with -D ENABLE_PIPELINE_PROFILING; otherwise the PROFILE_*
+ * macros are empty. CPU bound stages are measured with the cycle counter
+ * (PROFILE_BEGIN() / PROFILE_END()), stages which wait for the radio or start
+ * in an interrupt with the microsecond timer (PROFILE_BEGIN_US() / PROFILE_SINCE_US()).
+ *
+ * Each stage has a histogram with power of two buckets: bucket i counts the
+ * spans of 2^i .. 2^(i+1)-1 ns. Bucket 0 also holds spans below 1ns.
+ */
+
+enum profile_stage {
+  PROFILE_ISR_TO_RECV,    // RxDone interrupt until recvAPRS() in loop()
+  PROFILE_VALIDATE,       // packet_is_valid()
+  PROFILE_BLACKLIST,      // is_call_blacklisted()
+  PROFILE_DIGI_DECISION,  // digipeat rules and queue
+  PROFILE_KISS_ENCODE,    // encode_kiss() in taskTNC
+  PROFILE_WEBLIST,        // sendToWebList()
+  PROFILE_APRSIS,         // send_to_aprsis()
+  PROFILE_CSMA,           // loraSend(): waiting for a free channel
+  PROFILE_AIRTIME,        // loraSend(): sendAPRS() until TX done
+  PROFILE_STAGES
+};
+
+#define PROFILE_BUCKETS 36    // 2^36 ns == 68s
+
+struct profile_histogram {
+  uint32_t count;
+  uint64_t sum_ns;
+  uint64_t min_ns;
+  uint64_t max_ns;
+  uint32_t bucket[PROFILE_BUCKETS];
+};
+
+#ifdef ENABLE_PIPELINE_PROFILING
+  #define PROFILE_BEGIN(t) uint32_t t = profile_cycles()
+  #define PROFILE_END(stage, t) profile_record_cycles(stage, profile_cycles() - (t))
+  #define PROFILE_BEGIN_US(t) uint32_t t = profile_micros()
+  // start_us: PROFILE_BEGIN_US() or micros() (same clock), e.g. taken in an ISR
+  #define PROFILE_SINCE_US(stage, start_us) profile_record_ns(stage, (uint64_t ) (uint32_t ) (profile_micros() - (start_us)) * 1000)
+#else
+  #define PROFILE_BEGIN(t) do {} while (0)
+  #define PROFILE_END(stage, t) do {} while (0)
+  #define PROFILE_BEGIN_US(t) do {} while (0)
+  #define PROFILE_SINCE_US(stage, start_us) do {} while (0)
+#endif
+
+/**
+ * CPU cycle counter of the current core.
+ */
+uint32_t profile_cycles();
+
+/**
+ * esp_timer_get_time(), truncated like micros().
+ */
+uint32_t profile_micros();
+
+void profile_record_cycles(enum profile_stage stage, uint32_t cycles);
+
+void profile_record_ns(enum profile_stage stage, uint64_t ns);
+
+const char *profile_stage_name(enum profile_stage stage);
+
+/**
+ * Copy of the histogram of stage.
+ */
+void profile_get(enum profile_stage stage, struct profile_histogram *h);
+
+/**
+ * Upper bound in ns of the bucket the percentile p (0..100) falls in. 0 if no spans recorded.
+ */
+uint64_t profile_percentile_ns(const struct profile_histogram *h, uint8_t p);
+
+void profile_reset();
+
+/**
+ * All stages as JSON: {"cpu_mhz":240,"stages":[{"name":..,"count":..,"avg_us":..,"min_us":..,"max_us":..,
+ * "p50_us":..,"p99_us":..,"hist":[bucket 0, ..]}]}. Trailing empty buckets are omitted.
+ * Returns the length, or 0 if buf was too small.
+ */
+size_t profile_format_json(char *buf, size_t len);
+
+/**
+ * All stages as text, one line per stage, for the KISS CMD_HARDWARE reply.
+ * Returns the length, or 0 if buf was too small.
+ */
+size_t profile_format_text(char *buf, size_t len);
+
+#endif //PIPELINE_PROFILE_H
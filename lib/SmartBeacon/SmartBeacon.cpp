@@ -0,0 +1,99 @@
+#include "SmartBeacon.h"
+#include <math.h>
+#include <string.h>
+#include <stdlib.h>
+
+void sb_init(struct sb_state *s)
+{
+  memset(s, 0, sizeof(*s));
+  s->next_tx = SB_FIRST_INTERVAL;
+}
+
+// Algo from Kenwood SB Docu. Considered values should be int.
+// algo is: (int ) ((int )sb_angle + 10 * turn_slope / (int ) mph). In km/h, we have (int ) ((int ) ab_angle + 16 *turn_slope / (int ) mph)
+static bool sb_turned(const struct sb_params *p, float speed, float old_course, float new_course)
+{
+  // cave: speed must not be 0 (division by zero). Because min_speed may be configured as zero, the caller's check is not enough
+  int int_speed = (int ) speed;
+  if (int_speed < 1)
+    int_speed = 1;
+  int threshold = (int ) p->angle + 16 * p->turn_slope / int_speed;
+  if (threshold > 120)
+    threshold = 120;
+
+  if (old_course < threshold && new_course > 360 - threshold)
+    return fabsf(new_course - old_course - 360) >= threshold;
+  if (old_course > 360 - threshold && new_course < threshold)
+    return fabsf(new_course - old_course + 360) >= threshold;
+  return fabsf(new_course - old_course) >= threshold;
+}
+
+void sb_fix(struct sb_state *s, const struct sb_params *p, float speed_kmh, float course_deg, uint32_t now, uint32_t last_tx)
+{
+  float sum = 0;
+  int i;
+
+  s->speed[s->speed_pos] = speed_kmh;
+  if (++s->speed_pos >= SB_SPEED_AVGS)
+    s->speed_pos = 0;
+  for (i = 0; i < SB_SPEED_AVGS; i++)
+    sum += s->speed[i];
+  s->speed_avg = sum / SB_SPEED_AVGS;
+
+  s->course[s->course_pos] = course_deg;
+  if (++s->course_pos < SB_ANGLE_AVGS)
+    return;
+  s->course_pos = 0;
+
+  float y = 0;
+  float x = 0;
+  for (i = 0; i < SB_ANGLE_AVGS; i++) {
+    y += sinf(s->course[i] / 180 * 3.1415);
+    x += cosf(s->course[i] / 180 * 3.1415);
+  }
+  float course = atan2f(y, x) * 180 / 3.1415;
+  if (course < 0)
+    course += 360;
+  // tooo much false positives
+  // Only in turn_time interval and if we did not announce turn in last round.
+  if (s->next_tx > 1 && now - last_tx > p->turn_time * 1000UL && s->speed_avg >= p->min_speed &&
+      sb_turned(p, s->speed_avg, s->course_avg, course))
+    s->next_tx = 1;
+  s->course_avg = course;
+}
+
+bool sb_due(struct sb_state *s, const struct sb_params *p, uint32_t now, uint32_t last_tx, uint32_t min_gap)
+{
+  if (now < p->max_interval && last_tx == 0)
+    s->next_tx = 0;
+
+  // No course change (indicator next_tx == 1)? Recompute next_tx
+  if (s->next_tx > 1 && now - last_tx >= p->min_interval) {
+    if (p->kenwood) {
+      if (s->speed_avg < p->min_speed)
+        s->next_tx = p->max_interval;
+      else if (s->speed_avg > p->max_speed)
+        s->next_tx = p->min_interval;
+      else
+        s->next_tx = p->min_interval * p->max_speed / s->speed_avg;
+    } else {
+      // dl9sau: imho, too affine at high speed level
+      // could become negative if we are faster than max_speed: min_interval then
+      s->next_tx = (p->max_speed > s->speed_avg) ?
+        (p->max_interval - p->min_interval) / (p->max_speed - p->min_speed) * (p->max_speed - s->speed_avg) + p->min_interval :
+        p->min_interval;
+    }
+    if (s->next_tx > p->max_interval)
+      s->next_tx = p->max_interval;
+  }
+
+  // rate limited by min_gap, unless next_tx <= 1: the turn_time limit applied already
+  return last_tx + s->next_tx < now && (s->next_tx <= 1 || now - last_tx >= min_gap);
+}
+
+void sb_sent(struct sb_state *s, const struct sb_params *p)
+{
+  // We just transmitted. We transmitted due to turn? Don't TX again in next round:
+  if (s->next_tx < p->min_interval)
+    s->next_tx = p->min_interval;
+}
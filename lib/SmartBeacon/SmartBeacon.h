@@ -0,0 +1,64 @@
+#ifndef SMART_BEACON_H
+#define SMART_BEACON_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/*
+ * Smart beaconing: when to send the next position, from speed and course.
+ *
+ * The interval shrinks with the (averaged) speed, between max_interval
+ * when slow and min_interval when fast. A turn sharper than the threshold
+ * (angle, plus turn_slope / speed: more at low speed) makes the next
+ * beacon due at once, but at most every turn_time.
+ *
+ * No clock of its own: all times are passed in (millis() on the device,
+ * the track time in tools/sb_sim.cpp), as is the time of the last TX,
+ * which may have been another frame than a beacon.
+ */
+
+#define SB_SPEED_AVGS 5               // speed averaging: fixes
+#define SB_ANGLE_AVGS 3               // course averaging: fixes
+#define SB_FIRST_INTERVAL 60000       // next_tx before the first computation
+
+struct sb_params {
+  uint32_t min_interval;              // ms
+  uint32_t max_interval;              // ms
+  float min_speed;                    // km/h
+  float max_speed;                    // km/h
+  float angle;                        // degree
+  int turn_slope;
+  int turn_time;                      // s
+  bool kenwood;                       // interval min_interval * max_speed / speed, else linear in speed
+};
+
+struct sb_state {
+  float speed[SB_SPEED_AVGS];
+  uint8_t speed_pos;
+  float speed_avg;                    // km/h
+  float course[SB_ANGLE_AVGS];
+  uint8_t course_pos;
+  float course_avg;                   // degree, of the last SB_ANGLE_AVGS fixes
+  uint32_t next_tx;                   // ms after the last TX. <= 1: due now (turn, or first beacon)
+};
+
+void sb_init(struct sb_state *s);
+
+/**
+ * A new fix. Once per fix: the averages count fixes, not calls.
+ * @param last_tx time of the last TX. 0: none yet
+ */
+void sb_fix(struct sb_state *s, const struct sb_params *p, float speed_kmh, float course_deg, uint32_t now, uint32_t last_tx);
+
+/**
+ * Whether a beacon is due. Recomputes the interval from the speed first.
+ * @param min_gap ms between two TX, unless it is a turn
+ */
+bool sb_due(struct sb_state *s, const struct sb_params *p, uint32_t now, uint32_t last_tx, uint32_t min_gap);
+
+/**
+ * A beacon was sent: no other for min_interval, even after a turn
+ */
+void sb_sent(struct sb_state *s, const struct sb_params *p);
+
+#endif //SMART_BEACON_H
@@ -0,0 +1,238 @@
+#include "UbxNavPvt.h"
+#include <NmeaStream.h>
+#include <stdio.h>
+#include <string.h>
+
+#define UBX_SYNC1 0xb5
+#define UBX_SYNC2 0x62
+#define UBX_CLASS_NAV 0x01
+#define UBX_ID_NAV_PVT 0x07
+
+enum {
+  UBX_WAIT_SYNC1,
+  UBX_WAIT_SYNC2,
+  UBX_CLASS,
+  UBX_ID,
+  UBX_LEN1,
+  UBX_LEN2,
+  UBX_PAYLOAD,
+  UBX_CK_A,
+  UBX_CK_B,
+};
+
+void ubx_reader_init(struct ubx_reader *r)
+{
+  memset(r, 0, sizeof(*r));
+}
+
+static uint16_t get_u2(const uint8_t *p)
+{
+  return p[0] | p[1] << 8;
+}
+
+static uint32_t get_u4(const uint8_t *p)
+{
+  return (uint32_t) p[0] | (uint32_t) p[1] << 8 | (uint32_t) p[2] << 16 | (uint32_t) p[3] << 24;
+}
+
+static void ubx_nav_pvt_decode(const uint8_t *p, struct ubx_nav_pvt *pvt)
+{
+  pvt->itow = get_u4(p);
+  pvt->year = get_u2(p + 4);
+  pvt->month = p[6];
+  pvt->day = p[7];
+  pvt->hour = p[8];
+  pvt->min = p[9];
+  pvt->sec = p[10];
+  pvt->valid = p[11];
+  pvt->t_acc = get_u4(p + 12);
+  pvt->nano = (int32_t) get_u4(p + 16);
+  pvt->fix_type = p[20];
+  pvt->flags = p[21];
+  pvt->num_sv = p[23];
+  pvt->lon = (int32_t) get_u4(p + 24);
+  pvt->lat = (int32_t) get_u4(p + 28);
+  pvt->height = (int32_t) get_u4(p + 32);
+  pvt->h_msl = (int32_t) get_u4(p + 36);
+  pvt->h_acc = get_u4(p + 40);
+  pvt->v_acc = get_u4(p + 44);
+  pvt->g_speed = (int32_t) get_u4(p + 60);
+  pvt->head_mot = (int32_t) get_u4(p + 64);
+  pvt->p_dop = get_u2(p + 76);
+}
+
+bool ubx_reader_feed(struct ubx_reader *r, uint8_t c, struct ubx_nav_pvt *pvt)
+{
+  // class, id, length and payload are in the checksum
+  if (r->state >= UBX_CLASS && r->state <= UBX_PAYLOAD) {
+    r->ck_a += c;
+    r->ck_b += r->ck_a;
+  }
+  switch (r->state) {
+  case UBX_WAIT_SYNC1:
+    if (c == UBX_SYNC1)
+      r->state = UBX_WAIT_SYNC2;
+    return false;
+  case UBX_WAIT_SYNC2:
+    r->state = (c == UBX_SYNC2) ? UBX_CLASS : (c == UBX_SYNC1 ? UBX_WAIT_SYNC2 : UBX_WAIT_SYNC1);
+    r->ck_a = r->ck_b = 0;
+    return false;
+  case UBX_CLASS:
+    r->msg_class = c;
+    r->state = UBX_ID;
+    return false;
+  case UBX_ID:
+    r->msg_id = c;
+    r->state = UBX_LEN1;
+    return false;
+  case UBX_LEN1:
+    r->len = c;
+    r->state = UBX_LEN2;
+    return false;
+  case UBX_LEN2:
+    r->len |= c << 8;
+    r->pos = 0;
+    r->state = r->len ? UBX_PAYLOAD : UBX_CK_A;
+    return false;
+  case UBX_PAYLOAD:
+    // only NAV-PVT is kept. Others are just counted through
+    if (r->pos < sizeof(r->payload))
+      r->payload[r->pos] = c;
+    if (++r->pos >= r->len)
+      r->state = UBX_CK_A;
+    return false;
+  case UBX_CK_A:
+    if (c != r->ck_a) {
+      r->invalid++;
+      r->state = (c == UBX_SYNC1) ? UBX_WAIT_SYNC2 : UBX_WAIT_SYNC1;
+      return false;
+    }
+    r->state = UBX_CK_B;
+    return false;
+  case UBX_CK_B:
+    r->state = UBX_WAIT_SYNC1;
+    if (c != r->ck_b) {
+      r->invalid++;
+      if (c == UBX_SYNC1)
+        r->state = UBX_WAIT_SYNC2;
+      return false;
+    }
+    if (r->msg_class != UBX_CLASS_NAV || r->msg_id != UBX_ID_NAV_PVT || r->len < UBX_NAV_PVT_LEN_MIN || r->len > UBX_NAV_PVT_LEN)
+      return false;
+    ubx_nav_pvt_decode(r->payload, pvt);
+    return true;
+  }
+  r->state = UBX_WAIT_SYNC1;
+  return false;
+}
+
+bool ubx_nav_pvt_has_fix(const struct ubx_nav_pvt *pvt)
+{
+  return (pvt->flags & UBX_PVT_GNSS_FIX_OK) &&
+    (pvt->fix_type == UBX_FIX_2D || pvt->fix_type == UBX_FIX_3D || pvt->fix_type == UBX_FIX_GNSS_DEAD_RECKONING);
+}
+
+// days since 1970-01-01 of a date (proleptic Gregorian)
+static int32_t days_from_civil(int32_t y, uint32_t m, uint32_t d)
+{
+  y -= m <= 2;
+  int32_t era = (y >= 0 ? y : y - 399) / 400;
+  uint32_t yoe = (uint32_t) (y - era * 400);
+  uint32_t doy = (153 * (m > 2 ? m - 3 : m + 9) + 2) / 5 + d - 1;
+  uint32_t doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+  return era * 146097 + (int32_t) doe - 719468;
+}
+
+uint32_t ubx_nav_pvt_unix_time(const struct ubx_nav_pvt *pvt, uint32_t *usec)
+{
+  const uint8_t known = UBX_PVT_VALID_DATE | UBX_PVT_VALID_TIME | UBX_PVT_FULLY_RESOLVED;
+  int64_t t;
+  int32_t ns = pvt->nano;
+
+  if ((pvt->valid & known) != known || pvt->year < 1970 || pvt->month < 1 || pvt->month > 12)
+    return 0;
+  t = (int64_t) days_from_civil(pvt->year, pvt->month, pvt->day) * 86400 + pvt->hour * 3600 + pvt->min * 60 + pvt->sec;
+  if (ns < 0) {
+    t--;
+    ns += 1000000000;
+  }
+  *usec = ns / 1000;
+  return (uint32_t) t;
+}
+
+// ddmm.mmmmm,N
+static int nmea_coord(char *buf, size_t len, int32_t v, int deg_digits, char pos, char neg)
+{
+  uint32_t a = v < 0 ? -(int64_t) v : v;
+  uint32_t deg = a / 10000000;
+  // minutes * 100000
+  uint32_t min = (uint32_t) ((uint64_t) (a % 10000000) * 60 / 100);
+
+  return snprintf(buf, len, "%0*lu%02lu.%05lu,%c", deg_digits, (unsigned long) deg,
+    (unsigned long) (min / 100000), (unsigned long) (min % 100000), v < 0 ? neg : pos);
+}
+
+size_t ubx_nav_pvt_to_nmea(const struct ubx_nav_pvt *pvt, char *buf, size_t len)
+{
+  char tm[12] = "";
+  char date[8] = "";
+  char lat[16];
+  char lon[16];
+  char line[NMEA_LINE_MAX + 1];
+  bool fix = ubx_nav_pvt_has_fix(pvt);
+  size_t pos = 0;
+  size_t n;
+  int k;
+
+  if (pvt->valid & UBX_PVT_VALID_TIME) {
+    // nano < 0: the fix was before hh:mm:ss. Not carried into the date at midnight
+    int32_t sod = pvt->hour * 3600 + pvt->min * 60 + pvt->sec;
+    int32_t ns = pvt->nano;
+    if (ns < 0) {
+      ns += 1000000000;
+      sod = (sod + 86399) % 86400;
+    }
+    // fields bounded, so the compiler sees they fit
+    snprintf(tm, sizeof(tm), "%02u%02u%02u.%02u", (unsigned) sod / 3600 % 24, (unsigned) sod / 60 % 60, (unsigned) sod % 60, (unsigned) ns / 10000000 % 100);
+  }
+  if (pvt->valid & UBX_PVT_VALID_DATE)
+    snprintf(date, sizeof(date), "%02u%02u%02u", pvt->day % 100u, pvt->month % 100u, pvt->year % 100u);
+  if (fix) {
+    nmea_coord(lat, sizeof(lat), pvt->lat, 2, 'N', 'S');
+    nmea_coord(lon, sizeof(lon), pvt->lon, 3, 'E', 'W');
+  } else {
+    strcpy(lat, ",");
+    strcpy(lon, ",");
+  }
+
+  // knots * 1000, degree * 100
+  uint32_t knots = pvt->g_speed > 0 ? (uint32_t) ((uint64_t) pvt->g_speed * 1943844 / 1000000) : 0;
+  uint32_t course = pvt->head_mot > 0 ? pvt->head_mot / 1000 : 0;
+  if (fix)
+    k = snprintf(line, sizeof(line), "$GPRMC,%s,A,%s,%s,%lu.%03lu,%lu.%02lu,%s,,,%c", tm, lat, lon,
+      (unsigned long) (knots / 1000), (unsigned long) (knots % 1000), (unsigned long) (course / 100), (unsigned long) (course % 100),
+      date, pvt->fix_type == UBX_FIX_GNSS_DEAD_RECKONING ? 'E' : 'A');
+  else
+    k = snprintf(line, sizeof(line), "$GPRMC,%s,V,,,,,,,%s,,,N", tm, date);
+  if (k < 0 || (size_t) k >= sizeof(line) || !(n = nmea_sentence_finish(line, k, sizeof(line))) || pos + n >= len)
+    return 0;
+  memcpy(buf + pos, line, n + 1);
+  pos += n;
+
+  // no HDOP in NAV-PVT: PDOP, which is never smaller. Geoid separation from the two heights
+  if (fix) {
+    int32_t sep = (pvt->height - pvt->h_msl) / 100;
+    int32_t alt = pvt->h_msl / 100;
+    k = snprintf(line, sizeof(line), "$GPGGA,%s,%s,%s,1,%02u,%u.%02u,%s%ld.%ld,M,%s%ld.%ld,M,,", tm, lat, lon,
+      pvt->num_sv, pvt->p_dop / 100, pvt->p_dop % 100,
+      alt < 0 ? "-" : "", (long) (alt < 0 ? -alt : alt) / 10, (long) (alt < 0 ? -alt : alt) % 10,
+      sep < 0 ? "-" : "", (long) (sep < 0 ? -sep : sep) / 10, (long) (sep < 0 ? -sep : sep) % 10);
+  } else {
+    k = snprintf(line, sizeof(line), "$GPGGA,%s,,,,,0,%02u,,,,,,,", tm, pvt->num_sv);
+  }
+  if (k < 0 || (size_t) k >= sizeof(line) || !(n = nmea_sentence_finish(line, k, sizeof(line))) || pos + n >= len)
+    return 0;
+  memcpy(buf + pos, line, n + 1);
+  pos += n;
+  return pos;
+}
@@ -0,0 +1,100 @@
+#ifndef UBX_NAV_PVT_H
+#define UBX_NAV_PVT_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+/*
+ * u-blox UBX-NAV-PVT: position, velocity and time of a fix in one binary
+ * message, instead of six NMEA sentences.
+ *
+ * The reader picks NAV-PVT frames out of the UART byte stream and checks
+ * their checksum; any other UBX frame (ACK, NAK) is skipped. A fix can be
+ * turned into an RMC and a GGA sentence, for TinyGPS++ and the NMEA TCP
+ * clients.
+ *
+ * NAV-PVT needs UBX protocol 14 or newer (u-blox 7/M8). A NEO-6 does not
+ * send it.
+ */
+
+#define UBX_NAV_PVT_LEN 92          // protocol 15+. 14: 84, without head_veh, mag_dec, mag_acc
+#define UBX_NAV_PVT_LEN_MIN 84
+
+// ubx_nav_pvt.valid
+#define UBX_PVT_VALID_DATE 0x01
+#define UBX_PVT_VALID_TIME 0x02
+#define UBX_PVT_FULLY_RESOLVED 0x04
+
+// ubx_nav_pvt.fix_type
+#define UBX_FIX_NONE 0
+#define UBX_FIX_DEAD_RECKONING 1
+#define UBX_FIX_2D 2
+#define UBX_FIX_3D 3
+#define UBX_FIX_GNSS_DEAD_RECKONING 4
+#define UBX_FIX_TIME_ONLY 5
+
+// ubx_nav_pvt.flags
+#define UBX_PVT_GNSS_FIX_OK 0x01
+
+struct ubx_nav_pvt {
+  uint32_t itow;                    // ms, GPS time of week of the fix
+  uint16_t year;                    // UTC
+  uint8_t month;
+  uint8_t day;
+  uint8_t hour;
+  uint8_t min;
+  uint8_t sec;
+  uint8_t valid;                    // UBX_PVT_VALID_*
+  uint32_t t_acc;                   // ns
+  int32_t nano;                     // ns, -1e9..1e9, added to the time above
+  uint8_t fix_type;                 // UBX_FIX_*
+  uint8_t flags;                    // UBX_PVT_GNSS_FIX_OK
+  uint8_t num_sv;
+  int32_t lon;                      // 1e-7 degree
+  int32_t lat;
+  int32_t height;                   // mm above the ellipsoid
+  int32_t h_msl;                    // mm above mean sea level
+  uint32_t h_acc;                   // mm
+  uint32_t v_acc;
+  int32_t g_speed;                  // mm/s, over ground
+  int32_t head_mot;                 // 1e-5 degree, heading of motion
+  uint16_t p_dop;                   // 0.01
+};
+
+struct ubx_reader {
+  uint8_t state;
+  uint8_t msg_class;
+  uint8_t msg_id;
+  uint16_t len;
+  uint16_t pos;
+  uint8_t ck_a;
+  uint8_t ck_b;
+  uint8_t payload[UBX_NAV_PVT_LEN];
+  uint32_t invalid;                 // frames with a bad checksum
+};
+
+void ubx_reader_init(struct ubx_reader *r);
+
+/**
+ * Next byte from the GPS. Returns true if it completes a valid NAV-PVT, which is then copied to pvt.
+ */
+bool ubx_reader_feed(struct ubx_reader *r, uint8_t c, struct ubx_nav_pvt *pvt);
+
+/**
+ * 2D or 3D fix, GNSS fix OK
+ */
+bool ubx_nav_pvt_has_fix(const struct ubx_nav_pvt *pvt);
+
+/**
+ * Seconds since 1970 (UTC) of the fix. 0 if date and time are not known yet.
+ * @param usec microseconds to add
+ */
+uint32_t ubx_nav_pvt_unix_time(const struct ubx_nav_pvt *pvt, uint32_t *usec);
+
+/**
+ * RMC and GGA sentence of the fix, each ending in CR LF. Returns the length, or 0 if buf is too small.
+ */
+size_t ubx_nav_pvt_to_nmea(const struct ubx_nav_pvt *pvt, char *buf, size_t len);
+
+#endif //UBX_NAV_PVT_H
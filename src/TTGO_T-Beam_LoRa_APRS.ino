@@ -25,12 +25,18 @@
 #include "version.h"
 #include "preference_storage.h"
 #include "syslog_log.h"
+#include <Digipeater.h>
+#include <HeardStations.h>
+#include <PipelineProfile.h>
+#include <SmartBeacon.h>
+#include "metrics.h"
 
 #ifdef KISS_PROTOCOL
   #include "taskTNC.h"
 #endif
 #ifdef ENABLE_WIFI
   #include "taskWebServer.h"
+  #include "taskAPRSIS.h"
 #endif
 
 // oled address
@@ -123,6 +129,7 @@ String aprsis_filter = "";
 String aprsis_callsign = "";
 String aprsis_password = "-1";
 uint8_t aprsis_data_allow_inet_to_rf = 2;  // 0: disable. 1: gate to main qrg. 2: gate to secondary qrg. 3: gate to both frequencies
+String aprsis_rf_filter = "";  // local filter for gating to RF (see lib/AprsFilter). Empty: gate everything
 #endif
 
 // Variables for APRS packaging
@@ -183,6 +190,12 @@ boolean showAltitudeInsideCompressedPosition = true;
 #else
   boolean enable_bluetooth = false;
 #endif
+// listen first, no init screens; bluetooth and WiFi start in the background
+#ifdef FAST_BOOT
+  boolean fast_boot = true;
+#else
+  boolean fast_boot = false;
+#endif
 #if defined(ENABLE_WIFI)
   uint8_t enable_webserver = 2;
   boolean webserverStarted = 0;
@@ -245,11 +258,9 @@ int sb_turn_slope = 26;			// kenwood example: 26 in mph. Yaesu suggests 26 in hi
 					// TS 7 if <= 20km/h, TS 11 if <= 50km/h, TS 26 else.
 int sb_turn_time = 30;			// min. 30s between transmissions (kenwood example)
 
-float average_speed[5] = {0,0,0,0,0}, average_speed_final=0;
-float old_course = 0, new_course = 0;
-int point_avg_speed = 0, point_avg_course = 0;
-
-ulong nextTX=60000L;                  // preset time period between TX = 60000ms = 60secs = 1min
+struct sb_params smart_beacon_params;  // the sb_* settings above
+struct sb_state smart_beacon;          // next_tx: ms after lastTX the next beacon is due
+uint32_t sb_fix_time = 0;              // gps.time (hhmmss) of the last fix fed to smart_beacon
 
 ulong time_to_refresh = 0;
 ulong next_fixed_beacon = 0;
@@ -281,10 +292,6 @@ String infoApName = "";
 String infoApPass = "";
 String infoApAddr = "";
 
-#define ANGLE_AVGS 3                  // angle averaging - x times
-float average_course[ANGLE_AVGS];
-float avg_c_y, avg_c_x;
-
 #ifdef RXDISABLE		// define RXDISABLE if you don't like to receive packets. Saves power consumption
 boolean lora_rx_enabled = false;
 #else
@@ -316,6 +323,9 @@ boolean lora_automatic_cr_adaption = false;	// automatic CR adaption
 						// This may become set to true by default, after it proves it behaves good to our network
 uint8_t lora_digipeating_mode = 1;		// Digipeating: 0: disabled (recommended if the device should not do repeating decisions, and even more, if you have attached a normal aprs digipeating software via kiss). 1: if own call addressed (recommended for users) 2: act as WIDE1 fill-in digi (recommended for standalone fill-in-digi). 3: act as a simple stupid WIDE2 digi
 uint8_t lora_cross_digipeating_mode = 0;	// 0: disable cross freq digipeating. 1: send on both frequencies. 2: send only on cross frequency
+String lora_digipeating_rules = "";		// Digipeater rules (see lib/Digipeater). Empty: derived from lora_digipeating_mode
+struct digi_rules digi_rules_tables[2];		// compiled rules. Active one is swapped on config save
+struct digi_rules *digi_rules_active = &digi_rules_tables[0];
 #define FLAG_ADD_SNR_RSSI_FOR_RF     1
 #define FLAG_ADD_SNR_RSSI_FOR_KISS   2
 #define FLAG_ADD_SNR_RSSI_FOR_APRSIS 4
@@ -329,6 +339,12 @@ boolean tx_own_beacon_from_this_device_or_fromKiss__to_aprsis = true;	// TX own
 int rx_on_frequencies = 1;			// RX freq. Only if lora_digipeating_mode < 2 (we are a user) 1: main freq. 2: cross_digi_freq. 3: both frequencies
 
 bool acceptOwnPositionReportsViaKiss = true;		// true: Switches off local beacons as long as a kiss device is sending positions with our local callsign. false: filters out position packets with own callsign coming from kiss (-> do not send to LoRa).
+boolean gps_ubx_pvt = false;			// u-blox 7/M8: UBX NAV-PVT instead of NMEA on the UART. Less to send and to parse, exact time of the fix
+uint8_t gps_ubx_rate = 1;			// NAV-PVT fixes per second
+#define GPS_POWER_MOVING_KMH 3
+boolean gps_power_save = false;			// GPS sleeps between beacons, woken in time for a fix
+volatile uint32_t gps_beacon_due = 0;		// for taskGPS: next beacon needing a fix (millis()). 0: none planned
+volatile bool gps_keep_on = true;		// for taskGPS: GPS needed continuously
 boolean gps_allow_sleep_while_kiss = true;		// user has a kiss device attached via kiss which sends positions with own call, we don't need our gps to be turned on -> We pause sending positions by ourself (neither fixed nor smart beaconing). Except: user has a display attached to this tracker, he'll will be able to see his position because our gps does not go to sleep (-> set this to false). Why sleep? Energy saving
 
 #ifdef KISS_PROTOCOL
@@ -349,8 +365,7 @@ uint32_t time_lora_automaic_cr_adoption_rx_measurement_window = 0L;
 uint16_t lora_automaic_cr_adoption_rf_transmissions_heard_in_timeslot = 0;
 uint16_t lora_packets_received_in_timeslot_on_main_freq = 0;
 uint16_t lora_packets_received_in_timeslot_on_secondary_freq = 0;
-char lora_TXBUFF_for_digipeating[BG_RF95_MAX_MESSAGE_LEN+1] = "";		// buffer for digipeating
-time_t time_lora_TXBUFF_for_digipeating_was_filled = 0L;
+struct digi_queue lora_digi_queue;		// buffer for digipeating
 boolean sendpacket_was_called_twice = false;
 uint32_t t_last_smart_beacon_sent = 0L;
 
@@ -358,7 +373,6 @@ String MY_APRS_DEST_IDENTIFYER = "APLOX1";
 
 #ifdef ENABLE_WIFI
   tWebServerCfg webServerCfg;
-  String to_aprsis_data = "";
 #endif
 
 static const adc_atten_t atten = ADC_ATTEN_DB_6;
@@ -580,9 +594,21 @@ void lora_set_speed(ulong lora_speed) {
 }
 
 #if defined(ENABLE_WIFI)
-void send_to_aprsis(String s)
+// t_rx_us: micros() when the frame was received, for the upload latency
+void send_to_aprsis(String s, uint32_t t_rx_us)
 {
-  to_aprsis_data = s;
+  PROFILE_BEGIN(t_profile);
+  if (aprsisUplinkQueue && aprsis_enabled) {
+    tAprsisUplinkFrame buffer = { new String(s), t_rx_us };
+    // don't block loop(): if taskAPRSIS is behind, drop the frame
+    if (xQueueSend(aprsisUplinkQueue, &buffer, 0) != pdPASS) {
+      delete buffer.frame;
+      aprsisUplinkStats.dropped_full++;
+    } else {
+      aprsisUplinkStats.queued++;
+    }
+  }
+  PROFILE_END(PROFILE_APRSIS, t_profile);
   return;
 }
 #endif
@@ -598,13 +624,13 @@ void sendpacket(boolean force_fixed){
   prepareAPRSFrame(force_fixed);
   if (lora_tx_enabled && tx_own_beacon_from_this_device_or_fromKiss__to_frequencies) {
     if (tx_own_beacon_from_this_device_or_fromKiss__to_frequencies % 2)
-      loraSend(txPower, lora_freq, lora_speed, outString);  //send the packet, data is in TXbuff from lora_TXStart to lora_TXEnd
+      loraSend(txPower, lora_freq, lora_speed, outString, "TX");  //send the packet, data is in TXbuff from lora_TXStart to lora_TXEnd
     if (tx_own_beacon_from_this_device_or_fromKiss__to_frequencies > 1 && lora_digipeating_mode > 1 && lora_freq_cross_digi > 1.0 && lora_freq_cross_digi != lora_freq)
-      loraSend(txPower_cross_digi, lora_freq_cross_digi, lora_speed_cross_digi, outString);  //send the packet, data is in TXbuff from lora_TXStart to lora_TXEnd
+      loraSend(txPower_cross_digi, lora_freq_cross_digi, lora_speed_cross_digi, outString, "TX");  //send the packet, data is in TXbuff from lora_TXStart to lora_TXEnd
   }
 #if defined(ENABLE_WIFI)
   if (tx_own_beacon_from_this_device_or_fromKiss__to_aprsis)
-    send_to_aprsis(outString);
+    send_to_aprsis(outString, micros());
 #endif
   sendpacket_was_called_twice = true;
 }
@@ -615,8 +641,9 @@ void sendpacket(boolean force_fixed){
  * @param lora_FREQ
  * @param lora_SPEED
  * @param message
+ * @param kind what it is, for the live frames of the web interface and /metrics: "TX" (own), "KISS", "digi", "IS" (gated from APRS-IS)
  */
-void loraSend(byte lora_LTXPower, float lora_FREQ, ulong lora_SPEED, const String &message) {
+void loraSend(byte lora_LTXPower, float lora_FREQ, ulong lora_SPEED, const String &message, const char *kind) {
   if (!lora_tx_enabled)
     return;
 #ifdef T_BEAM_V1_0
@@ -643,11 +670,14 @@ void loraSend(byte lora_LTXPower, float lora_FREQ, ulong lora_SPEED, const Strin
   if (lora_speed  == 610) wait_for_signal = 250;
   else if (lora_speed  == 1200) wait_for_signal = 125;
 
+  PROFILE_BEGIN_US(t_profile_csma);
   randomSeed(millis());
   int n;
+  uint32_t busy = 0;
   for (n = 0; n < 30; n++) {
     delay(wait_for_signal);
     if (rf95.SignalDetected()) {
+      busy++;
       continue;
     }
     delay(100);
@@ -659,9 +689,25 @@ void loraSend(byte lora_LTXPower, float lora_FREQ, ulong lora_SPEED, const Strin
   #ifdef ENABLE_LED_SIGNALING
     digitalWrite(TXLED, LOW);
   #endif
+  PROFILE_SINCE_US(PROFILE_CSMA, t_profile_csma);
   lastTX = millis();
+  PROFILE_BEGIN_US(t_profile_airtime);
+  uint32_t t_airtime = millis();
   rf95.sendAPRS(lora_TXBUFF, messageSize);
   rf95.waitPacketSent();
+  PROFILE_SINCE_US(PROFILE_AIRTIME, t_profile_airtime);
+  t_airtime = millis() - t_airtime;
+  portENTER_CRITICAL(&metrics_mux);
+  metrics.tx_frames[metrics_tx_kind(kind)]++;
+  metrics.csma_slots += (n < 30) ? n + 1 : n;
+  metrics.csma_busy += busy;
+  if (n == 30)
+    metrics.csma_gave_up++;
+  metrics.airtime_ms += t_airtime;
+  portEXIT_CRITICAL(&metrics_mux);
+#if defined(ENABLE_WIFI)
+  web_event_frame(kind, message, 0, 0, lora_FREQ);
+#endif
   #ifdef ENABLE_LED_SIGNALING
     digitalWrite(TXLED, HIGH);
   #endif
@@ -735,6 +781,12 @@ void writedisplaytext(String HeaderTxt, String Line1, String Line2, String Line3
   time_to_refresh = millis() + showRXTime;
 }
 
+// progress screens of the init. None in fast boot: each one is a refresh of the whole display
+void writeinittext(String HeaderTxt, String Line1, String Line2, String Line3, String Line4, String Line5) {
+  if (!fast_boot)
+    writedisplaytext(HeaderTxt, Line1, Line2, Line3, Line4, Line5);
+}
+
 String getSatAndBatInfo() {
   String line5;
   if(gps_state == true){
@@ -785,6 +837,7 @@ void sendToTNC(const String& TNC2FormatedFrame) {
     if (xQueueSend(tncReceivedQueue, &buffer, (1000 / portTICK_PERIOD_MS)) != pdPASS){
       // remove buffer on error
       delete buffer;
+      metrics.kiss_out_dropped++;
     }
   }
 }
@@ -795,6 +848,7 @@ void sendToTNC(const String& TNC2FormatedFrame) {
  * @param TNC2FormatedFrame
  */
 void sendToWebList(const String& TNC2FormatedFrame, const int RSSI, const int SNR) {
+  PROFILE_BEGIN(t_profile);
   if (webListReceivedQueue){
     auto *receivedPacketData = new tReceivedPacketData();
     receivedPacketData->packet = new String();
@@ -807,8 +861,10 @@ void sendToWebList(const String& TNC2FormatedFrame, const int RSSI, const int SN
       // remove buffer on error
       delete receivedPacketData->packet;
       delete receivedPacketData;
+      metrics.weblist_dropped++;
     }
   }
+  PROFILE_END(PROFILE_WEBLIST, t_profile);
 }
 #endif
 
@@ -893,8 +949,492 @@ String prepareCallsign(const String& callsign){
 #endif
 
 
+// needs Tcall. Broken rules from storage: fall back to rules derived from lora_digipeating_mode
+void digipeater_rules_load(){
+  char err[80];
+
+  if (digipeater_rules_set(lora_digipeating_rules.c_str(), err, sizeof(err)) < 0) {
+    Serial.printf("Digipeater rules: %s. Using defaults for mode %d\n", err, lora_digipeating_mode);
+    digipeater_rules_set("", err, sizeof(err));
+  }
+}
+
+void lora_apply_rx_settings(){
+  // if we are fill-in or wide2 digi, we listen only on configured main frequency
+  lora_speed_rx_curr = (rx_on_frequencies  != 2 || lora_digipeating_mode > 1) ? lora_speed : lora_speed_cross_digi;
+  lora_set_speed(lora_speed_rx_curr);
+  Serial.printf("LoRa Speed:\t%lu\n", lora_speed_rx_curr);
+  
+  lora_freq_rx_curr = (rx_on_frequencies  != 2 || lora_digipeating_mode > 1) ? lora_freq : lora_freq_cross_digi;
+  rf95.setFrequency(lora_freq_rx_curr);
+  Serial.printf("LoRa FREQ:\t%f\n", lora_freq_rx_curr);
+
+  // we tx on main and/or secondary frequency. For tx, loraSend is called (and always has desired txpower as argument)
+  rf95.setTxPower((lora_digipeating_mode < 2 || lora_cross_digipeating_mode < 1) ? txPower : txPower_cross_digi);
+}
+
+// position and symbol as the beacon needs them, whatever is stored
+void position_presets_normalize(){
+  // We have stored the manual position strring in a higher precision (in case resolution more precise than 18.52m is required; i.e. for base-91 location encoding, or DAO extenstion).
+  // Furthermore, 53-32.1234N is more readable in the Web-interface than 5232.1234N
+  aprsLatPreset.toUpperCase(); aprsLatPreset.replace(",", "."); aprsLatPreset.trim();
+  if (aprsLatPreset.length() == 11 && aprsLatPreset.indexOf('-') == 2 && aprsLatPreset.indexOf(' ') == -1 && (aprsLatPreset.endsWith("N") || aprsLatPreset.endsWith("S"))) {
+    char buf[9];
+    const char *p = aprsLatPreset.c_str();
+    sprintf(buf, "%.2s%.5s%c", p, p+3, p[10]);
+    aprsLatPreset = String(buf);
+  }
+
+  // 001-20.5000E is more readable in the Web-interface than 00120.5000E, and could not be mis-interpreted as 120.5 degrees east  (== 120 deg 30' 0" E)
+  aprsLonPreset.toUpperCase(); aprsLonPreset.replace(",", "."); aprsLonPreset.trim();
+  if (aprsLonPreset.length() == 12 && aprsLonPreset.indexOf('-') == 3 && aprsLonPreset.indexOf(' ') == -1 && (aprsLonPreset.endsWith("E") || aprsLonPreset.endsWith("W"))) {
+    char buf[10];
+    const char *p = aprsLonPreset.c_str();
+    sprintf(buf, "%.3s%.5s%c", p, p+4, p[11]);
+    aprsLonPreset = String(buf);
+  }
+
+  // enforce valid transmissions even on wrong configurations
+  if (aprsSymbolTable.length() != 1)
+    aprsSymbolTable = String("/");
+  if (aprsSymbol.length() != 1)
+    aprsSymbol = String("[");
+  if (aprsLatPreset.length() != 8 || !(aprsLatPreset.endsWith("N") || aprsLatPreset.endsWith("S")) || aprsLatPreset.c_str()[4] != '.')
+    aprsLatPreset = String("0000.00N");
+  if (aprsLonPreset.length() != 9 || !(aprsLonPreset.endsWith("E") || aprsLonPreset.endsWith("W")) || aprsLonPreset.c_str()[5] != '.')
+    aprsLonPreset = String("00000.00E");
+}
+
+#ifdef ENABLE_PREFERENCES
+// LoRa, digipeater and beacon settings. At boot, and again when changed in the web interface (see apply_settings())
+void load_lora_and_aprs_settings(){
+  if (!preferences.getBool(PREF_LORA_FREQ_PRESET_INIT)){
+    preferences.putBool(PREF_LORA_FREQ_PRESET_INIT, true);
+    preferences.putDouble(PREF_LORA_FREQ_PRESET, lora_freq);
+  }
+  lora_freq = preferences.getDouble(PREF_LORA_FREQ_PRESET);
+  
+  if (!preferences.getBool(PREF_LORA_SPEED_PRESET_INIT)){
+    preferences.putBool(PREF_LORA_SPEED_PRESET_INIT, true);
+    preferences.putInt(PREF_LORA_SPEED_PRESET, lora_speed);
+  }
+  lora_speed = preferences.getInt(PREF_LORA_SPEED_PRESET);
+
+  if (!preferences.getBool(PREF_LORA_RX_ENABLE_INIT)){
+    preferences.putBool(PREF_LORA_RX_ENABLE_INIT, true);
+    preferences.putBool(PREF_LORA_RX_ENABLE, lora_rx_enabled);
+  }
+  lora_rx_enabled = preferences.getBool(PREF_LORA_RX_ENABLE);
+
+  if (!preferences.getBool(PREF_LORA_TX_ENABLE_INIT)){
+    preferences.putBool(PREF_LORA_TX_ENABLE_INIT, true);
+    preferences.putBool(PREF_LORA_TX_ENABLE, lora_tx_enabled);
+  }
+  lora_tx_enabled = preferences.getBool(PREF_LORA_TX_ENABLE);
+
+  if (!preferences.getBool(PREF_LORA_TX_POWER_INIT)){
+    preferences.putBool(PREF_LORA_TX_POWER_INIT, true);
+    preferences.putInt(PREF_LORA_TX_POWER, txPower);
+  }
+  txPower = lora_tx_enabled ? preferences.getInt(PREF_LORA_TX_POWER) : 0;
+
+  if (!preferences.getBool(PREF_LORA_AUTOMATIC_CR_ADAPTION_PRESET_INIT)){
+    preferences.putBool(PREF_LORA_AUTOMATIC_CR_ADAPTION_PRESET_INIT, true);
+    preferences.putBool(PREF_LORA_AUTOMATIC_CR_ADAPTION_PRESET, lora_automatic_cr_adaption);
+  }
+  lora_automatic_cr_adaption = preferences.getBool(PREF_LORA_AUTOMATIC_CR_ADAPTION_PRESET);
+
+  if (!preferences.getBool(PREF_LORA_ADD_SNR_RSSI_TO_PATH_PRESET_INIT)){
+    preferences.putBool(PREF_LORA_ADD_SNR_RSSI_TO_PATH_PRESET_INIT, true);
+    preferences.putInt(PREF_LORA_ADD_SNR_RSSI_TO_PATH_PRESET, lora_add_snr_rssi_to_path);
+  }
+  lora_add_snr_rssi_to_path = preferences.getInt(PREF_LORA_ADD_SNR_RSSI_TO_PATH_PRESET);
+
+  if (!preferences.getBool(PREF_LORA_ADD_SNR_RSSI_TO_PATH_END_AT_KISS_PRESET_INIT)){
+    preferences.putBool(PREF_LORA_ADD_SNR_RSSI_TO_PATH_END_AT_KISS_PRESET_INIT, true);
+    preferences.putBool(PREF_LORA_ADD_SNR_RSSI_TO_PATH_END_AT_KISS_PRESET, kiss_add_snr_rssi_to_path_at_position_without_digippeated_flag);
+  }
+  kiss_add_snr_rssi_to_path_at_position_without_digippeated_flag = preferences.getBool(PREF_LORA_ADD_SNR_RSSI_TO_PATH_END_AT_KISS_PRESET);
+
+  if (!preferences.getBool(PREF_APRS_DIGIPEATING_MODE_PRESET_INIT)){
+    preferences.putBool(PREF_APRS_DIGIPEATING_MODE_PRESET_INIT, true);
+    preferences.putInt(PREF_APRS_DIGIPEATING_MODE_PRESET, lora_digipeating_mode);
+  }
+  lora_digipeating_mode = preferences.getInt(PREF_APRS_DIGIPEATING_MODE_PRESET);
+
+  if (!preferences.getBool(PREF_APRS_CROSS_DIGIPEATING_MODE_PRESET_INIT)){
+    preferences.putBool(PREF_APRS_CROSS_DIGIPEATING_MODE_PRESET_INIT, true);
+    preferences.putInt(PREF_APRS_CROSS_DIGIPEATING_MODE_PRESET, lora_cross_digipeating_mode);
+  }
+  lora_cross_digipeating_mode = preferences.getInt(PREF_APRS_CROSS_DIGIPEATING_MODE_PRESET);
+
+  if (!preferences.getBool(PREF_LORA_TX_BEACON_AND_KISS_TO_FREQUENCIES_PRESET_INIT)){
+    preferences.putBool(PREF_LORA_TX_BEACON_AND_KISS_TO_FREQUENCIES_PRESET_INIT, true);
+    preferences.putInt(PREF_LORA_TX_BEACON_AND_KISS_TO_FREQUENCIES_PRESET, tx_own_beacon_from_this_device_or_fromKiss__to_frequencies);
+  }
+  tx_own_beacon_from_this_device_or_fromKiss__to_frequencies = preferences.getInt(PREF_LORA_TX_BEACON_AND_KISS_TO_FREQUENCIES_PRESET);
+
+  if (!preferences.getBool(PREF_LORA_TX_BEACON_AND_KISS_TO_APRSIS_PRESET_INIT)){
+    preferences.putBool(PREF_LORA_TX_BEACON_AND_KISS_TO_APRSIS_PRESET_INIT, true);
+    preferences.putBool(PREF_LORA_TX_BEACON_AND_KISS_TO_APRSIS_PRESET, tx_own_beacon_from_this_device_or_fromKiss__to_aprsis);
+  }
+  tx_own_beacon_from_this_device_or_fromKiss__to_aprsis = preferences.getBool(PREF_LORA_TX_BEACON_AND_KISS_TO_APRSIS_PRESET);
+
+  if (!preferences.getBool(PREF_LORA_FREQ_CROSSDIGI_PRESET_INIT)){
+    preferences.putBool(PREF_LORA_FREQ_CROSSDIGI_PRESET_INIT, true);
+    preferences.putDouble(PREF_LORA_FREQ_CROSSDIGI_PRESET, lora_freq_cross_digi);
+  }
+  lora_freq_cross_digi = preferences.getDouble(PREF_LORA_FREQ_CROSSDIGI_PRESET);
+  
+  if (!preferences.getBool(PREF_LORA_SPEED_CROSSDIGI_PRESET_INIT)){
+    preferences.putBool(PREF_LORA_SPEED_CROSSDIGI_PRESET_INIT, true);
+    preferences.putInt(PREF_LORA_SPEED_CROSSDIGI_PRESET, lora_speed_cross_digi);
+  }
+  lora_speed_cross_digi = preferences.getInt(PREF_LORA_SPEED_CROSSDIGI_PRESET);
+
+  if (!preferences.getBool(PREF_LORA_TX_POWER_CROSSDIGI_PRESET_INIT)){
+    preferences.putBool(PREF_LORA_TX_POWER_CROSSDIGI_PRESET_INIT, true);
+    preferences.putInt(PREF_LORA_TX_POWER_CROSSDIGI_PRESET, txPower_cross_digi);
+  }
+  txPower_cross_digi = lora_tx_enabled ? preferences.getInt(PREF_LORA_TX_POWER_CROSSDIGI_PRESET) : 0;
+
+  if (!preferences.getBool(PREF_LORA_RX_ON_FREQUENCIES_PRESET_INIT)){
+    preferences.putBool(PREF_LORA_RX_ON_FREQUENCIES_PRESET_INIT, true);
+    preferences.putInt(PREF_LORA_RX_ON_FREQUENCIES_PRESET, rx_on_frequencies);
+  }
+  rx_on_frequencies = preferences.getInt(PREF_LORA_RX_ON_FREQUENCIES_PRESET);
+
+  // APRS station settings
+
+  aprsSymbolTable = preferences.getString(PREF_APRS_SYMBOL_TABLE, "");
+  if (aprsSymbolTable.isEmpty()){
+    preferences.putString(PREF_APRS_SYMBOL_TABLE, APRS_SYMBOL_TABLE);
+    aprsSymbolTable = preferences.getString(PREF_APRS_SYMBOL_TABLE);
+  }
+
+  aprsSymbol = preferences.getString(PREF_APRS_SYMBOL, "");
+  if (aprsSymbol.isEmpty()){
+    preferences.putString(PREF_APRS_SYMBOL, APRS_SYMBOL);
+    aprsSymbol = preferences.getString(PREF_APRS_SYMBOL, APRS_SYMBOL);
+  }
+
+  if (!preferences.getBool(PREF_APRS_COMMENT_INIT)){
+    preferences.putBool(PREF_APRS_COMMENT_INIT, true);
+    preferences.putString(PREF_APRS_COMMENT, MY_COMMENT);
+  }
+  aprsComment = preferences.getString(PREF_APRS_COMMENT, "");
+
+  if (!preferences.getBool(PREF_APRS_RELAY_PATH_INIT)){
+    preferences.putBool(PREF_APRS_RELAY_PATH_INIT, true);
+    preferences.putString(PREF_APRS_RELAY_PATH, DIGI_PATH);
+  }
+  relay_path = preferences.getString(PREF_APRS_RELAY_PATH, "");
+
+  if (!preferences.getBool(PREF_APRS_SHOW_ALTITUDE_INIT)){
+    preferences.putBool(PREF_APRS_SHOW_ALTITUDE_INIT, true);
+    preferences.putBool(PREF_APRS_SHOW_ALTITUDE, showAltitude);
+  }
+  showAltitude = preferences.getBool(PREF_APRS_SHOW_ALTITUDE);
+  if (!preferences.getBool(PREF_APRS_SHOW_ALTITUDE_INSIDE_COMPRESSED_POSITION_INIT)){
+    preferences.putBool(PREF_APRS_SHOW_ALTITUDE_INSIDE_COMPRESSED_POSITION_INIT, true);
+    preferences.putBool(PREF_APRS_SHOW_ALTITUDE_INSIDE_COMPRESSED_POSITION, showAltitudeInsideCompressedPosition);
+  }
+  showAltitudeInsideCompressedPosition = preferences.getBool(PREF_APRS_SHOW_ALTITUDE_INSIDE_COMPRESSED_POSITION);
+  if (!preferences.getBool(PREF_APRS_ALTITUDE_RATIO_INIT)){
+    preferences.putBool(PREF_APRS_ALTITUDE_RATIO_INIT, true);
+    // preferences.putInt(PREF_APRS_ALTITUDE_RATIO, altitude_ratio); // until SHOW_ALTITUDE is obsolete, commented out
+    preferences.putInt(PREF_APRS_ALTITUDE_RATIO, showAltitude ? 100 : 0);
+  }
+  altitude_ratio = preferences.getInt(PREF_APRS_ALTITUDE_RATIO);
+  
+
+  if (!preferences.getBool(PREF_ACCEPT_OWN_POSITION_REPORTS_VIA_KISS_INIT)){
+    preferences.putBool(PREF_ACCEPT_OWN_POSITION_REPORTS_VIA_KISS_INIT, true);
+    preferences.putBool(PREF_ACCEPT_OWN_POSITION_REPORTS_VIA_KISS, acceptOwnPositionReportsViaKiss);
+  }
+  acceptOwnPositionReportsViaKiss = preferences.getBool(PREF_ACCEPT_OWN_POSITION_REPORTS_VIA_KISS);
+
+  if (!preferences.getBool(PREF_GPS_ALLOW_SLEEP_WHILE_KISS_INIT)){
+    preferences.putBool(PREF_GPS_ALLOW_SLEEP_WHILE_KISS_INIT, true);
+    preferences.putBool(PREF_GPS_ALLOW_SLEEP_WHILE_KISS, gps_allow_sleep_while_kiss);
+  }
+  gps_allow_sleep_while_kiss = preferences.getBool(PREF_GPS_ALLOW_SLEEP_WHILE_KISS);
+
+  if (!preferences.getBool(PREF_GPS_UBX_PVT_INIT)){
+    preferences.putBool(PREF_GPS_UBX_PVT_INIT, true);
+    preferences.putBool(PREF_GPS_UBX_PVT, gps_ubx_pvt);
+  }
+  gps_ubx_pvt = preferences.getBool(PREF_GPS_UBX_PVT);
+
+  if (!preferences.getBool(PREF_GPS_UBX_RATE_INIT)){
+    preferences.putBool(PREF_GPS_UBX_RATE_INIT, true);
+    preferences.putInt(PREF_GPS_UBX_RATE, gps_ubx_rate);
+  }
+  gps_ubx_rate = preferences.getInt(PREF_GPS_UBX_RATE);
+  if (gps_ubx_rate < 1 || gps_ubx_rate > 10)
+    gps_ubx_rate = 1;
+
+  if (!preferences.getBool(PREF_GPS_POWER_SAVE_INIT)){
+    preferences.putBool(PREF_GPS_POWER_SAVE_INIT, true);
+    preferences.putBool(PREF_GPS_POWER_SAVE, gps_power_save);
+  }
+  gps_power_save = preferences.getBool(PREF_GPS_POWER_SAVE);
+
+
+  if (!preferences.getBool(PREF_APRS_SHOW_BATTERY_INIT)){
+    preferences.putBool(PREF_APRS_SHOW_BATTERY_INIT, true);
+    preferences.putBool(PREF_APRS_SHOW_BATTERY, showBattery);
+  }
+  showBattery = preferences.getBool(PREF_APRS_SHOW_BATTERY);
+
+  if (!preferences.getBool(PREF_ENABLE_TNC_SELF_TELEMETRY_INIT)){
+    preferences.putBool(PREF_ENABLE_TNC_SELF_TELEMETRY_INIT, true);
+    preferences.putBool(PREF_ENABLE_TNC_SELF_TELEMETRY, enable_tel);
+  }
+  enable_tel = preferences.getBool(PREF_ENABLE_TNC_SELF_TELEMETRY);
+
+  if (!preferences.getBool(PREF_TNC_SELF_TELEMETRY_INTERVAL_INIT)){
+    preferences.putBool(PREF_TNC_SELF_TELEMETRY_INTERVAL_INIT, true);
+    preferences.putInt(PREF_TNC_SELF_TELEMETRY_INTERVAL, tel_interval);
+  }
+  tel_interval = preferences.getInt(PREF_TNC_SELF_TELEMETRY_INTERVAL);
+
+  if (!preferences.getBool(PREF_TNC_SELF_TELEMETRY_MIC_INIT)){
+    preferences.putBool(PREF_TNC_SELF_TELEMETRY_MIC_INIT, true);
+    preferences.putInt(PREF_TNC_SELF_TELEMETRY_MIC, tel_mic);
+  }
+  tel_mic = preferences.getInt(PREF_TNC_SELF_TELEMETRY_MIC);
+
+  if (!preferences.getBool(PREF_TNC_SELF_TELEMETRY_PATH_INIT)){
+    preferences.putBool(PREF_TNC_SELF_TELEMETRY_PATH_INIT, true);
+    preferences.putString(PREF_TNC_SELF_TELEMETRY_PATH, tel_path);
+  }
+  tel_path = preferences.getString(PREF_TNC_SELF_TELEMETRY_PATH, "");
+
+  if (!preferences.getBool(PREF_APRS_LATITUDE_PRESET_INIT)){
+    preferences.putBool(PREF_APRS_LATITUDE_PRESET_INIT, true);
+    preferences.putString(PREF_APRS_LATITUDE_PRESET, LATITUDE_PRESET);
+  }
+  aprsLatPreset = preferences.getString(PREF_APRS_LATITUDE_PRESET, "");
+  LatShownP = aprsLonPreset;
+
+  if (!preferences.getBool(PREF_APRS_LONGITUDE_PRESET_INIT)){
+    preferences.putBool(PREF_APRS_LONGITUDE_PRESET_INIT, true);
+    preferences.putString(PREF_APRS_LONGITUDE_PRESET, LONGITUDE_PRESET);
+  }
+  aprsLonPreset = preferences.getString(PREF_APRS_LONGITUDE_PRESET, "");
+  LongShownP = aprsLonPreset;
+
+  if (!preferences.getBool(PREF_APRS_SENDER_BLACKLIST_INIT)){
+    preferences.putBool(PREF_APRS_SENDER_BLACKLIST_INIT, true);
+    preferences.putString(PREF_APRS_SENDER_BLACKLIST, "");
+  }
+  { String s = preferences.getString(PREF_APRS_SENDER_BLACKLIST, "");
+    s.toUpperCase(); s.trim(); s.replace(" ", ","); s.replace(",,", ",");
+    if (!s.isEmpty() && s != "," && s.length() < sizeof(blacklist_calls)-3) {
+      *blacklist_calls = ',';
+      strcpy(blacklist_calls+1, s.c_str());
+      strcat(blacklist_calls, ",");
+    } else {
+      *blacklist_calls = 0;
+    }
+  }
+
+  if (!preferences.getBool(PREF_APRS_FIXED_BEACON_PRESET_INIT)){
+    preferences.putBool(PREF_APRS_FIXED_BEACON_PRESET_INIT, true);
+    preferences.putBool(PREF_APRS_FIXED_BEACON_PRESET, fixed_beacon_enabled);
+  }
+  fixed_beacon_enabled = preferences.getBool(PREF_APRS_FIXED_BEACON_PRESET);
+
+  if (!preferences.getBool(PREF_APRS_FIXED_BEACON_INTERVAL_PRESET_INIT)){
+    preferences.putBool(PREF_APRS_FIXED_BEACON_INTERVAL_PRESET_INIT, true);
+    preferences.putInt(PREF_APRS_FIXED_BEACON_INTERVAL_PRESET, fix_beacon_interval/1000);
+  }
+  fix_beacon_interval = preferences.getInt(PREF_APRS_FIXED_BEACON_INTERVAL_PRESET) * 1000;
+
+// + SMART BEACONING
+
+  if (!preferences.getBool(PREF_APRS_SB_MIN_INTERVAL_PRESET_INIT)){
+    preferences.putBool(PREF_APRS_SB_MIN_INTERVAL_PRESET_INIT, true);
+    preferences.putInt(PREF_APRS_SB_MIN_INTERVAL_PRESET, sb_min_interval/1000);
+  }
+  sb_min_interval = preferences.getInt(PREF_APRS_SB_MIN_INTERVAL_PRESET) * 1000;
+  if (sb_min_interval < 10000) sb_min_interval = 10000;
+
+  if (!preferences.getBool(PREF_APRS_SB_MAX_INTERVAL_PRESET_INIT)){
+    preferences.putBool(PREF_APRS_SB_MAX_INTERVAL_PRESET_INIT, true);
+    preferences.putInt(PREF_APRS_SB_MAX_INTERVAL_PRESET, sb_max_interval/1000);
+  }
+  sb_max_interval = preferences.getInt(PREF_APRS_SB_MAX_INTERVAL_PRESET) * 1000;
+  if (sb_max_interval <= sb_min_interval) sb_max_interval = sb_min_interval + 1000;
+
+  if (!preferences.getBool(PREF_APRS_SB_MIN_SPEED_PRESET_INIT)){
+    preferences.putBool(PREF_APRS_SB_MIN_SPEED_PRESET_INIT, true);
+    preferences.putInt(PREF_APRS_SB_MIN_SPEED_PRESET, sb_min_speed);
+  }
+  sb_min_speed = (float) preferences.getInt(PREF_APRS_SB_MIN_SPEED_PRESET);
+  if (sb_min_speed < 0) sb_min_speed = 0;
+
+  if (!preferences.getBool(PREF_APRS_SB_MAX_SPEED_PRESET_INIT)){
+    preferences.putBool(PREF_APRS_SB_MAX_SPEED_PRESET_INIT, true);
+    preferences.putInt(PREF_APRS_SB_MAX_SPEED_PRESET, sb_max_speed);
+  }
+  sb_max_speed = (float ) preferences.getInt(PREF_APRS_SB_MAX_SPEED_PRESET);
+  if (sb_max_speed <= sb_min_speed) sb_max_speed = sb_min_speed +1;
+
+  if (!preferences.getBool(PREF_APRS_SB_ANGLE_PRESET_INIT)){
+    preferences.putBool(PREF_APRS_SB_ANGLE_PRESET_INIT, true);
+    preferences.putDouble(PREF_APRS_SB_ANGLE_PRESET, sb_angle);
+  }
+  sb_angle = preferences.getDouble(PREF_APRS_SB_ANGLE_PRESET);
+
+  if (!preferences.getBool(PREF_APRS_SB_TURN_SLOPE_PRESET_INIT)){
+    preferences.putBool(PREF_APRS_SB_TURN_SLOPE_PRESET_INIT, true);
+    preferences.putInt(PREF_APRS_SB_TURN_SLOPE_PRESET, sb_turn_slope);
+  }
+  sb_turn_slope = preferences.getInt(PREF_APRS_SB_TURN_SLOPE_PRESET);
+
+  if (!preferences.getBool(PREF_APRS_SB_TURN_TIME_PRESET_INIT)){
+    preferences.putBool(PREF_APRS_SB_TURN_TIME_PRESET_INIT, true);
+    preferences.putInt(PREF_APRS_SB_TURN_TIME_PRESET, sb_turn_time);
+  }
+  sb_turn_time = preferences.getInt(PREF_APRS_SB_TURN_TIME_PRESET);
+}
+#endif
+
+#ifdef ENABLE_WIFI
+static portMUX_TYPE webserver_start_mux = portMUX_INITIALIZER_UNLOCKED;
+
+// Starts taskWebServer, once: the button in loop() and the background start of fast boot may both try.
+// Returns false if it had been started already
+bool webserver_start(){
+  portENTER_CRITICAL(&webserver_start_mux);
+  bool started = webserverStarted;
+  webserverStarted = true;
+  portEXIT_CRITICAL(&webserver_start_mux);
+  if (started)
+    return false;
+  webServerCfg = {.callsign = Tcall};
+  xTaskCreate(taskWebServer, "taskWebServer", 12000, (void*)(&webServerCfg), 1, nullptr);
+  return true;
+}
+#endif
+
+// Bluetooth, then the webserver unless a bluetooth client connects. Waits up to 60s for one.
+// The init screens are not shown in fast boot, so this can run beside loop()
+void start_bluetooth_and_wifi(){
+#if defined(KISS_PROTOCOL) && defined(ENABLE_BLUETOOTH)
+  // LORA32_21: bug in hardware. cannot run bluetooth and wifi concurrently.
+  // We wait for a bt-client connecting, up to 60s. If none connected,
+  // we start the webserver.
+  // TTGO: webserver cunsumes abt 80mA. User may not start the webserver
+  // if bt-client is connected. We'll also wait herefor clients.
+  // If enable_webserver on LORA32_21 is set to 2, user
+  // likes the webserver always to be started -> do not start bluetooth.
+#if defined(ENABLE_WIFI)
+#if defined(LORA32_21)
+  if (enable_bluetooth && enable_webserver < 2) {
+#else
+  if (enable_bluetooth) {
+#endif /* LORA32_21 */
+#else
+  if (enable_bluetooth) {
+#endif /* ENABLE_WIFI */
+
+#ifdef BLUETOOTH_PIN
+    SerialBT.setPin(BLUETOOTH_PIN);
+#endif
+    SerialBT.begin(String("TTGO LORA APRS ") + Tcall);
+    metrics_boot_phase("bluetooth");
+    writeinittext("LoRa-APRS","","Init:","BT OK!","","");
+
+#if defined(ENABLE_WIFI)
+    if (enable_webserver == 1 && !aprsis_enabled) {
+      writeinittext("LoRa-APRS","","Init:","Waiting for BT-client","","");
+      // wait 60s until BT client connects
+      uint32_t t_end = millis() + 60000;
+      while (millis() < t_end) {
+        if (SerialBT.hasClient())
+          break;
+        delay(100);
+      }
+      if (!SerialBT.hasClient()) {
+  #if defined(LORA32_21)
+        writeinittext("LoRa-APRS","","Init:","Waiting for BT-client","Disabling BT!","");
+        SerialBT.end();
+  #endif
+      } else {
+        writeinittext("LoRa-APRS","","Init:","Waiting for BT-clients","BT-client connected","Will NOT start WiFi!");
+      }
+      if (!fast_boot)
+        delay(1500);
+    }
+#endif /* ENABLE_WIFI */
+  }
+#endif /* KISS_PROTOCOL && ENABLE_BLUETOOTH */
+
+#ifdef ENABLE_WIFI
+  // the button may have started it meanwhile
+  if (enable_webserver && !webserverStarted) {
+#if defined(KISS_PROTOCOL) && defined(ENABLE_BLUETOOTH)
+    // if enabble_webserver == 2 or (enable_webserver == 1 && (no serial-bt-client is connected OR aprs-is-connecion configuried)
+    if (enable_webserver > 1 || aprsis_enabled || !SerialBT.hasClient()) {
+#else
+    {
+#endif /* KISS_PROTOCOL && ENABLE_BLUETOOTH */
+      if (webserver_start())
+        writeinittext("LoRa-APRS","","Init:","WiFi task started","   =:-)   ","");
+#if defined(KISS_PROTOCOL) && defined(ENABLE_BLUETOOTH)
+    } else {
+      writeinittext("LoRa-APRS","","Init:","WiFi NOT started!","   =:-S   ","");
+    }
+#else
+    }
+#endif /* KISS_PROTOCOL && ENABLE_BLUETOOTH */
+    if (!fast_boot)
+      delay(1500);
+  }
+#endif /* ENABLE_WIFI */
+}
+
+void taskStartInBackground(void *parameter){
+  start_bluetooth_and_wifi();
+  vTaskDelete(nullptr);
+}
+
+#ifdef ENABLE_PREFERENCES
+// set by the webserver after a save, applied by loop()
+static volatile bool settings_apply_pending = false;
+
+void apply_settings_later(){
+  settings_apply_pending = true;
+}
+
+// Settings saved in the web interface, applied without a reboot. Callsign and device settings (WiFi, bluetooth, display, CPU) still need one
+void apply_settings(){
+  load_lora_and_aprs_settings();
+  position_presets_normalize();
+  // as at boot: fixed beacon interval is the fallback, if the GPS fix is lost
+  if (!fixed_beacon_enabled && gps_state && fix_beacon_interval < sb_max_interval)
+    fix_beacon_interval = sb_max_interval;
+  lora_digipeating_rules = preferences.getString(PREF_APRS_DIGIPEATING_RULES);
+  digipeater_rules_load();
+#ifdef T_BEAM_V1_0
+  if (lora_digipeating_mode > 0 || lora_rx_enabled)
+    axp.setPowerOutPut(AXP192_LDO2, AXP202_ON);                           // LoRa
+#endif
+  lora_apply_rx_settings();
+#ifdef ENABLE_WIFI
+  // the aprsis_* settings are only written by taskAPRSIS, or here while it does not run
+  aprsis_settings_changed();
+#endif
+  Serial.println("Settings applied");
+}
+#endif
+
 // + SETUP --------------------------------------------------------------+//
 void setup(){
+  metrics_register_task();
 #ifdef T_BEAM_V0_7 /*
   adcAttachPin(35);
   adcStart(35);
@@ -967,291 +1507,19 @@ void setup(){
     wifi_txpwr_mode_STA = preferences.getInt(PREF_WIFI_TXPWR_MODE_STA);
 #endif
     
-    // LoRa transmission settings
-
-    if (!preferences.getBool(PREF_LORA_FREQ_PRESET_INIT)){
-      preferences.putBool(PREF_LORA_FREQ_PRESET_INIT, true);
-      preferences.putDouble(PREF_LORA_FREQ_PRESET, lora_freq);
-    }
-    lora_freq = preferences.getDouble(PREF_LORA_FREQ_PRESET);
-    
-    if (!preferences.getBool(PREF_LORA_SPEED_PRESET_INIT)){
-      preferences.putBool(PREF_LORA_SPEED_PRESET_INIT, true);
-      preferences.putInt(PREF_LORA_SPEED_PRESET, lora_speed);
-    }
-    lora_speed = preferences.getInt(PREF_LORA_SPEED_PRESET);
-
-    if (!preferences.getBool(PREF_LORA_RX_ENABLE_INIT)){
-      preferences.putBool(PREF_LORA_RX_ENABLE_INIT, true);
-      preferences.putBool(PREF_LORA_RX_ENABLE, lora_rx_enabled);
-    }
-    lora_rx_enabled = preferences.getBool(PREF_LORA_RX_ENABLE);
-
-    if (!preferences.getBool(PREF_LORA_TX_ENABLE_INIT)){
-      preferences.putBool(PREF_LORA_TX_ENABLE_INIT, true);
-      preferences.putBool(PREF_LORA_TX_ENABLE, lora_tx_enabled);
-    }
-    lora_tx_enabled = preferences.getBool(PREF_LORA_TX_ENABLE);
-
-    if (!preferences.getBool(PREF_LORA_TX_POWER_INIT)){
-      preferences.putBool(PREF_LORA_TX_POWER_INIT, true);
-      preferences.putInt(PREF_LORA_TX_POWER, txPower);
-    }
-    txPower = lora_tx_enabled ? preferences.getInt(PREF_LORA_TX_POWER) : 0;
-
-    if (!preferences.getBool(PREF_LORA_AUTOMATIC_CR_ADAPTION_PRESET_INIT)){
-      preferences.putBool(PREF_LORA_AUTOMATIC_CR_ADAPTION_PRESET_INIT, true);
-      preferences.putBool(PREF_LORA_AUTOMATIC_CR_ADAPTION_PRESET, lora_automatic_cr_adaption);
-    }
-    lora_automatic_cr_adaption = preferences.getBool(PREF_LORA_AUTOMATIC_CR_ADAPTION_PRESET);
-
-    if (!preferences.getBool(PREF_LORA_ADD_SNR_RSSI_TO_PATH_PRESET_INIT)){
-      preferences.putBool(PREF_LORA_ADD_SNR_RSSI_TO_PATH_PRESET_INIT, true);
-      preferences.putInt(PREF_LORA_ADD_SNR_RSSI_TO_PATH_PRESET, lora_add_snr_rssi_to_path);
-    }
-    lora_add_snr_rssi_to_path = preferences.getInt(PREF_LORA_ADD_SNR_RSSI_TO_PATH_PRESET);
-
-    if (!preferences.getBool(PREF_LORA_ADD_SNR_RSSI_TO_PATH_END_AT_KISS_PRESET_INIT)){
-      preferences.putBool(PREF_LORA_ADD_SNR_RSSI_TO_PATH_END_AT_KISS_PRESET_INIT, true);
-      preferences.putBool(PREF_LORA_ADD_SNR_RSSI_TO_PATH_END_AT_KISS_PRESET, kiss_add_snr_rssi_to_path_at_position_without_digippeated_flag);
-    }
-    kiss_add_snr_rssi_to_path_at_position_without_digippeated_flag = preferences.getBool(PREF_LORA_ADD_SNR_RSSI_TO_PATH_END_AT_KISS_PRESET);
-
-    if (!preferences.getBool(PREF_APRS_DIGIPEATING_MODE_PRESET_INIT)){
-      preferences.putBool(PREF_APRS_DIGIPEATING_MODE_PRESET_INIT, true);
-      preferences.putInt(PREF_APRS_DIGIPEATING_MODE_PRESET, lora_digipeating_mode);
-    }
-    lora_digipeating_mode = preferences.getInt(PREF_APRS_DIGIPEATING_MODE_PRESET);
-
-    if (!preferences.getBool(PREF_APRS_CROSS_DIGIPEATING_MODE_PRESET_INIT)){
-      preferences.putBool(PREF_APRS_CROSS_DIGIPEATING_MODE_PRESET_INIT, true);
-      preferences.putInt(PREF_APRS_CROSS_DIGIPEATING_MODE_PRESET, lora_cross_digipeating_mode);
-    }
-    lora_cross_digipeating_mode = preferences.getInt(PREF_APRS_CROSS_DIGIPEATING_MODE_PRESET);
-
-    if (!preferences.getBool(PREF_LORA_TX_BEACON_AND_KISS_TO_FREQUENCIES_PRESET_INIT)){
-      preferences.putBool(PREF_LORA_TX_BEACON_AND_KISS_TO_FREQUENCIES_PRESET_INIT, true);
-      preferences.putInt(PREF_LORA_TX_BEACON_AND_KISS_TO_FREQUENCIES_PRESET, tx_own_beacon_from_this_device_or_fromKiss__to_frequencies);
-    }
-    tx_own_beacon_from_this_device_or_fromKiss__to_frequencies = preferences.getInt(PREF_LORA_TX_BEACON_AND_KISS_TO_FREQUENCIES_PRESET);
-
-    if (!preferences.getBool(PREF_LORA_TX_BEACON_AND_KISS_TO_APRSIS_PRESET_INIT)){
-      preferences.putBool(PREF_LORA_TX_BEACON_AND_KISS_TO_APRSIS_PRESET_INIT, true);
-      preferences.putBool(PREF_LORA_TX_BEACON_AND_KISS_TO_APRSIS_PRESET, tx_own_beacon_from_this_device_or_fromKiss__to_aprsis);
-    }
-    tx_own_beacon_from_this_device_or_fromKiss__to_aprsis = preferences.getBool(PREF_LORA_TX_BEACON_AND_KISS_TO_APRSIS_PRESET);
-
-    if (!preferences.getBool(PREF_LORA_FREQ_CROSSDIGI_PRESET_INIT)){
-      preferences.putBool(PREF_LORA_FREQ_CROSSDIGI_PRESET_INIT, true);
-      preferences.putDouble(PREF_LORA_FREQ_CROSSDIGI_PRESET, lora_freq_cross_digi);
-    }
-    lora_freq_cross_digi = preferences.getDouble(PREF_LORA_FREQ_CROSSDIGI_PRESET);
-    
-    if (!preferences.getBool(PREF_LORA_SPEED_CROSSDIGI_PRESET_INIT)){
-      preferences.putBool(PREF_LORA_SPEED_CROSSDIGI_PRESET_INIT, true);
-      preferences.putInt(PREF_LORA_SPEED_CROSSDIGI_PRESET, lora_speed_cross_digi);
-    }
-    lora_speed_cross_digi = preferences.getInt(PREF_LORA_SPEED_CROSSDIGI_PRESET);
-
-    if (!preferences.getBool(PREF_LORA_TX_POWER_CROSSDIGI_PRESET_INIT)){
-      preferences.putBool(PREF_LORA_TX_POWER_CROSSDIGI_PRESET_INIT, true);
-      preferences.putInt(PREF_LORA_TX_POWER_CROSSDIGI_PRESET, txPower_cross_digi);
-    }
-    txPower_cross_digi = lora_tx_enabled ? preferences.getInt(PREF_LORA_TX_POWER_CROSSDIGI_PRESET) : 0;
-
-    if (!preferences.getBool(PREF_LORA_RX_ON_FREQUENCIES_PRESET_INIT)){
-      preferences.putBool(PREF_LORA_RX_ON_FREQUENCIES_PRESET_INIT, true);
-      preferences.putInt(PREF_LORA_RX_ON_FREQUENCIES_PRESET, rx_on_frequencies);
-    }
-    rx_on_frequencies = preferences.getInt(PREF_LORA_RX_ON_FREQUENCIES_PRESET);
-
-    // APRS station settings
-
-    aprsSymbolTable = preferences.getString(PREF_APRS_SYMBOL_TABLE, "");
-    if (aprsSymbolTable.isEmpty()){
-      preferences.putString(PREF_APRS_SYMBOL_TABLE, APRS_SYMBOL_TABLE);
-      aprsSymbolTable = preferences.getString(PREF_APRS_SYMBOL_TABLE);
-    }
-
-    aprsSymbol = preferences.getString(PREF_APRS_SYMBOL, "");
-    if (aprsSymbol.isEmpty()){
-      preferences.putString(PREF_APRS_SYMBOL, APRS_SYMBOL);
-      aprsSymbol = preferences.getString(PREF_APRS_SYMBOL, APRS_SYMBOL);
-    }
-
-    if (!preferences.getBool(PREF_APRS_COMMENT_INIT)){
-      preferences.putBool(PREF_APRS_COMMENT_INIT, true);
-      preferences.putString(PREF_APRS_COMMENT, MY_COMMENT);
-    }
-    aprsComment = preferences.getString(PREF_APRS_COMMENT, "");
-
-    if (!preferences.getBool(PREF_APRS_RELAY_PATH_INIT)){
-      preferences.putBool(PREF_APRS_RELAY_PATH_INIT, true);
-      preferences.putString(PREF_APRS_RELAY_PATH, DIGI_PATH);
-    }
-    relay_path = preferences.getString(PREF_APRS_RELAY_PATH, "");
-
-    if (!preferences.getBool(PREF_APRS_SHOW_ALTITUDE_INIT)){
-      preferences.putBool(PREF_APRS_SHOW_ALTITUDE_INIT, true);
-      preferences.putBool(PREF_APRS_SHOW_ALTITUDE, showAltitude);
-    }
-    showAltitude = preferences.getBool(PREF_APRS_SHOW_ALTITUDE);
-    if (!preferences.getBool(PREF_APRS_SHOW_ALTITUDE_INSIDE_COMPRESSED_POSITION_INIT)){
-      preferences.putBool(PREF_APRS_SHOW_ALTITUDE_INSIDE_COMPRESSED_POSITION_INIT, true);
-      preferences.putBool(PREF_APRS_SHOW_ALTITUDE_INSIDE_COMPRESSED_POSITION, showAltitudeInsideCompressedPosition);
-    }
-    showAltitudeInsideCompressedPosition = preferences.getBool(PREF_APRS_SHOW_ALTITUDE_INSIDE_COMPRESSED_POSITION);
-    if (!preferences.getBool(PREF_APRS_ALTITUDE_RATIO_INIT)){
-      preferences.putBool(PREF_APRS_ALTITUDE_RATIO_INIT, true);
-      // preferences.putInt(PREF_APRS_ALTITUDE_RATIO, altitude_ratio); // until SHOW_ALTITUDE is obsolete, commented out
-      preferences.putInt(PREF_APRS_ALTITUDE_RATIO, showAltitude ? 100 : 0);
-    }
-    altitude_ratio = preferences.getInt(PREF_APRS_ALTITUDE_RATIO);
-    
-
     if (!preferences.getBool(PREF_APRS_GPS_EN_INIT)){
       preferences.putBool(PREF_APRS_GPS_EN_INIT, true);
-      preferences.putBool(PREF_APRS_GPS_EN, gps_state);
-    }
-    gps_state = preferences.getBool(PREF_APRS_GPS_EN);
-
-    if (!preferences.getBool(PREF_ACCEPT_OWN_POSITION_REPORTS_VIA_KISS_INIT)){
-      preferences.putBool(PREF_ACCEPT_OWN_POSITION_REPORTS_VIA_KISS_INIT, true);
-      preferences.putBool(PREF_ACCEPT_OWN_POSITION_REPORTS_VIA_KISS, acceptOwnPositionReportsViaKiss);
-    }
-    acceptOwnPositionReportsViaKiss = preferences.getBool(PREF_ACCEPT_OWN_POSITION_REPORTS_VIA_KISS);
-
-    if (!preferences.getBool(PREF_GPS_ALLOW_SLEEP_WHILE_KISS_INIT)){
-      preferences.putBool(PREF_GPS_ALLOW_SLEEP_WHILE_KISS_INIT, true);
-      preferences.putBool(PREF_GPS_ALLOW_SLEEP_WHILE_KISS, gps_allow_sleep_while_kiss);
-    }
-    gps_allow_sleep_while_kiss = preferences.getBool(PREF_GPS_ALLOW_SLEEP_WHILE_KISS);
-
-
-    if (!preferences.getBool(PREF_APRS_SHOW_BATTERY_INIT)){
-      preferences.putBool(PREF_APRS_SHOW_BATTERY_INIT, true);
-      preferences.putBool(PREF_APRS_SHOW_BATTERY, showBattery);
-    }
-    showBattery = preferences.getBool(PREF_APRS_SHOW_BATTERY);
-
-    if (!preferences.getBool(PREF_ENABLE_TNC_SELF_TELEMETRY_INIT)){
-      preferences.putBool(PREF_ENABLE_TNC_SELF_TELEMETRY_INIT, true);
-      preferences.putBool(PREF_ENABLE_TNC_SELF_TELEMETRY, enable_tel);
-    }
-    enable_tel = preferences.getBool(PREF_ENABLE_TNC_SELF_TELEMETRY);
-
-    if (!preferences.getBool(PREF_TNC_SELF_TELEMETRY_INTERVAL_INIT)){
-      preferences.putBool(PREF_TNC_SELF_TELEMETRY_INTERVAL_INIT, true);
-      preferences.putInt(PREF_TNC_SELF_TELEMETRY_INTERVAL, tel_interval);
-    }
-    tel_interval = preferences.getInt(PREF_TNC_SELF_TELEMETRY_INTERVAL);
-
-    if (!preferences.getBool(PREF_TNC_SELF_TELEMETRY_SEQ_INIT)){
-      preferences.putBool(PREF_TNC_SELF_TELEMETRY_SEQ_INIT, true);
-      preferences.putInt(PREF_TNC_SELF_TELEMETRY_SEQ, tel_sequence);
-    }
-    tel_sequence = preferences.getInt(PREF_TNC_SELF_TELEMETRY_SEQ);
-
-    if (!preferences.getBool(PREF_TNC_SELF_TELEMETRY_MIC_INIT)){
-      preferences.putBool(PREF_TNC_SELF_TELEMETRY_MIC_INIT, true);
-      preferences.putInt(PREF_TNC_SELF_TELEMETRY_MIC, tel_mic);
-    }
-    tel_mic = preferences.getInt(PREF_TNC_SELF_TELEMETRY_MIC);
-
-    if (!preferences.getBool(PREF_TNC_SELF_TELEMETRY_PATH_INIT)){
-      preferences.putBool(PREF_TNC_SELF_TELEMETRY_PATH_INIT, true);
-      preferences.putString(PREF_TNC_SELF_TELEMETRY_PATH, tel_path);
-    }
-    tel_path = preferences.getString(PREF_TNC_SELF_TELEMETRY_PATH, "");
-
-    if (!preferences.getBool(PREF_APRS_LATITUDE_PRESET_INIT)){
-      preferences.putBool(PREF_APRS_LATITUDE_PRESET_INIT, true);
-      preferences.putString(PREF_APRS_LATITUDE_PRESET, LATITUDE_PRESET);
-    }
-    aprsLatPreset = preferences.getString(PREF_APRS_LATITUDE_PRESET, "");
-    LatShownP = aprsLonPreset;
-
-    if (!preferences.getBool(PREF_APRS_LONGITUDE_PRESET_INIT)){
-      preferences.putBool(PREF_APRS_LONGITUDE_PRESET_INIT, true);
-      preferences.putString(PREF_APRS_LONGITUDE_PRESET, LONGITUDE_PRESET);
-    }
-    aprsLonPreset = preferences.getString(PREF_APRS_LONGITUDE_PRESET, "");
-    LongShownP = aprsLonPreset;
-
-    if (!preferences.getBool(PREF_APRS_SENDER_BLACKLIST_INIT)){
-      preferences.putBool(PREF_APRS_SENDER_BLACKLIST_INIT, true);
-      preferences.putString(PREF_APRS_SENDER_BLACKLIST, "");
-    }
-    { String s = preferences.getString(PREF_APRS_SENDER_BLACKLIST, "");
-      s.toUpperCase(); s.trim(); s.replace(" ", ","); s.replace(",,", ",");
-      if (!s.isEmpty() && s != "," && s.length() < sizeof(blacklist_calls)-3) {
-        *blacklist_calls = ',';
-        strcpy(blacklist_calls+1, s.c_str());
-        strcat(blacklist_calls, ",");
-      } else {
-        *blacklist_calls = 0;
-      }
-    }
-
-    if (!preferences.getBool(PREF_APRS_FIXED_BEACON_PRESET_INIT)){
-      preferences.putBool(PREF_APRS_FIXED_BEACON_PRESET_INIT, true);
-      preferences.putBool(PREF_APRS_FIXED_BEACON_PRESET, fixed_beacon_enabled);
-    }
-    fixed_beacon_enabled = preferences.getBool(PREF_APRS_FIXED_BEACON_PRESET);
-
-    if (!preferences.getBool(PREF_APRS_FIXED_BEACON_INTERVAL_PRESET_INIT)){
-      preferences.putBool(PREF_APRS_FIXED_BEACON_INTERVAL_PRESET_INIT, true);
-      preferences.putInt(PREF_APRS_FIXED_BEACON_INTERVAL_PRESET, fix_beacon_interval/1000);
-    }
-    fix_beacon_interval = preferences.getInt(PREF_APRS_FIXED_BEACON_INTERVAL_PRESET) * 1000;
-
-// + SMART BEACONING
-
-    if (!preferences.getBool(PREF_APRS_SB_MIN_INTERVAL_PRESET_INIT)){
-      preferences.putBool(PREF_APRS_SB_MIN_INTERVAL_PRESET_INIT, true);
-      preferences.putInt(PREF_APRS_SB_MIN_INTERVAL_PRESET, sb_min_interval/1000);
-    }
-    sb_min_interval = preferences.getInt(PREF_APRS_SB_MIN_INTERVAL_PRESET) * 1000;
-    if (sb_min_interval < 10000) sb_min_interval = 10000;
-
-    if (!preferences.getBool(PREF_APRS_SB_MAX_INTERVAL_PRESET_INIT)){
-      preferences.putBool(PREF_APRS_SB_MAX_INTERVAL_PRESET_INIT, true);
-      preferences.putInt(PREF_APRS_SB_MAX_INTERVAL_PRESET, sb_max_interval/1000);
-    }
-    sb_max_interval = preferences.getInt(PREF_APRS_SB_MAX_INTERVAL_PRESET) * 1000;
-    if (sb_max_interval <= sb_min_interval) sb_max_interval = sb_min_interval + 1000;
-
-    if (!preferences.getBool(PREF_APRS_SB_MIN_SPEED_PRESET_INIT)){
-      preferences.putBool(PREF_APRS_SB_MIN_SPEED_PRESET_INIT, true);
-      preferences.putInt(PREF_APRS_SB_MIN_SPEED_PRESET, sb_min_speed);
-    }
-    sb_min_speed = (float) preferences.getInt(PREF_APRS_SB_MIN_SPEED_PRESET);
-    if (sb_min_speed < 0) sb_min_speed = 0;
-
-    if (!preferences.getBool(PREF_APRS_SB_MAX_SPEED_PRESET_INIT)){
-      preferences.putBool(PREF_APRS_SB_MAX_SPEED_PRESET_INIT, true);
-      preferences.putInt(PREF_APRS_SB_MAX_SPEED_PRESET, sb_max_speed);
-    }
-    sb_max_speed = (float ) preferences.getInt(PREF_APRS_SB_MAX_SPEED_PRESET);
-    if (sb_max_speed <= sb_min_speed) sb_max_speed = sb_min_speed +1;
-
-    if (!preferences.getBool(PREF_APRS_SB_ANGLE_PRESET_INIT)){
-      preferences.putBool(PREF_APRS_SB_ANGLE_PRESET_INIT, true);
-      preferences.putDouble(PREF_APRS_SB_ANGLE_PRESET, sb_angle);
+      preferences.putBool(PREF_APRS_GPS_EN, gps_state);
     }
-    sb_angle = preferences.getDouble(PREF_APRS_SB_ANGLE_PRESET);
+    gps_state = preferences.getBool(PREF_APRS_GPS_EN);
 
-    if (!preferences.getBool(PREF_APRS_SB_TURN_SLOPE_PRESET_INIT)){
-      preferences.putBool(PREF_APRS_SB_TURN_SLOPE_PRESET_INIT, true);
-      preferences.putInt(PREF_APRS_SB_TURN_SLOPE_PRESET, sb_turn_slope);
+    if (!preferences.getBool(PREF_TNC_SELF_TELEMETRY_SEQ_INIT)){
+      preferences.putBool(PREF_TNC_SELF_TELEMETRY_SEQ_INIT, true);
+      preferences.putInt(PREF_TNC_SELF_TELEMETRY_SEQ, tel_sequence);
     }
-    sb_turn_slope = preferences.getInt(PREF_APRS_SB_TURN_SLOPE_PRESET);
+    tel_sequence = preferences.getInt(PREF_TNC_SELF_TELEMETRY_SEQ);
 
-    if (!preferences.getBool(PREF_APRS_SB_TURN_TIME_PRESET_INIT)){
-      preferences.putBool(PREF_APRS_SB_TURN_TIME_PRESET_INIT, true);
-      preferences.putInt(PREF_APRS_SB_TURN_TIME_PRESET, sb_turn_time);
-    }
-    sb_turn_time = preferences.getInt(PREF_APRS_SB_TURN_TIME_PRESET);
+    load_lora_and_aprs_settings();
 
 // 
 
@@ -1317,6 +1585,12 @@ void setup(){
     }
     adjust_cpuFreq_to = preferences.getInt(PREF_DEV_CPU_FREQ); 
 
+    if (!preferences.getBool(PREF_DEV_FAST_BOOT_INIT)){
+      preferences.putBool(PREF_DEV_FAST_BOOT_INIT, true);
+      preferences.putBool(PREF_DEV_FAST_BOOT, fast_boot);
+    }
+    fast_boot = preferences.getBool(PREF_DEV_FAST_BOOT);
+
 
 // APRSIS settings
 #ifdef ENABLE_WIFI
@@ -1361,6 +1635,12 @@ void setup(){
       preferences.putInt(PREF_APRSIS_ALLOW_INET_TO_RF, aprsis_data_allow_inet_to_rf);
     }
     aprsis_data_allow_inet_to_rf = preferences.getInt(PREF_APRSIS_ALLOW_INET_TO_RF);
+
+    if (!preferences.getBool(PREF_APRSIS_RF_FILTER_INIT)){
+      preferences.putBool(PREF_APRSIS_RF_FILTER_INIT, true);
+      preferences.putString(PREF_APRSIS_RF_FILTER, aprsis_rf_filter);
+    }
+    aprsis_rf_filter = preferences.getString(PREF_APRSIS_RF_FILTER, "");
 #endif
 
     if (clear_preferences){
@@ -1371,39 +1651,11 @@ void setup(){
     }
 
   #endif
+  metrics_boot_phase("settings");
 
-  // We have stored the manual position strring in a higher precision (in case resolution more precise than 18.52m is required; i.e. for base-91 location encoding, or DAO extenstion).
-  // Furthermore, 53-32.1234N is more readable in the Web-interface than 5232.1234N
-  aprsLatPreset.toUpperCase(); aprsLatPreset.replace(",", "."); aprsLatPreset.trim();
-  if (aprsLatPreset.length() == 11 && aprsLatPreset.indexOf('-') == 2 && aprsLatPreset.indexOf(' ') == -1 && (aprsLatPreset.endsWith("N") || aprsLatPreset.endsWith("S"))) {
-    char buf[9];
-    const char *p = aprsLatPreset.c_str();
-    sprintf(buf, "%.2s%.5s%c", p, p+3, p[10]);
-    aprsLatPreset = String(buf);
-  }
-
-  // 001-20.5000E is more readable in the Web-interface than 00120.5000E, and could not be mis-interpreted as 120.5 degrees east  (== 120 deg 30' 0" E)
-  aprsLonPreset.toUpperCase(); aprsLonPreset.replace(",", "."); aprsLonPreset.trim();
-  if (aprsLonPreset.length() == 12 && aprsLonPreset.indexOf('-') == 3 && aprsLonPreset.indexOf(' ') == -1 && (aprsLonPreset.endsWith("E") || aprsLonPreset.endsWith("W"))) {
-    char buf[10];
-    const char *p = aprsLonPreset.c_str();
-    sprintf(buf, "%.3s%.5s%c", p, p+4, p[11]);
-    aprsLonPreset = String(buf);
-  }
-
-  // enforce valid transmissions even on wrong configurations
-  if (aprsSymbolTable.length() != 1)
-    aprsSymbolTable = String("/");
-  if (aprsSymbol.length() != 1)
-    aprsSymbol = String("[");
-  if (aprsLatPreset.length() != 8 || !(aprsLatPreset.endsWith("N") || aprsLatPreset.endsWith("S")) || aprsLatPreset.c_str()[4] != '.')
-    aprsLatPreset = String("0000.00N");
-  if (aprsLonPreset.length() != 9 || !(aprsLonPreset.endsWith("E") || aprsLonPreset.endsWith("W")) || aprsLonPreset.c_str()[5] != '.')
-    aprsLonPreset = String("00000.00E");
+  position_presets_normalize();
 
-  for (int i=0;i<ANGLE_AVGS;i++) {                                        // set average_course to "0"
-    average_course[i]=0;
-  }
+  sb_init(&smart_beacon);
 
   pinMode(TXLED, OUTPUT);
   #ifdef T_BEAM_V1_0
@@ -1447,6 +1699,7 @@ void setup(){
   if(!display.begin(SSD1306_SWITCHCAPVCC, SSD1306_ADDRESS)) {
       for(;;);                                                             // Don't proceed, loop forever
   }
+  metrics_boot_phase("display");
 
   #ifdef ENABLE_PREFERENCES
     if (clear_preferences == 2){
@@ -1467,7 +1720,7 @@ void setup(){
       //#endif
     }
   #endif
-  writedisplaytext("LoRa-APRS","","Init:","Display OK!","","");
+  writeinittext("LoRa-APRS","","Init:","Display OK!","","");
 
   Tcall = prepareCallsign(String(CALLSIGN));
   #ifdef ENABLE_PREFERENCES
@@ -1478,13 +1731,35 @@ void setup(){
     }
   #endif
 
+  #ifdef ENABLE_PREFERENCES
+    if (!preferences.getBool(PREF_APRS_DIGIPEATING_RULES_INIT)){
+      preferences.putBool(PREF_APRS_DIGIPEATING_RULES_INIT, true);
+      preferences.putString(PREF_APRS_DIGIPEATING_RULES, lora_digipeating_rules);
+    }
+    lora_digipeating_rules = preferences.getString(PREF_APRS_DIGIPEATING_RULES);
+    // defaults of settings not stored yet: all in one write
+    preferences.commit();
+  #endif
+  digipeater_rules_load();
+  #ifdef ENABLE_WIFI
+  {
+    char err[80];
+    // broken filter from storage: nothing is gated to RF
+    if (aprsis_rf_filter_set(aprsis_rf_filter.c_str(), err, sizeof(err)) < 0)
+      Serial.printf("APRS-IS RF filter: %s. Not gating to RF\n", err);
+  }
+  #endif
+
   if (!rf95.init()) {
     writedisplaytext("LoRa-APRS","","Init:","RF95 FAILED!",":-(","");
     for(;;); // Don't proceed, loop forever
   }
+  // receiving from here on; loop() reads the frames once setup() is done
+  lora_apply_rx_settings();
+  metrics_boot_phase("radio");
 
-  if (sb_max_interval < nextTX){
-    sb_max_interval=nextTX;
+  if (sb_max_interval < smart_beacon.next_tx){
+    sb_max_interval=smart_beacon.next_tx;
   }
 
   // we need this assurance for failback to fixed interval, if gps position is lost.
@@ -1492,106 +1767,33 @@ void setup(){
   if (!fixed_beacon_enabled && gps_state && fix_beacon_interval < sb_max_interval)
     fix_beacon_interval = sb_max_interval;
 
-  writedisplaytext("LoRa-APRS","","Init:","RF95 OK!","","");
-  writedisplaytext(" "+Tcall,"","Init:","Waiting for GPS","","");
+  // heard stations table lives in PSRAM, if present
+  if (heard_stations_init(psramFound() ? 1024 : 128) < 0)
+    Serial.println("Heard stations table: out of memory");
+
+  writeinittext("LoRa-APRS","","Init:","RF95 OK!","","");
+  writeinittext(" "+Tcall,"","Init:","Waiting for GPS","","");
   xTaskCreate(taskGPS, "taskGPS", 5000, nullptr, 1, nullptr);
-  writedisplaytext(" "+Tcall,"","Init:","GPS Task Created!","","");
+  writeinittext(" "+Tcall,"","Init:","GPS Task Created!","","");
   #ifndef T_BEAM_V1_0
     adc1_config_width(ADC_WIDTH_BIT_12);
     adc1_config_channel_atten(ADC1_CHANNEL_7,ADC_ATTEN_DB_6);
   #endif
   batt_read();
-  writedisplaytext("LoRa-APRS","","Init:","ADC OK!","BAT: "+String(BattVolts,2),"");
+  writeinittext("LoRa-APRS","","Init:","ADC OK!","BAT: "+String(BattVolts,2),"");
   
-  // if we are fill-in or wide2 digi, we listen only on configured main frequency
-  lora_speed_rx_curr = (rx_on_frequencies  != 2 || lora_digipeating_mode > 1) ? lora_speed : lora_speed_cross_digi;
-  lora_set_speed(lora_speed_rx_curr);
-  Serial.printf("LoRa Speed:\t%lu\n", lora_speed_rx_curr);
-  
-  lora_freq_rx_curr = (rx_on_frequencies  != 2 || lora_digipeating_mode > 1) ? lora_freq : lora_freq_cross_digi;
-  rf95.setFrequency(lora_freq_rx_curr);
-  Serial.printf("LoRa FREQ:\t%f\n", lora_freq_rx_curr);
-
-  // we tx on main and/or secondary frequency. For tx, loraSend is called (and always has desired txpower as argument)
-  rf95.setTxPower((lora_digipeating_mode < 2 || lora_cross_digipeating_mode < 1) ? txPower : txPower_cross_digi);
-  delay(250);
+  if (!fast_boot)
+    delay(250);
   #ifdef KISS_PROTOCOL
     xTaskCreatePinnedToCore(taskTNC, "taskTNC", 10000, nullptr, 1, nullptr, xPortGetCoreID());
   #endif
 
+  if (fast_boot)
+    xTaskCreate(taskStartInBackground, "taskStartInBackground", 8192, nullptr, 1, nullptr);
+  else
+    start_bluetooth_and_wifi();
 
-#if defined(KISS_PROTOCOL) && defined(ENABLE_BLUETOOTH)
-  // LORA32_21: bug in hardware. cannot run bluetooth and wifi concurrently.
-  // We wait for a bt-client connecting, up to 60s. If none connected,
-  // we start the webserver.
-  // TTGO: webserver cunsumes abt 80mA. User may not start the webserver
-  // if bt-client is connected. We'll also wait herefor clients.
-  // If enable_webserver on LORA32_21 is set to 2, user
-  // likes the webserver always to be started -> do not start bluetooth.
-#if defined(ENABLE_WIFI)
-#if defined(LORA32_21)
-  if (enable_bluetooth && enable_webserver < 2) {
-#else
-  if (enable_bluetooth) {
-#endif /* LORA32_21 */
-#else
-  if (enable_bluetooth) {
-#endif /* ENABLE_WIFI */
-
-#ifdef BLUETOOTH_PIN
-    SerialBT.setPin(BLUETOOTH_PIN);
-#endif
-    SerialBT.begin(String("TTGO LORA APRS ") + Tcall);
-    writedisplaytext("LoRa-APRS","","Init:","BT OK!","","");
-
-#if defined(ENABLE_WIFI)
-    if (enable_webserver == 1 && !aprsis_enabled) {
-      writedisplaytext("LoRa-APRS","","Init:","Waiting for BT-client","","");
-      // wait 60s until BT client connects
-      uint32_t t_end = millis() + 60000;
-      while (millis() < t_end) {
-        if (SerialBT.hasClient())
-          break;
-        delay(100);
-      }
-      if (!SerialBT.hasClient()) {
-  #if defined(LORA32_21)
-        writedisplaytext("LoRa-APRS","","Init:","Waiting for BT-client","Disabling BT!","");
-        SerialBT.end();
-  #endif
-      } else {
-        writedisplaytext("LoRa-APRS","","Init:","Waiting for BT-clients","BT-client connected","Will NOT start WiFi!");
-      }
-      delay(1500);
-    }
-#endif /* ENABLE_WIFI */
-  }
-#endif /* KISS_PROTOCOL && ENABLE_BLUETOOTH */
-
-#ifdef ENABLE_WIFI
-  if (enable_webserver) {
-#if defined(KISS_PROTOCOL) && defined(ENABLE_BLUETOOTH)
-    // if enabble_webserver == 2 or (enable_webserver == 1 && (no serial-bt-client is connected OR aprs-is-connecion configuried)
-    if (enable_webserver > 1 || aprsis_enabled || !SerialBT.hasClient()) {
-#else
-    {
-#endif /* KISS_PROTOCOL && ENABLE_BLUETOOTH */
-      webServerCfg = {.callsign = Tcall};
-      xTaskCreate(taskWebServer, "taskWebServer", 12000, (void*)(&webServerCfg), 1, nullptr);
-      webserverStarted = true;
-      writedisplaytext("LoRa-APRS","","Init:","WiFi task started","   =:-)   ","");
-#if defined(KISS_PROTOCOL) && defined(ENABLE_BLUETOOTH)
-    } else {
-      writedisplaytext("LoRa-APRS","","Init:","WiFi NOT started!","   =:-S   ","");
-    }
-#else
-    }
-#endif /* KISS_PROTOCOL && ENABLE_BLUETOOTH */
-    delay(1500);
-#endif /* ENABLE_WIFI */
-  }
-
-  writedisplaytext("LoRa-APRS","","Init:","FINISHED OK!","   =:-)   ","");
+  writeinittext("LoRa-APRS","","Init:","FINISHED OK!","   =:-)   ","");
   writedisplaytext("","","","","","");
   time_to_refresh = millis() + showRXTime;
   displayInvalidGPS();
@@ -1602,151 +1804,46 @@ void setup(){
 
   esp_task_wdt_init(120, true); //enable panic so ESP32 restarts
   esp_task_wdt_add(NULL); //add current thread to WDT watch
+  metrics_boot_phase("setup");
 }
 
-void enableOled() {
-  // This function enables OLED display after pressing a button
-  tempOled = true;
-  oled_timer = millis() + oled_timeout;
+// smart beaconing with the sb_* settings. They may change at runtime
+void sb_params_update() {
+  smart_beacon_params.min_interval = sb_min_interval;
+  smart_beacon_params.max_interval = sb_max_interval;
+  smart_beacon_params.min_speed = sb_min_speed;
+  smart_beacon_params.max_speed = sb_max_speed;
+  smart_beacon_params.angle = sb_angle;
+  smart_beacon_params.turn_slope = sb_turn_slope;
+  smart_beacon_params.turn_time = sb_turn_time;
+#ifdef SB_ALGO_KENWOOD
+  smart_beacon_params.kenwood = true;
+#else
+  smart_beacon_params.kenwood = false;
+#endif
 }
 
-int packet_is_valid (const char *frame_start) {
-  const char *p = frame_start;
-  if (!*p || !((*p >= 'A' && *p <= 'Z') || (*p >= '0' && *p <= '9')))
-    return 0;
-  for (p++; *p && *p != ':'; p++) {
-    if (! ((*p >= 'A' && *p <= 'Z') || (*p >= '0' && *p <= '9') || *p == '-' || *p == '*' || *p == ',' || *p == '>') )
-      return 0;
-  }
-  if (!*p || *p != ':')
-    return 0;
-  // do it again. Now we know the header is ok, which makes it parseable more easy, without race conditions (no need to check p[1] == 0 or so..)
-  boolean src_call_end = 0;
-  boolean to_call_end = 0;
-  for (p = frame_start; *p && *p != ':'; p++) {
-    if (*p == '>') { if (src_call_end || !isalnum(*(p-1))) return 0; src_call_end = true; } // '>' twice?
-    else if (*p == ',') { if (!src_call_end || (to_call_end ? (!(isalnum(*(p-1)) || *(p-1) == '*')) : !(isalnum(*(p-1))))  || !isalnum(p[1])) return 0; to_call_end = true; } // -,call or ,- is not valid
-    else if (*p == '-') {
-      // not call-1-2 or call-- or -call or ..>-1 or ,-1 or --15
-      if (!isalnum(*(p-1)) || !isdigit(p[1])) return 0;
-      char c_after_ssid = p[2];
-      if (isdigit(c_after_ssid)) {
-        if (p[1] != '1' || c_after_ssid > '5') return 0; // max "-15".
-        c_after_ssid = p[3];
-      }
-      if (!(c_after_ssid == '>' || c_after_ssid == '*' || c_after_ssid == ',' || c_after_ssid == ':')) return 0; // After ssid (pos 3) only '>', '*', ',', ':', are allowed.
-    }
+// when the GPS may sleep (see taskGPS): until the next beacon, unless moving
+void gps_power_plan() {
+  if (!gps_state || dont_send_own_position_packets || !lora_tx_enabled) {
+    gps_keep_on = true;
+    gps_beacon_due = 0;
+  } else if (fixed_beacon_enabled) {
+    gps_keep_on = false;
+    gps_beacon_due = next_fixed_beacon;
+  } else {
+    // smart beaconing needs the course while moving; next_tx <= 1: beacon now (turn, or first one)
+    gps_keep_on = !lastTX || smart_beacon.speed_avg >= max(sb_min_speed, (float) GPS_POWER_MOVING_KMH);
+    gps_beacon_due = smart_beacon.next_tx > 1 ? lastTX + smart_beacon.next_tx : millis();
   }
-  if (!to_call_end && isalnum(*(p-1)))
-    to_call_end = true;
-  if (!src_call_end || !to_call_end) return 0;
-  return 1;
 }
 
-
-int is_call_blacklisted(const char *frame_start) {
-  // src-call_validation
-  const char *p_call = frame_start;
-  int i = 0;
-  if (!p_call || !*p_call) return 1;
-  if (isdigit(p_call[1]) && isalpha(p_call[2])) {
-    // left-shift g1abc -> _g1abc
-    i = 1;
-    p_call--; // warning, beyond start of pointer
-  }
-  for (; i <= 7; i++) {
-    if (i == 7) return 1;
-    else if (!p_call[i] || p_call[i] == '>' || p_call[i] == '-') {
-      if (i < 4) return 1;
-      break;
-    } else if (i < 2 && !isalnum(p_call[i])) return 1;
-    else if (i == 2 && !isdigit(p_call[i])) return 1;
-    else if (i > 2 && !isalpha(p_call[i])) return 1;
-  }
-
-  // list empty? we may leave here
-  if (!*blacklist_calls || !strcmp(blacklist_calls, ",,"))
-    return 0;
-
-  boolean ssid_present = false;
-  char buf[12]; // room for ",DL1AAA-15," + \0
-  char *p = buf;
-  *p++ = ',';
-  for (i = 0; i < 9; i++) {
-    if (!frame_start[i] || /* frame_start[i] == '>' || */ ! (frame_start[i] == '-' || isalnum(frame_start[i]))) {
-      break;
-    }
-    if (frame_start[i] == '-')
-      ssid_present = true;
-    // callvalidation above prevents calls (excl. ssid) with len > 6.
-    // this loop goes over all positions in DL1AAA-15 (9). But if someone modifies the assurance above, we'll have
-    // a race condition here. If user input is DL1AAAAAA (9 bytes; no ssid present), and we add '-0' afterwards,
-    // the result will be ",DL1AAAAAA-00," -> 13, plus \0. But buf is len 12.
-    // If we are here at position i==6 (behind "DL1AAA"), that means at '-', and we did not found the ssid,
-    // well' enforce a break here.
-    if (i == 6 && !ssid_present)
-      break;
-    *p++ = frame_start[i];
-  }
-  if (!ssid_present) {
-    // for being able to filter out DL1AAA but not DL1AAA-1. -> DL1AAA is DL1AAA-0 by AX.25 definition. Blacklist lists DL1AAA-0. DL1AAA means: filter all variants.:w
-    *p++ = '-'; *p++ = '0';
-  }
-  *p++ = ',';
-  *p = 0;
-
-  // exact match?
-  if (strstr(blacklist_calls, buf))
-    return 2;
-  // filter call completely?
-  if ((p = strchr(buf, '-'))) {
-    *p++ = ','; *p++ = 0;
-    if (strstr(blacklist_calls, buf))
-      return 3;
-  }
-
-  char *header_end = strchr(frame_start, ':');
-  // check for blacklisted digi in path
-  if (header_end && (p = strchr(frame_start, ','))) {
-    for (;;) {
-      char *q = strchr(p+1, ',');
-      if (!q || q > header_end)
-        q = header_end;
-      // copy ",DL1AAA,.." to buf as ",DL1AAA"
-      // but before: length check. len ",DL1AAA-15*," is 12; sizeof(buf) is 12 (due to \0); we copy until trailing ','.
-      if ((q-p) > sizeof(buf)-1)
-        break;
-      strncpy(buf, p, q-p);
-      buf[q-p] = 0;
-      char *r = strchr(buf, '*');
-      if (r)
-        *r = 0;
-      // our ssid filter construct: -0 means search for call with ssid 0 zero.
-      if (!(r = strchr(buf, '-')))
-        strcat(buf, "-0");
-      // after modifications above, is len(buf) still < 10 (space for ',' and \0)?
-      if (strlen(buf) > 10)
-        return 0;
-      strcat(buf, ",");
-      // exact match?
-      if (strstr(blacklist_calls, buf))
-        return 4;
-      // filter call completely?
-      if ((r = strchr(buf, '-'))) {
-        *r++ = ','; *r++ = 0;
-        if (strstr(blacklist_calls, buf))
-          return 5;
-      }
-      if (q == header_end)
-        break;
-      p = q;
-    }
-  }
-  
-  return 0;
+void enableOled() {
+  // This function enables OLED display after pressing a button
+  tempOled = true;
+  oled_timer = millis() + oled_timeout;
 }
 
-
 // rf95.lastSNR() returns unsigned 8bit value, which we get as input
 int bg_rf95snr_to_snr(uint8_t snr)
 {
@@ -1786,34 +1883,11 @@ int bg_rf95rssi_to_rssi(int rssi)
 
 char *encode_snr_rssi_in_path()
 {
-  static char buf[7]; // length for "Q2373X" == 6 + 1 (\0) == 7
-  *buf = 0;
   // SNR values reported by rf95.lastSNR() are not plausible. See those two projects:
   // https://github.com/Lora-net/LoRaMac-node/issues/275
   // https://github.com/mayeranalytics/pySX127x/blob/master/SX127x/LoRa.py
   // rf95snr_to_snr returns values in range -32 to 31. The lowest two bits are RFU
-  int snr = bg_rf95snr_to_snr(rf95.lastSNR());
-  int rssi = bg_rf95rssi_to_rssi(rf95.lastRssi());
-  if (snr > 99) snr = 99;			// snr will not go upper 31
-  else if (snr < -99) snr = -99;		// snr will not go below -32
-  if (rssi > 0) rssi = 0;			// rssi is always negative
-  else if (rssi < -259) rssi = -259;		// rssi will not be below -174 anyway ;)
-  // Make SNR >= 0 human readable:
-  //   First position: SNR < 0: replace -1 by A1, -10 by B0, ...
-  //   This way, we reduce "-10" to two letters: B0.
-  // Make RSSI  > -100 RSSI human readable.
-  //   First position: rssi < -99 -> 0. We'll use 91 for rssi -91 instead of J1 for better readibility.
-  //   K means -10x, L means -11x, M means -12x, N means -13x, ...   (everone knows, 'N' is #13 in alphabet out of 26 chars ;)
-  //   => With this, we reduce "-110" to two letters: L0.
-  // Last position of call (6) is left empty for future use. As well as SSID 1-15. Could be used for BER, RX antenna gain, EIRP, ..
-  // => This is a good compromise between efficiency and being able to quickly interprete snr and rssi
-  sprintf(buf, "Q%c%01d%c%01d",
-    ((snr >= 0 ? snr : -snr) / 10) + (snr >= 0 ? '0' : 'A'),
-    (snr >= 0 ? snr : -snr) % 10,
-    (-rssi / 10) + (rssi > -100 ? '0' : 'A'),
-    (-rssi) % 10);
- 
-  return buf;
+  return encode_snr_rssi(bg_rf95snr_to_snr(rf95.lastSNR()), bg_rf95rssi_to_rssi(rf95.lastRssi()));
 }
 
 
@@ -1886,300 +1960,51 @@ char *append_element_to_path(const char *data, const char *element) {
 }
 
 
-#define AX_ADDR_LEN 9   // room for "DL9SAU-15" == 9
-#define AX_DIGIS_MAX 8
-
-struct axaddr {
-  char addr[AX_ADDR_LEN+1];
-  boolean repeated;
-};
-
-struct ax25_frame {
-  struct axaddr src;
-  struct axaddr dst;
-  struct axaddr digis[AX_DIGIS_MAX];
-  uint8_t n_digis;
-  char *data;
-};
-
-struct ax25_frame *tnc_format_to_ax25_frame(const char *s)
+// Only from setup() and loop() (the same task): loop() reads digi_rules_active without a lock.
+// The webserver dry-run compiles the form (cfg_check_aprs) and leaves the swap to apply_settings() in loop().
+int digipeater_rules_set(const char *rules_text, char *err, size_t errlen)
 {
-  static char data[BG_RF95_MAX_MESSAGE_LEN+1];
-  static struct ax25_frame frame;
-  char *p;
-  char *q;
-  char *next_digi = 0;
-
-  memset(&frame, 0, sizeof(frame));
-  *data = 0;
-
-  if (strlen(s) > sizeof(data) -1)
-    return 0;
-  strcpy(data, s);
-
-  p = strchr(data, ':');
-  if (!p || strlen(p) > sizeof(data)-1)
-    return 0;
-  // skip leading ':'
-  frame.data = p+1;
-  *p = 0;
-
-  p = data;
-  if (!(q = strchr(p, '>')))
-    return 0;
-  *q = 0;
-  if (!*p || strlen(p) > AX_ADDR_LEN)
-    return 0;
-  strcpy(frame.src.addr, p);
-
-  p = q+1;
-  if ((q = strchr(p, ','))) {
-    next_digi = q+1;
-    *q = 0;
-  }
-  if (!*p || strlen(p) > AX_ADDR_LEN)
-    return 0;
-  strcpy(frame.dst.addr, p);
-
-  int digi;
-  for (digi = 0; digi < AX_DIGIS_MAX && next_digi; digi++) {
-    p = next_digi;
-    if ((q = strchr(p, ','))) {
-      next_digi = q+1;
-      *q = 0;
-    } else
-      next_digi = 0;
-
-    if ((q = strchr(p, '*'))) {
-      frame.digis[digi].repeated = true;
-      *q = 0;
-    }
-    if (!*p || strlen(p) > AX_ADDR_LEN)
-      return 0;
-    strcpy(frame.digis[digi].addr, p);
-    // max digi cound reached, but frame had more digis in path
-    if (digi == AX_DIGIS_MAX-1 && next_digi)
-      return 0;
-  }
-
-  // sanity check
-  for (digi = 0; digi < AX_DIGIS_MAX && *(frame.digis[digi].addr); digi++) {
-    if (!frame.digis[digi].repeated && !strncmp(frame.digis[digi].addr, "WIDE", 4) && strlen(frame.digis[digi].addr) == 5)
-        frame.digis[digi].repeated = true;
-  }
-  boolean last_repeated_found = false;
-  for (digi = AX_DIGIS_MAX-1; digi >= 0; digi--) {
-    if (!*(frame.digis[digi].addr))
-      continue;
-    // once: set n_digis
-    if (!frame.n_digis)
-      frame.n_digis = digi+1;
-    if (!last_repeated_found && frame.digis[digi].repeated)
-      last_repeated_found = true;
-    else if (last_repeated_found && !frame.digis[digi].repeated)
-      frame.digis[digi].repeated = true;
-  }
-
-  return &frame;
+  static TaskHandle_t owner = xTaskGetCurrentTaskHandle();
+  if (xTaskGetCurrentTaskHandle() != owner) {
+    snprintf(err, errlen, "rules are only set by loop()");
+    return -1;
+  }
+  // Compile into the table which is not in use, and swap afterwards. loop() never sees a half compiled table.
+  struct digi_rules *next = (digi_rules_active == &digi_rules_tables[0]) ? &digi_rules_tables[1] : &digi_rules_tables[0];
+  if (digi_rules_compile((rules_text && *rules_text) ? rules_text : digi_rules_for_mode(lora_digipeating_mode), Tcall.c_str(), next, err, errlen) < 0)
+    return -1;
+  digi_rules_active = next;
+  return 0;
 }
 
 
-void handle_lora_frame_for_lora_digipeating(const char *received_frame, const char *snr_rssi)
+// returns DIGI_QUEUE_*
+int handle_lora_frame_for_lora_digipeating(const char *received_frame, const char *snr_rssi, uint8_t rx_qrg)
 {
+  struct digi_link link;
+  PROFILE_BEGIN(t_profile);
+  heard_stations_digi_link(received_frame, bg_rf95rssi_to_rssi(rf95.lastRssi()), bg_rf95snr_to_snr(rf95.lastSNR()), &link);
+  int queued = digi_queue_frame(&lora_digi_queue, digi_rules_active, lora_digipeating_mode, received_frame, rx_qrg, snr_rssi, &link, millis());
+  PROFILE_END(PROFILE_DIGI_DECISION, t_profile);
+  return queued;
+}
 
-  if (snr_rssi && !*snr_rssi)
-    snr_rssi = 0;
-
-  struct ax25_frame* frame = tnc_format_to_ax25_frame(received_frame);
-
-  if (!frame)
-    return;
-
-  // no room left for adding our call in path during repeating
-  if (frame->n_digis > AX_DIGIS_MAX)
+// Frame in the digipeating queue (heard on the main frequency) on the cross-digi frequency, if enabled and set.
+// New frames go out without delay, held ones when they are released.
+void lora_digi_queue_send_cross()
+{
+  if (lora_cross_digipeating_mode < 1 || lora_freq_cross_digi <= 1.0 || lora_freq_cross_digi == lora_freq)
     return;
-
-  // aprs-message / query addressed to us? Format: ":DL9SAU-15:..."
-  if (frame->data[0] == ':' && strlen(frame->data) > 10 && frame->data[10] == ':' &&
-       !strncmp((frame->data)+1, Tcall.c_str(), Tcall.length()) && (Tcall.length() == 9 || frame->data[9] == ' '))
+  // word 'NOGATE' part of the header? Don't gate it
+  const char *q = strstr(lora_digi_queue.frame, ",NOGATE");
+  if (q && q < strchr(lora_digi_queue.frame, ':'))
     return;
-
-  // '>' and ':' found. Always in header. Sanity check: if ',' present, it must be > p. If r exists, must be > q. And header_end must be > than the others and always a message-body *(header_end + 1) != 0.
-
-  // wide1-digi case
-  if (lora_digipeating_mode == 2) {
-    const char *p = strchr(received_frame, '>');
-    const char *q = strchr(received_frame, ','); // digis, optional 
-    const char *r = strchr(received_frame, '*');
-    const char *header_end = strchr(received_frame, ':');
-    // we hear an packet, digipeated from another digipeater (same source call, digipeated flag '*' in header)
-    // and have the original packet in our digipeating queue? -> clear queue.
-    // If we are a WIDE2 digi, it may be desired that we digipeat him.
-    // We'll throw that frame away if further down the new frame is worth digipeating. We don't build up Digipeating-TX-queues
-    if (p && strncmp(lora_TXBUFF_for_digipeating, received_frame, p-received_frame) && r && r > q && r < header_end && *(header_end+1))
-      *lora_TXBUFF_for_digipeating = 0;
-  }
-
-  int i = 0;
-#ifdef notdef
-  // src-call_validation
-  // not here anymore; now in is_call_blacklisted()
-  char *p_call = frame->src.addr;
-  if (isdigit(p_call[1]) && isalpha(p_call[2])) {
-    // left-shift g1abc -> _g1abc
-    i = 1;
-    p_call--; // warning, beyond start of pointer
-  }
-  for (; i <= 7; i++) {
-    if (i == 7) return;
-    else if (!p_call[i] || p_call[i] == '-') {
-      if (i < 4) return;
-      break;
-    } else if (i < 2 && !isalnum(p_call[i])) return;
-    else if (i == 2 && !isdigit(p_call[i])) return;
-    else if (i > 2 && !isalpha(p_call[i])) return;
-  }
+  loraSend(txPower_cross_digi, lora_freq_cross_digi, lora_speed_cross_digi, String(lora_digi_queue.frame), "digi");  //send the packet, data is in TXbuff from lora_TXStart to lora_TXEnd
+  writedisplaytext("  ((TX cross-digi))", "", String(lora_digi_queue.frame), "", "", "");
+#ifdef KISS_PROTOCOL
+  char *s = add_element_to_path(lora_digi_queue.frame, "GATE");
+  sendToTNC(s ? String(s) : lora_digi_queue.frame);
 #endif
-
-  // If DST-call-ssid-digipeating: rewrite before adding path, because WIDE in path and DST-SSID-digipeating are mutual exclusive
-  char *q;
-  if ((q = strchr(frame->dst.addr, '-'))) {
-    if (frame->n_digis && frame->digis[0].repeated)
-      return;
-    if (frame->n_digis > AX_DIGIS_MAX-1)
-      return;
-    *q++ = 0;
-    if (*q < '1' || *q > '7' || q[1] )
-      return;
-    for (i = 0; i < frame->n_digis; i++)
-      if (!strncmp(frame->digis[i].addr, "WIDE", 4) || !strcmp(frame->digis[i].addr, Tcall.c_str()))
-        return;
-    // move digi path one right
-    for (i = frame->n_digis-1; i >= 0; i--) {
-      strcpy(frame->digis[i+1].addr, frame->digis[i].addr);
-      frame->digis[i+1].repeated = frame->digis[i].repeated;
-    }
-    sprintf(frame->digis[0].addr, "WIDE%c-%c", *q, *q);
-    frame->digis[0].repeated = false;
-    frame->n_digis++;
-  }
-
-  // nothing to repeat:
-  if (!frame->n_digis)
-    return;
-
-  // we do not digipeat our own packets
-  if (!strcmp(frame->src.addr, Tcall.c_str()))
-    return;
-
-  int curr_not_repeated = 0;
-  for (i = 0; i < frame->n_digis; i++) {
-    if (!frame->digis[i].repeated) {
-      curr_not_repeated = i;
-      break;
-    }
-    // our call with digipeated marker in header?
-    if (!strcmp(frame->digis[i].addr, Tcall.c_str()))
-      return;
-  }
-
-  // our call in path?
-  boolean add_our_call = true;
-  int insert_our_data_before = -1;
-  if (!strcmp(frame->digis[curr_not_repeated].addr, Tcall.c_str())) {
-    // digi path too long for adding snr_rssi? skip adding snr_rssi
-    if (snr_rssi && frame->n_digis == AX_DIGIS_MAX)
-      snr_rssi = 0;
-    frame->digis[curr_not_repeated].repeated = true;
-    add_our_call = false;
-    insert_our_data_before = curr_not_repeated;
-    // if we are a digicall-only digi, our job ends here
-    goto add_our_data;
-  }
-
-  if (lora_digipeating_mode < 2)
-    return;
-
-  // digi path too long for adding our call skip adding snr_rssi
-  if (frame->n_digis == AX_DIGIS_MAX)
-    return;
-  // digi path too long for adding snr_rssi and our call? skip adding snr_rssi
-  if (snr_rssi && frame->n_digis +1 == AX_DIGIS_MAX)
-    snr_rssi = 0;
-
-  if (!strcmp(frame->digis[curr_not_repeated].addr, "WIDE1-1")) {
-    frame->digis[curr_not_repeated].addr[5] = 0;
-    frame->digis[curr_not_repeated].repeated = 1;
-    if (insert_our_data_before < 0)
-      insert_our_data_before = curr_not_repeated;
-    curr_not_repeated++;
-    // If we are a WIDE2 digi, we'll also change WIDE2-n to WIDE2* further down
-  }
-  if (lora_digipeating_mode < 3)
-    goto add_our_data;
-
-  if (!strncmp(frame->digis[curr_not_repeated].addr, "WIDE", 4) && strlen(frame->digis[curr_not_repeated].addr) == 7) {
-    if (frame->digis[curr_not_repeated].addr[4] < '2' || frame->digis[curr_not_repeated].addr[4] > '3')
-      return;
-    if (frame->digis[curr_not_repeated].addr[5] != '-')
-      return;
-    // bad syntax?
-    if (frame->digis[curr_not_repeated].addr[6] < '1' || frame->digis[curr_not_repeated].addr[6] > frame->digis[curr_not_repeated].addr[4])
-      return;
-    // prevent abuse
-    if (curr_not_repeated+1 < frame->n_digis && !strncmp(frame->digis[curr_not_repeated+1].addr, "WIDE", 4))
-        return;
-    // mark every WIDEn-m as WIDEn and repeated
-    frame->digis[curr_not_repeated].addr[5] = 0;
-    frame->digis[curr_not_repeated].repeated = 1;
-    if (insert_our_data_before < 0)
-      insert_our_data_before = curr_not_repeated;
-  }
-
-add_our_data:
-
-  // insert_our_data still < 0? i.e. searches like that for WIDE2-1 in path did not lead to a result
-  if (insert_our_data_before < 0)
-    return;
-
-
-  // Build txbuff:
-
-  char buf[sizeof(lora_TXBUFF_for_digipeating)];
-
-  sprintf(buf, "%s>%s", frame->src.addr, frame->dst.addr);
-  char *digi_paths_start = buf + strlen(buf);
-
-  for (i = 0; i < insert_our_data_before; i++)
-    sprintf(buf + strlen(buf), ",%s", frame->digis[i].addr);
-
-  if (snr_rssi)
-    sprintf(buf + strlen(buf), ",%s", snr_rssi);
-
-  if (add_our_call)
-    sprintf(buf + strlen(buf), ",%s", Tcall.c_str());
-
-  for (i = insert_our_data_before; i < frame->n_digis; i++) {
-    sprintf(buf + strlen(buf), ",%s", frame->digis[i].addr);
-    if (frame->digis[i].repeated) {
-      i++;
-      break;
-    }
-  }
-
-  // we have something added after "SRC>DST"?
-  if (strlen(buf) > (digi_paths_start-buf))
-    strcat(buf, "*");
-  for (; i < frame->n_digis; i++)
-    sprintf(buf + strlen(buf), ",%s", frame->digis[i].addr);
-
-  // length check:
-  if (strlen(buf) + 1 /* : */ + strlen(frame->data) > sizeof(lora_TXBUFF_for_digipeating)-1)
-    return;
-
-  sprintf(lora_TXBUFF_for_digipeating, "%s:%s", buf, frame->data);
-  time_lora_TXBUFF_for_digipeating_was_filled = millis();
-
 }
 
 char *s_min_nn(uint32_t min_nnnnn, int high_precision) {
@@ -2261,8 +2086,18 @@ String create_long_aprs(const char *delimiter, RawDegrees lng) {
 void loop() {
 
   esp_task_wdt_reset();
+  #ifdef ENABLE_PREFERENCES
+    preferences.poll();
+    if (settings_apply_pending) {
+      settings_apply_pending = false;
+      apply_settings();
+    }
+  #endif
  
   if (reboot_interval && millis() > reboot_interval) {
+    #ifdef ENABLE_PREFERENCES
+      preferences.commit();
+    #endif
     ESP.restart();
   }
 
@@ -2298,11 +2133,10 @@ void loop() {
 	  SerialBT.end();
 	  delay(100);
 #endif
-	  webServerCfg = {.callsign = Tcall};
-          xTaskCreate(taskWebServer, "taskWebServer", 12000, (void*)(&webServerCfg), 1, nullptr);
-          webserverStarted = true;
-          writedisplaytext("LoRa-APRS","","Init:","WiFi task started","   =:-)   ","");
-	  delay(1500);
+          if (webserver_start()) {
+            writedisplaytext("LoRa-APRS","","Init:","WiFi task started","   =:-)   ","");
+	    delay(1500);
+          }
 #endif
 	}
         key_up = true;
@@ -2357,6 +2191,9 @@ void loop() {
         fixed_beacon_enabled = true;
         #ifdef ENABLE_PREFERENCES
           preferences.putBool(PREF_APRS_GPS_EN, false);
+          #ifdef ENABLE_WIFI
+            web_cfg_changed();
+          #endif
         #endif
       }else{
         gps_state = true;
@@ -2367,6 +2204,9 @@ void loop() {
         fixed_beacon_enabled = false;
         #ifdef ENABLE_PREFERENCES
           preferences.putBool(PREF_APRS_GPS_EN, true);
+          #ifdef ENABLE_WIFI
+            web_cfg_changed();
+          #endif
         #endif
       }
   }
@@ -2535,7 +2375,7 @@ void loop() {
 	  if (!q || q > strchr(data, ':')) {
 	    q = strstr(data, ",RFONLY");
 	    if (!q || q > strchr(data, ':')) {
-	      send_to_aprsis(*TNC2DataFrame);
+	      send_to_aprsis(*TNC2DataFrame, micros());
 	    }
 	  }
 	}
@@ -2543,9 +2383,9 @@ void loop() {
 
 	if (lora_tx_enabled) {
           if (tx_own_beacon_from_this_device_or_fromKiss__to_frequencies % 2)
-            loraSend(txPower, lora_freq, lora_speed, String(data));  //send the packet, data is in TXbuff from lora_TXStart to lora_TXEnd
+            loraSend(txPower, lora_freq, lora_speed, String(data), "KISS");  //send the packet, data is in TXbuff from lora_TXStart to lora_TXEnd
           if (tx_own_beacon_from_this_device_or_fromKiss__to_frequencies > 1 && lora_digipeating_mode > 1 && lora_freq_cross_digi > 1.0 && lora_freq_cross_digi != lora_freq)
-            loraSend(txPower_cross_digi, lora_freq_cross_digi, lora_speed_cross_digi, String(data));  //send the packet, data is in TXbuff from lora_TXStart to lora_TXEnd
+            loraSend(txPower_cross_digi, lora_freq_cross_digi, lora_speed_cross_digi, String(data), "KISS");  //send the packet, data is in TXbuff from lora_TXStart to lora_TXEnd
           enableOled(); // enable OLED
           writedisplaytext("((KISSTX))","","","","","");
           time_to_refresh = millis() + showRXTime;
@@ -2571,7 +2411,11 @@ out:
     // we need to read the received packt, even if rx is set to disable. else rf95.waitAvailableTimeout(100) will always show, data is available
     loraReceivedLength = sizeof(lora_RXBUFF);                           // reset max length before receiving!
     boolean lora_rx_data_available = rf95.recvAPRS(lora_RXBUFF, &loraReceivedLength);
+    if (lora_rx_data_available)
+      PROFILE_SINCE_US(PROFILE_ISR_TO_RECV, rf95.lastRxTime());
     const char *rssi_for_path = encode_snr_rssi_in_path();
+    if (lora_rx_data_available)
+      metrics.rx_frames[(lora_freq_rx_curr == lora_freq) ? METRICS_QRG_MAIN : METRICS_QRG_CROSS]++;
 
     // always needed (even if rx is disabled)
     if (lora_freq_rx_curr == lora_freq) {
@@ -2591,13 +2435,20 @@ out:
 	const char *received_frame = loraReceivedFrameString.c_str();
 
 	// valid packet?
-	if (!packet_is_valid(received_frame)) {
+	PROFILE_BEGIN(t_profile_validate);
+	int valid = packet_is_valid(received_frame);
+	PROFILE_END(PROFILE_VALIDATE, t_profile_validate);
+	if (!valid) {
+	  metrics.rx_invalid++;
 	  goto invalid_packet;
 	}
 
-        int blacklisted = is_call_blacklisted(received_frame);
+	PROFILE_BEGIN(t_profile_blacklist);
+        int blacklisted = is_call_blacklisted(received_frame, blacklist_calls);
+	PROFILE_END(PROFILE_BLACKLIST, t_profile_blacklist);
 	// don't even automaticaly adapt CR for spammers
 	if (blacklisted) {
+	  metrics.rx_blacklisted++;
 	  goto call_invalid_or_blacklisted;
 	}
 
@@ -2621,6 +2472,9 @@ out:
 	    our_packet |= 2;
 	}
 
+	if (!our_packet)
+	  heard_stations_update(received_frame, !digipeatedflag, bg_rf95rssi_to_rssi(rf95.lastRssi()), bg_rf95snr_to_snr(rf95.lastSNR()), millis());
+
 	// CR adaption: because only for SF12 different CR levels have been defined, we unfortunately cannot deal with SF < 12.
 	// In most cases, only useful for normal users, not for WIDE1 or WIDE2 digis. But there may exist good reasons; thus we don't enforce.
 	if (lora_automatic_cr_adaption && lora_speed <= 300L) {
@@ -2650,12 +2504,15 @@ out:
 	      if (((lora_add_snr_rssi_to_path & FLAG_ADD_SNR_RSSI_FOR_APRSIS) || user_demands_trace > 1) ||
 	          (!digipeatedflag && ((lora_add_snr_rssi_to_path & FLAG_ADD_SNR_RSSI_FOR_APRSIS__ONLY_IF_HEARD_DIRECT) || user_demands_trace == 1)) )
 	        s = append_element_to_path(received_frame, rssi_for_path);
-	      send_to_aprsis(s ? String(s) : loraReceivedFrameString);
+	      send_to_aprsis(s ? String(s) : loraReceivedFrameString, rf95.lastRxTime());
 	    }
 	  }
 	}
 #endif
 
+    #ifdef ENABLE_WIFI
+        web_event_frame("RX", loraReceivedFrameString, bg_rf95rssi_to_rssi(rf95.lastRssi()), bg_rf95snr_to_snr(rf95.lastSNR()), lora_freq_rx_curr);
+    #endif
     #ifdef SHOW_RX_PACKET                                                 // only show RX packets when activitated in config
         writedisplaytext("  ((RX))", "", loraReceivedFrameString, "", "", "");
         #ifdef ENABLE_WIFI
@@ -2672,27 +2529,19 @@ out:
 	sendToTNC(s ? String(s) : loraReceivedFrameString);
         #endif
 
-	// Are we configured as lora digi? Are we listening on the main frequency?
-	if (lora_tx_enabled && lora_digipeating_mode > 0 && !our_packet && !blacklisted && lora_freq_rx_curr == lora_freq) {
-	  uint32_t time_lora_TXBUFF_for_digipeating_was_filled_prev = time_lora_TXBUFF_for_digipeating_was_filled;
+	// Are we configured as lora digi? Do we have rules for the frequency we are listening on?
+	uint8_t rx_qrg = (lora_freq_rx_curr == lora_freq) ? DIGI_QRG_MAIN : DIGI_QRG_CROSS;
+	if (lora_tx_enabled && lora_digipeating_mode > 0 && !our_packet && !blacklisted && (digi_rules_active->qrg & rx_qrg)) {
+	  int queued;
 	  if (((lora_add_snr_rssi_to_path & FLAG_ADD_SNR_RSSI_FOR_RF) || user_demands_trace > 1) ||
 	         (!digipeatedflag && ((lora_add_snr_rssi_to_path & FLAG_ADD_SNR_RSSI_FOR_RF__ONLY_IF_HEARD_DIRECT) || user_demands_trace == 1)) )
-            handle_lora_frame_for_lora_digipeating(received_frame, rssi_for_path);
+            queued = handle_lora_frame_for_lora_digipeating(received_frame, rssi_for_path, rx_qrg);
 	  else
-            handle_lora_frame_for_lora_digipeating(received_frame, NULL);
-	  // new frame in digipeating queue? cross-digi freq enabled and freq set? Send without delay.
-          if (*lora_TXBUFF_for_digipeating && lora_cross_digipeating_mode > 0 && lora_freq_cross_digi > 1.0 && lora_freq_cross_digi != lora_freq && time_lora_TXBUFF_for_digipeating_was_filled > time_lora_TXBUFF_for_digipeating_was_filled_prev) {
-	    // word 'NOGATE' part of the header? Don't gate it
-	    q = strstr(lora_TXBUFF_for_digipeating, ",NOGATE");
-	    if (!q || q > strchr(lora_TXBUFF_for_digipeating, ':')) {
-              loraSend(txPower_cross_digi, lora_freq_cross_digi, lora_speed_cross_digi, String(lora_TXBUFF_for_digipeating));  //send the packet, data is in TXbuff from lora_TXStart to lora_TXEnd
-              writedisplaytext("  ((TX cross-digi))", "", String(lora_TXBUFF_for_digipeating), "", "", "");
-#ifdef KISS_PROTOCOL
-	      s = add_element_to_path(lora_TXBUFF_for_digipeating, "GATE");
-	      sendToTNC(s ? String(s) : lora_TXBUFF_for_digipeating);
-#endif
-	    }
-	  }
+            queued = handle_lora_frame_for_lora_digipeating(received_frame, NULL, rx_qrg);
+	  // new frame in digipeating queue, heard on main frequency? Cross-digi without delay.
+	  // Held frames wait for their release from the queue: a duplicate heard meanwhile still cancels them.
+	  if (queued == DIGI_QUEUE_QUEUED && rx_qrg == DIGI_QRG_MAIN)
+	    lora_digi_queue_send_cross();
 	}
       }
     } else {
@@ -2787,81 +2636,12 @@ invalid_packet:
     goto behind_position_tx;
 
 
-  average_speed[point_avg_speed] = gps.speed.kmph();   // calculate smart beaconing
-  ++point_avg_speed;
-  if (point_avg_speed>4) {
-    point_avg_speed=0;
-  }
-
-  average_speed_final = (average_speed[0]+average_speed[1]+average_speed[2]+average_speed[3]+average_speed[4])/5;
-  average_course[point_avg_course] = gps.course.deg();   // calculate smart beaconing course
-  ++point_avg_course;
-
-  if (point_avg_course>(ANGLE_AVGS-1)) {
-    point_avg_course=0;
-    avg_c_y = 0;
-    avg_c_x = 0;
-    for (int i=0;i<ANGLE_AVGS;i++) {
-      avg_c_y += sin(average_course[i]/180*3.1415);
-      avg_c_x += cos(average_course[i]/180*3.1415);
-    }
-    new_course = atan2f(avg_c_y,avg_c_x)*180/3.1415;
-    if (new_course < 0) {
-        new_course=360+new_course;
-      }
-    // tooo much false positives
-    // Only in 30s interval and if we did not announce turn in last round.
-    // Algo from Kenwood SB Docu. Considered values should be int.
-    // algo is: (int ) ((int )sb_angle + 10 * turn_slope / (int ) mph). In km/h, we have (int ) ((int ) ab_angle + 16 *turn_slope / (int ) mph)
-    if (nextTX > 1 && (millis()-lastTX) > (sb_turn_time*1000L) && average_speed_final >= sb_min_speed) {
-        // cave: average_speed_final must not be 0 (division by zero). Becuse sb_min_speed may be configured as zero, check above is not enough
-        int int_average_speed_final = (int ) average_speed_final;
-        if (int_average_speed_final < 1) int_average_speed_final = 1;
-        int sb_turn_threshold=min(120, (int ) ((int ) sb_angle + 16 * sb_turn_slope / int_average_speed_final));
-        if ((old_course < sb_turn_threshold) && (new_course > (360-sb_turn_threshold))) {
-          if (abs(new_course-old_course-360)>=sb_turn_threshold) {
-            nextTX = 1;
-          }
-        } else {
-          if ((old_course > (360-sb_turn_threshold)) && (new_course < sb_turn_threshold)) {
-            if (abs(new_course-old_course+360)>=sb_turn_threshold) {
-              nextTX = 1;
-            }
-          } else {
-            if (abs(new_course-old_course)>=sb_turn_threshold) {
-              nextTX = 1;
-            }
-          }
-      }
-    }
-    old_course = new_course;
-  }
-
-  if ((millis()<sb_max_interval)&&(lastTX == 0)) {
-    nextTX = 0;
-  }
-
-  // No course change (indicator nextTX==1)? Recomputei nextTX
-  if (nextTX > 1 && millis()-lastTX >= sb_min_interval) {
-#ifdef SB_ALGO_KENWOOD
-    if (average_speed_final < sb_min_speed)
-      nextTX = sb_max_interval;
-    else if (average_speed_final > sb_max_speed)
-      nextTX = sb_min_interval;
-    else {
-      nextTX = sb_min_interval * sb_max_speed / average_speed_final;
-      if (nextTX > sb_max_interval)
-        nextTX = sb_max_interval;
-    }
-#else
-    // dl9sau: imho, too affine at high speed level
-    //nextTX = (sb_max_interval-sb_min_interval)/(sb_max_speed-sb_min_speed)*(sb_max_speed-average_speed_final)+sb_min_interval;
-    // next computation could become negative (if we are faster than sb_max_speed). fixes: either work with temporary signed long variable, or test if sb_max_speed < average_speed_final.
-    nextTX = ((sb_max_speed > average_speed_final) ? ((sb_max_interval-sb_min_interval)/(sb_max_speed-sb_min_speed)*(sb_max_speed-average_speed_final)+sb_min_interval) : sb_min_interval);
-    //if (nextTX < sb_min_interval) {nextTX=sb_min_interval;}   // already assured (  (sb_max_speed <= average_speed_final) -> nextTX=sb_min_interval)
-    if (nextTX > sb_max_interval) {nextTX=sb_max_interval;}
- #endif
-    // now, nextTX is <= sb_min_interval
+  // calculate smart beaconing, with the first fix of each second: the averages are over
+  // SB_SPEED_AVGS / SB_ANGLE_AVGS seconds, also with gps_ubx_rate up to 10 fixes per second
+  sb_params_update();
+  if (gps.time.isValid() && gps.time.value() / 100 != sb_fix_time) {
+    sb_fix_time = gps.time.value() / 100;
+    sb_fix(&smart_beacon, &smart_beacon_params, gps.speed.kmph(), gps.course.deg(), millis(), lastTX);
   }
 
   // LatShownP  = gg-mm.dd[N|S]
@@ -2875,8 +2655,8 @@ invalid_packet:
   }
 
   // rate limit to 20s in SF12 CR4/5 aka lora_speed 300; 5s in lora_speed 1200 (SF9 CR4/7). -> 1200/lora_speed*5 seconds == 6000000 / lora_speed ms
-  // If special case nextTX <= 1: we already enforced rate-limiting (see course computation)
-  if (!fixed_beacon_enabled && !dont_send_own_position_packets && lora_tx_enabled && (lastTX+nextTX) < millis() && (nextTX <= 1 || (millis()-lastTX) >= (6000000L / lora_speed ))) {
+  // sb_due() first: it recomputes next_tx, shown on the display
+  if (sb_due(&smart_beacon, &smart_beacon_params, millis(), lastTX, 6000000L / lora_speed) && !fixed_beacon_enabled && !dont_send_own_position_packets && lora_tx_enabled) {
     if (gps.location.age() < 2000) {
       enableOled(); // enable OLED
       writedisplaytext(" ((TX))","","LAT: "+LatShownP,"LON: "+LongShownP,"SPD: "+String(gps.speed.kmph(),1)+"  CRS: "+String(gps.course.deg(),1),getSatAndBatInfo());
@@ -2884,8 +2664,7 @@ invalid_packet:
       // for fixed beacon (if we loose gps fix, we'll send our last position in fix_beacon_interval)
       next_fixed_beacon = millis() + fix_beacon_interval;
       t_last_smart_beacon_sent = millis();
-      // We just transmitted. We transmitted due to turn? Don't TX again in next round:
-      if (nextTX < sb_min_interval) nextTX = sb_min_interval;
+      sb_sent(&smart_beacon, &smart_beacon_params);
     } else {
       if (millis() > time_to_refresh){
         displayInvalidGPS();
@@ -2894,7 +2673,7 @@ invalid_packet:
   } else {
     if (millis() > time_to_refresh){
       if (gps.location.age() < 2000) {
-        writedisplaytext(" "+Tcall,"Time to TX: "+ (dont_send_own_position_packets || !lora_tx_enabled) ? "never" : (fixed_beacon_enabled ? String((next_fixed_beacon-millis()) / 1000) : (String(((lastTX+nextTX)-millis())/1000)+"sec")),"LAT: "+LatShownP,"LON: "+LongShownP,"SPD: "+String(gps.speed.kmph())+"  CRS: "+String(gps.course.deg(),1),getSatAndBatInfo());
+        writedisplaytext(" "+Tcall,"Time to TX: "+ (dont_send_own_position_packets || !lora_tx_enabled) ? "never" : (fixed_beacon_enabled ? String((next_fixed_beacon-millis()) / 1000) : (String(((lastTX+smart_beacon.next_tx)-millis())/1000)+"sec")),"LAT: "+LatShownP,"LON: "+LongShownP,"SPD: "+String(gps.speed.kmph())+"  CRS: "+String(gps.course.deg(),1),getSatAndBatInfo());
       } else {
         displayInvalidGPS();
       }
@@ -2902,6 +2681,7 @@ invalid_packet:
   }
 
 behind_position_tx:
+  gps_power_plan();
 
   #if defined(ENABLE_TNC_SELF_TELEMETRY) && defined(KISS_PROTOCOL)
     if (nextTelemetryFrame < millis()){
@@ -2944,18 +2724,26 @@ behind_position_tx:
 
 
   // Data for digipeating in queue?
-  if (lora_tx_enabled && lora_rx_enabled && lora_digipeating_mode && *lora_TXBUFF_for_digipeating) {
+  if (lora_tx_enabled && lora_rx_enabled && lora_digipeating_mode && *lora_digi_queue.frame) {
     // 5s grace time (plus up to 250ms random) for digipeating. 10s if we are a fill-in digi
-    if ((time_lora_TXBUFF_for_digipeating_was_filled + 5*lora_digipeating_mode*1000L + (millis() % 250)) < millis()) {
-      if (lora_cross_digipeating_mode < 2 && (time_lora_TXBUFF_for_digipeating_was_filled + 2* 5*lora_digipeating_mode*1000L) > millis()) {
+    int due = digi_queue_due(&lora_digi_queue, lora_digipeating_mode, lora_cross_digipeating_mode, millis());
+    if (due) {
+      // released held frame (only held if heard on main frequency): its cross-digi is due now, too.
+      // Only cross-digipeating (mode 2): the queue reports the release as -1
+      if (lora_digi_queue.held && (due > 0 || lora_cross_digipeating_mode > 1))
+        lora_digi_queue_send_cross();
+      if (due > 0) {
         // if SF12: we degipeat in fastest mode CR4/5. -> if lora_speed < 300 tx in lora_speed_300.
-        loraSend(txPower, lora_freq, (lora_speed < 300) ? 300 : lora_speed, String(lora_TXBUFF_for_digipeating));  //send the packet, data is in TXbuff from lora_TXStart to lora_TXEnd
-        writedisplaytext("  ((TX digi))", "", String(lora_TXBUFF_for_digipeating), "", "", "");
+        loraSend(txPower, lora_freq, (lora_speed < 300) ? 300 : lora_speed, String(lora_digi_queue.frame), "digi");  //send the packet, data is in TXbuff from lora_TXStart to lora_TXEnd
+        writedisplaytext("  ((TX digi))", "", String(lora_digi_queue.frame), "", "", "");
 #ifdef KISS_PROTOCOL
-        sendToTNC(String(lora_TXBUFF_for_digipeating));
+        sendToTNC(String(lora_digi_queue.frame));
 #endif
-      } // else: too late. skip TX
-      *lora_TXBUFF_for_digipeating = 0;
+      } else {
+        // too late. skip TX
+        metrics.digi_too_late++;
+      }
+      *lora_digi_queue.frame = 0;
     }
   }
 
@@ -0,0 +1,67 @@
+#include "metrics.h"
+#include <esp_timer.h>
+
+tMetrics metrics;
+portMUX_TYPE metrics_mux = portMUX_INITIALIZER_UNLOCKED;
+
+static TaskHandle_t metrics_task_handles[METRICS_TASKS_MAX];
+static uint8_t metrics_task_count = 0;
+
+static const char *metrics_boot_phase_names[METRICS_BOOT_PHASES_MAX];
+static uint32_t metrics_boot_phase_ms[METRICS_BOOT_PHASES_MAX];
+static uint8_t metrics_boot_phase_count = 0;
+
+void metrics_register_task() {
+  portENTER_CRITICAL(&metrics_mux);
+  if (metrics_task_count < METRICS_TASKS_MAX)
+    metrics_task_handles[metrics_task_count++] = xTaskGetCurrentTaskHandle();
+  portEXIT_CRITICAL(&metrics_mux);
+}
+
+uint8_t metrics_tasks(TaskHandle_t *tasks, uint8_t max) {
+  uint8_t n;
+  portENTER_CRITICAL(&metrics_mux);
+  for (n = 0; n < metrics_task_count && n < max; n++)
+    tasks[n] = metrics_task_handles[n];
+  portEXIT_CRITICAL(&metrics_mux);
+  return n;
+}
+
+uint8_t metrics_tx_kind(const char *kind) {
+  if (!strcmp(kind, "KISS"))
+    return METRICS_TX_KISS;
+  if (!strcmp(kind, "digi"))
+    return METRICS_TX_DIGI;
+  if (!strcmp(kind, "IS"))
+    return METRICS_TX_IS;
+  return METRICS_TX_OWN;
+}
+
+void metrics_boot_phase(const char *phase) {
+  uint32_t ms = (uint32_t) (esp_timer_get_time() / 1000);
+  bool added = false;
+  uint8_t i;
+  portENTER_CRITICAL(&metrics_mux);
+  // only the first time (APRS-IS logs in again after a disconnect)
+  for (i = 0; i < metrics_boot_phase_count && strcmp(metrics_boot_phase_names[i], phase); i++)
+    ;
+  if (i == metrics_boot_phase_count && metrics_boot_phase_count < METRICS_BOOT_PHASES_MAX) {
+    metrics_boot_phase_names[metrics_boot_phase_count] = phase;
+    metrics_boot_phase_ms[metrics_boot_phase_count++] = ms;
+    added = true;
+  }
+  portEXIT_CRITICAL(&metrics_mux);
+  if (added)
+    Serial.printf("Boot: %s after %lu ms\n", phase, (unsigned long) ms);
+}
+
+uint8_t metrics_boot_phases(const char **phases, uint32_t *ms, uint8_t max) {
+  uint8_t n;
+  portENTER_CRITICAL(&metrics_mux);
+  for (n = 0; n < metrics_boot_phase_count && n < max; n++) {
+    phases[n] = metrics_boot_phase_names[n];
+    ms[n] = metrics_boot_phase_ms[n];
+  }
+  portEXIT_CRITICAL(&metrics_mux);
+  return n;
+}
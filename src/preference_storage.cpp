@@ -1,3 +1,538 @@
 #include "preference_storage.h"
+#include <nvs.h>
+#include <rom/crc.h>
 
-Preferences preferences;
\ No newline at end of file
+ConfigStore preferences;
+
+#define CFG_BLOB_KEY "cfg_blob"
+#define CFG_BLOB_MAGIC 0x47464354     // "TCFG"
+
+#define CFG_TYPE_BOOL 1
+#define CFG_TYPE_INT 2
+#define CFG_TYPE_UINT 3
+#define CFG_TYPE_DOUBLE 4
+#define CFG_TYPE_STRING 5
+
+struct cfg_entry {
+  char key[16];                       // NVS keys have at most 15 chars
+  uint8_t type;
+  union {
+    int32_t i;
+    uint32_t u;
+    double d;
+  } v;
+  char *s;                            // CFG_TYPE_STRING, malloced
+};
+
+// blob: header, then per entry: key length, key, type, value. Strings with a 16 bit length
+struct cfg_blob_header {
+  uint32_t magic;
+  uint16_t version;
+  uint16_t count;
+  uint32_t len;                       // of the entries after the header
+  uint32_t crc;                       // crc32_le() of the entries
+};
+
+// Keys of the layout before the blob, one NVS entry each. Only read once for the
+// migration, so new settings need not be added here
+static const char *const cfg_legacy_keys[] = {
+  PREF_WIFI_SSID, PREF_WIFI_PASSWORD, PREF_AP_PASSWORD, PREF_NTP_SERVER, PREF_WIFI_ENABLE_INIT,
+  PREF_WIFI_ENABLE, PREF_WIFI_TXPWR_MODE_AP_INIT, PREF_WIFI_TXPWR_MODE_AP, PREF_WIFI_TXPWR_MODE_STA_INIT,
+  PREF_WIFI_TXPWR_MODE_STA, PREF_TNCSERVER_ENABLE_INIT, PREF_TNCSERVER_ENABLE, PREF_GPSSERVER_ENABLE_INIT,
+  PREF_GPSSERVER_ENABLE, PREF_LORA_FREQ_PRESET_INIT, PREF_LORA_FREQ_PRESET, PREF_LORA_SPEED_PRESET_INIT,
+  PREF_LORA_SPEED_PRESET, PREF_LORA_RX_ENABLE_INIT, PREF_LORA_RX_ENABLE, PREF_LORA_TX_ENABLE_INIT,
+  PREF_LORA_TX_ENABLE, PREF_LORA_TX_POWER_INIT, PREF_LORA_TX_POWER,
+  PREF_LORA_ADD_SNR_RSSI_TO_PATH_PRESET_INIT, PREF_LORA_ADD_SNR_RSSI_TO_PATH_PRESET,
+  PREF_LORA_ADD_SNR_RSSI_TO_PATH_END_AT_KISS_PRESET_INIT, PREF_LORA_ADD_SNR_RSSI_TO_PATH_END_AT_KISS_PRESET,
+  PREF_LORA_FREQ_CROSSDIGI_PRESET_INIT, PREF_LORA_FREQ_CROSSDIGI_PRESET,
+  PREF_LORA_TX_BEACON_AND_KISS_TO_FREQUENCIES_PRESET_INIT,
+  PREF_LORA_TX_BEACON_AND_KISS_TO_FREQUENCIES_PRESET, PREF_LORA_TX_BEACON_AND_KISS_TO_APRSIS_PRESET_INIT,
+  PREF_LORA_TX_BEACON_AND_KISS_TO_APRSIS_PRESET, PREF_LORA_SPEED_CROSSDIGI_PRESET_INIT,
+  PREF_LORA_SPEED_CROSSDIGI_PRESET, PREF_LORA_TX_POWER_CROSSDIGI_PRESET_INIT,
+  PREF_LORA_TX_POWER_CROSSDIGI_PRESET, PREF_LORA_RX_ON_FREQUENCIES_PRESET_INIT,
+  PREF_LORA_RX_ON_FREQUENCIES_PRESET, PREF_LORA_AUTOMATIC_CR_ADAPTION_PRESET_INIT,
+  PREF_LORA_AUTOMATIC_CR_ADAPTION_PRESET, PREF_APRS_DIGIPEATING_MODE_PRESET_INIT,
+  PREF_APRS_DIGIPEATING_MODE_PRESET, PREF_APRS_CROSS_DIGIPEATING_MODE_PRESET_INIT,
+  PREF_APRS_CROSS_DIGIPEATING_MODE_PRESET, PREF_APRS_DIGIPEATING_RULES_INIT, PREF_APRS_DIGIPEATING_RULES,
+  PREF_APRS_CALLSIGN, PREF_APRS_RELAY_PATH, PREF_APRS_RELAY_PATH_INIT, PREF_APRS_SYMBOL_TABLE,
+  PREF_APRS_SYMBOL, PREF_APRS_COMMENT, PREF_APRS_COMMENT_INIT, PREF_APRS_COMMENT_RATELIMIT_PRESET,
+  PREF_APRS_COMMENT_RATELIMIT_PRESET_INIT, PREF_APRS_SHOW_ALTITUDE, PREF_APRS_SHOW_ALTITUDE_INIT,
+  PREF_APRS_SHOW_ALTITUDE_INSIDE_COMPRESSED_POSITION,
+  PREF_APRS_SHOW_ALTITUDE_INSIDE_COMPRESSED_POSITION_INIT, PREF_APRS_ALTITUDE_RATIO,
+  PREF_APRS_ALTITUDE_RATIO_INIT, PREF_APRS_SHOW_BATTERY, PREF_APRS_SHOW_BATTERY_INIT,
+  PREF_APRS_LATITUDE_PRESET, PREF_APRS_LATITUDE_PRESET_INIT, PREF_APRS_LONGITUDE_PRESET,
+  PREF_APRS_LONGITUDE_PRESET_INIT, PREF_APRS_SENDER_BLACKLIST, PREF_APRS_SENDER_BLACKLIST_INIT,
+  PREF_APRS_FIXED_BEACON_PRESET, PREF_APRS_FIXED_BEACON_PRESET_INIT, PREF_APRS_FIXED_BEACON_INTERVAL_PRESET,
+  PREF_APRS_FIXED_BEACON_INTERVAL_PRESET_INIT, PREF_ENABLE_TNC_SELF_TELEMETRY,
+  PREF_ENABLE_TNC_SELF_TELEMETRY_INIT, PREF_TNC_SELF_TELEMETRY_INTERVAL,
+  PREF_TNC_SELF_TELEMETRY_INTERVAL_INIT, PREF_TNC_SELF_TELEMETRY_SEQ, PREF_TNC_SELF_TELEMETRY_SEQ_INIT,
+  PREF_TNC_SELF_TELEMETRY_MIC, PREF_TNC_SELF_TELEMETRY_MIC_INIT, PREF_TNC_SELF_TELEMETRY_PATH,
+  PREF_TNC_SELF_TELEMETRY_PATH_INIT, PREF_APRS_SB_MIN_INTERVAL_PRESET, PREF_APRS_SB_MIN_INTERVAL_PRESET_INIT,
+  PREF_APRS_SB_MAX_INTERVAL_PRESET, PREF_APRS_SB_MAX_INTERVAL_PRESET_INIT, PREF_APRS_SB_MIN_SPEED_PRESET,
+  PREF_APRS_SB_MIN_SPEED_PRESET_INIT, PREF_APRS_SB_MAX_SPEED_PRESET, PREF_APRS_SB_MAX_SPEED_PRESET_INIT,
+  PREF_APRS_SB_ANGLE_PRESET, PREF_APRS_SB_ANGLE_PRESET_INIT, PREF_APRS_SB_TURN_SLOPE_PRESET,
+  PREF_APRS_SB_TURN_SLOPE_PRESET_INIT, PREF_APRS_SB_TURN_TIME_PRESET, PREF_APRS_SB_TURN_TIME_PRESET_INIT,
+  PREF_APRS_GPS_EN, PREF_APRS_GPS_EN_INIT, PREF_ACCEPT_OWN_POSITION_REPORTS_VIA_KISS,
+  PREF_ACCEPT_OWN_POSITION_REPORTS_VIA_KISS_INIT, PREF_GPS_ALLOW_SLEEP_WHILE_KISS,
+  PREF_GPS_ALLOW_SLEEP_WHILE_KISS_INIT, PREF_APRS_SHOW_CMT, PREF_APRS_SHOW_CMT_INIT, PREF_DEV_BT_EN,
+  PREF_DEV_BT_EN_INIT, PREF_DEV_OL_EN, PREF_DEV_OL_EN_INIT, PREF_DEV_SHOW_RX_TIME,
+  PREF_DEV_SHOW_RX_TIME_INIT, PREF_DEV_AUTO_SHUT, PREF_DEV_AUTO_SHUT_INIT, PREF_DEV_AUTO_SHUT_PRESET,
+  PREF_DEV_AUTO_SHUT_PRESET_INIT, PREF_DEV_REBOOT_INTERVAL, PREF_DEV_REBOOT_INTERVAL_INIT,
+  PREF_DEV_SHOW_OLED_TIME, PREF_DEV_SHOW_OLED_TIME_INIT, PREF_DEV_CPU_FREQ, PREF_DEV_CPU_FREQ_INIT,
+  PREF_APRSIS_EN_INIT, PREF_APRSIS_EN, PREF_APRSIS_SERVER_NAME_INIT, PREF_APRSIS_SERVER_NAME,
+  PREF_APRSIS_SERVER_PORT_INIT, PREF_APRSIS_SERVER_PORT, PREF_APRSIS_FILTER_INIT, PREF_APRSIS_FILTER,
+  PREF_APRSIS_CALLSIGN_INIT, PREF_APRSIS_CALLSIGN, PREF_APRSIS_PASSWORD_INIT, PREF_APRSIS_PASSWORD,
+  PREF_APRSIS_ALLOW_INET_TO_RF_INIT, PREF_APRSIS_ALLOW_INET_TO_RF, PREF_APRSIS_RF_FILTER_INIT,
+  PREF_APRSIS_RF_FILTER
+};
+
+// recursive: a transaction holds the lock across put*() and commit()
+void ConfigStore::lock() {
+  if (mutex)
+    xSemaphoreTakeRecursive(mutex, portMAX_DELAY);
+}
+
+void ConfigStore::unlock() {
+  if (mutex)
+    xSemaphoreGiveRecursive(mutex);
+}
+
+struct cfg_entry *ConfigStore::find(const char *key) {
+  for (uint16_t i = 0; i < count; i++) {
+    if (!strcmp(entries[i].key, key))
+      return &entries[i];
+  }
+  return nullptr;
+}
+
+struct cfg_entry *ConfigStore::add(const char *key) {
+  struct cfg_entry *e = find(key);
+
+  if (e)
+    return e;
+  if (strlen(key) >= sizeof(e->key))
+    return nullptr;
+  if (count == allocated) {
+    uint16_t n = allocated ? allocated + 32 : 160;
+    struct cfg_entry *p = (struct cfg_entry *) realloc(entries, n * sizeof(struct cfg_entry));
+    if (!p)
+      return nullptr;
+    entries = p;
+    allocated = n;
+  }
+  e = &entries[count++];
+  memset(e, 0, sizeof(*e));
+  strcpy(e->key, key);
+  return e;
+}
+
+// drop the old value before a put of type
+void ConfigStore::set(struct cfg_entry *e, uint8_t type) {
+  if (e->type == CFG_TYPE_STRING)
+    free(e->s);
+  e->s = nullptr;
+  e->type = type;
+  dirty = true;
+  t_changed = millis();
+}
+
+void ConfigStore::drop_all() {
+  for (uint16_t i = 0; i < count; i++) {
+    if (entries[i].type == CFG_TYPE_STRING)
+      free(entries[i].s);
+  }
+  count = 0;
+}
+
+// Entries from the blob. False if there is none or it is not valid
+bool ConfigStore::load() {
+  struct cfg_blob_header hdr;
+  size_t len = 0;
+
+  if (nvs_get_blob(handle, CFG_BLOB_KEY, nullptr, &len) != ESP_OK || len < sizeof(hdr))
+    return false;
+  uint8_t *buf = (uint8_t *) malloc(len);
+  if (!buf)
+    return false;
+  if (nvs_get_blob(handle, CFG_BLOB_KEY, buf, &len) != ESP_OK)
+    goto invalid;
+  memcpy(&hdr, buf, sizeof(hdr));
+  if (hdr.magic != CFG_BLOB_MAGIC || hdr.len != len - sizeof(hdr) || crc32_le(0, buf + sizeof(hdr), hdr.len) != hdr.crc) {
+    Serial.println("Settings: blob corrupt");
+    goto invalid;
+  }
+  if (hdr.version > CFG_STORE_VERSION) {
+    Serial.printf("Settings: blob version %u is newer than this firmware\n", hdr.version);
+    goto invalid;
+  }
+  // older versions: convert here, once there are any
+
+  {
+    const uint8_t *p = buf + sizeof(hdr);
+    const uint8_t *end = buf + len;
+    for (uint16_t i = 0; i < hdr.count; i++) {
+      char key[16];
+      uint8_t n;
+      uint16_t slen;
+      struct cfg_entry *e;
+
+      if (p >= end || (n = *p++) >= sizeof(key) || end - p < n + 1)
+        goto invalid_entries;
+      memcpy(key, p, n);
+      key[n] = 0;
+      p += n;
+      uint8_t type = *p++;
+      if (!(e = add(key)))
+        goto invalid_entries;
+      e->type = type;
+      switch (type) {
+      case CFG_TYPE_BOOL:
+        if (end - p < 1)
+          goto invalid_entries;
+        e->v.i = *p++;
+        break;
+      case CFG_TYPE_INT:
+      case CFG_TYPE_UINT:
+        if (end - p < 4)
+          goto invalid_entries;
+        memcpy(&e->v.u, p, 4);
+        p += 4;
+        break;
+      case CFG_TYPE_DOUBLE:
+        if (end - p < 8)
+          goto invalid_entries;
+        memcpy(&e->v.d, p, 8);
+        p += 8;
+        break;
+      case CFG_TYPE_STRING:
+        if (end - p < 2)
+          goto invalid_entries;
+        memcpy(&slen, p, 2);
+        p += 2;
+        if (end - p < slen || !(e->s = (char *) malloc(slen + 1))) {
+          e->type = 0;
+          goto invalid_entries;
+        }
+        memcpy(e->s, p, slen);
+        e->s[slen] = 0;
+        p += slen;
+        break;
+      default:
+        goto invalid_entries;
+      }
+    }
+  }
+  free(buf);
+  return true;
+
+invalid_entries:
+  drop_all();
+invalid:
+  free(buf);
+  return false;
+}
+
+// Settings in the old layout, one NVS key each. Types as Preferences stored them
+bool ConfigStore::migrate_legacy() {
+  uint16_t found = 0;
+
+  for (size_t i = 0; i < sizeof(cfg_legacy_keys) / sizeof(cfg_legacy_keys[0]); i++) {
+    const char *key = cfg_legacy_keys[i];
+    struct cfg_entry *e;
+    uint8_t u8;
+    int32_t i32;
+    uint32_t u32;
+    double d;
+    size_t len = 0;
+
+    if (nvs_get_u8(handle, key, &u8) == ESP_OK) {
+      if ((e = add(key))) { e->type = CFG_TYPE_BOOL; e->v.i = u8; }
+    } else if (nvs_get_u32(handle, key, &u32) == ESP_OK) {
+      // before i32: the telemetry sequence exists as both, the u32 one is current
+      if ((e = add(key))) { e->type = CFG_TYPE_UINT; e->v.u = u32; }
+    } else if (nvs_get_i32(handle, key, &i32) == ESP_OK) {
+      if ((e = add(key))) { e->type = CFG_TYPE_INT; e->v.i = i32; }
+    } else if ((len = sizeof(d)) && nvs_get_blob(handle, key, &d, &len) == ESP_OK && len == sizeof(d)) {
+      if ((e = add(key))) { e->type = CFG_TYPE_DOUBLE; e->v.d = d; }
+    } else if (nvs_get_str(handle, key, nullptr, &len) == ESP_OK) {
+      char *s = (char *) malloc(len ? len : 1);
+      if (!s || nvs_get_str(handle, key, s, &len) != ESP_OK || !(e = add(key))) {
+        free(s);
+        continue;
+      }
+      e->type = CFG_TYPE_STRING;
+      e->s = s;
+    } else {
+      continue;
+    }
+    found++;
+  }
+  if (!found)
+    return false;
+  Serial.printf("Settings: %u keys moved to the blob\n", found);
+  dirty = true;
+  if (!commit())
+    return true;
+  // blob is written: the old keys are no longer needed, and NVS has little room
+  for (size_t i = 0; i < sizeof(cfg_legacy_keys) / sizeof(cfg_legacy_keys[0]); i++)
+    nvs_erase_key(handle, cfg_legacy_keys[i]);
+  nvs_commit(handle);
+  return true;
+}
+
+bool ConfigStore::begin(const char *name, bool readOnly) {
+  if (!mutex)
+    mutex = xSemaphoreCreateRecursiveMutex();
+  lock();
+  if (handle) {
+    unlock();
+    return true;
+  }
+  if (nvs_open(name, readOnly ? NVS_READONLY : NVS_READWRITE, &handle) != ESP_OK) {
+    handle = 0;
+    unlock();
+    return false;
+  }
+  drop_all();
+  if (!load())
+    migrate_legacy();
+  dirty = false;
+  unlock();
+  return true;
+}
+
+// Settings stay readable from RAM
+void ConfigStore::end() {
+  lock();
+  if (handle) {
+    nvs_close(handle);
+    handle = 0;
+  }
+  unlock();
+}
+
+bool ConfigStore::clear() {
+  bool ok;
+
+  lock();
+  drop_all();
+  dirty = false;
+  ok = handle && nvs_erase_all(handle) == ESP_OK && nvs_commit(handle) == ESP_OK;
+  unlock();
+  return ok;
+}
+
+bool ConfigStore::commit() {
+  struct cfg_blob_header hdr;
+  size_t len = sizeof(hdr);
+  bool ok = false;
+
+  lock();
+  if (!dirty || !handle) {
+    unlock();
+    return !dirty;
+  }
+  for (uint16_t i = 0; i < count; i++) {
+    const struct cfg_entry *e = &entries[i];
+    len += 2 + strlen(e->key);
+    switch (e->type) {
+    case CFG_TYPE_BOOL: len += 1; break;
+    case CFG_TYPE_INT:
+    case CFG_TYPE_UINT: len += 4; break;
+    case CFG_TYPE_DOUBLE: len += 8; break;
+    case CFG_TYPE_STRING: len += 2 + strlen(e->s); break;
+    }
+  }
+  uint8_t *buf = (len <= CFG_STORE_MAX_LEN) ? (uint8_t *) malloc(len) : nullptr;
+  if (buf) {
+    uint8_t *p = buf + sizeof(hdr);
+    for (uint16_t i = 0; i < count; i++) {
+      const struct cfg_entry *e = &entries[i];
+      uint8_t n = strlen(e->key);
+      *p++ = n;
+      memcpy(p, e->key, n);
+      p += n;
+      *p++ = e->type;
+      switch (e->type) {
+      case CFG_TYPE_BOOL:
+        *p++ = e->v.i ? 1 : 0;
+        break;
+      case CFG_TYPE_INT:
+      case CFG_TYPE_UINT:
+        memcpy(p, &e->v.u, 4);
+        p += 4;
+        break;
+      case CFG_TYPE_DOUBLE:
+        memcpy(p, &e->v.d, 8);
+        p += 8;
+        break;
+      case CFG_TYPE_STRING: {
+        uint16_t slen = strlen(e->s);
+        memcpy(p, &slen, 2);
+        memcpy(p + 2, e->s, slen);
+        p += 2 + slen;
+        break;
+      }
+      }
+    }
+    hdr.magic = CFG_BLOB_MAGIC;
+    hdr.version = CFG_STORE_VERSION;
+    hdr.count = count;
+    hdr.len = len - sizeof(hdr);
+    hdr.crc = crc32_le(0, buf + sizeof(hdr), hdr.len);
+    memcpy(buf, &hdr, sizeof(hdr));
+    ok = nvs_set_blob(handle, CFG_BLOB_KEY, buf, len) == ESP_OK && nvs_commit(handle) == ESP_OK;
+    free(buf);
+  }
+  if (ok)
+    dirty = false;
+  else
+    Serial.printf("Settings: saving failed (%u bytes)\n", (unsigned) len);
+  unlock();
+  return ok;
+}
+
+void ConfigStore::poll() {
+  if (dirty && millis() - t_changed >= CFG_STORE_COMMIT_DELAY)
+    commit();
+}
+
+void ConfigStore::beginTransaction() {
+  lock();
+}
+
+bool ConfigStore::commitTransaction() {
+  bool ok = commit();
+  unlock();
+  return ok;
+}
+
+size_t ConfigStore::putBool(const char *key, bool value) {
+  struct cfg_entry *e;
+
+  lock();
+  if ((e = add(key)) && (e->type != CFG_TYPE_BOOL || !e->v.i != !value)) {
+    set(e, CFG_TYPE_BOOL);
+    e->v.i = value;
+  }
+  unlock();
+  return e ? 1 : 0;
+}
+
+size_t ConfigStore::putInt(const char *key, int32_t value) {
+  struct cfg_entry *e;
+
+  lock();
+  if ((e = add(key)) && (e->type != CFG_TYPE_INT || e->v.i != value)) {
+    set(e, CFG_TYPE_INT);
+    e->v.i = value;
+  }
+  unlock();
+  return e ? 4 : 0;
+}
+
+size_t ConfigStore::putUInt(const char *key, uint32_t value) {
+  struct cfg_entry *e;
+
+  lock();
+  if ((e = add(key)) && (e->type != CFG_TYPE_UINT || e->v.u != value)) {
+    set(e, CFG_TYPE_UINT);
+    e->v.u = value;
+  }
+  unlock();
+  return e ? 4 : 0;
+}
+
+size_t ConfigStore::putDouble(const char *key, double value) {
+  struct cfg_entry *e;
+
+  lock();
+  if ((e = add(key)) && (e->type != CFG_TYPE_DOUBLE || memcmp(&e->v.d, &value, sizeof(value)))) {
+    set(e, CFG_TYPE_DOUBLE);
+    e->v.d = value;
+  }
+  unlock();
+  return e ? 8 : 0;
+}
+
+size_t ConfigStore::putString(const char *key, const char *value) {
+  struct cfg_entry *e;
+  size_t len = strlen(value);
+
+  // 16 bit length in the blob
+  if (len > 4000)
+    return 0;
+  lock();
+  if ((e = add(key)) && (e->type != CFG_TYPE_STRING || strcmp(e->s, value))) {
+    char *s = strdup(value);
+    if (s) {
+      set(e, CFG_TYPE_STRING);
+      e->s = s;
+    } else {
+      e = nullptr;
+    }
+  }
+  unlock();
+  return e ? len : 0;
+}
+
+size_t ConfigStore::putString(const char *key, const String &value) {
+  return putString(key, value.c_str());
+}
+
+bool ConfigStore::getBool(const char *key, bool defaultValue) {
+  struct cfg_entry *e;
+  bool value = defaultValue;
+
+  lock();
+  if ((e = find(key)) && e->type == CFG_TYPE_BOOL)
+    value = e->v.i;
+  unlock();
+  return value;
+}
+
+int32_t ConfigStore::getInt(const char *key, int32_t defaultValue) {
+  struct cfg_entry *e;
+  int32_t value = defaultValue;
+
+  lock();
+  if ((e = find(key)) && e->type == CFG_TYPE_INT)
+    value = e->v.i;
+  unlock();
+  return value;
+}
+
+uint32_t ConfigStore::getUInt(const char *key, uint32_t defaultValue) {
+  struct cfg_entry *e;
+  uint32_t value = defaultValue;
+
+  lock();
+  if ((e = find(key)) && e->type == CFG_TYPE_UINT)
+    value = e->v.u;
+  unlock();
+  return value;
+}
+
+double ConfigStore::getDouble(const char *key, double defaultValue) {
+  struct cfg_entry *e;
+  double value = defaultValue;
+
+  lock();
+  if ((e = find(key)) && e->type == CFG_TYPE_DOUBLE)
+    value = e->v.d;
+  unlock();
+  return value;
+}
+
+String ConfigStore::getString(const char *key, const String &defaultValue) {
+  struct cfg_entry *e;
+  String value;
+
+  lock();
+  if ((e = find(key)) && e->type == CFG_TYPE_STRING)
+    value = e->s;
+  else
+    value = defaultValue;
+  unlock();
+  return value;
+}
@@ -0,0 +1,715 @@
+#include "taskAPRSIS.h"
+#include "taskWebServer.h"
+#include "preference_storage.h"
+#include <AprsFilter.h>
+#include <AprsIs.h>
+#include <BufAppend.h>
+#include <esp_task_wdt.h>
+#include <lwip/sockets.h>
+#include "metrics.h"
+#include <errno.h>
+#include <stdarg.h>
+
+QueueHandle_t aprsisUplinkQueue = nullptr;
+tAprsisUplinkStats aprsisUplinkStats;
+tAprsisStats aprsisStats;
+
+extern boolean aprsis_enabled;
+extern String aprsis_host;
+extern uint16_t aprsis_port;
+extern String aprsis_filter;
+extern String aprsis_callsign;
+extern String aprsis_password;
+extern uint8_t aprsis_data_allow_inet_to_rf;
+extern String aprsis_rf_filter;
+extern String MY_APRS_DEST_IDENTIFYER;
+
+extern boolean lora_tx_enabled;
+extern uint8_t txPower;
+extern double lora_freq;
+extern ulong lora_speed;
+extern uint8_t txPower_cross_digi;
+extern ulong lora_speed_cross_digi;
+extern double lora_freq_cross_digi;
+extern void loraSend(byte, float, ulong, const String &, const char *);
+#ifdef KISS_PROTOCOL
+extern void sendToTNC(const String &);
+#endif
+
+// connect, and each of greeting and login response
+#define APRSIS_CONNECT_TIMEOUT 15000
+#define APRSIS_RESPONSE_TIMEOUT 25000
+// servers send a comment line at least every 20s
+#define APRSIS_KEEPALIVE_TIMEOUT 60000
+// reconnect delay doubles after each failure, +-25% jitter
+#define APRSIS_BACKOFF_MIN 5000
+#define APRSIS_BACKOFF_MAX 600000
+// a connection which lasted that long resets the backoff
+#define APRSIS_BACKOFF_RESET 300000
+
+enum aprsis_state {
+  APRSIS_IDLE,            // waiting for the next attempt
+  APRSIS_CONNECTING,      // non-blocking connect in progress
+  APRSIS_WAIT_GREETING,
+  APRSIS_WAIT_LOGRESP,
+  APRSIS_CONNECTED
+};
+
+// Local filter for gating to RF. Compiled into the table which is not in use, then swapped. nullptr: nothing to RF
+static struct aprs_filter aprsis_rf_filter_tables[2];
+static struct aprs_filter *aprsis_rf_filter_active = nullptr;
+
+int aprsis_rf_filter_set(const char *text, char *err, size_t errlen)
+{
+  struct aprs_filter *next = (aprsis_rf_filter_active == &aprsis_rf_filter_tables[0]) ? &aprsis_rf_filter_tables[1] : &aprsis_rf_filter_tables[0];
+  if (aprs_filter_compile(text, next, err, errlen) < 0)
+    return -1;
+  aprsis_rf_filter_active = next;
+  memset(aprsisStats.rf_filter_rejected, 0, sizeof(aprsisStats.rf_filter_rejected));
+  return 0;
+}
+
+// written by this task, read by the webserver
+static portMUX_TYPE aprsis_status_mux = portMUX_INITIALIZER_UNLOCKED;
+static char aprsis_status[160] = "Disconnected";
+
+static void aprsis_status_set(const char *fmt, ...)
+{
+  char buf[sizeof(aprsis_status)];
+  va_list ap;
+
+  va_start(ap, fmt);
+  vsnprintf(buf, sizeof(buf), fmt, ap);
+  va_end(ap);
+  // server lines end with \r\n
+  size_t len = strlen(buf);
+  while (len && isspace(buf[len-1]))
+    buf[--len] = 0;
+
+  portENTER_CRITICAL(&aprsis_status_mux);
+  strcpy(aprsis_status, buf);
+  portEXIT_CRITICAL(&aprsis_status_mux);
+}
+
+void aprsis_status_get(char *buf, size_t len)
+{
+  portENTER_CRITICAL(&aprsis_status_mux);
+  snprintf(buf, len, "%s", aprsis_status);
+  portEXIT_CRITICAL(&aprsis_status_mux);
+}
+
+static bool aprsis_status_starts_with(const char *s)
+{
+  bool ret;
+  portENTER_CRITICAL(&aprsis_status_mux);
+  ret = !strncmp(aprsis_status, s, strlen(s));
+  portEXIT_CRITICAL(&aprsis_status_mux);
+  return ret;
+}
+
+
+// aprsis_host: "host[:port]", up to 4 separated by space or comma, tried in this order
+#define APRSIS_SERVERS_MAX 4
+// lwIP does not tell the TTL of a DNS answer
+#define APRSIS_DNS_TTL 3600000
+// next server after a failed one. Backoff applies after all have failed
+#define APRSIS_FAILOVER_DELAY 2000
+
+struct aprsis_server {
+  char host[64];
+  uint16_t port;
+  uint32_t ip;            // cached address, network byte order. 0: not resolved
+  uint32_t t_resolved;    // millis()
+};
+
+static struct aprsis_server aprsis_servers[APRSIS_SERVERS_MAX];
+static uint8_t aprsis_servers_count;
+
+static void aprsis_servers_parse(const char *list, uint16_t default_port)
+{
+  char buf[APRSIS_SERVERS_MAX * 72];
+  char *tok;
+  char *tok_save;
+
+  aprsis_servers_count = 0;
+  snprintf(buf, sizeof(buf), "%s", list);
+  for (tok = strtok_r(buf, " ,;\t", &tok_save); tok && aprsis_servers_count < APRSIS_SERVERS_MAX; tok = strtok_r(0, " ,;\t", &tok_save)) {
+    struct aprsis_server *srv = &aprsis_servers[aprsis_servers_count];
+    char *p = strchr(tok, ':');
+    long port = default_port;
+    if (p) {
+      *p++ = 0;
+      port = strtol(p, nullptr, 10);
+    }
+    if (!*tok || strlen(tok) >= sizeof(srv->host) || port < 1 || port > 65535)
+      continue;
+    memset(srv, 0, sizeof(*srv));
+    strcpy(srv->host, tok);
+    srv->port = port;
+    aprsis_servers_count++;
+  }
+}
+
+/**
+ * Address of srv, from the cache if it is not too old. Name resolution blocks, but only this task.
+ * @return false if the name could not be resolved
+ */
+static bool aprsis_server_resolve(struct aprsis_server *srv, uint32_t now)
+{
+  IPAddress ip;
+
+  if (srv->ip && now - srv->t_resolved < APRSIS_DNS_TTL)
+    return true;
+  if (!WiFi.hostByName(srv->host, ip) || !(uint32_t) ip)
+    return false;
+  srv->ip = (uint32_t) ip;
+  srv->t_resolved = now;
+  return true;
+}
+
+/**
+ * Start a non-blocking connect.
+ * @return socket, or -1 on error
+ */
+static int aprsis_connect_start(uint32_t ip, uint16_t port)
+{
+  struct sockaddr_in addr;
+
+  int fd = socket(AF_INET, SOCK_STREAM, 0);
+  if (fd < 0)
+    return -1;
+  fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = ip;
+  addr.sin_port = htons(port);
+  if (connect(fd, (struct sockaddr *) &addr, sizeof(addr)) < 0 && errno != EINPROGRESS) {
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+/**
+ * @return 1: connected. 0: in progress. -1: failed
+ */
+static int aprsis_connect_poll(int fd)
+{
+  fd_set wfds;
+  struct timeval tv = { 0, 0 };
+  int err = 0;
+  socklen_t len = sizeof(err);
+
+  FD_ZERO(&wfds);
+  FD_SET(fd, &wfds);
+  int n = select(fd + 1, nullptr, &wfds, nullptr, &tv);
+  if (n < 0)
+    return -1;
+  if (!n)
+    return 0;
+  if (getsockopt(fd, SOL_SOCKET, SO_ERROR, &err, &len) < 0 || err)
+    return -1;
+  // WiFiClient expects a blocking socket, like after WiFiClient::connect()
+  fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) & ~O_NONBLOCK);
+  return 1;
+}
+
+
+static void aprsis_latency_add(uint32_t t_rx_us, uint32_t now_us)
+{
+  uint32_t us = now_us - t_rx_us;
+  int b = 0;
+
+  for (uint32_t limit = 10000; b < APRSIS_LATENCY_BUCKETS-1 && us >= limit; limit *= 10)
+    b++;
+  aprsisStats.latency_count++;
+  aprsisStats.latency_sum_us += us;
+  if (us > aprsisStats.latency_max_us)
+    aprsisStats.latency_max_us = us;
+  aprsisStats.latency_bucket[b]++;
+}
+
+// lines per write; the RX time of each is kept for the latency
+#define APRSIS_UPLINK_BATCH 16
+
+/**
+ * Everything which is queued goes out, several lines per write.
+ * @return false if the connection failed
+ */
+static bool aprsis_uplink_send(WiFiClient &client)
+{
+  char buf[1024];
+  char line[320];
+  size_t len = 0;
+  uint32_t lines = 0;
+  uint32_t t_rx_us[APRSIS_UPLINK_BATCH];
+  tAprsisUplinkFrame data;
+
+  for (;;) {
+    bool more = (xQueueReceive(aprsisUplinkQueue, &data, 0) == pdPASS);
+    size_t n = 0;
+    if (more) {
+      n = aprsis_uplink_line(data.frame->c_str(), lora_tx_enabled, aprsis_callsign.c_str(), line, sizeof(line));
+      delete data.frame;
+    }
+    if (len && (!more || len + n > sizeof(buf) || lines == APRSIS_UPLINK_BATCH)) {
+      if (client.write((const uint8_t *) buf, len) != len) {
+        aprsisUplinkStats.dropped_offline += lines;
+        aprsis_status_set("Error: write failed");
+        return false;
+      }
+      uint32_t now_us = micros();
+      for (uint32_t i = 0; i < lines; i++)
+        aprsis_latency_add(t_rx_us[i], now_us);
+      aprsisStats.bytes_out += len;
+      aprsisUplinkStats.sent += lines;
+      aprsisUplinkStats.writes++;
+      len = 0;
+      lines = 0;
+    }
+    if (!more)
+      return true;
+    if (n) {
+      memcpy(buf + len, line, n);
+      len += n;
+      t_rx_us[lines++] = data.t_rx_us;
+      aprsis_status_set("OK, toAPRSIS: %s", line);
+    } else {
+      aprsisUplinkStats.not_gated++;
+    }
+  }
+}
+
+// not connected: don't send old frames later
+static void aprsis_uplink_drop()
+{
+  tAprsisUplinkFrame data;
+  while (xQueueReceive(aprsisUplinkQueue, &data, 0) == pdPASS) {
+    delete data.frame;
+    aprsisUplinkStats.dropped_offline++;
+  }
+}
+
+// per wakeup: more than that waits for the next turn, so the uplink is not starved
+#define APRSIS_RX_CHUNKS 8
+
+// not on the task stack
+static struct aprsis_reader aprsis_rx;
+
+/**
+ * Append what the server has sent. Only call after aprsis_reader_next() returned nullptr.
+ * @return bytes read
+ */
+static int aprsis_reader_fill(struct aprsis_reader *r, WiFiClient &client)
+{
+  int avail = client.available();
+  size_t room;
+  char *space = aprsis_reader_space(r, &room);
+  if (avail <= 0 || !room)
+    return 0;
+  int n = client.read((uint8_t *) space, ((size_t ) avail < room) ? avail : room);
+  if (n > 0) {
+    aprsis_reader_added(r, n);
+    aprsisStats.bytes_in += n;
+  }
+  return n;
+}
+
+/**
+ * Line from the server: gate it to KISS and RF if allowed.
+ * Works on the line in place; modifies nothing.
+ */
+static void aprsis_handle_downlink(const char *s, size_t len, const char *aprs_callsign)
+{
+  // third party frame, reused
+  static char third_party[APRSIS_LINE_MAX + 64];
+
+  if (!len) return;
+  switch (aprsis_downlink_check(s, aprs_callsign, aprsis_callsign.c_str())) {
+  case APRSIS_DL_COMMENT: aprsisStats.dl_comment++; return;
+  case APRSIS_DL_INVALID: aprsisStats.dl_invalid++; return;
+  case APRSIS_DL_OWN: aprsisStats.dl_own++; return;
+  }
+
+  // generate third party packet. Use aprs_callsign (deriving from webServerCfg->callsign), because aprsis_callsign may have a non-aprs (but only aprsis-compatible) ssid like '-L4'
+  if (!aprsis_third_party(aprs_callsign, MY_APRS_DEST_IDENTIFYER.c_str(), s, third_party, sizeof(third_party))) {
+    aprsisStats.dl_invalid++;
+    return;
+  }
+  aprsis_status_set("OK, fromAPRSIS: %s", s);
+  // sendToTNC() and loraSend() take a String: one copy per gated frame
+  String third_party_packet(third_party);
+#ifdef KISS_PROTOCOL
+  sendToTNC(third_party_packet);
+  aprsisStats.gated_kiss++;
+#endif
+  if (lora_tx_enabled && aprsis_data_allow_inet_to_rf) {
+    // not query or aprs-message addressed to our call (check both, aprs_callsign and aprsis_callsign)=
+    // Format: "..::DL9SAU-15:..."
+    // check is in this code part, because we may like to see those packets via kiss (sent above)
+    if (aprsis_downlink_to_us(s, len, aprs_callsign, aprsis_callsign.c_str())) {
+      aprsisStats.dl_to_us++;
+      return;
+    }
+    const struct aprs_filter *rf_filter = aprsis_rf_filter_active;
+    int reason;
+    if (!rf_filter || !aprs_filter_match(rf_filter, s, millis(), &reason)) {
+      if (!rf_filter || reason == APRS_FILTER_NO_MATCH)
+        aprsisStats.rf_filter_no_match++;
+      else if (reason == APRS_FILTER_NOT_HEARD)
+        aprsisStats.rf_filter_not_heard++;
+      else
+        aprsisStats.rf_filter_rejected[reason]++;
+      return;
+    }
+    aprsisStats.gated_rf++;
+    if (aprsis_data_allow_inet_to_rf % 2)
+      loraSend(txPower, lora_freq, lora_speed, third_party_packet, "IS");
+    if (aprsis_data_allow_inet_to_rf > 1 && lora_freq_cross_digi > 1.0 && lora_freq_cross_digi != lora_freq)
+      loraSend(txPower_cross_digi, lora_freq_cross_digi, lora_speed_cross_digi, third_party_packet, "IS");
+  }
+}
+
+
+// seconds since t, -1 for never
+static long aprsis_age(uint32_t t, uint32_t now)
+{
+  return t ? (long ) ((now - t) / 1000) : -1;
+}
+
+size_t aprsis_stats_json(char *buf, size_t len)
+{
+  // copy: counters keep changing while we format
+  tAprsisStats st = aprsisStats;
+  tAprsisUplinkStats up = aprsisUplinkStats;
+  const struct aprs_filter *rf_filter = aprsis_rf_filter_active;
+  uint32_t now = millis();
+  size_t pos = 0;
+
+  if (!buf_append(buf, len, &pos,
+        "{\"uptime\":%lu,\"server\":%u,\"failovers\":%lu,\"connects\":%lu,\"connect_failures\":%lu,\"disconnects\":%lu,"
+        "\"lines_in\":%lu,\"bytes_in\":%lu,\"bytes_out\":%lu,\"last_rx\":%ld,\"last_keepalive\":%ld,",
+        (unsigned long ) now / 1000, st.server, (unsigned long ) st.failovers, (unsigned long ) st.connects, (unsigned long ) st.connect_failures, (unsigned long ) st.disconnects,
+        (unsigned long ) st.lines_in, (unsigned long ) st.bytes_in, (unsigned long ) st.bytes_out,
+        aprsis_age(st.t_last_rx, now), aprsis_age(st.t_last_keepalive, now)))
+    return 0;
+  if (!buf_append(buf, len, &pos,
+        "\"uplink\":{\"queued\":%lu,\"queue_depth\":%u,\"dropped_full\":%lu,\"dropped_offline\":%lu,\"not_gated\":%lu,\"sent\":%lu,\"writes\":%lu,"
+        "\"latency\":{\"count\":%lu,\"avg_ms\":%.1f,\"max_ms\":%.1f,\"hist\":[",
+        (unsigned long ) up.queued, aprsisUplinkQueue ? (unsigned ) uxQueueMessagesWaiting(aprsisUplinkQueue) : 0,
+        (unsigned long ) up.dropped_full, (unsigned long ) up.dropped_offline, (unsigned long ) up.not_gated, (unsigned long ) up.sent, (unsigned long ) up.writes,
+        (unsigned long ) st.latency_count, st.latency_count ? st.latency_sum_us / 1000.0 / st.latency_count : 0.0, st.latency_max_us / 1000.0))
+    return 0;
+  for (int i = 0; i < APRSIS_LATENCY_BUCKETS; i++) {
+    if (!buf_append(buf, len, &pos, "%s%lu", i ? "," : "", (unsigned long ) st.latency_bucket[i]))
+      return 0;
+  }
+  if (!buf_append(buf, len, &pos,
+        "]}},\"downlink\":{\"comment\":%lu,\"invalid\":%lu,\"own\":%lu,\"to_us\":%lu,\"gated_kiss\":%lu,\"gated_rf\":%lu,"
+        "\"rf_filter\":{\"no_match\":%lu,\"not_heard\":%lu,\"rejected\":[",
+        (unsigned long ) st.dl_comment, (unsigned long ) st.dl_invalid, (unsigned long ) st.dl_own, (unsigned long ) st.dl_to_us,
+        (unsigned long ) st.gated_kiss, (unsigned long ) st.gated_rf, (unsigned long ) st.rf_filter_no_match, (unsigned long ) st.rf_filter_not_heard))
+    return 0;
+  // one per term of the filter in use, in the order of the filter text
+  for (int i = 0; rf_filter && i < rf_filter->terms; i++) {
+    if (!buf_append(buf, len, &pos, "%s%lu", i ? "," : "", (unsigned long ) st.rf_filter_rejected[i]))
+      return 0;
+  }
+  if (!buf_append(buf, len, &pos, "]}}}"))
+    return 0;
+  return pos;
+}
+
+
+// Settings changed at runtime: the task reloads them. Not running: loaded and started by aprsis_settings_changed() in loop()
+static tWebServerCfg *aprsis_cfg = nullptr;
+static TaskHandle_t aprsis_task = nullptr;
+static volatile bool aprsis_reload = false;
+
+bool aprsis_settings_check(const String &aprs_callsign)
+{
+  aprsis_host.trim();
+  aprsis_filter.trim();
+  aprsis_password.trim();
+  if (aprsis_callsign.length() < 3 || aprsis_callsign.length() > 9)
+    aprsis_callsign = "";
+  if (aprsis_callsign.isEmpty()) aprsis_callsign = aprs_callsign;
+  if (aprsis_callsign.length() < 3 || aprsis_callsign.length() > 9)
+    aprsis_callsign = "";
+  aprsis_callsign.toUpperCase(); aprsis_callsign.trim();
+
+  // sanity check
+  if (aprsis_enabled) {
+    if (aprsis_callsign.isEmpty() || aprsis_host.isEmpty() || aprsis_port == 0) {
+      aprsis_enabled = false;
+   } else {
+      const char *p = aprsis_callsign.c_str();
+      for (; *p && aprsis_enabled; p++) {
+        if (*p == '-') {
+          int len = strlen(p+1);
+          if (len < 1 || len > 2)
+            aprsis_enabled = false;
+        } else if ( !((*p >= 'A' && *p <= 'Z') || (*p >= '0' && *p <= '9')) )
+            aprsis_enabled = false;
+      }
+    }
+  }
+  return aprsis_enabled;
+}
+
+// Only by this task, or by loop() while it is not running
+static void aprsis_settings_load(const String &aprs_callsign)
+{
+  char err[80];
+  String rf_filter = preferences.getString(PREF_APRSIS_RF_FILTER, "");
+
+  aprsis_enabled = preferences.getBool(PREF_APRSIS_EN);
+  aprsis_host = preferences.getString(PREF_APRSIS_SERVER_NAME, "");
+  aprsis_port = preferences.getInt(PREF_APRSIS_SERVER_PORT);
+  aprsis_filter = preferences.getString(PREF_APRSIS_FILTER, "");
+  aprsis_callsign = preferences.getString(PREF_APRSIS_CALLSIGN, "");
+  aprsis_password = preferences.getString(PREF_APRSIS_PASSWORD, "");
+  aprsis_data_allow_inet_to_rf = preferences.getInt(PREF_APRSIS_ALLOW_INET_TO_RF);
+  aprsis_settings_check(aprs_callsign);
+  if (rf_filter != aprsis_rf_filter) {
+    aprsis_rf_filter = rf_filter;
+    if (aprsis_rf_filter_set(aprsis_rf_filter.c_str(), err, sizeof(err)) < 0)
+      Serial.printf("APRS-IS RF filter: %s. Not gating to RF\n", err);
+  }
+}
+
+// what a new login is needed for
+static String aprsis_login_settings()
+{
+  return String(aprsis_enabled) + " " + aprsis_host + ":" + aprsis_port + " " + aprsis_callsign + " " + aprsis_password + " " + aprsis_filter;
+}
+
+void aprsis_start(tWebServerCfg *cfg)
+{
+  aprsis_cfg = cfg;
+  // connects and reconnects on its own, without blocking the webserver
+  if (aprsis_settings_check(cfg->callsign) && !aprsis_task) {
+    // created once: it outlives the task, which ends itself without a valid server
+    if (!aprsisUplinkQueue)
+      aprsisUplinkQueue = xQueueCreate(APRSIS_UPLINK_QUEUE_LEN, sizeof(tAprsisUplinkFrame));
+    xTaskCreate(taskAPRSIS, "taskAPRSIS", 8192, cfg, 1, &aprsis_task);
+  }
+}
+
+void aprsis_settings_changed()
+{
+  if (aprsis_task) {
+    aprsis_reload = true;
+  } else if (aprsis_cfg) {
+    aprsis_settings_load(aprsis_cfg->callsign);
+    aprsis_start(aprsis_cfg);
+  }
+}
+
+[[noreturn]] void taskAPRSIS(void *parameter) {
+  auto *webServerCfg = (tWebServerCfg*)parameter;
+  String aprs_callsign = webServerCfg->callsign;
+
+  WiFiClient aprs_is_client;
+  int fd = -1;
+  enum aprsis_state state = APRSIS_IDLE;
+  uint32_t t_state = 0;         // state entered
+  uint32_t t_last_rx = 0;       // keepalive
+  uint32_t t_connected = 0;     // logged in. 0: not in this attempt
+  uint32_t t_retry = millis();
+  uint32_t backoff = APRSIS_BACKOFF_MIN;
+  uint8_t server = 0;           // index in aprsis_servers
+  uint8_t servers_failed = 0;   // since the last login
+  struct aprsis_server *srv = nullptr;
+  const char *err = nullptr;
+  char *line;
+  size_t line_len;
+
+  aprsis_servers_parse(aprsis_host.c_str(), aprsis_port);
+  if (!aprsis_servers_count) {
+    aprsis_status_set("Error: no valid server");
+    aprsis_uplink_drop();
+    aprsis_task = nullptr;
+    vTaskDelete(nullptr);
+  }
+  metrics_register_task();
+
+  esp_task_wdt_init(120, true); //enable panic so ESP32 restarts
+  esp_task_wdt_add(NULL); //add current thread to WDT watch
+
+  while (true) {
+    esp_task_wdt_reset();
+    uint32_t now = millis();
+    err = nullptr;
+
+    if (aprsis_reload) {
+      aprsis_reload = false;
+      String login = aprsis_login_settings();
+      aprsis_settings_load(aprs_callsign);
+      if (aprsis_login_settings() != login) {
+        // log in again with the new settings, right away
+        if (fd >= 0) {
+          close(fd);
+          fd = -1;
+        }
+        aprs_is_client.stop();
+        aprsis_uplink_drop();
+        aprsis_servers_parse(aprsis_host.c_str(), aprsis_port);
+        state = APRSIS_IDLE;
+        t_connected = 0;
+        t_retry = now;
+        backoff = APRSIS_BACKOFF_MIN;
+        server = 0;
+        servers_failed = 0;
+        srv = nullptr;
+        if (!aprsis_enabled)
+          aprsis_status_set("Disabled");
+        else if (!aprsis_servers_count)
+          aprsis_status_set("Error: no valid server");
+        else
+          aprsis_status_set("Settings changed");
+      }
+    }
+
+    // Only as WiFi client (mode STA), with a working connection
+    bool online = (WiFi.getMode() == 1 && WiFi.status() == WL_CONNECTED);
+    if (!online && state != APRSIS_IDLE) {
+      err = "Error: no internet";
+    } else if (!online && WiFi.getMode() == 1 && !aprsis_status_starts_with("Error: no internet")) {
+      aprsis_status_set("Error: no internet");
+    }
+
+    switch (err ? APRSIS_IDLE : state) {
+    case APRSIS_IDLE:
+      aprsis_uplink_drop();
+      if (!online || !aprsis_enabled || !aprsis_servers_count || (int32_t ) (now - t_retry) < 0)
+        break;
+      srv = &aprsis_servers[server];
+      aprsisStats.server = server;
+      aprsis_status_set("Connecting to %s:%u", srv->host, srv->port);
+      if (!aprsis_server_resolve(srv, now)) { aprsis_status_set("Error: cannot resolve %s", srv->host); err = ""; break; }
+      fd = aprsis_connect_start(srv->ip, srv->port);
+      if (fd < 0) { err = "Error: connect failed"; break; }
+      state = APRSIS_CONNECTING;
+      t_state = now;
+      break;
+
+    case APRSIS_CONNECTING:
+      switch (aprsis_connect_poll(fd)) {
+      case 0:
+        if (now - t_state > APRSIS_CONNECT_TIMEOUT)
+          err = "Error: connect timeout";
+        break;
+      case 1:
+        aprs_is_client = WiFiClient(fd);
+        fd = -1;
+        aprsis_reader_reset(&aprsis_rx);
+        aprsis_status_set("Connected. Waiting for greeting.");
+        state = APRSIS_WAIT_GREETING;
+        t_state = now;
+        break;
+      default:
+        err = "Error: connect failed";
+      }
+      break;
+
+    case APRSIS_WAIT_GREETING:
+      aprsis_reader_fill(&aprsis_rx, aprs_is_client);
+      if ((line = aprsis_reader_next(&aprsis_rx, &line_len))) {
+        if (*line != '#') { err = "Error: unexpected greeting"; break; }
+        aprsis_status_set("Login");
+        char buffer[1024];
+        if (!aprsis_login_line(aprsis_callsign.c_str(), aprsis_password.c_str(), aprsis_filter.c_str(), buffer, sizeof(buffer))) { err = "Error: filter too long"; break; }
+        aprs_is_client.print(buffer);
+        state = APRSIS_WAIT_LOGRESP;
+        t_state = now;
+      } else if (!aprs_is_client.connected()) {
+        err = "Error: connection closed";
+      } else if (now - t_state > APRSIS_RESPONSE_TIMEOUT) {
+        err = "Error: No response";
+      }
+      break;
+
+    case APRSIS_WAIT_LOGRESP:
+      aprsis_reader_fill(&aprsis_rx, aprs_is_client);
+      if ((line = aprsis_reader_next(&aprsis_rx, &line_len))) {
+        if (*line != '#') { err = "Error: unexpected reponse on login"; break; }
+        if (!strstr(line, " logresp")) { aprsis_status_set("Error: Login denied: %s", line); err = ""; break; }
+        if (!strstr(line, " verified"))
+          aprsis_status_set("Notice: server responsed not verified: %s", line);
+        else
+          aprsis_status_set("Logged in");
+        state = APRSIS_CONNECTED;
+        t_connected = now;
+        t_last_rx = now;
+        servers_failed = 0;
+        aprsisStats.connects++;
+        metrics_boot_phase("aprsis");
+      } else if (!aprs_is_client.connected()) {
+        err = "Error: connection closed";
+      } else if (now - t_state > APRSIS_RESPONSE_TIMEOUT) {
+        err = "Error: No response";
+      }
+      break;
+
+    case APRSIS_CONNECTED:
+      // everything received so far, in chunks of the line buffer
+      for (int chunks = 0; chunks < APRSIS_RX_CHUNKS; chunks++) {
+        while ((line = aprsis_reader_next(&aprsis_rx, &line_len))) {
+          t_last_rx = now;
+          aprsisStats.lines_in++;
+          aprsisStats.t_last_rx = now;
+          if (*line == '#')
+            aprsisStats.t_last_keepalive = now;
+          aprsis_handle_downlink(line, line_len, aprs_callsign.c_str());
+        }
+        if (aprsis_reader_fill(&aprsis_rx, aprs_is_client) <= 0)
+          break;
+      }
+      if (!aprs_is_client.connected()) { err = "Error: connection lost"; break; }
+      if (now - t_last_rx > APRSIS_KEEPALIVE_TIMEOUT) { err = "Error: server timeout"; break; }
+      if (!aprsis_uplink_send(aprs_is_client))
+        err = "";
+      break;
+    }
+
+    if (err) {
+      // "": status has already been set
+      if (*err)
+        aprsis_status_set("%s", err);
+      if (fd >= 0) {
+        close(fd);
+        fd = -1;
+      }
+      aprs_is_client.stop();
+      aprsis_uplink_drop();
+      if (t_connected)
+        aprsisStats.disconnects++;
+      else
+        aprsisStats.connect_failures++;
+      if (!online) {
+        // not the fault of the server: same one again, as soon as we are back online
+        t_retry = now;
+      } else {
+        // the address may be outdated, e.g. of a rotate name
+        if (!t_connected && srv)
+          srv->ip = 0;
+        if (t_connected && now - t_connected > APRSIS_BACKOFF_RESET)
+          backoff = APRSIS_BACKOFF_MIN;
+        server = (server + 1) % aprsis_servers_count;
+        if (++servers_failed < aprsis_servers_count) {
+          t_retry = now + APRSIS_FAILOVER_DELAY;
+          aprsisStats.failovers++;
+        } else {
+          servers_failed = 0;
+          t_retry = now + backoff * 3 / 4 + esp_random() % (backoff / 2 + 1);
+          backoff = (backoff * 2 > APRSIS_BACKOFF_MAX) ? APRSIS_BACKOFF_MAX : backoff * 2;
+        }
+      }
+      t_connected = 0;
+      state = APRSIS_IDLE;
+    }
+
+    vTaskDelay(((state == APRSIS_IDLE) ? 100 : 10) / portTICK_PERIOD_MS);
+  }
+}
@@ -2,14 +2,33 @@
 #include <SparkFun_Ublox_Arduino_Library.h>
 #include <taskWebServer.h>
 #include <esp_task_wdt.h>
+#include "metrics.h"
+#include <NmeaStream.h>
+#include <UbxNavPvt.h>
+#include <GpsPower.h>
+#include <sys/time.h>
 
 
 SFE_UBLOX_GPS myGPS;
 
 #ifdef ENABLE_WIFI
   #include "wifi_clients.h"
+  #include <lwip/sockets.h>
+  #include <errno.h>
   #define MAX_GPS_WIFI_CLIENTS 6
   WiFiClient * gps_clients[MAX_GPS_WIFI_CLIENTS];
+
+  // per client: the sentence types it asked for, and what the socket did not take yet
+  struct gps_client_state {
+    WiFiClient *client;               // slot was reassigned if it differs from gps_clients[]
+    uint16_t types;                   // NMEA_* mask
+    uint8_t cmd_len;
+    char cmd[48];                     // line from the client: types like "RMC,GGA"
+    uint8_t pending_off;
+    uint8_t pending_len;
+    char pending[NMEA_LINE_MAX];
+  };
+  static struct gps_client_state gps_client_states[MAX_GPS_WIFI_CLIENTS];
 #endif
 
 // Pins for GPS
@@ -22,8 +41,163 @@ static const uint32_t GPSBaud = 9600; //GPS
 HardwareSerial gpsSerial(1);        // TTGO has HW serial
 TinyGPSPlus gps;             // The TinyGPS++ object
 bool gpsInitialized = false;
+static bool gpsModuleFound = false;   // answered the UBX config
+
+extern boolean gps_state;
+extern boolean gps_ubx_pvt;
+extern uint8_t gps_ubx_rate;
+extern boolean gps_power_save;
+extern volatile uint32_t gps_beacon_due;
+extern volatile bool gps_keep_on;
+
+// NAV-PVT expected at least this often. Else the module was off (back at NMEA) or does not know NAV-PVT
+#define GPS_UBX_TIMEOUT 5000
+#define GPS_UBX_RETRIES 3
+
+#ifdef ENABLE_WIFI
+// a line from the client selects the sentence types it gets. Unknown types: no change
+static void gps_client_read(WiFiClient *client, struct gps_client_state *st) {
+  while (client->available() > 0) {
+    int c = client->read();
+    if (c < 0)
+      break;
+    if (c == '\r' || c == '\n') {
+      st->cmd[st->cmd_len] = 0;
+      uint16_t types = nmea_filter_parse(st->cmd);
+      if (st->cmd_len && types)
+        st->types = types;
+      st->cmd_len = 0;
+    } else if (st->cmd_len < sizeof(st->cmd) - 1) {
+      st->cmd[st->cmd_len++] = (char) c;
+    }
+  }
+}
+
+// rest of the last sentence first. Never blocks: returns false if the socket has no room for all of it
+static bool gps_client_flush(WiFiClient *client, struct gps_client_state *st) {
+  while (st->pending_off < st->pending_len) {
+    int n = send(client->fd(), st->pending + st->pending_off, st->pending_len - st->pending_off, MSG_DONTWAIT);
+    if (n < 0) {
+      if (errno != EAGAIN && errno != EWOULDBLOCK)
+        client->stop();
+      return false;
+    }
+    st->pending_off += n;
+  }
+  st->pending_off = st->pending_len = 0;
+  return true;
+}
+
+// whole sentences only: if the client is still behind with the last one, it misses this one
+static void gps_clients_send(const char *sentence, size_t len) {
+  uint16_t type = nmea_sentence_type(sentence);
+  for (int i = 0; i < MAX_GPS_WIFI_CLIENTS; i++) {
+    WiFiClient *client = gps_clients[i];
+    struct gps_client_state *st = &gps_client_states[i];
+    if (!client || !(st->types & type) || !client->connected())
+      continue;
+    if (!gps_client_flush(client, st)) {
+      metrics.nmea_dropped++;
+      continue;
+    }
+    memcpy(st->pending, sentence, len);
+    st->pending_len = len;
+    gps_client_flush(client, st);
+  }
+}
+
+static bool gps_clients_connected() {
+  for (int i = 0; i < MAX_GPS_WIFI_CLIENTS; i++) {
+    if (gps_clients[i])
+      return true;
+  }
+  return false;
+}
+
+static void gps_clients_poll() {
+  check_for_new_clients(&gpsServer, gps_clients, MAX_GPS_WIFI_CLIENTS);
+  for (int i = 0; i < MAX_GPS_WIFI_CLIENTS; i++) {
+    WiFiClient *client = gps_clients[i];
+    struct gps_client_state *st = &gps_client_states[i];
+    if (client != st->client) {
+      memset(st, 0, sizeof(*st));
+      st->client = client;
+      st->types = NMEA_ALL;
+    }
+    if (client && client->connected()) {
+      gps_client_read(client, st);
+      gps_client_flush(client, st);
+    } else {
+      // deleted below. A new client may get the same address
+      st->client = nullptr;
+    }
+  }
+  // frees the disconnected ones
+  iterateWifiClients([](WiFiClient *client, int clientIdx, const String *data){}, nullptr, gps_clients, MAX_GPS_WIFI_CLIENTS);
+}
+#endif
+
+// the sentences the module sent before NAV-PVT was selected
+static void gps_output_nmea() {
+  myGPS.setNavigationFrequency(1);
+  myGPS.disableMessage(UBX_CLASS_NAV, UBX_NAV_PVT, COM_PORT_UART1);
+  myGPS.setUART1Output(COM_TYPE_NMEA);
+  myGPS.enableNMEAMessage(UBX_NMEA_GLL, COM_PORT_UART1);
+  myGPS.enableNMEAMessage(UBX_NMEA_GSA, COM_PORT_UART1);
+  myGPS.enableNMEAMessage(UBX_NMEA_GSV, COM_PORT_UART1);
+  myGPS.enableNMEAMessage(UBX_NMEA_VTG, COM_PORT_UART1);
+  myGPS.enableNMEAMessage(UBX_NMEA_RMC, COM_PORT_UART1);
+  myGPS.enableNMEAMessage(UBX_NMEA_GGA, COM_PORT_UART1);
+}
+
+// NAV-PVT only, rate fixes per second. Returns false (and NMEA again) if the module refused it
+static bool gps_output_ubx_pvt(uint8_t rate) {
+  if (!myGPS.setUART1Output(COM_TYPE_UBX) ||
+      !myGPS.enableMessage(UBX_CLASS_NAV, UBX_NAV_PVT, COM_PORT_UART1) ||
+      !myGPS.setNavigationFrequency(rate)) {
+    gps_output_nmea();
+    return false;
+  }
+  return true;
+}
+
+// time of the fix, if NTP has not set the clock yet
+static void gps_clock_set(const struct ubx_nav_pvt *pvt) {
+  uint32_t usec;
+  uint32_t t = ubx_nav_pvt_unix_time(pvt, &usec);
+  if (!t || time(nullptr) > 1600000000)
+    return;
+  struct timeval tv = { .tv_sec = (time_t) t, .tv_usec = (suseconds_t) usec };
+  settimeofday(&tv, nullptr);
+}
+
+static void gps_pvt_received(const struct ubx_nav_pvt *pvt) {
+  char buf[2 * (NMEA_LINE_MAX + 1)];
+  size_t len = ubx_nav_pvt_to_nmea(pvt, buf, sizeof(buf));
+
+  // RMC and GGA are all TinyGPS++ takes from the NMEA stream, too
+  for (size_t i = 0; i < len; i++)
+    gps.encode(buf[i]);
+  #ifdef ENABLE_WIFI
+    for (const char *p = buf; p < buf + len; ) {
+      const char *end = strchr(p, '\n') + 1;
+      gps_clients_send(p, end - p);
+      p = end;
+    }
+  #endif
+  gps_clock_set(pvt);
+}
+
+// any byte on its RX line ends the backup mode of RXM-PMREQ
+static void gps_wake() {
+  for (int i = 0; i < 8; i++)
+    gpsSerial.write(0xff);
+  gpsSerial.flush();
+  delay(100);
+}
 
 [[noreturn]] void taskGPS(void *parameter) {
+  metrics_register_task();
   if (!gpsInitialized){
     gpsSerial.begin(GPSBaud, SERIAL_8N1, TXPin, RXPin);        //Startup HW serial for GPS
 
@@ -31,6 +205,7 @@ bool gpsInitialized = false;
     // Thanks Peter (https://github.com/peterus)
     // https://github.com/lora-aprs/TTGO-T-Beam_GPS-reset
     if(myGPS.begin(gpsSerial)){
+          gpsModuleFound = true;
           myGPS.setUART1Output(COM_TYPE_NMEA); //Set the UART port to output NMEA only
           //myGPS.saveConfiguration(); //Save the current settings to flash and BBR
           myGPS.enableNMEAMessage(UBX_NMEA_GLL, COM_PORT_UART1);
@@ -43,38 +218,123 @@ bool gpsInitialized = false;
           delay(1000);
     }
   }
+  metrics_boot_phase("gps");
 
 
   esp_task_wdt_init(120, true); //enable panic so ESP32 restarts
   esp_task_wdt_add(NULL); //add current thread to WDT watch
 
-  String gpsDataBuffer = "              ";
+  #ifdef ENABLE_WIFI
+    struct nmea_reader nmea;
+    nmea_reader_init(&nmea);
+  #endif
+  struct ubx_reader ubx_rx;
+  struct ubx_nav_pvt pvt;
+  ubx_reader_init(&ubx_rx);
+  bool ubx = false;                   // module sends NAV-PVT
+  uint8_t ubx_rate = 0;
+  bool ubx_wanted = false;            // gps_ubx_pvt when last looked at
+  bool ubx_given_up = false;          // until gps_ubx_pvt changes
+  uint8_t ubx_retries = 0;
+  uint32_t t_last_pvt = 0;
+  struct gps_power gps_pwr;
+  gps_power_init(&gps_pwr, millis());
   for (;;) {
     esp_task_wdt_reset();
     #ifdef ENABLE_WIFI
-    check_for_new_clients(&gpsServer, gps_clients, MAX_GPS_WIFI_CLIENTS);
+    gps_clients_poll();
     #endif
+    // settings apply without reboot
+    if (gps_ubx_pvt != ubx_wanted) {
+      ubx_wanted = gps_ubx_pvt;
+      ubx_given_up = false;
+    }
+    if (gpsModuleFound && gps_state && (ubx_wanted && !ubx_given_up) != ubx) {
+      if (!ubx) {
+        ubx = gps_output_ubx_pvt(gps_ubx_rate);
+        if (!ubx) {
+          Serial.println("GPS: UBX NAV-PVT refused, using NMEA");
+          ubx_given_up = true;
+        }
+        ubx_rate = gps_ubx_rate;
+        ubx_retries = 0;
+        ubx_reader_init(&ubx_rx);
+        t_last_pvt = millis();
+      } else {
+        gps_output_nmea();
+        ubx = false;
+      }
+    } else if (ubx && gps_state && gps_ubx_rate != ubx_rate) {
+      ubx_rate = gps_ubx_rate;
+      myGPS.setNavigationFrequency(ubx_rate);
+    }
+
+    // sleep between beacons. The LDO3 switch (gps_state) is the hard off
+    if (gpsModuleFound && gps_state && gps_power_save) {
+      bool keep_on = gps_keep_on;
+      #ifdef ENABLE_WIFI
+        // NMEA clients want a continuous stream
+        keep_on = keep_on || gps_clients_connected();
+      #endif
+      uint32_t sleep_ms;
+      switch (gps_power_update(&gps_pwr, millis(), gps_beacon_due, keep_on, gps.location.isValid() && gps.location.age() < 2000, &sleep_ms)) {
+      case GPS_POWER_SLEEP:
+        myGPS.powerOffWithInterrupt(sleep_ms, VAL_RXM_PMREQ_WAKEUPSOURCE_UARTRX);
+        break;
+      case GPS_POWER_WAKE:
+        gps_wake();
+        // the configuration may not have survived
+        if (ubx && !gps_output_ubx_pvt(ubx_rate)) {
+          ubx = false;
+          ubx_given_up = true;
+        }
+        t_last_pvt = millis();
+        break;
+      }
+    } else if (gps_pwr.asleep) {
+      if (gps_state)
+        gps_wake();
+      gps_power_init(&gps_pwr, millis());
+    }
+    metrics.gps_sleeps = gps_pwr.sleeps;
+    metrics.gps_slept_ms = gps_pwr.slept_ms;
+    metrics.gps_time_to_fix_ms = gps_pwr.ttf_avg;
+
+    if (ubx && gps_state && !gps_pwr.asleep && millis() - t_last_pvt > GPS_UBX_TIMEOUT) {
+      if (++ubx_retries > GPS_UBX_RETRIES) {
+        Serial.println("GPS: no UBX NAV-PVT, using NMEA");
+        gps_output_nmea();
+        ubx = false;
+        ubx_given_up = true;
+      } else if (!gps_output_ubx_pvt(ubx_rate)) {
+        ubx = false;
+        ubx_given_up = true;
+      }
+      t_last_pvt = millis();
+    }
+
     while (gpsSerial.available() > 0) {
       char gpsChar = (char)gpsSerial.read();
+      if (ubx) {
+        if (ubx_reader_feed(&ubx_rx, (uint8_t) gpsChar, &pvt)) {
+          t_last_pvt = millis();
+          ubx_retries = 0;
+          gps_pvt_received(&pvt);
+        }
+        continue;
+      }
       gps.encode(gpsChar);
       #ifdef ENABLE_WIFI
-        if (gpsChar == '$') {
-          gpsDataBuffer = String(gpsChar);
-        } else {
-          gpsDataBuffer += String(gpsChar);
-
-          if (gpsChar == '\n') {
-            iterateWifiClients([](WiFiClient *client, int clientIdx, const String *data){
-              if (client->connected()){
-                client->print(*data);
-                client->flush();
-              }
-            }, &gpsDataBuffer, gps_clients, MAX_GPS_WIFI_CLIENTS);
-            gpsDataBuffer = "";
-          }
-        }
+        size_t len;
+        const char *sentence = nmea_reader_feed(&nmea, gpsChar, &len);
+        if (sentence)
+          gps_clients_send(sentence, len);
       #endif
     }
+    #ifdef ENABLE_WIFI
+      metrics.nmea_invalid = nmea.invalid;
+    #endif
+    metrics.ubx_invalid = ubx_rx.invalid;
     vTaskDelay(100 / portTICK_PERIOD_MS);
   }
 }
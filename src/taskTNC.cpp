@@ -1,5 +1,7 @@
 #include "taskTNC.h"
 #include <esp_task_wdt.h>
+#include <PipelineProfile.h>
+#include "metrics.h"
 
 #ifdef ENABLE_BLUETOOTH
   BluetoothSerial SerialBT;
@@ -20,6 +22,57 @@ String inTNCDataBuffers[IN_TNC_BUFFERS];
 
 QueueHandle_t tncToSendQueue = nullptr;
 
+#ifdef ENABLE_PIPELINE_PROFILING
+/**
+ * Answer a KISS command on the port it came from
+ * @param kissFrame
+ * @param bufferIndex 0: serial. 1: bluetooth. 2..: wifi clients
+ */
+void replyKISS(const String &kissFrame, int bufferIndex) {
+  if (bufferIndex == 0) {
+    Serial.print(kissFrame);
+  }
+  #ifdef ENABLE_BLUETOOTH
+  else if (bufferIndex == 1) {
+    if (SerialBT.hasClient()) {
+      SerialBT.print(kissFrame);
+    }
+  }
+  #endif
+  #ifdef ENABLE_WIFI
+  else if (bufferIndex - 2 < MAX_WIFI_CLIENTS) {
+    WiFiClient *client = clients[bufferIndex - 2];
+    if (client && client->connected()) {
+      client->print(kissFrame);
+      client->flush();
+    }
+  }
+  #endif
+}
+
+/**
+ * CMD_HARDWARE HW_PROFILE: reply with the pipeline profile (C0 06 50 C0)
+ * @param kissFrame raw command frame
+ */
+void handleKISSHardwareCommand(const String &kissFrame, int bufferIndex) {
+  int i = 1;
+  while (i < kissFrame.length() && kissFrame.charAt(i) == (char) FEND) {
+    i++;
+  }
+  if (i + 1 >= kissFrame.length() || (kissFrame.charAt(i) & 0x0f) != CMD_HARDWARE || kissFrame.charAt(i + 1) != (char) HW_PROFILE) {
+    return;
+  }
+  char *buf = (char *) malloc(1024);
+  if (!buf) {
+    return;
+  }
+  if (profile_format_text(buf, 1024)) {
+    replyKISS(encapsulateKISS(String(buf), CMD_HARDWARE), bufferIndex);
+  }
+  free(buf);
+}
+#endif
+
 
 /**
  * Handle incoming TNC KISS data character
@@ -27,6 +80,7 @@ QueueHandle_t tncToSendQueue = nullptr;
  */
 void handleKISSData(char character, int bufferIndex) {
   String *inTNCData = &inTNCDataBuffers[bufferIndex];
+  metrics.kiss_rx_bytes[(bufferIndex < METRICS_KISS_TCP) ? bufferIndex : METRICS_KISS_TCP]++;
   if (inTNCData->length() == 0 && character != (char) FEND){
     // kiss frame begins with C0
     return;
@@ -57,8 +111,14 @@ void handleKISSData(char character, int bufferIndex) {
       buffer->concat(TNC2DataFrame);
       if (xQueueSend(tncToSendQueue, &buffer, (1000 / portTICK_PERIOD_MS)) != pdPASS) {
         delete buffer;
+        metrics.kiss_in_dropped++;
       }
     }
+    #ifdef ENABLE_PIPELINE_PROFILING
+    else {
+      handleKISSHardwareCommand(TNC2DataFrame, bufferIndex);
+    }
+    #endif
     inTNCData->clear();
   }
   if (inTNCData->length() > 255){
@@ -72,6 +132,7 @@ void handleKISSData(char character, int bufferIndex) {
   tncToSendQueue = xQueueCreate(4,sizeof(String *));
   tncReceivedQueue = xQueueCreate(4,sizeof(String *));
   String *loraReceivedFrameString = nullptr;
+  metrics_register_task();
 
   esp_task_wdt_init(120, true); //enable panic so ESP32 restarts
   esp_task_wdt_add(NULL); //add current thread to WDT watch
@@ -102,17 +163,19 @@ void handleKISSData(char character, int bufferIndex) {
 
     #endif
     if (xQueueReceive(tncReceivedQueue, &loraReceivedFrameString, (1 / portTICK_PERIOD_MS)) == pdPASS) {
+      PROFILE_BEGIN(t_profile);
       const String &kissEncoded = encode_kiss(*loraReceivedFrameString);
-      Serial.print(kissEncoded);
+      PROFILE_END(PROFILE_KISS_ENCODE, t_profile);
+      metrics.kiss_tx_bytes[METRICS_KISS_SERIAL] += Serial.print(kissEncoded);
       #ifdef ENABLE_BLUETOOTH
         if (SerialBT.hasClient()){
-          SerialBT.print(kissEncoded);
+          metrics.kiss_tx_bytes[METRICS_KISS_BLUETOOTH] += SerialBT.print(kissEncoded);
         }
       #endif
       #ifdef ENABLE_WIFI
         iterateWifiClients([](WiFiClient *client, int clientIdx, const String *data){
           if (client->connected()){
-            client->print(*data);
+            metrics.kiss_tx_bytes[METRICS_KISS_TCP] += client->print(*data);
             client->flush();
           }
         }, &kissEncoded, clients, MAX_WIFI_CLIENTS);
@@ -1,9 +1,16 @@
-#include <list>
 #include "taskWebServer.h"
+#include "taskAPRSIS.h"
 #include "preference_storage.h"
 #include "syslog_log.h"
 #include "PSRAMJsonDocument.h"
+#include <Digipeater.h>
+#include <HeardStations.h>
+#include <PacketCapture.h>
+#include <PipelineProfile.h>
+#include <BufAppend.h>
+#include "metrics.h"
 #include <time.h>
+#include <sys/time.h>
 #include <ArduinoJson.h>
 #include <esp_task_wdt.h>
 
@@ -34,7 +41,6 @@ extern bool tncServer_enabled;
 extern bool gpsServer_enabled;
 
 // For APRS-IS connection
-extern String to_aprsis_data;
 extern boolean aprsis_enabled;
 extern String aprsis_host;
 extern uint16_t aprsis_port;
@@ -50,29 +56,67 @@ extern boolean lora_tx_enabled;
 extern char src_call_blacklist;
 
 QueueHandle_t webListReceivedQueue = nullptr;
-std::list <tReceivedPacketData*> receivedPackets;
-const int MAX_RECEIVED_LIST_SIZE = 50;
+
+// Received frames for /received_list: a ring of fixed size entries, allocated at start
+// (in PSRAM if there is some) and sized by the memory free then. Entry of seq: rx_list[seq % capacity]
+#define RX_LIST_PACKET_LEN 256
+#define RX_LIST_MIN 16
+#define RX_LIST_MAX 100           // in RAM
+#define RX_LIST_MAX_PSRAM 2000
+
+struct rx_list_entry {
+  uint32_t seq;                   // 0: empty
+  char time[20];                  // formatted when received
+  int16_t rssi;
+  int16_t snr;
+  char packet[RX_LIST_PACKET_LEN];
+};
+
+static struct rx_list_entry *rx_list = nullptr;
+static uint16_t rx_list_capacity = 0;
+static uint32_t rx_list_seq = 0;  // newest entry. Appended by taskWebServer, read by the handlers
+static SemaphoreHandle_t rxListLock = nullptr;
+
+// All frames received and sent, for /capture.pcapng (see lib/PacketCapture). Sized like the received list
+#define CAPTURE_MIN 16
+#define CAPTURE_MAX 64            // in RAM
+#define CAPTURE_MAX_PSRAM 2000
+#define CAPTURE_FOLLOWERS_MAX 2   // ?follow=1 keeps the connection open
+
+static uint8_t capture_followers = 0;  // handlers and fillers all run in the async_tcp task
+
+// Live frames for /events (Server-Sent Events). Producers only queue a copy, taskWebServer formats
+// and sends them. Each subscriber has its own bounded queue in AsyncEventSource, a slow one loses events
+#define WEB_EVENTS_QUEUE_LEN 8
+#define WEB_EVENTS_CLIENTS_MAX 4
+
+typedef struct {
+  const char *kind;
+  int16_t rssi;
+  int16_t snr;
+  double freq;
+  struct timeval tv;
+  uint32_t uptime;
+  char frame[256];
+} tWebEvent;
+
+AsyncEventSource events("/events");
+static QueueHandle_t webEventsQueue = nullptr;
+static volatile bool web_events_listening = false;  // events.count(), updated by taskWebServer
+static uint32_t web_events_id = 0;
 
 String apSSID = "";
 String apPassword;
 String defApPassword = "xxxxxxxxxx";
 
-// needed for aprsis igate functionality
-String aprsis_status = "Disconnected";
-// aprsis 3rd party traffic encoding
-String generate_third_party_packet(String, String);
+extern String Tcall;
+extern void apply_settings_later();
 #ifdef KISS_PROTOCOL
-extern void sendToTNC(const String &);
+extern QueueHandle_t tncToSendQueue;
+extern QueueHandle_t tncReceivedQueue;
 #endif
-extern uint8_t txPower;
-extern double lora_freq;
-extern ulong lora_speed;
-extern uint8_t txPower_cross_digi;
-extern ulong lora_speed_cross_digi;
-extern double lora_freq_cross_digi;
-extern void loraSend(byte, float, ulong, const String &);
-
-WebServer server(80);
+
+AsyncWebServer server(80);
 #ifdef KISS_PROTOCOL
   WiFiServer tncServer(NETWORK_TNC_PORT);
 #endif
@@ -92,17 +136,69 @@ WiFiServer gpsServer(NETWORK_GPS_PORT);
 #endif
 
 
-void sendCacheHeader() { server.sendHeader("Cache-Control", "max-age=3600"); }
-void sendGzipHeader() { server.sendHeader("Content-Encoding", "gzip"); }
+void sendCacheHeader(AsyncWebServerResponse *response) { response->addHeader("Cache-Control", "max-age=3600"); }
+void sendGzipHeader(AsyncWebServerResponse *response) { response->addHeader("Content-Encoding", "gzip"); }
+
+// Handlers run in the AsyncTCP task, several requests may be in progress at a time.
+// Below this much free heap, new requests are answered 503 (see handle_NotFound)
+#define WEB_MIN_FREE_HEAP 24576
+
+bool web_admit(AsyncWebServerRequest *request) {
+  return ESP.getFreeHeap() >= WEB_MIN_FREE_HEAP;
+}
+
+// ESP.restart() from a handler would cut off its response: taskWebServer restarts at this millis(). 0: not pending
+static volatile uint32_t web_restart_at = 0;
+
+void web_restart_later() {
+  web_restart_at = (millis() + 500) | 1;
+}
 
+// one pass; control characters as \u00XX
 String jsonEscape(String s){
-    s.replace("\\", "\\\\");
-    s.replace("\"", "\\\"");
-    s.replace("\x7f", "\\\x7f");
-    for(char i = 0; i < 0x1f; i++){
-        s.replace(String(i), "\\" + String((char)i));
+  String out;
+  out.reserve(s.length() + 8);
+  for (const char *p = s.c_str(); *p; p++) {
+    uint8_t c = *p;
+    if (c == '"' || c == '\\') {
+      out += '\\';
+      out += (char) c;
+    } else if (c < 0x20 || c == 0x7f) {
+      char hex[8];
+      snprintf(hex, sizeof(hex), "\\u%04x", c);
+      out += hex;
+    } else {
+      out += (char) c;
+    }
+  }
+  return out;
+}
+
+// jsonEscape() into buf. Returns the length, or -1 if it does not fit (nothing is terminated).
+// cut: instead of -1, the length of the characters which fit
+int json_escape_to(char *buf, size_t len, const char *s, bool cut=false){
+  size_t n = 0;
+  for (; *s; s++) {
+    uint8_t c = *s;
+    if (c == '"' || c == '\\') {
+      if (n + 2 > len)
+        return cut ? (int) n : -1;
+      buf[n++] = '\\';
+      buf[n++] = c;
+    } else if (c < 0x20 || c == 0x7f) {
+      char hex[8];
+      if (n + 6 > len)
+        return cut ? (int) n : -1;
+      snprintf(hex, sizeof(hex), "\\u%04x", c);
+      memcpy(buf + n, hex, 6);
+      n += 6;
+    } else {
+      if (n + 1 > len)
+        return cut ? (int) n : -1;
+      buf[n++] = c;
     }
-  return s;
+  }
+  return n;
 }
 
 String jsonLineFromPreferenceString(const char *preferenceName, bool last=false){
@@ -127,141 +223,184 @@ String jsonLineFromDouble(const char *name, const double value, bool last=false)
   return String("\"") + name + "\":" + String(value, 4) + (last ?  + R"()" :  + R"(,)");
 }
 
-void handle_NotFound(){
-  sendCacheHeader();
-  server.send(404, "text/plain", "Not found");
+void handle_NotFound(AsyncWebServerRequest *request) {
+  // also the requests web_admit() turned away
+  if (!web_admit(request)) {
+    request->send(503, "text/plain", "Busy");
+    return;
+  }
+  AsyncWebServerResponse *response = request->beginResponse(404, "text/plain", "Not found");
+  sendCacheHeader(response);
+  request->send(response);
 }
 
-void handle_Index() {
-  sendGzipHeader();
-  server.send_P(200, "text/html", web_index_html, web_index_html_end - web_index_html);
+void handle_Index(AsyncWebServerRequest *request) {
+  AsyncWebServerResponse *response = request->beginResponse_P(200, "text/html", (const uint8_t *) web_index_html, web_index_html_end - web_index_html);
+  sendGzipHeader(response);
+  request->send(response);
 }
 
-void handle_Style() {
-  sendCacheHeader();
-  sendGzipHeader();
-  server.send_P(200, "text/css", web_style_css, web_style_css_end - web_style_css);
+void handle_Style(AsyncWebServerRequest *request) {
+  AsyncWebServerResponse *response = request->beginResponse_P(200, "text/css", (const uint8_t *) web_style_css, web_style_css_end - web_style_css);
+  sendCacheHeader(response);
+  sendGzipHeader(response);
+  request->send(response);
 }
 
-void handle_Js() {
-  sendCacheHeader();
-  sendGzipHeader();
-  server.send_P(200, "text/javascript", web_js_js, web_js_js_end-web_js_js);
+void handle_Js(AsyncWebServerRequest *request) {
+  AsyncWebServerResponse *response = request->beginResponse_P(200, "text/javascript", (const uint8_t *) web_js_js, web_js_js_end-web_js_js);
+  sendCacheHeader(response);
+  sendGzipHeader(response);
+  request->send(response);
 }
 
-void handle_ScanWifi() {
+// The scan runs in the background: 202 while it is in progress, the page asks again
+void handle_ScanWifi(AsyncWebServerRequest *request) {
+  int n = WiFi.scanComplete();
+  if (n == WIFI_SCAN_FAILED) {
+    WiFi.scanNetworks(true);
+    n = WIFI_SCAN_RUNNING;
+  }
+  if (n == WIFI_SCAN_RUNNING) {
+    request->send(202, "text/plain", "Scanning");
+    return;
+  }
+
   String listResponse = R"(<label for="networks_found_list">Networks found:</label><select class="u-full-width" id="networks_found_list">)";
-  int n = WiFi.scanNetworks();
   listResponse += "<option value=\"\">Select Network</option>";
 
   for (int i = 0; i < n; ++i) {
     listResponse += "<option value=\""+WiFi.SSID(i)+"\">" + WiFi.SSID(i) + "</option>";
   }
   listResponse += "</select>";
-  server.send(200,"text/html", listResponse);
+  WiFi.scanDelete();
+  request->send(200,"text/html", listResponse);
+}
+
+static void web_cfg_not_saved(AsyncWebServerRequest *request) {
+  request->send(500, "text/plain", "Settings could not be written to flash. They are lost on the next reboot");
 }
 
-void handle_SaveWifiCfg() {
+void handle_SaveWifiCfg(AsyncWebServerRequest *request) {
 
-  if (!server.hasArg(PREF_WIFI_SSID) || !server.hasArg(PREF_WIFI_PASSWORD) || !server.hasArg(PREF_AP_PASSWORD)){
-    server.send(500, "text/plain", "Invalid request, make sure all fields are set");
+  if (!request->hasArg(PREF_WIFI_SSID) || !request->hasArg(PREF_WIFI_PASSWORD) || !request->hasArg(PREF_AP_PASSWORD)){
+    request->send(500, "text/plain", "Invalid request, make sure all fields are set");
+    return;
   }
 
   // Mode STA:
-  if (!server.arg(PREF_WIFI_SSID).length()){
-    server.send(403, "text/plain", "Empty SSID");
+  if (!request->arg(PREF_WIFI_SSID).length()){
+    request->send(403, "text/plain", "Empty SSID");
+    return;
   } else {
     // Update SSID
-    preferences.putString(PREF_WIFI_SSID, server.arg(PREF_WIFI_SSID));
-    Serial.println("Updated SSID: " + server.arg(PREF_WIFI_SSID));
+    preferences.putString(PREF_WIFI_SSID, request->arg(PREF_WIFI_SSID));
+    Serial.println("Updated SSID: " + request->arg(PREF_WIFI_SSID));
   }
 
-  if (server.arg(PREF_WIFI_PASSWORD)!="*" && server.arg(PREF_WIFI_PASSWORD).length()>0 && server.arg(PREF_WIFI_PASSWORD).length()<8){
-    server.send(403, "text/plain", "WiFi Password must be minimum 8 character");
+  if (request->arg(PREF_WIFI_PASSWORD)!="*" && request->arg(PREF_WIFI_PASSWORD).length()>0 && request->arg(PREF_WIFI_PASSWORD).length()<8){
+    request->send(403, "text/plain", "WiFi Password must be minimum 8 character");
+    return;
   } else {
-    if (server.arg(PREF_WIFI_PASSWORD)!="*") {
+    if (request->arg(PREF_WIFI_PASSWORD)!="*") {
       // Update WiFi password
-      preferences.putString(PREF_WIFI_PASSWORD, server.arg(PREF_WIFI_PASSWORD));
-      Serial.println("Updated WiFi PASS: " + server.arg(PREF_WIFI_PASSWORD));
+      preferences.putString(PREF_WIFI_PASSWORD, request->arg(PREF_WIFI_PASSWORD));
+      Serial.println("Updated WiFi PASS: " + request->arg(PREF_WIFI_PASSWORD));
     }
   }
-  if (server.hasArg(PREF_WIFI_TXPWR_MODE_STA)) {
+  if (request->hasArg(PREF_WIFI_TXPWR_MODE_STA)) {
     // Web chooser min, low, mid, high, max
     // We'll use "min", "low", "mid", "high", "max" -> 2dBm (1.5mW) -> 8, 11dBm (12mW) -> 44, 15dBm (32mW) -> 60, 18dBm (63mW) ->72, 20dBm (100mW) ->80
-    int8_t choosed = server.arg(PREF_WIFI_TXPWR_MODE_STA).toInt();
+    int8_t choosed = request->arg(PREF_WIFI_TXPWR_MODE_STA).toInt();
     if (choosed < 0) choosed = 8;
     else if (choosed > 84) choosed = 84;
     preferences.putInt(PREF_WIFI_TXPWR_MODE_STA, choosed);
   }
 
   // Mode AP:
-  if (server.arg(PREF_AP_PASSWORD)!="*" && server.arg(PREF_AP_PASSWORD).length()<8){
-    server.send(403, "text/plain", "AP Password must be minimum 8 character");
+  if (request->arg(PREF_AP_PASSWORD)!="*" && request->arg(PREF_AP_PASSWORD).length()<8){
+    request->send(403, "text/plain", "AP Password must be minimum 8 character");
+    return;
   } else {
-    if (server.arg(PREF_AP_PASSWORD)!="*") {
+    if (request->arg(PREF_AP_PASSWORD)!="*") {
       // Update AP password
-      preferences.putString(PREF_AP_PASSWORD, server.arg(PREF_AP_PASSWORD));
-      Serial.println("Updated AP PASS: " + server.arg(PREF_AP_PASSWORD));
+      preferences.putString(PREF_AP_PASSWORD, request->arg(PREF_AP_PASSWORD));
+      Serial.println("Updated AP PASS: " + request->arg(PREF_AP_PASSWORD));
     }
   }
-  if (server.hasArg(PREF_WIFI_TXPWR_MODE_AP)) {
+  if (request->hasArg(PREF_WIFI_TXPWR_MODE_AP)) {
     // Web chooser min, low, mid, high, max
     // We'll use "min", "low", "mid", "high", "max" -> 2dBm (1.5mW) -> 8, 11dBm (12mW) -> 44, 15dBm (32mW) -> 60, 18dBm (63mW) ->72, 20dBm (100mW) ->80
-    int8_t choosed = server.arg(PREF_WIFI_TXPWR_MODE_AP).toInt();
+    int8_t choosed = request->arg(PREF_WIFI_TXPWR_MODE_AP).toInt();
     if (choosed < 0) choosed = 8;
     else if (choosed > 84) choosed = 84;
     preferences.putInt(PREF_WIFI_TXPWR_MODE_AP, choosed);
   }
 
-  if (server.hasArg(PREF_WIFI_ENABLE))
-    preferences.putInt(PREF_WIFI_ENABLE, server.arg(PREF_WIFI_ENABLE).toInt());
+  if (request->hasArg(PREF_WIFI_ENABLE))
+    preferences.putInt(PREF_WIFI_ENABLE, request->arg(PREF_WIFI_ENABLE).toInt());
 
-  preferences.putBool(PREF_TNCSERVER_ENABLE, server.hasArg(PREF_TNCSERVER_ENABLE));
-  preferences.putBool(PREF_GPSSERVER_ENABLE, server.hasArg(PREF_GPSSERVER_ENABLE));
+  preferences.putBool(PREF_TNCSERVER_ENABLE, request->hasArg(PREF_TNCSERVER_ENABLE));
+  preferences.putBool(PREF_GPSSERVER_ENABLE, request->hasArg(PREF_GPSSERVER_ENABLE));
   String s = "";
-  if (server.hasArg(PREF_NTP_SERVER) && server.arg(PREF_NTP_SERVER).length()) {
-    s = server.arg(PREF_NTP_SERVER);
+  if (request->hasArg(PREF_NTP_SERVER) && request->arg(PREF_NTP_SERVER).length()) {
+    s = request->arg(PREF_NTP_SERVER);
     s.trim();
   }
   preferences.putString(PREF_NTP_SERVER, s);
 
-  server.sendHeader("Location", "/");
-  server.send(302,"text/html", "");
+  if (!web_cfg_changed()) {
+    web_cfg_not_saved(request);
+    return;
+  }
+  request->redirect("/");
 }
 
-void handle_Reboot() {
-  server.sendHeader("Location", "/");
-  server.send(302,"text/html", "");
-  server.close();
-  ESP.restart();
+void handle_Reboot(AsyncWebServerRequest *request) {
+  request->redirect("/");
+  web_restart_later();
 }
 
-void handle_Beacon() {
-  server.sendHeader("Location", "/");
-  server.send(302,"text/html", "");
+void handle_Beacon(AsyncWebServerRequest *request) {
+  request->redirect("/");
   manBeacon=true;
 }
 
-void handle_Shutdown() {
+void handle_Shutdown(AsyncWebServerRequest *request) {
   #ifdef T_BEAM_V1_0
-    server.send(200,"text/html", "Shutdown");
+    request->send(200,"text/html", "Shutdown");
     axp.setChgLEDMode(AXP20X_LED_OFF);
     axp.shutdown();
   #else
-    server.send(404,"text/html", "Not supported");
+    request->send(404,"text/html", "Not supported");
   #endif
 }
 
-void handle_Restore() {
-  server.sendHeader("Location", "/");
-  server.send(302,"text/html", "");
+void handle_Restore(AsyncWebServerRequest *request) {
+  request->redirect("/");
   preferences.clear();
   preferences.end();
-  ESP.restart();
+  web_cfg_changed();
+  web_restart_later();
 }
 
-void handle_Cfg() {
+// /cfg is rendered from the settings once per change and kept as text.
+// ETag: boot id and version, the browser revalidates and gets 304 while nothing changed
+static SemaphoreHandle_t cfgSnapshotLock = nullptr;
+static std::shared_ptr<String> cfg_snapshot;
+static uint32_t cfg_snapshot_version = 0;
+static volatile uint32_t cfg_version = 1;
+static uint32_t cfg_boot_id = 0;
+
+bool web_cfg_changed() {
+  cfg_version = cfg_version + 1;
+  // all settings of a save in one NVS write. If commitTransaction() failed, this is the retry
+  return preferences.commit();
+}
+
+static String cfg_render() {
   String jsonData = "{";
+  jsonData.reserve(4096);
   jsonData += String("\"") + PREF_WIFI_PASSWORD + "\": \"" + jsonEscape((preferences.getString(PREF_WIFI_PASSWORD, "").isEmpty() ? String("") : "*")) + R"(",)";
   jsonData += String("\"") + PREF_AP_PASSWORD + "\": \"" + jsonEscape((preferences.getString(PREF_AP_PASSWORD, "").isEmpty() ? String("") : "*")) + R"(",)";
   jsonData += jsonLineFromPreferenceInt(PREF_WIFI_ENABLE);
@@ -281,6 +420,7 @@ void handle_Cfg() {
   jsonData += jsonLineFromPreferenceBool(PREF_LORA_ADD_SNR_RSSI_TO_PATH_END_AT_KISS_PRESET);
   jsonData += jsonLineFromPreferenceInt(PREF_APRS_DIGIPEATING_MODE_PRESET);
   jsonData += jsonLineFromPreferenceInt(PREF_APRS_CROSS_DIGIPEATING_MODE_PRESET);
+  jsonData += jsonLineFromPreferenceString(PREF_APRS_DIGIPEATING_RULES);
   jsonData += jsonLineFromPreferenceInt(PREF_LORA_TX_BEACON_AND_KISS_TO_FREQUENCIES_PRESET);
   jsonData += jsonLineFromPreferenceBool(PREF_LORA_TX_BEACON_AND_KISS_TO_APRSIS_PRESET);
   jsonData += jsonLineFromPreferenceDouble(PREF_LORA_FREQ_CROSSDIGI_PRESET);
@@ -311,6 +451,9 @@ void handle_Cfg() {
   jsonData += jsonLineFromPreferenceBool(PREF_APRS_GPS_EN);
   jsonData += jsonLineFromPreferenceBool(PREF_ACCEPT_OWN_POSITION_REPORTS_VIA_KISS);
   jsonData += jsonLineFromPreferenceBool(PREF_GPS_ALLOW_SLEEP_WHILE_KISS);
+  jsonData += jsonLineFromPreferenceBool(PREF_GPS_UBX_PVT);
+  jsonData += jsonLineFromPreferenceInt(PREF_GPS_UBX_RATE);
+  jsonData += jsonLineFromPreferenceBool(PREF_GPS_POWER_SAVE);
   jsonData += jsonLineFromPreferenceBool(PREF_ENABLE_TNC_SELF_TELEMETRY);
   jsonData += jsonLineFromPreferenceInt(PREF_TNC_SELF_TELEMETRY_INTERVAL);
   jsonData += jsonLineFromPreferenceInt(PREF_TNC_SELF_TELEMETRY_MIC);
@@ -325,6 +468,7 @@ void handle_Cfg() {
   jsonData += jsonLineFromPreferenceInt(PREF_DEV_REBOOT_INTERVAL);
   jsonData += jsonLineFromPreferenceInt(PREF_DEV_SHOW_OLED_TIME);
   jsonData += jsonLineFromPreferenceInt(PREF_DEV_CPU_FREQ);
+  jsonData += jsonLineFromPreferenceBool(PREF_DEV_FAST_BOOT);
   jsonData += jsonLineFromPreferenceBool(PREF_APRSIS_EN);
   jsonData += jsonLineFromPreferenceString(PREF_APRSIS_SERVER_NAME);
   jsonData += jsonLineFromPreferenceInt(PREF_APRSIS_SERVER_PORT);
@@ -332,8 +476,63 @@ void handle_Cfg() {
   jsonData += jsonLineFromPreferenceString(PREF_APRSIS_CALLSIGN);
   jsonData += jsonLineFromPreferenceString(PREF_APRSIS_PASSWORD);
   jsonData += jsonLineFromPreferenceInt(PREF_APRSIS_ALLOW_INET_TO_RF);
+  jsonData += jsonLineFromPreferenceString(PREF_APRSIS_RF_FILTER, true);
+  jsonData += "}";
+  return jsonData;
+}
+
+void handle_Cfg(AsyncWebServerRequest *request) {
+  uint32_t version = cfg_version;
+  std::shared_ptr<String> snapshot;
+  AsyncWebServerResponse *response;
+  char etag[24];
+
+  snprintf(etag, sizeof(etag), "\"%08x-%u\"", cfg_boot_id, version);
+  if (request->hasHeader("If-None-Match") && request->header("If-None-Match") == etag) {
+    response = request->beginResponse(304);
+    response->addHeader("ETag", etag);
+    request->send(response);
+    return;
+  }
+
+  xSemaphoreTake(cfgSnapshotLock, portMAX_DELAY);
+  if (!cfg_snapshot || cfg_snapshot_version != version) {
+    cfg_snapshot = std::make_shared<String>(cfg_render());
+    cfg_snapshot_version = version;
+  }
+  snapshot = cfg_snapshot;
+  xSemaphoreGive(cfgSnapshotLock);
+  if (snapshot->length() < 2) {
+    request->send(503, "text/plain", "Out of memory");
+    return;
+  }
+
+  // copied from the snapshot as the TCP window opens; a newer snapshot does not affect this response
+  response = request->beginResponse("application/json", snapshot->length(), [snapshot](uint8_t *buf, size_t maxLen, size_t index) -> size_t {
+    size_t len = snapshot->length() - index;
+    if (len > maxLen)
+      len = maxLen;
+    memcpy(buf, snapshot->c_str() + index, len);
+    return len;
+  });
+  response->addHeader("ETag", etag);
+  response->addHeader("Cache-Control", "no-cache");
+  request->send(response);
+}
+
+// Values that change while running. Not part of /cfg, so that /cfg can be cached
+void handle_Status(AsyncWebServerRequest *request) {
+  String jsonData = "{";
   jsonData += jsonLineFromDouble("lora_freq_rx_curr", lora_freq_rx_curr);
-  jsonData += jsonLineFromString("aprsis_status", aprsis_status.c_str());
+  char aprsis_status[160];
+  aprsis_status_get(aprsis_status, sizeof(aprsis_status));
+  jsonData += jsonLineFromString("aprsis_status", aprsis_status);
+  char uplink[128];
+  snprintf(uplink, sizeof(uplink), "%lu sent in %lu writes. Dropped: %lu queue full, %lu offline. %lu not gated",
+    (unsigned long) aprsisUplinkStats.sent, (unsigned long) aprsisUplinkStats.writes,
+    (unsigned long) aprsisUplinkStats.dropped_full, (unsigned long) aprsisUplinkStats.dropped_offline,
+    (unsigned long) aprsisUplinkStats.not_gated);
+  jsonData += jsonLineFromString("aprsis_uplink", uplink);
   jsonData += jsonLineFromInt("FreeHeap", ESP.getFreeHeap());
   jsonData += jsonLineFromInt("HeapSize", ESP.getHeapSize());
   jsonData += jsonLineFromInt("FreeSketchSpace", ESP.getFreeSketchSpace());
@@ -342,25 +541,464 @@ void handle_Cfg() {
   jsonData += jsonLineFromInt("UptimeMinutes", millis()/1000/60, true);
 
   jsonData += "}";
-  server.send(200,"application/json", jsonData);
+  request->send(200,"application/json", jsonData);
 }
 
-void handle_ReceivedList() {
-  //PSRAMJsonDocument doc(MAX_RECEIVED_LIST_SIZE * 1000);
-  DynamicJsonDocument doc(MAX_RECEIVED_LIST_SIZE * 500);
-  JsonObject root = doc.to<JsonObject>();
-  auto received = root.createNestedArray("received");
-  for (auto element: receivedPackets){
-    char buf[64];
-    strftime(buf, 64, "%Y-%m-%d %H:%M:%S", &element->rxTime);
-    auto packet_data = received.createNestedObject();
-    packet_data["time"] = String(buf);
-    packet_data["packet"] = element->packet->c_str();
-    packet_data["rssi"] = element->RSSI;
-    packet_data["snr"] = element->SNR;
-  }
-
-  server.send(200,"application/json", doc.as<String>());
+static void rx_list_init() {
+  size_t budget = psramFound() ? heap_caps_get_free_size(MALLOC_CAP_SPIRAM) / 16 : ESP.getFreeHeap() / 10;
+  size_t max = psramFound() ? RX_LIST_MAX_PSRAM : RX_LIST_MAX;
+  size_t n = budget / sizeof(struct rx_list_entry);
+
+  if (n > max)
+    n = max;
+  if (n < RX_LIST_MIN)
+    n = RX_LIST_MIN;
+  rx_list = (struct rx_list_entry *) heap_caps_calloc(n, sizeof(struct rx_list_entry), MALLOC_CAP_SPIRAM);
+  if (!rx_list)
+    rx_list = (struct rx_list_entry *) calloc(n, sizeof(struct rx_list_entry));
+  rx_list_capacity = rx_list ? n : 0;
+}
+
+static void rx_list_add(const tReceivedPacketData *p) {
+  if (!rx_list_capacity)
+    return;
+  xSemaphoreTake(rxListLock, portMAX_DELAY);
+  uint32_t seq = ++rx_list_seq;
+  struct rx_list_entry *e = &rx_list[seq % rx_list_capacity];
+  e->seq = seq;
+  strftime(e->time, sizeof(e->time), "%Y-%m-%d %H:%M:%S", &p->rxTime);
+  e->rssi = p->RSSI;
+  e->snr = p->SNR;
+  strlcpy(e->packet, p->packet->c_str(), sizeof(e->packet));
+  xSemaphoreGive(rxListLock);
+}
+
+// handle_ReceivedList() position in the ring, between calls of the chunk filler
+struct rx_list_cursor {
+  uint32_t next;
+  uint32_t last;                  // newest entry when the request came in
+  bool first;
+  bool done;
+};
+
+// end of an entry whose packet did not fit into a chunk
+static const char rx_list_cut[] = "\",\"truncated\":true}";
+
+static size_t rx_list_fill(struct rx_list_cursor *cur, uint8_t *buf, size_t maxLen, size_t index) {
+  char *out = (char *) buf;
+  size_t len = 0;
+
+  if (cur->done)
+    return 0;
+  if (!index) {
+    len = snprintf(out, maxLen, "{\"last\":%lu,\"capacity\":%u,\"received\":[", (unsigned long) cur->last, rx_list_capacity);
+    if (len >= maxLen)
+      return RESPONSE_TRY_AGAIN;
+  }
+  xSemaphoreTake(rxListLock, portMAX_DELAY);
+  while (cur->next <= cur->last) {
+    const struct rx_list_entry *e = &rx_list[cur->next % rx_list_capacity];
+    if (e->seq != cur->next) {
+      // overwritten meanwhile: go on with the oldest entry still there
+      uint32_t oldest = rx_list_seq >= rx_list_capacity ? rx_list_seq - rx_list_capacity + 1 : 1;
+      cur->next = oldest > cur->next ? oldest : cur->next + 1;
+      continue;
+    }
+    int n = snprintf(out + len, maxLen - len, "%s\n{\"seq\":%lu,\"time\":\"%s\",\"rssi\":%d,\"snr\":%d,\"packet\":\"",
+      cur->first ? "" : ",", (unsigned long) e->seq, e->time, e->rssi, e->snr);
+    int m = (n < 0 || len + n >= maxLen) ? -1 : json_escape_to(out + len + n, maxLen - len - n, e->packet);
+    if (m >= 0 && len + n + m + 2 <= maxLen) {
+      memcpy(out + len + n + m, "\"}", 2);
+      len += n + m + 2;
+    } else if (len) {
+      // does not fit: again in the next chunk
+      break;
+    } else if (n >= 0 && (size_t) n + sizeof(rx_list_cut) - 1 <= maxLen) {
+      // larger than a whole chunk, waiting would not help: the packet as far as it fits
+      m = json_escape_to(out + n, maxLen - n - (sizeof(rx_list_cut) - 1), e->packet, true);
+      memcpy(out + n + m, rx_list_cut, sizeof(rx_list_cut) - 1);
+      len = n + m + sizeof(rx_list_cut) - 1;
+    } else {
+      // not even that: left out, so that the list goes on
+      syslog_log(LOG_WARNING, String("Received list: frame ") + String(e->seq) + " left out, chunk of " + String(maxLen) + " bytes too small");
+      cur->next++;
+      continue;
+    }
+    cur->first = false;
+    cur->next++;
+  }
+  xSemaphoreGive(rxListLock);
+  if (cur->next > cur->last && len + 3 <= maxLen) {
+    memcpy(out + len, "]}\n", 3);
+    len += 3;
+    cur->done = true;
+  }
+  return len ? len : RESPONSE_TRY_AGAIN;
+}
+
+// Received frames, oldest first. ?since=N: only those after seq N ("last" of the previous answer).
+// If N is ahead of us (we restarted), all of them
+void handle_ReceivedList(AsyncWebServerRequest *request) {
+  auto cur = std::make_shared<struct rx_list_cursor>();
+  uint32_t since = request->hasArg("since") ? strtoul(request->arg("since").c_str(), nullptr, 10) : 0;
+
+  if (!rx_list_capacity) {
+    request->send(503, "text/plain", "Out of memory");
+    return;
+  }
+  xSemaphoreTake(rxListLock, portMAX_DELAY);
+  uint32_t last = rx_list_seq;
+  xSemaphoreGive(rxListLock);
+  uint32_t oldest = last >= rx_list_capacity ? last - rx_list_capacity + 1 : 1;
+  if (since > last)
+    since = 0;
+  cur->next = since + 1 > oldest ? since + 1 : oldest;
+  cur->last = last;
+  cur->first = true;
+  cur->done = false;
+  request->send(request->beginChunkedResponse("application/json", [cur](uint8_t *buf, size_t maxLen, size_t index) -> size_t {
+    return rx_list_fill(cur.get(), buf, maxLen, index);
+  }));
+}
+
+
+static void capture_ring_init() {
+  size_t budget = psramFound() ? heap_caps_get_free_size(MALLOC_CAP_SPIRAM) / 16 : ESP.getFreeHeap() / 20;
+  size_t max = psramFound() ? CAPTURE_MAX_PSRAM : CAPTURE_MAX;
+  size_t n = budget / sizeof(struct capture_frame);
+
+  if (n > max)
+    n = max;
+  if (n < CAPTURE_MIN)
+    n = CAPTURE_MIN;
+  capture_init(n);
+}
+
+// handle_Capture() position in the capture ring, between calls of the chunk filler
+struct capture_cursor {
+  uint32_t next;
+  uint32_t last;                  // newest frame when the request came in. Not used when following
+  bool follow;
+  bool done;
+
+  ~capture_cursor() {
+    if (follow)
+      capture_followers--;
+  }
+};
+
+static size_t capture_fill(struct capture_cursor *cur, uint8_t *buf, size_t maxLen, size_t index) {
+  struct capture_frame frame;
+  size_t len = 0;
+
+  if (cur->done)
+    return 0;
+  if (!index) {
+    len = capture_pcapng_header(buf, maxLen);
+    if (!len)
+      return RESPONSE_TRY_AGAIN;
+  }
+  while (cur->next <= (cur->follow ? capture_last_seq() : cur->last)) {
+    if (!capture_get(cur->next, &frame)) {
+      // overwritten meanwhile: go on with the oldest frame still there
+      uint32_t oldest = capture_oldest_seq();
+      cur->next = oldest > cur->next ? oldest : cur->next + 1;
+      continue;
+    }
+    size_t n = capture_pcapng_packet(&frame, buf + len, maxLen - len);
+    // does not fit: again in the next chunk
+    if (!n)
+      break;
+    len += n;
+    cur->next++;
+  }
+  if (!cur->follow && cur->next > cur->last)
+    cur->done = true;
+  // following: nothing new yet, AsyncWebServer asks again when it polls the connection
+  return (len || cur->done) ? len : RESPONSE_TRY_AGAIN;
+}
+
+// Frames received and sent as pcapng, for Wireshark. ?since=N: only those after seq N; the newest seq
+// at the time of the request is in the header X-Capture-Last. ?follow=1: then stream new frames as they
+// come, until the client disconnects
+void handle_Capture(AsyncWebServerRequest *request) {
+  bool follow = request->hasArg("follow") && request->arg("follow") != "0";
+  uint32_t since = request->hasArg("since") ? strtoul(request->arg("since").c_str(), nullptr, 10) : 0;
+
+  if (!capture_capacity()) {
+    request->send(503, "text/plain", "Out of memory");
+    return;
+  }
+  if (follow && capture_followers >= CAPTURE_FOLLOWERS_MAX) {
+    request->send(503, "text/plain", "Too many clients following the capture");
+    return;
+  }
+  auto cur = std::make_shared<struct capture_cursor>();
+  uint32_t last = capture_last_seq();
+  uint32_t oldest = capture_oldest_seq();
+  if (since > last)
+    since = 0;
+  cur->next = since + 1 > oldest ? since + 1 : oldest;
+  cur->last = last;
+  cur->follow = follow;
+  cur->done = false;
+  if (follow)
+    capture_followers++;
+  AsyncWebServerResponse *response = request->beginChunkedResponse("application/x-pcapng", [cur](uint8_t *buf, size_t maxLen, size_t index) -> size_t {
+    return capture_fill(cur.get(), buf, maxLen, index);
+  });
+  response->addHeader("Content-Disposition", "attachment; filename=\"lora.pcapng\"");
+  response->addHeader("X-Capture-Last", String(last));
+  request->send(response);
+}
+
+
+// handle_HeardList() position in the table, between calls of the chunk filler
+struct heard_list_cursor {
+  uint32_t now;
+  uint16_t slot;
+  bool first;
+  bool done;
+};
+
+static size_t heard_list_fill(struct heard_list_cursor *cur, uint8_t *buf, size_t maxLen, size_t index) {
+  size_t len = 0;
+
+  if (cur->done)
+    return 0;
+  if (!index)
+    len = snprintf((char *) buf, maxLen, "{\"uptime\":%lu,\"capacity\":%u,\"stations\":[", (unsigned long) cur->now/1000, heard_stations_capacity());
+  for (; cur->slot < heard_stations_capacity(); cur->slot++) {
+    struct heard_station e;
+    char call[AX_ADDR_LEN+1];
+    char line[256];
+    uint32_t now = cur->now;
+    if (!heard_stations_get(cur->slot, &e))
+      continue;
+    int n = snprintf(line, sizeof(line), "%s\n{\"call\":\"%s\",\"last\":%lu,\"first\":%lu,\"pkts\":%u,\"direct\":%u",
+      cur->first ? "" : ",", ax25_key_to_addr(e.key, call), (unsigned long) (now - e.last_heard)/1000, (unsigned long) (now - e.first_heard)/1000, e.packets, e.packets_direct);
+    if (e.packets_direct)
+      n += snprintf(line + n, sizeof(line) - n, ",\"last_direct\":%lu,\"rssi\":[%d,%d,%d],\"snr\":[%d,%d,%d]",
+        (unsigned long) (now - e.last_heard_direct)/1000,
+        e.rssi_min, (int ) (e.rssi_sum / e.packets_direct), e.rssi_max, e.snr_min, (int ) (e.snr_sum / e.packets_direct), e.snr_max);
+    if (e.last_position)
+      n += snprintf(line + n, sizeof(line) - n, ",\"pos\":[%.6f,%.6f],\"pos_age\":%lu", e.lat / 1000000.0, e.lon / 1000000.0, (unsigned long) (now - e.last_position)/1000);
+    n += snprintf(line + n, sizeof(line) - n, "}");
+    // does not fit: again in the next chunk
+    if (len + n > maxLen)
+      return len ? len : RESPONSE_TRY_AGAIN;
+    memcpy(buf + len, line, n);
+    len += n;
+    cur->first = false;
+  }
+  if (len + 3 > maxLen)
+    return len ? len : RESPONSE_TRY_AGAIN;
+  memcpy(buf + len, "]}\n", 3);
+  cur->done = true;
+  return len + 3;
+}
+
+// Heard stations. Compact: one line per station, sent in chunks; the table may hold 1024 entries.
+// rssi/snr: [min, avg, max] of direct receptions. Times in seconds ago. pos: [lat, lon]
+void handle_HeardList(AsyncWebServerRequest *request) {
+  auto cur = std::make_shared<struct heard_list_cursor>();
+
+  cur->now = millis();
+  cur->slot = 0;
+  cur->first = true;
+  cur->done = false;
+  // the filler runs as the TCP window opens, each chunk at most maxLen bytes
+  request->send(request->beginChunkedResponse("application/json", [cur](uint8_t *buf, size_t maxLen, size_t index) -> size_t {
+    return heard_list_fill(cur.get(), buf, maxLen, index);
+  }));
+}
+
+void web_event_frame(const char *kind, const String &frame, int rssi, int snr, double freq) {
+  tWebEvent ev;
+  struct timeval tv;
+
+  gettimeofday(&tv, nullptr);
+  capture_add(kind, frame.c_str(), rssi, snr, freq, tv.tv_sec, tv.tv_usec);
+  if (!webEventsQueue || !web_events_listening)
+    return;
+  ev.kind = kind;
+  ev.rssi = rssi;
+  ev.snr = snr;
+  ev.freq = freq;
+  ev.tv = tv;
+  ev.uptime = millis();
+  strlcpy(ev.frame, frame.c_str(), sizeof(ev.frame));
+  if (xQueueSend(webEventsQueue, &ev, 0) != pdPASS) {
+    portENTER_CRITICAL(&metrics_mux);
+    metrics.web_events_dropped++;
+    portEXIT_CRITICAL(&metrics_mux);
+  }
+}
+
+// event "frame": {"dir":..,"up":ms,"time":unix time if known,"freq":MHz,"rssi":..,"snr":..,"frame":..}
+static void web_event_send(const tWebEvent *ev) {
+  static char buf[1800];
+  size_t len = sizeof(buf) - 3;
+  int n;
+
+  n = snprintf(buf, len, "{\"dir\":\"%s\",\"up\":%lu,", ev->kind, (unsigned long) ev->uptime);
+  // before NTP: no time
+  if (ev->tv.tv_sec > 1600000000)
+    n += snprintf(buf + n, len - n, "\"time\":%lu.%03lu,", (unsigned long) ev->tv.tv_sec, (unsigned long) ev->tv.tv_usec / 1000);
+  n += snprintf(buf + n, len - n, "\"freq\":%.4f,", ev->freq);
+  if (!strcmp(ev->kind, "RX"))
+    n += snprintf(buf + n, len - n, "\"rssi\":%d,\"snr\":%d,", ev->rssi, ev->snr);
+  n += snprintf(buf + n, len - n, "\"frame\":\"");
+  int m = json_escape_to(buf + n, len - n, ev->frame);
+  if (m < 0)
+    return;
+  strcpy(buf + n + m, "\"}");
+  events.send(buf, "frame", ++web_events_id);
+}
+
+// APRS-IS link counters and upload latency, as JSON
+void handle_AprsisStats(AsyncWebServerRequest *request) {
+  char buf[1024];
+  size_t len = aprsis_stats_json(buf, sizeof(buf));
+
+  if (len)
+    request->send(200, "application/json", buf);
+  else
+    request->send(500, "text/plain", "Stats too large");
+}
+
+#ifdef ENABLE_PIPELINE_PROFILING
+// Time spent per stage of the RX/TX path (see lib/PipelineProfile). /profile?reset=1 clears the histograms
+void handle_Profile(AsyncWebServerRequest *request) {
+  // 9 stages with up to 36 buckets each
+  size_t len = 6144;
+  char *buf = (char *) malloc(len);
+
+  if (!buf) {
+    request->send(503, "text/plain", "Out of memory");
+    return;
+  }
+  len = profile_format_json(buf, len);
+  if (request->hasArg("reset"))
+    profile_reset();
+  if (len)
+    request->send(200, "application/json", buf);
+  else
+    request->send(500, "text/plain", "Profile too large");
+  free(buf);
+}
+#endif
+
+static void metrics_queue(char *buf, size_t len, size_t *pos, const char *name, QueueHandle_t queue) {
+  if (queue)
+    buf_append(buf, len, pos, "lora_aprs_queue_depth{queue=\"%s\"} %u\n", name, (unsigned) uxQueueMessagesWaiting(queue));
+}
+
+// Counters of all subsystems, Prometheus text format (version 0.0.4). Counters start at 0 with each boot
+void handle_Metrics(AsyncWebServerRequest *request) {
+  static const char *tx_kinds[METRICS_TX_KINDS] = { "own", "kiss", "digi", "is" };
+  static const char *kiss_ports[METRICS_KISS_PORTS] = { "serial", "bluetooth", "tcp" };
+  TaskHandle_t tasks[METRICS_TASKS_MAX];
+  tMetrics m;
+  size_t len = 6144;
+  size_t pos = 0;
+  char *buf = (char *) malloc(len);
+
+  if (!buf) {
+    request->send(503, "text/plain", "Out of memory");
+    return;
+  }
+  portENTER_CRITICAL(&metrics_mux);
+  m = metrics;
+  portEXIT_CRITICAL(&metrics_mux);
+
+  buf_append(buf, len, &pos, "# TYPE lora_aprs_rx_frames_total counter\n"
+    "lora_aprs_rx_frames_total{qrg=\"main\"} %lu\nlora_aprs_rx_frames_total{qrg=\"cross\"} %lu\n",
+    (unsigned long) m.rx_frames[METRICS_QRG_MAIN], (unsigned long) m.rx_frames[METRICS_QRG_CROSS]);
+  buf_append(buf, len, &pos, "# TYPE lora_aprs_rx_invalid_total counter\nlora_aprs_rx_invalid_total %lu\n"
+    "# TYPE lora_aprs_rx_blacklisted_total counter\nlora_aprs_rx_blacklisted_total %lu\n"
+    "# TYPE lora_aprs_digi_too_late_total counter\nlora_aprs_digi_too_late_total %lu\n",
+    (unsigned long) m.rx_invalid, (unsigned long) m.rx_blacklisted, (unsigned long) m.digi_too_late);
+  buf_append(buf, len, &pos, "# TYPE lora_aprs_tx_frames_total counter\n");
+  for (int i = 0; i < METRICS_TX_KINDS; i++)
+    buf_append(buf, len, &pos, "lora_aprs_tx_frames_total{kind=\"%s\"} %lu\n", tx_kinds[i], (unsigned long) m.tx_frames[i]);
+  buf_append(buf, len, &pos, "# TYPE lora_aprs_csma_slots_total counter\nlora_aprs_csma_slots_total %lu\n"
+    "# TYPE lora_aprs_csma_busy_total counter\nlora_aprs_csma_busy_total %lu\n"
+    "# TYPE lora_aprs_csma_gave_up_total counter\nlora_aprs_csma_gave_up_total %lu\n"
+    "# TYPE lora_aprs_airtime_seconds_total counter\nlora_aprs_airtime_seconds_total %.3f\n",
+    (unsigned long) m.csma_slots, (unsigned long) m.csma_busy, (unsigned long) m.csma_gave_up, m.airtime_ms / 1000.0);
+
+  buf_append(buf, len, &pos, "# TYPE lora_aprs_kiss_bytes_total counter\n");
+  for (int i = 0; i < METRICS_KISS_PORTS; i++)
+    buf_append(buf, len, &pos, "lora_aprs_kiss_bytes_total{port=\"%s\",dir=\"rx\"} %lu\nlora_aprs_kiss_bytes_total{port=\"%s\",dir=\"tx\"} %lu\n",
+      kiss_ports[i], (unsigned long) m.kiss_rx_bytes[i], kiss_ports[i], (unsigned long) m.kiss_tx_bytes[i]);
+
+  buf_append(buf, len, &pos, "# TYPE lora_aprs_queue_depth gauge\n");
+  metrics_queue(buf, len, &pos, "aprsis_uplink", aprsisUplinkQueue);
+  metrics_queue(buf, len, &pos, "web_list", webListReceivedQueue);
+  metrics_queue(buf, len, &pos, "web_events", webEventsQueue);
+#ifdef KISS_PROTOCOL
+  metrics_queue(buf, len, &pos, "kiss_to_lora", tncToSendQueue);
+  metrics_queue(buf, len, &pos, "lora_to_kiss", tncReceivedQueue);
+#endif
+  buf_append(buf, len, &pos, "# TYPE lora_aprs_queue_dropped_total counter\n"
+    "lora_aprs_queue_dropped_total{queue=\"aprsis_uplink\"} %lu\nlora_aprs_queue_dropped_total{queue=\"web_list\"} %lu\n"
+    "lora_aprs_queue_dropped_total{queue=\"web_events\"} %lu\nlora_aprs_queue_dropped_total{queue=\"kiss_to_lora\"} %lu\n"
+    "lora_aprs_queue_dropped_total{queue=\"lora_to_kiss\"} %lu\n",
+    (unsigned long) aprsisUplinkStats.dropped_full, (unsigned long) m.weblist_dropped, (unsigned long) m.web_events_dropped,
+    (unsigned long) m.kiss_in_dropped, (unsigned long) m.kiss_out_dropped);
+  buf_append(buf, len, &pos, "# TYPE lora_aprs_nmea_invalid_total counter\nlora_aprs_nmea_invalid_total %lu\n"
+    "# TYPE lora_aprs_nmea_dropped_total counter\nlora_aprs_nmea_dropped_total %lu\n"
+    "# TYPE lora_aprs_ubx_invalid_total counter\nlora_aprs_ubx_invalid_total %lu\n",
+    (unsigned long) m.nmea_invalid, (unsigned long) m.nmea_dropped, (unsigned long) m.ubx_invalid);
+  buf_append(buf, len, &pos, "# TYPE lora_aprs_gps_sleeps_total counter\nlora_aprs_gps_sleeps_total %lu\n"
+    "# TYPE lora_aprs_gps_asleep_seconds_total counter\nlora_aprs_gps_asleep_seconds_total %.3f\n"
+    "# TYPE lora_aprs_gps_time_to_fix_seconds gauge\nlora_aprs_gps_time_to_fix_seconds %.3f\n",
+    (unsigned long) m.gps_sleeps, m.gps_slept_ms / 1000.0, m.gps_time_to_fix_ms / 1000.0);
+
+  buf_append(buf, len, &pos, "# TYPE lora_aprs_aprsis_lines_total counter\n"
+    "lora_aprs_aprsis_lines_total{dir=\"in\"} %lu\nlora_aprs_aprsis_lines_total{dir=\"out\"} %lu\n"
+    "# TYPE lora_aprs_aprsis_bytes_total counter\n"
+    "lora_aprs_aprsis_bytes_total{dir=\"in\"} %lu\nlora_aprs_aprsis_bytes_total{dir=\"out\"} %lu\n"
+    "# TYPE lora_aprs_aprsis_dropped_offline_total counter\nlora_aprs_aprsis_dropped_offline_total %lu\n"
+    "# TYPE lora_aprs_aprsis_not_gated_total counter\nlora_aprs_aprsis_not_gated_total %lu\n"
+    "# TYPE lora_aprs_aprsis_connects_total counter\nlora_aprs_aprsis_connects_total %lu\n"
+    "# TYPE lora_aprs_aprsis_disconnects_total counter\nlora_aprs_aprsis_disconnects_total %lu\n"
+    "# TYPE lora_aprs_aprsis_gated_total counter\n"
+    "lora_aprs_aprsis_gated_total{to=\"rf\"} %lu\nlora_aprs_aprsis_gated_total{to=\"kiss\"} %lu\n",
+    (unsigned long) aprsisStats.lines_in, (unsigned long) aprsisUplinkStats.sent,
+    (unsigned long) aprsisStats.bytes_in, (unsigned long) aprsisStats.bytes_out,
+    (unsigned long) aprsisUplinkStats.dropped_offline, (unsigned long) aprsisUplinkStats.not_gated,
+    (unsigned long) aprsisStats.connects, (unsigned long) aprsisStats.disconnects,
+    (unsigned long) aprsisStats.gated_rf, (unsigned long) aprsisStats.gated_kiss);
+
+  buf_append(buf, len, &pos, "# TYPE lora_aprs_heap_free_bytes gauge\nlora_aprs_heap_free_bytes %u\n"
+    "# TYPE lora_aprs_heap_min_free_bytes gauge\nlora_aprs_heap_min_free_bytes %u\n"
+    "# TYPE lora_aprs_heap_largest_free_block_bytes gauge\nlora_aprs_heap_largest_free_block_bytes %u\n"
+    "# TYPE lora_aprs_psram_free_bytes gauge\nlora_aprs_psram_free_bytes %u\n"
+    "# TYPE lora_aprs_uptime_seconds counter\nlora_aprs_uptime_seconds %lu\n",
+    (unsigned) ESP.getFreeHeap(), (unsigned) ESP.getMinFreeHeap(), (unsigned) heap_caps_get_largest_free_block(MALLOC_CAP_8BIT),
+    (unsigned) ESP.getFreePsram(), (unsigned long) (millis() / 1000));
+
+  const char *phases[METRICS_BOOT_PHASES_MAX];
+  uint32_t phase_ms[METRICS_BOOT_PHASES_MAX];
+  uint8_t n = metrics_boot_phases(phases, phase_ms, METRICS_BOOT_PHASES_MAX);
+  buf_append(buf, len, &pos, "# TYPE lora_aprs_boot_phase_seconds gauge\n");
+  for (int i = 0; i < n; i++)
+    buf_append(buf, len, &pos, "lora_aprs_boot_phase_seconds{phase=\"%s\"} %.3f\n", phases[i], phase_ms[i] / 1000.0);
+
+  // ESP-IDF: in bytes, not words
+  buf_append(buf, len, &pos, "# TYPE lora_aprs_task_stack_free_min_bytes gauge\n");
+  n = metrics_tasks(tasks, METRICS_TASKS_MAX);
+  for (int i = 0; i < n; i++)
+    buf_append(buf, len, &pos, "lora_aprs_task_stack_free_min_bytes{task=\"%s\"} %u\n",
+      pcTaskGetTaskName(tasks[i]), (unsigned) uxTaskGetStackHighWaterMark(tasks[i]));
+
+  if (pos < len)
+    request->send(200, "text/plain; version=0.0.4", buf);
+  else
+    request->send(500, "text/plain", "Metrics too large");
+  free(buf);
 }
 
 
@@ -590,61 +1228,195 @@ out:
   store_lat_long(f_lat, f_long);
 }
 
-void handle_SaveAPRSCfg() {
+// Numeric fields of the APRS settings form
+struct cfg_range {
+  const char *key;
+  double min;
+  double max;
+};
+
+static const struct cfg_range cfg_aprs_ranges[] = {
+  { PREF_LORA_FREQ_PRESET, 137.0, 1020.0 },               // SX127x
+  { PREF_LORA_TX_POWER, 0, 23 },
+  { PREF_LORA_ADD_SNR_RSSI_TO_PATH_PRESET, 0, 63 },
+  { PREF_APRS_DIGIPEATING_MODE_PRESET, 0, 3 },
+  { PREF_APRS_CROSS_DIGIPEATING_MODE_PRESET, 0, 2 },
+  { PREF_LORA_TX_BEACON_AND_KISS_TO_FREQUENCIES_PRESET, 0, 3 },
+  { PREF_LORA_FREQ_CROSSDIGI_PRESET, 0, 1020.0 },         // 0: none
+  { PREF_LORA_TX_POWER_CROSSDIGI_PRESET, 0, 23 },
+  { PREF_LORA_RX_ON_FREQUENCIES_PRESET, 1, 3 },
+  { PREF_TNC_SELF_TELEMETRY_INTERVAL, 0, 86400 },
+  { PREF_TNC_SELF_TELEMETRY_MIC, 0, 1 },
+  { PREF_APRS_FIXED_BEACON_INTERVAL_PRESET, 0, 86400 },
+  { PREF_APRS_SB_MIN_INTERVAL_PRESET, 0, 86400 },
+  { PREF_APRS_SB_MAX_INTERVAL_PRESET, 0, 86400 },
+  { PREF_APRS_SB_MIN_SPEED_PRESET, 0, 1000 },
+  { PREF_APRS_SB_MAX_SPEED_PRESET, 0, 1000 },
+  { PREF_APRS_SB_ANGLE_PRESET, 0, 360 },
+  { PREF_APRS_SB_TURN_SLOPE_PRESET, 0, 255 },
+  { PREF_APRS_SB_TURN_TIME_PRESET, 0, 3600 },
+  { PREF_APRS_ALTITUDE_RATIO, 0, 100 },
+  { PREF_APRSIS_SERVER_PORT, 1, 65535 },
+  { PREF_APRSIS_ALLOW_INET_TO_RF, 0, 3 },
+  { PREF_GPS_UBX_RATE, 1, 10 },
+};
+
+// lora_set_speed()
+static bool cfg_lora_speed_valid(long speed) {
+  static const long speeds[] = { 300, 240, 210, 180, 610, 1200 };
+  for (long s : speeds) {
+    if (s == speed)
+      return true;
+  }
+  return false;
+}
+
+// The whole APRS settings form, before anything is stored. Returns 0, or -1 (message in err)
+static int cfg_check_aprs(AsyncWebServerRequest *request, char *err, size_t errlen) {
+  char msg[80];
+
+  for (const struct cfg_range &r : cfg_aprs_ranges) {
+    if (!request->hasArg(r.key))
+      continue;
+    String s = request->arg(r.key);
+    s.trim();
+    char *end;
+    double v = strtod(s.c_str(), &end);
+    if (s.isEmpty() || *end || v < r.min || v > r.max) {
+      snprintf(err, errlen, "%s: '%s' is not a number from %g to %g", r.key, s.c_str(), r.min, r.max);
+      return -1;
+    }
+  }
+  if (request->hasArg(PREF_LORA_FREQ_CROSSDIGI_PRESET)) {
+    double v = request->arg(PREF_LORA_FREQ_CROSSDIGI_PRESET).toDouble();
+    if (v > 1.0 && v < 137.0) {
+      snprintf(err, errlen, "%s: %g MHz is out of range", PREF_LORA_FREQ_CROSSDIGI_PRESET, v);
+      return -1;
+    }
+  }
+  const char *speed_keys[] = { PREF_LORA_SPEED_PRESET, PREF_LORA_SPEED_CROSSDIGI_PRESET };
+  for (const char *key : speed_keys) {
+    if (request->hasArg(key) && !cfg_lora_speed_valid(request->arg(key).toInt())) {
+      snprintf(err, errlen, "%s: unknown speed '%s'", key, request->arg(key).c_str());
+      return -1;
+    }
+  }
+
+  // compiled for the check only. Empty rules: those of the digipeating mode, always valid
+  if (request->hasArg(PREF_APRS_DIGIPEATING_RULES)) {
+    String s = request->arg(PREF_APRS_DIGIPEATING_RULES);
+    s.trim();
+    // against the call as stored with this form (see handle_SaveAPRSCfg), which may change along with the rules
+    String call = Tcall;
+    if (request->hasArg(PREF_APRS_CALLSIGN) && !request->arg(PREF_APRS_CALLSIGN).isEmpty()) {
+      call = request->arg(PREF_APRS_CALLSIGN);
+      call.trim();
+    }
+    if (!s.isEmpty()) {
+      struct digi_rules *rules = (struct digi_rules *) malloc(sizeof(*rules));
+      if (!rules) {
+        snprintf(err, errlen, "Out of memory");
+        return -1;
+      }
+      int ret = digi_rules_compile(s.c_str(), call.c_str(), rules, msg, sizeof(msg));
+      free(rules);
+      if (ret < 0) {
+        snprintf(err, errlen, "Invalid digipeater rules: %s", msg);
+        return -1;
+      }
+    }
+  }
+  if (request->hasArg(PREF_APRSIS_RF_FILTER)) {
+    String s = request->arg(PREF_APRSIS_RF_FILTER);
+    s.trim();
+    struct aprs_filter *filter = (struct aprs_filter *) malloc(sizeof(*filter));
+    if (!filter) {
+      snprintf(err, errlen, "Out of memory");
+      return -1;
+    }
+    int ret = aprs_filter_compile(s.c_str(), filter, msg, sizeof(msg));
+    free(filter);
+    if (ret < 0) {
+      snprintf(err, errlen, "Invalid APRS-IS RF filter: %s", msg);
+      return -1;
+    }
+  }
+  return 0;
+}
+
+void handle_SaveAPRSCfg(AsyncWebServerRequest *request) {
+  char err[160];
+
+  // stored are all settings of the form, or none
+  if (cfg_check_aprs(request, err, sizeof(err)) < 0) {
+    request->send(400, "text/plain", err);
+    return;
+  }
+  preferences.beginTransaction();
+  if (request->hasArg(PREF_APRS_DIGIPEATING_RULES)){
+    String s = request->arg(PREF_APRS_DIGIPEATING_RULES);
+    s.trim();
+    preferences.putString(PREF_APRS_DIGIPEATING_RULES, s);
+  }
+  if (request->hasArg(PREF_APRSIS_RF_FILTER)){
+    String s = request->arg(PREF_APRSIS_RF_FILTER);
+    s.trim();
+    preferences.putString(PREF_APRSIS_RF_FILTER, s);
+  }
   // LoRa settings
-  if (server.hasArg(PREF_LORA_FREQ_PRESET)){
-    preferences.putDouble(PREF_LORA_FREQ_PRESET, server.arg(PREF_LORA_FREQ_PRESET).toDouble());
-    Serial.printf("FREQ saved:\t%f\n", server.arg(PREF_LORA_FREQ_PRESET).toDouble());
+  if (request->hasArg(PREF_LORA_FREQ_PRESET)){
+    preferences.putDouble(PREF_LORA_FREQ_PRESET, request->arg(PREF_LORA_FREQ_PRESET).toDouble());
+    Serial.printf("FREQ saved:\t%f\n", request->arg(PREF_LORA_FREQ_PRESET).toDouble());
   }
-  if (server.hasArg(PREF_LORA_SPEED_PRESET)){
-    preferences.putInt(PREF_LORA_SPEED_PRESET, server.arg(PREF_LORA_SPEED_PRESET).toInt());
+  if (request->hasArg(PREF_LORA_SPEED_PRESET)){
+    preferences.putInt(PREF_LORA_SPEED_PRESET, request->arg(PREF_LORA_SPEED_PRESET).toInt());
   }
-  preferences.putBool(PREF_LORA_RX_ENABLE, server.hasArg(PREF_LORA_RX_ENABLE));
-  preferences.putBool(PREF_LORA_TX_ENABLE, server.hasArg(PREF_LORA_TX_ENABLE));
-  if (server.hasArg(PREF_LORA_TX_POWER)) {
-    preferences.putInt(PREF_LORA_TX_POWER, server.arg(PREF_LORA_TX_POWER).toInt());
+  preferences.putBool(PREF_LORA_RX_ENABLE, request->hasArg(PREF_LORA_RX_ENABLE));
+  preferences.putBool(PREF_LORA_TX_ENABLE, request->hasArg(PREF_LORA_TX_ENABLE));
+  if (request->hasArg(PREF_LORA_TX_POWER)) {
+    preferences.putInt(PREF_LORA_TX_POWER, request->arg(PREF_LORA_TX_POWER).toInt());
   }
-  preferences.putBool(PREF_LORA_AUTOMATIC_CR_ADAPTION_PRESET, server.hasArg(PREF_LORA_AUTOMATIC_CR_ADAPTION_PRESET));
-  if (server.hasArg(PREF_LORA_ADD_SNR_RSSI_TO_PATH_PRESET)){
-    preferences.putInt(PREF_LORA_ADD_SNR_RSSI_TO_PATH_PRESET, server.arg(PREF_LORA_ADD_SNR_RSSI_TO_PATH_PRESET).toInt());
+  preferences.putBool(PREF_LORA_AUTOMATIC_CR_ADAPTION_PRESET, request->hasArg(PREF_LORA_AUTOMATIC_CR_ADAPTION_PRESET));
+  if (request->hasArg(PREF_LORA_ADD_SNR_RSSI_TO_PATH_PRESET)){
+    preferences.putInt(PREF_LORA_ADD_SNR_RSSI_TO_PATH_PRESET, request->arg(PREF_LORA_ADD_SNR_RSSI_TO_PATH_PRESET).toInt());
   }
-  preferences.putBool(PREF_LORA_ADD_SNR_RSSI_TO_PATH_END_AT_KISS_PRESET, server.hasArg(PREF_LORA_ADD_SNR_RSSI_TO_PATH_END_AT_KISS_PRESET));
-  if (server.hasArg(PREF_APRS_DIGIPEATING_MODE_PRESET)){
-    preferences.putInt(PREF_APRS_DIGIPEATING_MODE_PRESET, server.arg(PREF_APRS_DIGIPEATING_MODE_PRESET).toInt());
+  preferences.putBool(PREF_LORA_ADD_SNR_RSSI_TO_PATH_END_AT_KISS_PRESET, request->hasArg(PREF_LORA_ADD_SNR_RSSI_TO_PATH_END_AT_KISS_PRESET));
+  if (request->hasArg(PREF_APRS_DIGIPEATING_MODE_PRESET)){
+    preferences.putInt(PREF_APRS_DIGIPEATING_MODE_PRESET, request->arg(PREF_APRS_DIGIPEATING_MODE_PRESET).toInt());
   }
-  if (server.hasArg(PREF_APRS_CROSS_DIGIPEATING_MODE_PRESET)){
-    preferences.putInt(PREF_APRS_CROSS_DIGIPEATING_MODE_PRESET, server.arg(PREF_APRS_CROSS_DIGIPEATING_MODE_PRESET).toInt());
+  if (request->hasArg(PREF_APRS_CROSS_DIGIPEATING_MODE_PRESET)){
+    preferences.putInt(PREF_APRS_CROSS_DIGIPEATING_MODE_PRESET, request->arg(PREF_APRS_CROSS_DIGIPEATING_MODE_PRESET).toInt());
   }
-  if (server.hasArg(PREF_LORA_TX_BEACON_AND_KISS_TO_FREQUENCIES_PRESET)) {
-    preferences.putInt(PREF_LORA_TX_BEACON_AND_KISS_TO_FREQUENCIES_PRESET, server.arg(PREF_LORA_TX_BEACON_AND_KISS_TO_FREQUENCIES_PRESET).toInt());
+  if (request->hasArg(PREF_LORA_TX_BEACON_AND_KISS_TO_FREQUENCIES_PRESET)) {
+    preferences.putInt(PREF_LORA_TX_BEACON_AND_KISS_TO_FREQUENCIES_PRESET, request->arg(PREF_LORA_TX_BEACON_AND_KISS_TO_FREQUENCIES_PRESET).toInt());
   }
-  preferences.putBool(PREF_LORA_TX_BEACON_AND_KISS_TO_APRSIS_PRESET, server.hasArg(PREF_LORA_TX_BEACON_AND_KISS_TO_APRSIS_PRESET));
-  if (server.hasArg(PREF_LORA_FREQ_CROSSDIGI_PRESET)){
-    preferences.putDouble(PREF_LORA_FREQ_CROSSDIGI_PRESET, server.arg(PREF_LORA_FREQ_CROSSDIGI_PRESET).toDouble());
-    Serial.printf("FREQ crossdigi saved:\t%f\n", server.arg(PREF_LORA_FREQ_CROSSDIGI_PRESET).toDouble());
+  preferences.putBool(PREF_LORA_TX_BEACON_AND_KISS_TO_APRSIS_PRESET, request->hasArg(PREF_LORA_TX_BEACON_AND_KISS_TO_APRSIS_PRESET));
+  if (request->hasArg(PREF_LORA_FREQ_CROSSDIGI_PRESET)){
+    preferences.putDouble(PREF_LORA_FREQ_CROSSDIGI_PRESET, request->arg(PREF_LORA_FREQ_CROSSDIGI_PRESET).toDouble());
+    Serial.printf("FREQ crossdigi saved:\t%f\n", request->arg(PREF_LORA_FREQ_CROSSDIGI_PRESET).toDouble());
   }
-  if (server.hasArg(PREF_LORA_SPEED_CROSSDIGI_PRESET)){
-    preferences.putInt(PREF_LORA_SPEED_CROSSDIGI_PRESET, server.arg(PREF_LORA_SPEED_CROSSDIGI_PRESET).toInt());
+  if (request->hasArg(PREF_LORA_SPEED_CROSSDIGI_PRESET)){
+    preferences.putInt(PREF_LORA_SPEED_CROSSDIGI_PRESET, request->arg(PREF_LORA_SPEED_CROSSDIGI_PRESET).toInt());
   }
-  if (server.hasArg(PREF_LORA_TX_POWER_CROSSDIGI_PRESET)) {
-    preferences.putInt(PREF_LORA_TX_POWER_CROSSDIGI_PRESET, server.arg(PREF_LORA_TX_POWER_CROSSDIGI_PRESET).toInt());
+  if (request->hasArg(PREF_LORA_TX_POWER_CROSSDIGI_PRESET)) {
+    preferences.putInt(PREF_LORA_TX_POWER_CROSSDIGI_PRESET, request->arg(PREF_LORA_TX_POWER_CROSSDIGI_PRESET).toInt());
   }
-  if (server.hasArg(PREF_LORA_RX_ON_FREQUENCIES_PRESET)) {
-    preferences.putInt(PREF_LORA_RX_ON_FREQUENCIES_PRESET, server.arg(PREF_LORA_RX_ON_FREQUENCIES_PRESET).toInt());
+  if (request->hasArg(PREF_LORA_RX_ON_FREQUENCIES_PRESET)) {
+    preferences.putInt(PREF_LORA_RX_ON_FREQUENCIES_PRESET, request->arg(PREF_LORA_RX_ON_FREQUENCIES_PRESET).toInt());
   }
   // APRS station settings
-  if (server.hasArg(PREF_APRS_CALLSIGN) && !server.arg(PREF_APRS_CALLSIGN).isEmpty()){
-    String s = server.arg(PREF_APRS_CALLSIGN); s.trim();
+  if (request->hasArg(PREF_APRS_CALLSIGN) && !request->arg(PREF_APRS_CALLSIGN).isEmpty()){
+    String s = request->arg(PREF_APRS_CALLSIGN); s.trim();
     preferences.putString(PREF_APRS_CALLSIGN, s);
   }
-  if (server.hasArg(PREF_APRS_SYMBOL_TABLE) && !server.arg(PREF_APRS_SYMBOL_TABLE).isEmpty()){
-    preferences.putString(PREF_APRS_SYMBOL_TABLE, server.arg(PREF_APRS_SYMBOL_TABLE));
+  if (request->hasArg(PREF_APRS_SYMBOL_TABLE) && !request->arg(PREF_APRS_SYMBOL_TABLE).isEmpty()){
+    preferences.putString(PREF_APRS_SYMBOL_TABLE, request->arg(PREF_APRS_SYMBOL_TABLE));
   }
-  if (server.hasArg(PREF_APRS_SYMBOL) && !server.arg(PREF_APRS_SYMBOL).isEmpty()){
-    preferences.putString(PREF_APRS_SYMBOL, server.arg(PREF_APRS_SYMBOL));
+  if (request->hasArg(PREF_APRS_SYMBOL) && !request->arg(PREF_APRS_SYMBOL).isEmpty()){
+    preferences.putString(PREF_APRS_SYMBOL, request->arg(PREF_APRS_SYMBOL));
   }
-  if (server.hasArg(PREF_APRS_RELAY_PATH)){
-    String s = server.arg(PREF_APRS_RELAY_PATH);
+  if (request->hasArg(PREF_APRS_RELAY_PATH)){
+    String s = request->arg(PREF_APRS_RELAY_PATH);
     s.toUpperCase(); s.trim(); s.replace(" ", ","); s.replace(",,", ",");
     if (s.endsWith("WIDE1") || s.endsWith("WIDE2")) s = s + "-1";
     if (s.indexOf("WIDE1,") > -1) s.replace("WIDE1,", "WIDE1-1,");
@@ -653,193 +1425,223 @@ void handle_SaveAPRSCfg() {
     if (! ( s.indexOf("WIDE1") > s.indexOf("WIDE") || s.indexOf("WIDE-") > -1 || s.startsWith("RFONLY,WIDE") || s.startsWith("NOGATE,WIDE") || s.indexOf("*") > -1 ))
       preferences.putString(PREF_APRS_RELAY_PATH, s);
   }
-  if (server.hasArg(PREF_APRS_COMMENT)){
-    preferences.putString(PREF_APRS_COMMENT, server.arg(PREF_APRS_COMMENT));
+  if (request->hasArg(PREF_APRS_COMMENT)){
+    preferences.putString(PREF_APRS_COMMENT, request->arg(PREF_APRS_COMMENT));
   }
-  set_lat_long(server.hasArg(PREF_APRS_LATITUDE_PRESET) ? server.arg(PREF_APRS_LATITUDE_PRESET) : String(""), server.hasArg(PREF_APRS_LONGITUDE_PRESET) ? server.arg(PREF_APRS_LONGITUDE_PRESET) : String(""));
-  //if (server.hasArg(PREF_APRS_LATITUDE_PRESET)){
-    ////preferences.putString(PREF_APRS_LATITUDE_PRESET, server.arg(PREF_APRS_LATITUDE_PRESET));
-    //String s_lat = latORlon(server.arg(PREF_APRS_LATITUDE_PRESET), 0);
+  set_lat_long(request->hasArg(PREF_APRS_LATITUDE_PRESET) ? request->arg(PREF_APRS_LATITUDE_PRESET) : String(""), request->hasArg(PREF_APRS_LONGITUDE_PRESET) ? request->arg(PREF_APRS_LONGITUDE_PRESET) : String(""));
+  //if (request->hasArg(PREF_APRS_LATITUDE_PRESET)){
+    ////preferences.putString(PREF_APRS_LATITUDE_PRESET, request->arg(PREF_APRS_LATITUDE_PRESET));
+    //String s_lat = latORlon(request->arg(PREF_APRS_LATITUDE_PRESET), 0);
     //if (s_lat.length() == 8)
       //preferences.putString(PREF_APRS_LATITUDE_PRESET, s_lat);
   //}
-  //if (server.hasArg(PREF_APRS_LONGITUDE_PRESET)){
-    ////preferences.putString(PREF_APRS_LONGITUDE_PRESET, server.arg(PREF_APRS_LONGITUDE_PRESET));
-    //String s_lon = latORlon(server.arg(PREF_APRS_LONGITUDE_PRESET), 1);
+  //if (request->hasArg(PREF_APRS_LONGITUDE_PRESET)){
+    ////preferences.putString(PREF_APRS_LONGITUDE_PRESET, request->arg(PREF_APRS_LONGITUDE_PRESET));
+    //String s_lon = latORlon(request->arg(PREF_APRS_LONGITUDE_PRESET), 1);
     //if (s_lon.length() == 9)
       //preferences.putString(PREF_APRS_LONGITUDE_PRESET, s_lon);
   //}
-  if (server.hasArg(PREF_APRS_SENDER_BLACKLIST)){
-    String s = server.arg(PREF_APRS_SENDER_BLACKLIST);
+  if (request->hasArg(PREF_APRS_SENDER_BLACKLIST)){
+    String s = request->arg(PREF_APRS_SENDER_BLACKLIST);
     s.toUpperCase(); s.trim(); s.replace(" ", ","); s.replace(",,", ",");
     preferences.putString(PREF_APRS_SENDER_BLACKLIST, (s.isEmpty() || s == ",") ? "" : s);
   }
-  if (server.hasArg(PREF_TNC_SELF_TELEMETRY_INTERVAL)){
-    preferences.putInt(PREF_TNC_SELF_TELEMETRY_INTERVAL, server.arg(PREF_TNC_SELF_TELEMETRY_INTERVAL).toInt());
+  if (request->hasArg(PREF_TNC_SELF_TELEMETRY_INTERVAL)){
+    preferences.putInt(PREF_TNC_SELF_TELEMETRY_INTERVAL, request->arg(PREF_TNC_SELF_TELEMETRY_INTERVAL).toInt());
   }
-  if (server.hasArg(PREF_TNC_SELF_TELEMETRY_MIC)){
-    preferences.putInt(PREF_TNC_SELF_TELEMETRY_MIC, server.arg(PREF_TNC_SELF_TELEMETRY_MIC).toInt());
+  if (request->hasArg(PREF_TNC_SELF_TELEMETRY_MIC)){
+    preferences.putInt(PREF_TNC_SELF_TELEMETRY_MIC, request->arg(PREF_TNC_SELF_TELEMETRY_MIC).toInt());
   }
-  if (server.hasArg(PREF_TNC_SELF_TELEMETRY_PATH)){
-    String s = server.arg(PREF_TNC_SELF_TELEMETRY_PATH);
+  if (request->hasArg(PREF_TNC_SELF_TELEMETRY_PATH)){
+    String s = request->arg(PREF_TNC_SELF_TELEMETRY_PATH);
     s.toUpperCase(); s.trim(); s.replace(" ", ","); s.replace(",,", ",");
     preferences.putString(PREF_TNC_SELF_TELEMETRY_PATH, s);
   }
 
   // Smart Beaconing settings 
-  if (server.hasArg(PREF_APRS_FIXED_BEACON_INTERVAL_PRESET)){
-    preferences.putInt(PREF_APRS_FIXED_BEACON_INTERVAL_PRESET, server.arg(PREF_APRS_FIXED_BEACON_INTERVAL_PRESET).toInt());
+  if (request->hasArg(PREF_APRS_FIXED_BEACON_INTERVAL_PRESET)){
+    preferences.putInt(PREF_APRS_FIXED_BEACON_INTERVAL_PRESET, request->arg(PREF_APRS_FIXED_BEACON_INTERVAL_PRESET).toInt());
   }
-  if (server.hasArg(PREF_APRS_SB_MIN_INTERVAL_PRESET)){
-    preferences.putInt(PREF_APRS_SB_MIN_INTERVAL_PRESET, server.arg(PREF_APRS_SB_MIN_INTERVAL_PRESET).toInt());
+  if (request->hasArg(PREF_APRS_SB_MIN_INTERVAL_PRESET)){
+    preferences.putInt(PREF_APRS_SB_MIN_INTERVAL_PRESET, request->arg(PREF_APRS_SB_MIN_INTERVAL_PRESET).toInt());
   }
-  if (server.hasArg(PREF_APRS_SB_MAX_INTERVAL_PRESET)){
-    //preferences.putInt(PREF_APRS_SB_MAX_INTERVAL_PRESET, server.arg(PREF_APRS_SB_MAX_INTERVAL_PRESET).toInt());
-    int i = server.arg(PREF_APRS_SB_MAX_INTERVAL_PRESET).toInt();
+  if (request->hasArg(PREF_APRS_SB_MAX_INTERVAL_PRESET)){
+    //preferences.putInt(PREF_APRS_SB_MAX_INTERVAL_PRESET, request->arg(PREF_APRS_SB_MAX_INTERVAL_PRESET).toInt());
+    int i = request->arg(PREF_APRS_SB_MAX_INTERVAL_PRESET).toInt();
     if (i <= preferences.getInt(PREF_APRS_SB_MIN_INTERVAL_PRESET)) i = preferences.getInt(PREF_APRS_SB_MIN_INTERVAL_PRESET) +1;
     preferences.putInt(PREF_APRS_SB_MAX_INTERVAL_PRESET, i);
   }
-  if (server.hasArg(PREF_APRS_SB_MIN_SPEED_PRESET)){
-    preferences.putInt(PREF_APRS_SB_MIN_SPEED_PRESET, server.arg(PREF_APRS_SB_MIN_SPEED_PRESET).toInt());
+  if (request->hasArg(PREF_APRS_SB_MIN_SPEED_PRESET)){
+    preferences.putInt(PREF_APRS_SB_MIN_SPEED_PRESET, request->arg(PREF_APRS_SB_MIN_SPEED_PRESET).toInt());
   }
-  if (server.hasArg(PREF_APRS_SB_MAX_SPEED_PRESET)){
-    //preferences.putInt(PREF_APRS_SB_MAX_SPEED_PRESET, server.arg(PREF_APRS_SB_MAX_SPEED_PRESET).toInt());
-    int i = server.arg(PREF_APRS_SB_MAX_SPEED_PRESET).toInt();
+  if (request->hasArg(PREF_APRS_SB_MAX_SPEED_PRESET)){
+    //preferences.putInt(PREF_APRS_SB_MAX_SPEED_PRESET, request->arg(PREF_APRS_SB_MAX_SPEED_PRESET).toInt());
+    int i = request->arg(PREF_APRS_SB_MAX_SPEED_PRESET).toInt();
     if (i <= preferences.getInt(PREF_APRS_SB_MIN_SPEED_PRESET)) i = preferences.getInt(PREF_APRS_SB_MIN_SPEED_PRESET) +1;
     preferences.putInt(PREF_APRS_SB_MAX_SPEED_PRESET, i);
   }
-  if (server.hasArg(PREF_APRS_SB_ANGLE_PRESET)){
-    preferences.putDouble(PREF_APRS_SB_ANGLE_PRESET, server.arg(PREF_APRS_SB_ANGLE_PRESET).toDouble());
+  if (request->hasArg(PREF_APRS_SB_ANGLE_PRESET)){
+    preferences.putDouble(PREF_APRS_SB_ANGLE_PRESET, request->arg(PREF_APRS_SB_ANGLE_PRESET).toDouble());
   }
-  if (server.hasArg(PREF_APRS_SB_TURN_SLOPE_PRESET)){
-    preferences.putInt(PREF_APRS_SB_TURN_SLOPE_PRESET, server.arg(PREF_APRS_SB_TURN_SLOPE_PRESET).toInt());
+  if (request->hasArg(PREF_APRS_SB_TURN_SLOPE_PRESET)){
+    preferences.putInt(PREF_APRS_SB_TURN_SLOPE_PRESET, request->arg(PREF_APRS_SB_TURN_SLOPE_PRESET).toInt());
   }
-  if (server.hasArg(PREF_APRS_SB_TURN_TIME_PRESET)){
-    preferences.putInt(PREF_APRS_SB_TURN_TIME_PRESET, server.arg(PREF_APRS_SB_TURN_TIME_PRESET).toInt());
+  if (request->hasArg(PREF_APRS_SB_TURN_TIME_PRESET)){
+    preferences.putInt(PREF_APRS_SB_TURN_TIME_PRESET, request->arg(PREF_APRS_SB_TURN_TIME_PRESET).toInt());
   }
  
-  preferences.putBool(PREF_APRSIS_EN, server.hasArg(PREF_APRSIS_EN));
-  if (server.hasArg(PREF_APRSIS_SERVER_NAME)){
-    String s = server.arg(PREF_APRSIS_SERVER_NAME);
+  preferences.putBool(PREF_APRSIS_EN, request->hasArg(PREF_APRSIS_EN));
+  if (request->hasArg(PREF_APRSIS_SERVER_NAME)){
+    String s = request->arg(PREF_APRSIS_SERVER_NAME);
     preferences.putString(PREF_APRSIS_SERVER_NAME, s);
   }
-  if (server.hasArg(PREF_APRSIS_SERVER_PORT)){
-    preferences.putInt(PREF_APRSIS_SERVER_PORT, server.arg(PREF_APRSIS_SERVER_PORT).toInt());
+  if (request->hasArg(PREF_APRSIS_SERVER_PORT)){
+    preferences.putInt(PREF_APRSIS_SERVER_PORT, request->arg(PREF_APRSIS_SERVER_PORT).toInt());
   }
-  if (server.hasArg(PREF_APRSIS_FILTER)){
-    String s = server.arg(PREF_APRSIS_FILTER);
+  if (request->hasArg(PREF_APRSIS_FILTER)){
+    String s = request->arg(PREF_APRSIS_FILTER);
     s.trim();
     preferences.putString(PREF_APRSIS_FILTER, s);
   }
-  if (server.hasArg(PREF_APRSIS_CALLSIGN)){
-    String s = server.arg(PREF_APRSIS_CALLSIGN);
+  if (request->hasArg(PREF_APRSIS_CALLSIGN)){
+    String s = request->arg(PREF_APRSIS_CALLSIGN);
     s.toUpperCase(); s.trim();
     preferences.putString(PREF_APRSIS_CALLSIGN, s);
   }
-  if (server.hasArg(PREF_APRSIS_PASSWORD)){
-    String s = server.arg(PREF_APRSIS_PASSWORD);
+  if (request->hasArg(PREF_APRSIS_PASSWORD)){
+    String s = request->arg(PREF_APRSIS_PASSWORD);
     s.trim();
     preferences.putString(PREF_APRSIS_PASSWORD, s);
   }
-  if (server.hasArg(PREF_APRSIS_ALLOW_INET_TO_RF)){
-    preferences.putInt(PREF_APRSIS_ALLOW_INET_TO_RF, server.arg(PREF_APRSIS_ALLOW_INET_TO_RF).toInt());
+  if (request->hasArg(PREF_APRSIS_ALLOW_INET_TO_RF)){
+    preferences.putInt(PREF_APRSIS_ALLOW_INET_TO_RF, request->arg(PREF_APRSIS_ALLOW_INET_TO_RF).toInt());
   }
 
-  preferences.putBool(PREF_APRS_SHOW_BATTERY, server.hasArg(PREF_APRS_SHOW_BATTERY));
-  preferences.putBool(PREF_ENABLE_TNC_SELF_TELEMETRY, server.hasArg(PREF_ENABLE_TNC_SELF_TELEMETRY));
-  //preferences.putBool(PREF_APRS_SHOW_ALTITUDE, server.hasArg(PREF_APRS_SHOW_ALTITUDE));
-  preferences.putBool(PREF_APRS_SHOW_ALTITUDE_INSIDE_COMPRESSED_POSITION, server.hasArg(PREF_APRS_SHOW_ALTITUDE_INSIDE_COMPRESSED_POSITION));
-  if (server.hasArg(PREF_APRS_ALTITUDE_RATIO)){
-    preferences.putInt(PREF_APRS_ALTITUDE_RATIO, server.arg(PREF_APRS_ALTITUDE_RATIO).toInt());
+  preferences.putBool(PREF_APRS_SHOW_BATTERY, request->hasArg(PREF_APRS_SHOW_BATTERY));
+  preferences.putBool(PREF_ENABLE_TNC_SELF_TELEMETRY, request->hasArg(PREF_ENABLE_TNC_SELF_TELEMETRY));
+  //preferences.putBool(PREF_APRS_SHOW_ALTITUDE, request->hasArg(PREF_APRS_SHOW_ALTITUDE));
+  preferences.putBool(PREF_APRS_SHOW_ALTITUDE_INSIDE_COMPRESSED_POSITION, request->hasArg(PREF_APRS_SHOW_ALTITUDE_INSIDE_COMPRESSED_POSITION));
+  if (request->hasArg(PREF_APRS_ALTITUDE_RATIO)){
+    preferences.putInt(PREF_APRS_ALTITUDE_RATIO, request->arg(PREF_APRS_ALTITUDE_RATIO).toInt());
   }
-  preferences.putBool(PREF_APRS_FIXED_BEACON_PRESET, server.hasArg(PREF_APRS_FIXED_BEACON_PRESET));
-  preferences.putBool(PREF_APRS_GPS_EN, server.hasArg(PREF_APRS_GPS_EN));
-  preferences.putBool(PREF_ACCEPT_OWN_POSITION_REPORTS_VIA_KISS, server.hasArg(PREF_ACCEPT_OWN_POSITION_REPORTS_VIA_KISS));
-  preferences.putBool(PREF_GPS_ALLOW_SLEEP_WHILE_KISS, server.hasArg(PREF_GPS_ALLOW_SLEEP_WHILE_KISS));
-  preferences.putBool(PREF_APRS_SHOW_CMT, server.hasArg(PREF_APRS_SHOW_CMT));
-  preferences.putBool(PREF_APRS_COMMENT_RATELIMIT_PRESET, server.hasArg(PREF_APRS_COMMENT_RATELIMIT_PRESET));
-
-  server.sendHeader("Location", "/");
-  server.send(302,"text/html", "");
-  
+  preferences.putBool(PREF_APRS_FIXED_BEACON_PRESET, request->hasArg(PREF_APRS_FIXED_BEACON_PRESET));
+  preferences.putBool(PREF_APRS_GPS_EN, request->hasArg(PREF_APRS_GPS_EN));
+  preferences.putBool(PREF_ACCEPT_OWN_POSITION_REPORTS_VIA_KISS, request->hasArg(PREF_ACCEPT_OWN_POSITION_REPORTS_VIA_KISS));
+  preferences.putBool(PREF_GPS_ALLOW_SLEEP_WHILE_KISS, request->hasArg(PREF_GPS_ALLOW_SLEEP_WHILE_KISS));
+  preferences.putBool(PREF_GPS_UBX_PVT, request->hasArg(PREF_GPS_UBX_PVT));
+  preferences.putBool(PREF_GPS_POWER_SAVE, request->hasArg(PREF_GPS_POWER_SAVE));
+  if (request->hasArg(PREF_GPS_UBX_RATE)) {
+    preferences.putInt(PREF_GPS_UBX_RATE, request->arg(PREF_GPS_UBX_RATE).toInt());
+  }
+  preferences.putBool(PREF_APRS_SHOW_CMT, request->hasArg(PREF_APRS_SHOW_CMT));
+  preferences.putBool(PREF_APRS_COMMENT_RATELIMIT_PRESET, request->hasArg(PREF_APRS_COMMENT_RATELIMIT_PRESET));
+  preferences.commitTransaction();
+
+  bool saved = web_cfg_changed();
+  // by loop(), which hands the APRS-IS settings to their task. No reboot
+  apply_settings_later();
+  if (!saved) {
+    web_cfg_not_saved(request);
+    return;
+  }
+  request->redirect("/");
 }
 
-void handle_saveDeviceCfg(){
-  preferences.putBool(PREF_DEV_BT_EN, server.hasArg(PREF_DEV_BT_EN));
-  preferences.putBool(PREF_DEV_OL_EN, server.hasArg(PREF_DEV_OL_EN));
-  if (server.hasArg(PREF_DEV_SHOW_RX_TIME)){
-    preferences.putInt(PREF_DEV_SHOW_RX_TIME, server.arg(PREF_DEV_SHOW_RX_TIME).toInt());
+void handle_saveDeviceCfg(AsyncWebServerRequest *request) {
+  preferences.beginTransaction();
+  preferences.putBool(PREF_DEV_BT_EN, request->hasArg(PREF_DEV_BT_EN));
+  preferences.putBool(PREF_DEV_OL_EN, request->hasArg(PREF_DEV_OL_EN));
+  if (request->hasArg(PREF_DEV_SHOW_RX_TIME)){
+    preferences.putInt(PREF_DEV_SHOW_RX_TIME, request->arg(PREF_DEV_SHOW_RX_TIME).toInt());
   }
   // Manage OLED Timeout
-  if (server.hasArg(PREF_DEV_SHOW_OLED_TIME)){
-    preferences.putInt(PREF_DEV_SHOW_OLED_TIME, server.arg(PREF_DEV_SHOW_OLED_TIME).toInt());
+  if (request->hasArg(PREF_DEV_SHOW_OLED_TIME)){
+    preferences.putInt(PREF_DEV_SHOW_OLED_TIME, request->arg(PREF_DEV_SHOW_OLED_TIME).toInt());
   }
-  preferences.putBool(PREF_DEV_AUTO_SHUT, server.hasArg(PREF_DEV_AUTO_SHUT));
-  if (server.hasArg(PREF_DEV_AUTO_SHUT_PRESET)){
-    preferences.putInt(PREF_DEV_AUTO_SHUT_PRESET, server.arg(PREF_DEV_AUTO_SHUT_PRESET).toInt());
+  preferences.putBool(PREF_DEV_AUTO_SHUT, request->hasArg(PREF_DEV_AUTO_SHUT));
+  if (request->hasArg(PREF_DEV_AUTO_SHUT_PRESET)){
+    preferences.putInt(PREF_DEV_AUTO_SHUT_PRESET, request->arg(PREF_DEV_AUTO_SHUT_PRESET).toInt());
   } 
-  if (server.hasArg(PREF_DEV_REBOOT_INTERVAL)){
-    preferences.putInt(PREF_DEV_REBOOT_INTERVAL, server.arg(PREF_DEV_REBOOT_INTERVAL).toInt());
+  if (request->hasArg(PREF_DEV_REBOOT_INTERVAL)){
+    preferences.putInt(PREF_DEV_REBOOT_INTERVAL, request->arg(PREF_DEV_REBOOT_INTERVAL).toInt());
   }
-  if (server.hasArg(PREF_DEV_CPU_FREQ)){
-    uint8_t cpufreq = server.arg(PREF_DEV_CPU_FREQ).toInt();
+  if (request->hasArg(PREF_DEV_CPU_FREQ)){
+    uint8_t cpufreq = request->arg(PREF_DEV_CPU_FREQ).toInt();
     if (cpufreq != 0 && cpufreq < 10)
       cpufreq = 10;
     preferences.putInt(PREF_DEV_CPU_FREQ, cpufreq);
   }
-  server.sendHeader("Location", "/");
-  server.send(302,"text/html", "");
+  preferences.putBool(PREF_DEV_FAST_BOOT, request->hasArg(PREF_DEV_FAST_BOOT));
+  preferences.commitTransaction();
+  if (!web_cfg_changed()) {
+    web_cfg_not_saved(request);
+    return;
+  }
+  request->redirect("/");
 }
 
 [[noreturn]] void taskWebServer(void *parameter) {
   auto *webServerCfg = (tWebServerCfg*)parameter;
   apSSID = webServerCfg->callsign + " AP";
+  metrics_register_task();
 
-  server.on("/", handle_Index);
+  server.on("/", handle_Index).setFilter(web_admit);
   server.on("/favicon.ico", handle_NotFound);
-  server.on("/style.css", handle_Style);
-  server.on("/js.js", handle_Js);
-  server.on("/scan_wifi", handle_ScanWifi);
-  server.on("/save_wifi_cfg", handle_SaveWifiCfg);
+  server.on("/style.css", handle_Style).setFilter(web_admit);
+  server.on("/js.js", handle_Js).setFilter(web_admit);
+  server.on("/scan_wifi", handle_ScanWifi).setFilter(web_admit);
+  server.on("/save_wifi_cfg", handle_SaveWifiCfg).setFilter(web_admit);
   server.on("/reboot", handle_Reboot);
   server.on("/beacon", handle_Beacon);
   server.on("/shutdown", handle_Shutdown);
-  server.on("/cfg", handle_Cfg);
-  server.on("/received_list", handle_ReceivedList);
-  server.on("/save_aprs_cfg", handle_SaveAPRSCfg);
-  server.on("/save_device_cfg", handle_saveDeviceCfg);
+  server.on("/cfg", handle_Cfg).setFilter(web_admit);
+  server.on("/status", handle_Status).setFilter(web_admit);
+  server.on("/received_list", handle_ReceivedList).setFilter(web_admit);
+  server.on("/heard", handle_HeardList).setFilter(web_admit);
+  server.on("/capture.pcapng", handle_Capture).setFilter(web_admit);
+  server.on("/aprsis", handle_AprsisStats).setFilter(web_admit);
+#ifdef ENABLE_PIPELINE_PROFILING
+  server.on("/profile", handle_Profile).setFilter(web_admit);
+#endif
+  server.on("/metrics", handle_Metrics).setFilter(web_admit);
+  server.on("/save_aprs_cfg", handle_SaveAPRSCfg).setFilter(web_admit);
+  server.on("/save_device_cfg", handle_saveDeviceCfg).setFilter(web_admit);
   server.on("/restore", handle_Restore);
-  server.on("/update", HTTP_POST, []() {
+  server.on("/update", HTTP_POST, [](AsyncWebServerRequest *request) {
     syslog_log(LOG_WARNING, String("Update finished. Status: ") + (!Update.hasError() ? "Ok" : "Error"));
-    server.sendHeader("Connection", "close");
-    server.send(200, "text/plain", (Update.hasError()) ? "FAIL" : "OK");
-    delay(500);
-    ESP.restart();
-  }, []() {
-    HTTPUpload& upload = server.upload();
-    if (upload.status == UPLOAD_FILE_START) {
+    AsyncWebServerResponse *response = request->beginResponse(200, "text/plain", (Update.hasError()) ? "FAIL" : "OK");
+    response->addHeader("Connection", "close");
+    request->send(response);
+    web_restart_later();
+  }, [](AsyncWebServerRequest *request, const String& filename, size_t index, uint8_t *data, size_t len, bool final) {
+    if (!index) {
       rf95.sleep(); // disable rf95 before update
-      Serial.printf("Update: %s\n", upload.filename.c_str());
+      Serial.printf("Update: %s\n", filename.c_str());
       if (!Update.begin(UPDATE_SIZE_UNKNOWN)) { //start with max available size
         syslog_log(LOG_ERR, String("Update begin error: ") + Update.errorString());
         Update.printError(Serial);
       }
-    } else if (upload.status == UPLOAD_FILE_WRITE) {
-      /* flashing firmware to ESP*/
-      if (Update.write(upload.buf, upload.currentSize) != upload.currentSize) {
-        syslog_log(LOG_ERR, String("Update error: ") + Update.errorString());
-        Update.printError(Serial);
-      }
-    } else if (upload.status == UPLOAD_FILE_END) {
+    }
+    /* flashing firmware to ESP*/
+    if (len && Update.write(data, len) != len) {
+      syslog_log(LOG_ERR, String("Update error: ") + Update.errorString());
+      Update.printError(Serial);
+    }
+    if (final) {
       if (Update.end(true)) { //true to set the size to the current progress
-        Serial.printf("Update Success: %u\nRebooting...\n", upload.totalSize);
-        syslog_log(LOG_WARNING, String("Update Success: ") + String((int)upload.totalSize));
+        Serial.printf("Update Success: %u\nRebooting...\n", index + len);
+        syslog_log(LOG_WARNING, String("Update Success: ") + String((int)(index + len)));
       } else {
         syslog_log(LOG_ERR, String("Update error: ") + Update.errorString());
         Update.printError(Serial);
       }
     }
   });
+  events.onConnect([](AsyncEventSourceClient *client) {
+    if (events.count() > WEB_EVENTS_CLIENTS_MAX)
+      client->close();
+  });
+  server.addHandler(&events);
   server.onNotFound(handle_NotFound);
 
   String wifi_password = preferences.getString(PREF_WIFI_PASSWORD, "");
@@ -852,6 +1654,7 @@ void handle_saveDeviceCfg(){
   if (!wifi_ssid.length()){
     WiFi.softAP(apSSID.c_str(), apPassword.c_str());
     esp_wifi_set_max_tx_power(wifi_txpwr_mode_AP);
+    metrics_boot_phase("wifi");
   } else {
     int retryWifi = 0;
     WiFi.begin(wifi_ssid.c_str(), wifi_password.length() ? wifi_password.c_str() : nullptr);
@@ -901,6 +1704,7 @@ void handle_saveDeviceCfg(){
     } else {
       Serial.println("WiFi Mode: " + WiFi.getMode());
     }
+    metrics_boot_phase("wifi");
 
     #ifdef ENABLE_SYSLOG
       syslog.server(SYSLOG_IP, 514);
@@ -929,7 +1733,14 @@ void handle_saveDeviceCfg(){
     #endif
   }
 
+  rxListLock = xSemaphoreCreateMutex();
+  webEventsQueue = xQueueCreate(WEB_EVENTS_QUEUE_LEN, sizeof(tWebEvent));
+  rx_list_init();
+  capture_ring_init();
+  cfgSnapshotLock = xSemaphoreCreateMutex();
+  cfg_boot_id = esp_random();
   server.begin();
+  metrics_boot_phase("http");
   #ifdef KISS_PROTOCOL
     if (tncServer_enabled)
       tncServer.begin();
@@ -946,39 +1757,9 @@ void handle_saveDeviceCfg(){
 
   webListReceivedQueue = xQueueCreate(4,sizeof(tReceivedPacketData *));
 
-
   tReceivedPacketData *receivedPacketData = nullptr;
 
-  WiFiClient aprs_is_client;
-
-  uint32_t t_connect_apprsis_again = 0L;
-  String aprs_callsign = webServerCfg->callsign;
-  aprsis_host.trim();
-  aprsis_filter.trim();
-  aprsis_password.trim();
-  if (aprsis_callsign.length() < 3 || aprsis_callsign.length() > 9)
-    aprsis_callsign = "";
-  if (aprsis_callsign.isEmpty()) aprsis_callsign = aprs_callsign;
-  if (aprsis_callsign.length() < 3 || aprsis_callsign.length() > 9)
-    aprsis_callsign = "";
-  aprsis_callsign.toUpperCase(); aprsis_callsign.trim();
-
-  // sanity check
-  if (aprsis_enabled) {
-    if (aprsis_callsign.isEmpty() || aprsis_host.isEmpty() || aprsis_port == 0) {
-      aprsis_enabled = false;
-   } else {
-      const char *p = aprsis_callsign.c_str();
-      for (; *p && aprsis_enabled; p++) {
-        if (*p == '-') {
-          int len = strlen(p+1);
-          if (len < 1 || len > 2)
-            aprsis_enabled = false;
-        } else if ( !((*p >= 'A' && *p <= 'Z') || (*p >= '0' && *p <= '9')) )
-            aprsis_enabled = false;
-      }
-    }
-  }
+  aprsis_start(webServerCfg);
 
   esp_task_wdt_init(120, true); //enable panic so ESP32 restarts
   esp_task_wdt_add(NULL); //add current thread to WDT watch
@@ -986,7 +1767,13 @@ void handle_saveDeviceCfg(){
   while (true){
     esp_task_wdt_reset();
 
-    // Mode STA and connection lost? -> reconnect
+    if (web_restart_at && (int32_t) (millis() - web_restart_at) >= 0) {
+      server.end();
+      preferences.commit();
+      ESP.restart();
+    }
+
+    // Mode STA and connection lost? -> reconnect. The webserver runs in the AsyncTCP task meanwhile
     if (WiFi.getMode() == 1 && WiFi.status() != WL_CONNECTED) {
       static uint32_t last_connection_attempt = millis();
       if (millis() - last_connection_attempt > 20000L) {
@@ -996,194 +1783,19 @@ void handle_saveDeviceCfg(){
         esp_task_wdt_reset();
         last_connection_attempt = millis();
       }
-      if (WiFi.status() != WL_CONNECTED) {
-         // 500ms for reconnect should be enough, ant not too often (power consumption).. Or, if we did not try to reconnect, this value is also fine
-         delay(500);
-         continue;
-      }
     }
 
-    server.handleClient();
-    if (xQueueReceive(webListReceivedQueue, &receivedPacketData, (1 / portTICK_PERIOD_MS)) == pdPASS) {
-      auto *receivedPacketToQueue = new tReceivedPacketData();
-      receivedPacketToQueue->packet = new String();
-      receivedPacketToQueue->packet->concat(*receivedPacketData->packet);
-      receivedPacketToQueue->RSSI = receivedPacketData->RSSI;
-      receivedPacketToQueue->SNR = receivedPacketData->SNR;
-      receivedPacketToQueue->rxTime = receivedPacketData->rxTime;
-      receivedPackets.push_back(receivedPacketToQueue);
-      if (receivedPackets.size() > MAX_RECEIVED_LIST_SIZE){
-        auto *packetDataToDelete = receivedPackets.front();
-        delete packetDataToDelete->packet;
-        delete packetDataToDelete;
-        receivedPackets.pop_front();
-      }
+    // waits here while there is nothing to do: live frames are sent without delay
+    tWebEvent ev;
+    web_events_listening = events.count() > 0;
+    if (xQueueReceive(webEventsQueue, &ev, (50 / portTICK_PERIOD_MS)) == pdPASS)
+      web_event_send(&ev);
+
+    if (xQueueReceive(webListReceivedQueue, &receivedPacketData, 0) == pdPASS) {
+      rx_list_add(receivedPacketData);
       delete receivedPacketData->packet;
       delete receivedPacketData;
     }
-
-
-    if (aprsis_enabled) {
-      boolean err = true;
-      if (WiFi.getMode() == 1) {
-        if (WiFi.status() != WL_CONNECTED) { aprsis_status = "Error: no internet"; goto on_err; } else { if (aprsis_status == "Error: no internet") aprsis_status = "Internet available"; }
-        if (!aprs_is_client.connected() && t_connect_apprsis_again < millis()) {
-          aprsis_status = "Connecting";
-          aprs_is_client.connect(aprsis_host.c_str(), aprsis_port);
-          if (!aprs_is_client.connected()) { aprsis_status = "Error: connect failed"; goto on_err; }
-          aprsis_status = "Connected. Waiting for greeting.";
-          uint32_t t_start = millis();
-          while (!aprs_is_client.available() && (millis()-t_start) < 25000) delay(100);
-          if (aprs_is_client.available()) {
-	    // check 
-	    String s = aprs_is_client.readStringUntil('\n');
-	    if (s.isEmpty() || !s.startsWith("#")) { aprsis_status = "Error: unexpected greeting"; goto on_err; }
-	  } else { aprsis_status = "Error: No response"; goto on_err; }
-          aprsis_status = "Login";
-	  char buffer[1024];
-	  sprintf(buffer, "user %s pass %s TTGO-T-Beam-LoRa-APRS 0.1%s%s\r\n", aprsis_callsign.c_str(), aprsis_password.c_str(), aprsis_filter.isEmpty() ? "" : " filter ", aprsis_filter.isEmpty() ? "" :  aprsis_filter.c_str());
-          aprs_is_client.print(String(buffer));
-          t_start = millis();
-          while (!aprs_is_client.available() && (millis()-t_start) < 25000) delay(100);
-          aprsis_status = "Logged in";
-          if (aprs_is_client.available()) {
-	    // check 
-	    String s = aprs_is_client.readStringUntil('\n');
-	    if (s.isEmpty() || !s.startsWith("#")) { aprsis_status = "Error: unexpected reponse on login"; goto on_err; }
-	    if (s.indexOf(" logresp") == -1) { aprsis_status = "Error: Login denied: " + s; aprsis_status.trim(); goto on_err; }
-	    if (s.indexOf(" verified") == -1) { aprsis_status = "Notice: server responsed not verified: " + s; aprsis_status.trim(); }
-	  } else { aprsis_status = "Error: No response"; goto on_err; }
-        }
-        if (!aprs_is_client.connected())
-          goto on_err;
-        //aprsis_status = "OK";
-        if (aprs_is_client.available()) {
-          //aprsis_status = "OK, reading";
-          String s = aprs_is_client.readStringUntil('\n');
-          if (!s) goto on_err;
-          //aprsis_status = "OK";
-          s.trim();
-          if (s.isEmpty()) goto on_err;
-	  if (*(s.c_str()) == '#' || !isalnum(*(s.c_str()))) goto do_not_send;
-	  char *header_end = strchr(s.c_str(), ':');
-	  if (!header_end) goto do_not_send;
-	  char *src_call_end = strchr(s.c_str(), '>');
-	  if (!src_call_end) goto do_not_send;
-	  if (src_call_end > header_end-2) goto do_not_send;
-	  char *q = strchr(s.c_str(), '-');
-	  if (q && q < src_call_end) {
-	    // len callsign > 6?
-	    if (q-s.c_str() > 6) goto do_not_send;
-	    // SSID optional, only 0..15
-	    if (q[2] == '>') {
-	      if (q[1] < '0' || q[1] > '9') goto do_not_send;
-	    } else if (q[3] == '>') {
-	      if (q[1] != '1' || q[2] < '0' || q[2] > '5') goto do_not_send;
-	    } else goto do_not_send;
-	  } else {
-	    if (src_call_end-s.c_str() > 6) goto do_not_send;
-	  }
-
-	  // do not interprete packets coming back from aprs-is net (either our source call, or if we have repeated it with one of our calls
-	  // sender is our call?
-          if (s.startsWith(aprs_callsign + '>') || s.startsWith(aprsis_callsign + '>')) goto do_not_send;
-
-	  // packet has our call in i.E. ...,qAR,OURCALL:...
-	  q = strstr(s.c_str(), (',' + aprsis_callsign + ':').c_str());
-	  if (q && q < header_end) goto do_not_send;
-	  for (int i = 0; i < 2; i++) {
-	    String call = (i == 0 ? aprs_callsign : aprsis_callsign);
-		// digipeated frames look like "..,DL9SAU,DL1AAA,DL1BBB*,...", or "..,DL9SAU*,DL1AAA,DL1BBB,.."
-	    if (((q = strstr(s.c_str(), (',' + call + '*').c_str())) || (q = strstr(s.c_str(), (',' + call + ',').c_str()))) && q < header_end) {
-              char *digipeatedflag = strchr(q, '*');
-	      if (digipeatedflag && digipeatedflag < header_end && digipeatedflag > q)
-	        goto do_not_send;
-	    }
-	  }
-	  // generate third party packet. Use aprs_callsign (deriving from webServerCfg->callsign), because aprsis_callsign may have a non-aprs (but only aprsis-compatible) ssid like '-L4'
-          String third_party_packet = generate_third_party_packet(aprs_callsign, s);
-          if (!third_party_packet.isEmpty()) {
-            aprsis_status = "OK, fromAPRSIS: " + s + " => " + third_party_packet; aprsis_status.trim();
-#ifdef KISS_PROTOCOL
-            sendToTNC(third_party_packet);
-#endif
-            if (lora_tx_enabled && aprsis_data_allow_inet_to_rf) {
-	      // not query or aprs-message addressed to our call (check both, aprs_callsign and aprsis_callsign)=
-	      // Format: "..::DL9SAU-15:..."
-	      // check is in this code part, because we may like to see those packets via kiss (sent above)
-	      q = header_end + 1;
-	      if (*q == ':' && strlen(q) > 10 && q[10] == ':' &&
-                  ((!strncmp(q+1, aprs_callsign.c_str(), aprs_callsign.length()) && (aprs_callsign.length() == 9 || q[9] == ' ')) ||
-                  (!strncmp(q+1, aprsis_callsign.c_str(), aprsis_callsign.length()) && (aprsis_callsign.length() == 9 || q[9] == ' ')) ))
-	        goto do_not_send;
-              if (aprsis_data_allow_inet_to_rf % 2)
-                loraSend(txPower, lora_freq, lora_speed, third_party_packet);
-              if (aprsis_data_allow_inet_to_rf > 1 && lora_freq_cross_digi > 1.0 && lora_freq_cross_digi != lora_freq)
-                loraSend(txPower_cross_digi, lora_freq_cross_digi, lora_speed_cross_digi, third_party_packet);
-            }
-          }
-        }
-do_not_send:
-        if (to_aprsis_data) {
-	  // copy(). We are threaded..
-	  String data = String(to_aprsis_data);
-	  // clear queue
-          to_aprsis_data = "";
-          data.trim();
-          char *p = strchr(data.c_str(), '>');
-          char *q;
-          // some plausibility checks.
-          if (p && p > data.c_str() && (q = strchr(p+1, ':'))) {
-            // Due to http://www.aprs-is.net/IGateDetails.aspx , never gate third-party traffic contining TCPIP or TCPXX
-            // IGATECALL>APRS,GATEPATH:}FROMCALL>TOCALL,TCPIP,IGATECALL*:original packet data
-            char *r; char *s;
-            if (!(q[1] == '}' && (r = strchr(q+2, '>')) && ((s = strstr(r+1, ",TCPIP,")) || (s = strstr(r+1, ",TCPXX,"))) && strstr(s+6, "*:"))) {
-	      char buf[256];
-	      int len = (q-data.c_str());
-	      if (len > 0 && len < sizeof(buf)) {
-	        strncpy(buf, data.c_str(), len);
-                buf[len] = 0;
-		String s_data = String(buf) + (lora_tx_enabled ? ",qAR," : ",qAO,") + aprsis_callsign + q + "\r\n";
-                aprsis_status = "OK, toAPRSIS: " + s_data; aprsis_status.trim();
-                aprs_is_client.print(s_data);
-	      }
-            }
-          }
-          //aprsis_status = "OK";
-        }
-        err = false;
-
-        if (err) {
-on_err:
-	  aprs_is_client.stop();
-	  if (!aprsis_status.startsWith("Error: "))
-            aprsis_status = "Disconnected";
-	  if (t_connect_apprsis_again <=  millis())
-	    t_connect_apprsis_again = millis() + 60000;
-          to_aprsis_data = "";
-        }
-      }
-    }
-
-    vTaskDelay(5/portTICK_PERIOD_MS);
   }
 }
 
-
-String generate_third_party_packet(String callsign, String packet_in)
-{
-  String packet_out = "";
-  const char *s = packet_in.c_str();
-  char *p = strchr(s, '>');
-  char *q = strchr(s, ',');
-  char *r = strchr(s, ':');
-  char fromtodest[20]; // room for max (due to spec) 'DL9SAU-15>APRSXX-NN' + \0
-  if (p > s && p < q && q < r && (q-s) < sizeof(fromtodest)) {
-    r++;
-    strncpy(fromtodest, s, q-s);
-    fromtodest[(q-s)] = 0;
-    packet_out = callsign + ">" + MY_APRS_DEST_IDENTIFYER + ":}" + fromtodest + ",TCPIP," + callsign + "*:" + r;
-                             // ^ 3rd party traffic should be addressed directly (-> not to WIDE2-1 or so)
-  }
-  return packet_out;
-}
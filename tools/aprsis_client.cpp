@@ -0,0 +1,356 @@
+/*
+ * APRS-IS client driver for the host, to run the iGate protocol code of the firmware
+ * (lib/AprsIs, and lib/AprsFilter for gating to RF) against tools/aprsis_standin.py
+ * or a real server.
+ *
+ * Logs in like taskAPRSIS (greeting, login line, logresp), reads the downlink through
+ * the same line reader and decides for each line what the device would do with it:
+ * server comment, invalid, own frame, message to us, gated to KISS, gated to RF or
+ * rejected by the RF filter. Frames from an uplink capture ("heard on RF") are sent
+ * with q construct at a given rate. At the end, the counters are printed as the
+ * device shows them at /aprsis, to compare with the summary of the stand-in.
+ *
+ * Build (from the project root):
+ *   g++ -O2 -o aprsis_client -Ilib/AprsIs -Ilib/AprsFilter -Ilib/Digipeater -Ilib/HeardStations tools/aprsis_client.cpp lib/AprsIs/AprsIs.cpp lib/AprsFilter/AprsFilter.cpp lib/Digipeater/Digipeater.cpp lib/HeardStations/HeardStations.cpp
+ *
+ * Usage:
+ *   aprsis_client [-s host:port] [-c call] [-C aprsis_call] [-p pass] [-f filter] [-F rf_filter] [-u capture] [-r lines/s] [-o] [-d seconds] [-v]
+ *     -s  server (127.0.0.1:14580)
+ *     -c  own call on RF (N0CALL-10)
+ *     -C  call on APRS-IS (own call)
+ *     -p  passcode (-1)
+ *     -f  server side filter
+ *     -F  local filter for gating to RF, like aprsis_rf_filter. Without, nothing is gated to RF
+ *     -u  uplink capture: frames in TNC2 format, or in the capture format of tools/digi_sim.cpp
+ *     -r  uplink frames per second (1)
+ *     -o  receive only (qAO). Default: bidirectional igate (qAR)
+ *     -d  stop after that many seconds. Default: when the server closes the connection
+ *     -v  print each downlink line with what was done with it, and each uplink line
+ */
+
+#include <AprsIs.h>
+#include <AprsFilter.h>
+#include <HeardStations.h>
+#include <arpa/inet.h>
+#include <ctype.h>
+#include <errno.h>
+#include <getopt.h>
+#include <netdb.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+#include <string>
+#include <vector>
+
+// as in taskAPRSIS
+#define APRSIS_RESPONSE_TIMEOUT 25000
+#define APRSIS_KEEPALIVE_TIMEOUT 60000
+#define DEST "APLOX1"
+
+static const char *aprs_call = "N0CALL-10";
+static const char *igate_call = 0;
+static const char *password = "-1";
+static const char *filter = "";
+static bool verbose = false;
+
+static struct {
+  uint32_t lines_in, bytes_in, bytes_out;
+  uint32_t dl_comment, dl_invalid, dl_own, dl_to_us, gated_kiss, gated_rf;
+  uint32_t rf_filter_no_match, rf_filter_not_heard, rf_filter_rejected[APRS_FILTER_TERMS_MAX];
+  uint32_t sent, not_gated;
+} stat;
+
+static uint32_t now_ms()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint32_t ) (ts.tv_sec * 1000 + ts.tv_nsec / 1000000);
+}
+
+static int tcp_connect(const char *server)
+{
+  char host[256];
+  const char *port = "14580";
+  struct addrinfo hints, *res, *ai;
+  int fd = -1;
+
+  snprintf(host, sizeof(host), "%s", server);
+  char *p = strrchr(host, ':');
+  if (p) {
+    *p = 0;
+    port = server + (p - host) + 1;
+  }
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  if (getaddrinfo(host, port, &hints, &res)) {
+    fprintf(stderr, "cannot resolve %s\n", host);
+    return -1;
+  }
+  for (ai = res; ai; ai = ai->ai_next) {
+    fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+    if (fd >= 0 && !connect(fd, ai->ai_addr, ai->ai_addrlen))
+      break;
+    if (fd >= 0)
+      close(fd);
+    fd = -1;
+  }
+  freeaddrinfo(res);
+  if (fd < 0)
+    perror(server);
+  return fd;
+}
+
+static bool send_all(int fd, const char *buf, size_t len)
+{
+  while (len) {
+    ssize_t n = send(fd, buf, len, 0);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      return false;
+    buf += n;
+    len -= n;
+  }
+  return true;
+}
+
+/**
+ * Read what is there, up to timeout_ms.
+ * @return bytes read, 0 on timeout, -1 if the connection is closed
+ */
+static int reader_fill(struct aprsis_reader *r, int fd, int timeout_ms)
+{
+  struct pollfd pfd = { fd, POLLIN, 0 };
+  size_t room;
+  char *space = aprsis_reader_space(r, &room);
+
+  if (!room)
+    return 0;
+  int n = poll(&pfd, 1, timeout_ms);
+  if (n <= 0)
+    return 0;
+  n = recv(fd, space, room, 0);
+  if (n <= 0)
+    return -1;
+  aprsis_reader_added(r, n);
+  stat.bytes_in += n;
+  return n;
+}
+
+// next line from the server within timeout_ms, or 0
+static char *read_line(struct aprsis_reader *r, int fd, int timeout_ms, size_t *len)
+{
+  uint32_t t_start = now_ms();
+  char *line;
+
+  while (!(line = aprsis_reader_next(r, len))) {
+    int left = timeout_ms - (int ) (now_ms() - t_start);
+    if (left <= 0 || reader_fill(r, fd, left) < 0)
+      return 0;
+  }
+  return line;
+}
+
+static void handle_downlink(const char *s, size_t len, const struct aprs_filter *rf_filter)
+{
+  char third_party[APRSIS_LINE_MAX + 64];
+  const char *what;
+  int reason;
+
+  if (!len)
+    return;
+  switch (aprsis_downlink_check(s, aprs_call, igate_call)) {
+  case APRSIS_DL_COMMENT: stat.dl_comment++; what = "comment"; break;
+  case APRSIS_DL_INVALID: stat.dl_invalid++; what = "invalid"; break;
+  case APRSIS_DL_OWN: stat.dl_own++; what = "own"; break;
+  default:
+    if (!aprsis_third_party(aprs_call, DEST, s, third_party, sizeof(third_party))) {
+      stat.dl_invalid++;
+      what = "invalid";
+      break;
+    }
+    stat.gated_kiss++;
+    what = "kiss";
+    if (aprsis_downlink_to_us(s, len, aprs_call, igate_call)) {
+      stat.dl_to_us++;
+      what = "kiss, to us";
+    } else if (!rf_filter || !aprs_filter_match(rf_filter, s, now_ms(), &reason)) {
+      if (!rf_filter || reason == APRS_FILTER_NO_MATCH)
+        stat.rf_filter_no_match++;
+      else if (reason == APRS_FILTER_NOT_HEARD)
+        stat.rf_filter_not_heard++;
+      else
+        stat.rf_filter_rejected[reason]++;
+    } else {
+      stat.gated_rf++;
+      what = "kiss, rf";
+    }
+    if (verbose)
+      printf("DL %-12s %s\n   -> %s\n", what, s, third_party);
+    return;
+  }
+  if (verbose)
+    printf("DL %-12s %s\n", what, s);
+}
+
+static std::vector<std::string> read_capture(const char *name)
+{
+  std::vector<std::string> frames;
+  char line[1024];
+  FILE *f = fopen(name, "r");
+
+  if (!f) {
+    perror(name);
+    exit(1);
+  }
+  while (fgets(line, sizeof(line), f)) {
+    char *s = line;
+    while (isspace((unsigned char ) *s))
+      s++;
+    if (!*s || *s == '#')
+      continue;
+    // "<time> <rssi> <snr> <frame>": the frame
+    double t;
+    int rssi, snr, n = 0;
+    if (sscanf(s, "%lf %d %d %n", &t, &rssi, &snr, &n) == 3 && n)
+      s += n;
+    frames.push_back(s);
+  }
+  fclose(f);
+  return frames;
+}
+
+int main(int argc, char **argv)
+{
+  const char *server = "127.0.0.1:14580";
+  const char *rf_filter_text = 0;
+  const char *uplink = 0;
+  double rate = 1;
+  bool tx_enabled = true;
+  double duration = 0;
+  static struct aprs_filter rf_filter;
+  static struct aprsis_reader rx;
+  std::vector<std::string> frames;
+  char buf[1024];
+  char *line;
+  size_t len;
+  int c;
+
+  while ((c = getopt(argc, argv, "s:c:C:p:f:F:u:r:od:v")) != -1) {
+    switch (c) {
+    case 's': server = optarg; break;
+    case 'c': aprs_call = optarg; break;
+    case 'C': igate_call = optarg; break;
+    case 'p': password = optarg; break;
+    case 'f': filter = optarg; break;
+    case 'F': rf_filter_text = optarg; break;
+    case 'u': uplink = optarg; break;
+    case 'r': rate = atof(optarg); break;
+    case 'o': tx_enabled = false; break;
+    case 'd': duration = atof(optarg); break;
+    case 'v': verbose = true; break;
+    default:
+      fprintf(stderr, "usage: %s [-s host:port] [-c call] [-C aprsis_call] [-p pass] [-f filter] [-F rf_filter] [-u capture] [-r lines/s] [-o] [-d seconds] [-v]\n", argv[0]);
+      return 1;
+    }
+  }
+  if (!igate_call)
+    igate_call = aprs_call;
+  heard_stations_init(64);
+  if (rf_filter_text && aprs_filter_compile(rf_filter_text, &rf_filter, buf, sizeof(buf)) < 0) {
+    fprintf(stderr, "RF filter: %s\n", buf);
+    return 1;
+  }
+  if (uplink)
+    frames = read_capture(uplink);
+
+  int fd = tcp_connect(server);
+  if (fd < 0)
+    return 1;
+  aprsis_reader_reset(&rx);
+  if (!(line = read_line(&rx, fd, APRSIS_RESPONSE_TIMEOUT, &len)) || *line != '#') {
+    fprintf(stderr, "no greeting\n");
+    return 1;
+  }
+  fprintf(stderr, "greeting: %s\n", line);
+  if (!aprsis_login_line(igate_call, password, filter, buf, sizeof(buf)) || !send_all(fd, buf, strlen(buf))) {
+    fprintf(stderr, "login failed\n");
+    return 1;
+  }
+  if (!(line = read_line(&rx, fd, APRSIS_RESPONSE_TIMEOUT, &len)) || *line != '#') {
+    fprintf(stderr, "no response on login\n");
+    return 1;
+  }
+  if (!strstr(line, " logresp")) {
+    fprintf(stderr, "login denied: %s\n", line);
+    return 1;
+  }
+  fprintf(stderr, "%s: %s\n", strstr(line, " verified") ? "logged in" : "not verified", line);
+
+  uint32_t t_start = now_ms();
+  uint32_t t_last_rx = t_start;
+  uint32_t interval = rate > 0 ? (uint32_t ) (1000 / rate) : 0;
+  uint32_t t_next_tx = t_start;
+  size_t next_frame = 0;
+  const char *end = "connection closed";
+
+  for (;;) {
+    uint32_t now = now_ms();
+    if (duration > 0 && now - t_start >= duration * 1000) {
+      end = "done";
+      break;
+    }
+    if (now - t_last_rx > APRSIS_KEEPALIVE_TIMEOUT) {
+      end = "server timeout";
+      break;
+    }
+    while ((line = aprsis_reader_next(&rx, &len))) {
+      t_last_rx = now;
+      stat.lines_in++;
+      handle_downlink(line, len, rf_filter_text ? &rf_filter : 0);
+    }
+    // uplink: the frame was heard on RF, like in loop()
+    if (next_frame < frames.size() && (int32_t ) (now - t_next_tx) >= 0) {
+      const char *frame = frames[next_frame++].c_str();
+      heard_stations_update(frame, true, -100, 0, now);
+      size_t n = aprsis_uplink_line(frame, tx_enabled, igate_call, buf, sizeof(buf));
+      if (!n) {
+        stat.not_gated++;
+      } else {
+        if (!send_all(fd, buf, n))
+          break;
+        stat.sent++;
+        stat.bytes_out += n;
+        if (verbose)
+          printf("UL %.*s\n", (int ) n - 2, buf);
+      }
+      t_next_tx += interval;
+    }
+    int wait = (next_frame < frames.size()) ? (int ) (t_next_tx - now) : 100;
+    if (reader_fill(&rx, fd, wait < 0 ? 0 : (wait > 100 ? 100 : wait)) < 0)
+      break;
+  }
+  close(fd);
+
+  double t = (now_ms() - t_start) / 1000.0;
+  if (t < 0.001)
+    t = 0.001;
+  printf("%s after %.1f s\n", end, t);
+  printf("downlink   %lu lines, %lu bytes (%.1f lines/s, %.0f bytes/s)\n", (unsigned long ) stat.lines_in, (unsigned long ) stat.bytes_in,
+    stat.lines_in / t, stat.bytes_in / t);
+  printf("           comment %lu, invalid %lu, own %lu, to us %lu, gated kiss %lu, gated rf %lu\n",
+    (unsigned long ) stat.dl_comment, (unsigned long ) stat.dl_invalid, (unsigned long ) stat.dl_own, (unsigned long ) stat.dl_to_us,
+    (unsigned long ) stat.gated_kiss, (unsigned long ) stat.gated_rf);
+  printf("rf filter  no match %lu, not heard %lu, rejected [", (unsigned long ) stat.rf_filter_no_match, (unsigned long ) stat.rf_filter_not_heard);
+  for (int i = 0; rf_filter_text && i < rf_filter.terms; i++)
+    printf("%s%lu", i ? "," : "", (unsigned long ) stat.rf_filter_rejected[i]);
+  printf("]\n");
+  printf("uplink     %lu lines, %lu bytes (%.2f lines/s), %lu not gated\n", (unsigned long ) stat.sent, (unsigned long ) stat.bytes_out,
+    stat.sent / t, (unsigned long ) stat.not_gated);
+  return 0;
+}
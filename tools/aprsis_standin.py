@@ -0,0 +1,212 @@
+#!/usr/bin/env python3
+"""
+APRS-IS stand-in server, for testing the iGate without the Internet.
+
+Speaks the login handshake of an APRS-IS server ('#' greeting, 'user .. pass ..',
+'# logresp CALL verified'), streams downlink lines from a capture file at a given
+rate, and logs every uplink line it receives with a timestamp. At the end of each
+connection it prints a summary: lines and bytes sent and received, and the rates.
+
+Point the device to it: APRS-IS server name '<ip of your PC>:14580', or put it
+first in the server list to test failover ('<ip>:14580 euro.aprs2.net').
+
+Without a device: tools/aprsis_client.cpp runs the iGate protocol code of the
+firmware (lib/AprsIs) on the PC against it, and prints the counters of /aprsis.
+
+Capture: one frame per line in TNC2 format; lines starting with '#' are ignored.
+The capture format of tools/digi_sim.cpp ('<time> <rssi> <snr> <frame>') works
+too, the first three fields are dropped.
+
+Usage:
+  python3 tools/aprsis_standin.py [-p 14580] [-f capture] [-r lines/s] [--loop] [-o uplink.log]
+    -p  TCP port (14580)
+    -f  downlink capture. Without, only keepalives are sent
+    -r  downlink lines per second (1). 0: as fast as the device reads them
+    --loop        start the capture again at its end
+    --burst N     send the first N lines at once
+    -k  keepalive interval in seconds (20). 0: none, to test the server timeout
+    -o  uplink log, '<unix time> <line>' (stdout)
+    --unverified  answer 'unverified' even for a valid passcode
+    --deny        deny the login
+    --drop N      close the connection after N seconds, to test reconnect and failover
+"""
+
+import argparse
+import socket
+import sys
+import threading
+import time
+
+SERVER_NAME = 'STANDIN'
+
+
+def passcode(call):
+    # APRS-IS passcode of the base call
+    call = call.split('-')[0].upper()
+    h = 0x73e2
+    for i in range(0, len(call), 2):
+        h ^= ord(call[i]) << 8
+        if i + 1 < len(call):
+            h ^= ord(call[i + 1])
+    return h & 0x7fff
+
+
+def read_capture(file_name):
+    lines = []
+    with open(file_name, encoding='utf-8', errors='replace') as f:
+        for line in f:
+            line = line.strip()
+            if not line or line.startswith('#'):
+                continue
+            fields = line.split(None, 3)
+            if len(fields) == 4:
+                try:
+                    float(fields[0]), int(fields[1]), int(fields[2])
+                    line = fields[3]
+                except ValueError:
+                    pass
+            lines.append(line)
+    return lines
+
+
+class Client:
+    def __init__(self, conn, addr, args, capture, log, log_lock):
+        self.conn = conn
+        self.addr = addr
+        self.args = args
+        self.capture = capture
+        self.log = log
+        self.log_lock = log_lock
+        self.closed = threading.Event()
+        self.t_start = time.time()
+        self.down_lines = 0
+        self.down_bytes = 0
+        self.up_lines = 0
+        self.up_bytes = 0
+
+    def send(self, line):
+        data = (line + '\r\n').encode('utf-8', errors='replace')
+        # blocks while the TCP window of the device is full
+        self.conn.sendall(data)
+        return len(data)
+
+    def login(self, f):
+        self.send('# aprsc 2.1.10-standin')
+        line = f.readline()
+        if not line:
+            return False
+        line = line.decode('utf-8', errors='replace').strip()
+        fields = line.split()
+        if len(fields) < 4 or fields[0] != 'user' or fields[2] != 'pass':
+            self.send('# invalid login: ' + line)
+            return False
+        call = fields[1]
+        print('{}: login {}'.format(self.addr[0], line), file=sys.stderr)
+        if self.args.deny:
+            self.send('# logresp {} unverified, login denied'.format(call))
+            return False
+        try:
+            verified = int(fields[3]) == passcode(call) and not self.args.unverified
+        except ValueError:
+            verified = False
+        self.send('# logresp {} {}, server {}'.format(call, 'verified' if verified else 'unverified', SERVER_NAME))
+        return True
+
+    def uplink(self, f):
+        for line in f:
+            t = time.time()
+            self.up_lines += 1
+            self.up_bytes += len(line)
+            line = line.decode('utf-8', errors='replace').rstrip('\r\n')
+            with self.log_lock:
+                print('{:.3f} {}'.format(t, line), file=self.log, flush=True)
+        self.closed.set()
+
+    def downlink(self):
+        t_keepalive = time.time() + self.args.keepalive if self.args.keepalive else None
+        interval = 1.0 / self.args.rate if self.args.rate > 0 else 0
+        t_next = time.time()
+        i = 0
+        while not self.closed.is_set():
+            now = time.time()
+            if self.args.drop and now - self.t_start >= self.args.drop:
+                print('{}: dropping connection'.format(self.addr[0]), file=sys.stderr)
+                return
+            if t_keepalive and now >= t_keepalive:
+                self.down_bytes += self.send('# {} {} {}'.format(SERVER_NAME, time.strftime('%d %b %Y %H:%M:%S GMT', time.gmtime()), 'standin'))
+                t_keepalive = now + self.args.keepalive
+            if i == len(self.capture) and self.args.loop:
+                i = 0
+            if i < len(self.capture) and (i < self.args.burst or now >= t_next):
+                self.down_bytes += self.send(self.capture[i])
+                self.down_lines += 1
+                i += 1
+                if i >= self.args.burst:
+                    t_next = max(t_next + interval, now - 1) if interval else now
+                continue
+            time.sleep(min(0.01, max(0.0, t_next - now)) if i < len(self.capture) else 0.1)
+
+    def run(self):
+        f = self.conn.makefile('rb')
+        try:
+            if not self.login(f):
+                return
+            reader = threading.Thread(target=self.uplink, args=(f,), daemon=True)
+            reader.start()
+            self.downlink()
+        except (ConnectionError, OSError) as e:
+            print('{}: {}'.format(self.addr[0], e), file=sys.stderr)
+        finally:
+            self.closed.set()
+            try:
+                self.conn.shutdown(socket.SHUT_RDWR)
+            except OSError:
+                pass
+            self.conn.close()
+            self.summary()
+
+    def summary(self):
+        t = max(time.time() - self.t_start, 0.001)
+        print('{}: {:.1f}s. downlink: {} lines, {} bytes ({:.1f} lines/s, {:.0f} bytes/s). '
+              'uplink: {} lines, {} bytes ({:.2f} lines/s)'.format(
+                  self.addr[0], t, self.down_lines, self.down_bytes, self.down_lines / t, self.down_bytes / t,
+                  self.up_lines, self.up_bytes, self.up_lines / t), file=sys.stderr)
+
+
+def main():
+    parser = argparse.ArgumentParser(description='APRS-IS stand-in server')
+    parser.add_argument('-p', '--port', type=int, default=14580)
+    parser.add_argument('-f', '--file', help='downlink capture')
+    parser.add_argument('-r', '--rate', type=float, default=1.0, help='downlink lines per second, 0: unlimited')
+    parser.add_argument('--loop', action='store_true')
+    parser.add_argument('--burst', type=int, default=0)
+    parser.add_argument('-k', '--keepalive', type=float, default=20.0)
+    parser.add_argument('-o', '--output', help='uplink log')
+    parser.add_argument('--unverified', action='store_true')
+    parser.add_argument('--deny', action='store_true')
+    parser.add_argument('--drop', type=float, default=0)
+    args = parser.parse_args()
+
+    capture = read_capture(args.file) if args.file else []
+    log = open(args.output, 'a') if args.output else sys.stdout
+    log_lock = threading.Lock()
+
+    srv = socket.socket(socket.AF_INET, socket.SOCK_STREAM)
+    srv.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR, 1)
+    srv.bind(('', args.port))
+    srv.listen(4)
+    print('listening on port {}, {} downlink lines'.format(args.port, len(capture)), file=sys.stderr)
+    try:
+        while True:
+            conn, addr = srv.accept()
+            print('{}: connected'.format(addr[0]), file=sys.stderr)
+            client = Client(conn, addr, args, capture, log, log_lock)
+            threading.Thread(target=client.run, daemon=True).start()
+    except KeyboardInterrupt:
+        pass
+    finally:
+        srv.close()
+
+
+if __name__ == '__main__':
+    main()
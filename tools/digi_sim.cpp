@@ -0,0 +1,378 @@
+/*
+ * Trace driven digipeater simulator. Runs on the host, much faster than real time.
+ *
+ * Replays a capture of received frames through the same code the firmware uses
+ * (lib/Digipeater: packet_is_valid(), is_call_blacklisted(), digi_queue_frame(),
+ * digi_queue_due()), with a virtual clock instead of millis().
+ * Prints the digipeat decisions, the resulting TX timeline and the airtime used.
+ *
+ * Build (from the project root):
+ *   g++ -O2 -o digi_sim -Ilib/Digipeater -Ilib/HeardStations tools/digi_sim.cpp lib/Digipeater/Digipeater.cpp lib/HeardStations/HeardStations.cpp
+ *
+ * Capture format, one frame per line (lines starting with '#' are ignored):
+ *   <time in seconds, fractions allowed> <rssi> <snr> <frame in TNC2 format>
+ *   1623654000.250 -112 -7 DL1AAA-7>APLOX1,WIDE1-1:!4903.50N/07201.75W>
+ *
+ * Usage:
+ *   digi_sim [-c call] [-m mode] [-r rules] [-x cross_mode] [-s lora_speed] [-X cross_speed] [-b blacklist] [-t 0|1|2] [-S seed] [-v] [capture]
+ *     -c  own call (N0CALL-10)
+ *     -m  lora_digipeating_mode 1..3 (2)
+ *     -r  digipeater rules, like "trace WIDE1-1; onehop WIDE2-2". Default: rules of mode
+ *     -x  lora_cross_digipeating_mode 0..2 (0). The cross frequency is assumed to be free
+ *     -s  lora_speed 300, 240, 210, 180, 610, 1200 (300)
+ *     -X  lora_speed_cross_digi, the speed on the cross frequency (lora_speed)
+ *     -b  blacklist, like "DL1AAA,DL1BBB-0"
+ *     -t  add snr/rssi to path on RF: 0 never, 1 if heard direct, 2 always (0). ",Q" and ",QQ" in path are honored
+ *     -S  random seed for csma (1)
+ *     -v  print every received frame, not only the digipeated ones
+ *
+ * Model: the main loop polls every 100ms. loraSend() blocks during csma and TX, like on the device:
+ * frames heard while transmitting are lost; of the frames heard during csma only the last one is
+ * processed (BG_RF95 has one rx buffer). The channel is busy while a frame of the capture is on air.
+ */
+
+#include <Digipeater.h>
+#include <HeardStations.h>
+#include <ctype.h>
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+#include <string>
+
+#define MAX_FRAME_LEN 251   // == BG_RF95_MAX_MESSAGE_LEN
+
+struct rx_event {
+  uint32_t t;        // end of reception, ms since start of capture
+  uint32_t airtime;
+  int rssi;
+  int snr;
+  std::string frame;
+};
+
+static std::vector<rx_event> events;
+static const char *mycall = "N0CALL-10";
+static uint8_t lora_digipeating_mode = 2;
+static uint8_t lora_cross_digipeating_mode = 0;
+static uint16_t lora_speed = 300;
+static uint16_t lora_speed_cross_digi = 0;   // 0: lora_speed
+static char blacklist_calls[256] = "";
+static int add_snr_rssi = 0;
+static bool verbose = false;
+
+static struct digi_rules rules;
+static struct digi_queue lora_digi_queue;
+
+static struct {
+  uint32_t frames, invalid, blacklisted, own, lost_tx, lost_csma;
+  uint32_t queued, replaced, sent, sent_cross, expired;
+  uint32_t suppressed, held, held_cancelled;
+  uint64_t airtime_rx, airtime_tx, airtime_tx_cross, csma_wait;
+} stat;
+
+
+static void print_time(uint32_t t)
+{
+  printf("%8lu.%03lu ", (unsigned long ) t / 1000, (unsigned long ) t % 1000);
+}
+
+static bool channel_busy(uint32_t t)
+{
+  // events are sorted by end of reception. Frames are at most a few seconds long
+  for (size_t i = 0; i < events.size(); i++) {
+    if (events[i].t < t)
+      continue;
+    if (events[i].t - events[i].airtime <= t)
+      return true;
+    if (events[i].t > t + 20000)
+      break;
+  }
+  return false;
+}
+
+// loraSend(): csma and TX. Returns the time TX has finished.
+static uint32_t lora_send(uint32_t now, uint16_t speed, const char *frame, bool cross, size_t *next_event)
+{
+  uint32_t wait_for_signal = 700;
+  if (speed == 610) wait_for_signal = 250;
+  else if (speed == 1200) wait_for_signal = 125;
+
+  uint32_t start = now;
+  for (int n = 0; n < 30; n++) {
+    now += wait_for_signal;
+    if (!cross && channel_busy(now))
+      continue;
+    now += 100;
+    if ((cross || !channel_busy(now)) && rand() % 256 < 64)
+      break;
+  }
+  uint32_t airtime = lora_airtime_ms(speed, strlen(frame));
+  print_time(now);
+  printf("TX %s %5lu ms (csma %lu ms) %s\n", cross ? "cross" : "main ", (unsigned long ) airtime, (unsigned long ) (now - start), frame);
+  stat.csma_wait += now - start;
+  if (cross)
+    stat.airtime_tx_cross += airtime;
+  else
+    stat.airtime_tx += airtime;
+
+  // frames heard during csma: only the last one survives in the rx buffer. During TX: deaf
+  size_t i = *next_event;
+  size_t last_csma = events.size();
+  for (; i < events.size() && events[i].t <= now + airtime; i++) {
+    if (events[i].t < now) {
+      if (last_csma < events.size()) {
+        stat.lost_csma++;
+        if (verbose) { print_time(events[last_csma].t); printf("RX lost, overwritten during csma: %s\n", events[last_csma].frame.c_str()); }
+      }
+      last_csma = i;
+    } else {
+      stat.lost_tx++;
+      if (verbose) { print_time(events[i].t); printf("RX lost, we were transmitting: %s\n", events[i].frame.c_str()); }
+    }
+  }
+  if (last_csma < events.size()) {
+    // process it after TX. Move it to the position just before the next unprocessed event
+    events[last_csma].t = now + airtime;
+    if (last_csma != i-1)
+      std::swap(events[last_csma], events[i-1]);
+    *next_event = i-1;
+  } else {
+    *next_event = i;
+  }
+  return now + airtime;
+}
+
+// cross digipeating of the queued frame (the cross frequency is assumed to be free). Returns the time TX has finished
+static uint32_t send_cross(uint32_t now, size_t *next_event)
+{
+  const char *s = strstr(lora_digi_queue.frame, ",NOGATE");
+  if (s && s < strchr(lora_digi_queue.frame, ':'))
+    return now;
+  stat.sent_cross++;
+  return lora_send(now, lora_speed_cross_digi, lora_digi_queue.frame, true, next_event);
+}
+
+static void handle_rx(const rx_event &ev, uint32_t now, size_t *next_event, uint32_t *t_after)
+{
+  const char *received_frame = ev.frame.c_str();
+  const char *s;
+
+  stat.frames++;
+  stat.airtime_rx += ev.airtime;
+  if (!packet_is_valid(received_frame)) {
+    stat.invalid++;
+    if (verbose) { print_time(now); printf("RX invalid: %s\n", received_frame); }
+    return;
+  }
+  int blacklisted = is_call_blacklisted(received_frame, blacklist_calls);
+  if (blacklisted) {
+    stat.blacklisted++;
+    if (verbose) { print_time(now); printf("RX blacklisted (%d): %s\n", blacklisted, received_frame); }
+    return;
+  }
+
+  const char *header_end = strchr(received_frame, ':');
+  const char *digipeatedflag = strchr(received_frame, '*');
+  if (digipeatedflag && digipeatedflag > header_end)
+    digipeatedflag = 0;
+
+  // from us, or digipeated by us?
+  std::string call_gt = std::string(mycall) + ">";
+  std::string call_rep = std::string(",") + mycall + "*";
+  std::string call_path = std::string(",") + mycall + ",";
+  if (!strncmp(received_frame, call_gt.c_str(), call_gt.length()) ||
+      (((s = strstr(received_frame, call_rep.c_str())) || (s = strstr(received_frame, call_path.c_str()))) && s < header_end && digipeatedflag && digipeatedflag > s)) {
+    stat.own++;
+    if (verbose) { print_time(now); printf("RX own: %s\n", received_frame); }
+    return;
+  }
+
+  heard_stations_update(received_frame, !digipeatedflag, ev.rssi, ev.snr, now);
+
+  uint8_t user_demands_trace = ( ((s = strstr(received_frame, ",Q,")) || (s = strstr(received_frame, ",Q:"))) && s < header_end) ? 1 : 0;
+  if (((s = strstr(received_frame, ",QQ,")) || (s = strstr(received_frame, ",QQ:"))) && s < header_end)
+    user_demands_trace = 2;
+  const char *snr_rssi = 0;
+  if (add_snr_rssi > 1 || user_demands_trace > 1 || (!digipeatedflag && (add_snr_rssi == 1 || user_demands_trace == 1)))
+    snr_rssi = encode_snr_rssi(ev.snr, ev.rssi);
+
+  struct digi_link link;
+  heard_stations_digi_link(received_frame, ev.rssi, ev.snr, &link);
+  bool was_queued = *lora_digi_queue.frame;
+  bool was_held = was_queued && lora_digi_queue.held;
+  int ret = DIGI_QUEUE_NONE;
+  if (rules.qrg & DIGI_QRG_MAIN)
+    ret = digi_queue_frame(&lora_digi_queue, &rules, lora_digipeating_mode, received_frame, DIGI_QRG_MAIN, snr_rssi, &link, now);
+  if (was_held && !*lora_digi_queue.frame) {
+    stat.held_cancelled++;
+    print_time(now);
+    printf("   held frame digipeated by someone else, dropped: %s\n", received_frame);
+  }
+  if (ret == DIGI_QUEUE_SUPPRESSED) {
+    stat.suppressed++;
+    print_time(now);
+    printf("RX %4d dBm %3d dB suppressed (avg %d dBm %d dB over %u): %s\n", ev.rssi, ev.snr, link.rssi_avg, link.snr_avg, link.packets_direct, received_frame);
+    return;
+  }
+  if (ret == DIGI_QUEUE_NONE) {
+    if (verbose) { print_time(now); printf("RX not digipeated: %s\n", received_frame); }
+    return;
+  }
+  stat.queued++;
+  if (ret == DIGI_QUEUE_HELD)
+    stat.held++;
+  if (was_queued)
+    stat.replaced++;
+  print_time(now);
+  printf("RX %4d dBm %3d dB %s\n", ev.rssi, ev.snr, received_frame);
+  print_time(now);
+  printf("   %s%s: %s\n", ret == DIGI_QUEUE_HELD ? "held" : "queued", was_queued ? " (replaces pending frame)" : "", lora_digi_queue.frame);
+
+  // cross digipeating: immediately. Held frames when they are released
+  if (lora_cross_digipeating_mode > 0 && ret == DIGI_QUEUE_QUEUED)
+    *t_after = send_cross(now, next_event);
+}
+
+static int read_capture(FILE *f)
+{
+  char line[1024];
+  double t0 = -1;
+  int lineno = 0;
+
+  while (fgets(line, sizeof(line), f)) {
+    lineno++;
+    char *p = line + strlen(line);
+    while (p > line && (p[-1] == '\n' || p[-1] == '\r'))
+      *--p = 0;
+    if (!*line || *line == '#')
+      continue;
+    double t;
+    int rssi, snr, n = 0;
+    if (sscanf(line, "%lf %d %d %n", &t, &rssi, &snr, &n) < 3 || !n || !line[n]) {
+      fprintf(stderr, "line %d: expected <time> <rssi> <snr> <frame>\n", lineno);
+      continue;
+    }
+    if (strlen(line + n) > MAX_FRAME_LEN) {
+      fprintf(stderr, "line %d: frame too long\n", lineno);
+      continue;
+    }
+    if (t0 < 0)
+      t0 = t;
+    if (t < t0) {
+      fprintf(stderr, "line %d: capture not sorted by time\n", lineno);
+      return -1;
+    }
+    rx_event ev;
+    // start at 60s uptime, like a device which has been booted before the capture starts
+    ev.t = (uint32_t ) ((t - t0) * 1000.0) + 60000;
+    ev.rssi = rssi;
+    ev.snr = snr;
+    ev.frame = line + n;
+    ev.airtime = lora_airtime_ms(lora_speed, ev.frame.length());
+    events.push_back(ev);
+  }
+  return 0;
+}
+
+int main(int argc, char **argv)
+{
+  const char *rules_text = 0;
+  unsigned seed = 1;
+  int c;
+
+  while ((c = getopt(argc, argv, "c:m:r:x:s:X:b:t:S:v")) != -1) {
+    switch (c) {
+    case 'c': mycall = optarg; break;
+    case 'm': lora_digipeating_mode = atoi(optarg); break;
+    case 'r': rules_text = optarg; break;
+    case 'x': lora_cross_digipeating_mode = atoi(optarg); break;
+    case 's': lora_speed = atoi(optarg); break;
+    case 'X': lora_speed_cross_digi = atoi(optarg); break;
+    case 'b': snprintf(blacklist_calls, sizeof(blacklist_calls), ",%s,", optarg); break;
+    case 't': add_snr_rssi = atoi(optarg); break;
+    case 'S': seed = strtoul(optarg, 0, 0); break;
+    case 'v': verbose = true; break;
+    default:
+      fprintf(stderr, "usage: %s [-c call] [-m mode] [-r rules] [-x cross_mode] [-s lora_speed] [-X cross_speed] [-b blacklist] [-t 0|1|2] [-S seed] [-v] [capture]\n", argv[0]);
+      return 1;
+    }
+  }
+  if (lora_digipeating_mode < 1 || lora_digipeating_mode > 3) {
+    fprintf(stderr, "mode must be 1..3\n");
+    return 1;
+  }
+  if (!lora_speed_cross_digi)
+    lora_speed_cross_digi = lora_speed;
+  srand(seed);
+
+  char err[80];
+  if (digi_rules_compile(rules_text ? rules_text : digi_rules_for_mode(lora_digipeating_mode), mycall, &rules, err, sizeof(err)) < 0) {
+    fprintf(stderr, "rules: %s\n", err);
+    return 1;
+  }
+  heard_stations_init(1024);
+
+  FILE *f = stdin;
+  if (optind < argc && !(f = fopen(argv[optind], "r"))) {
+    perror(argv[optind]);
+    return 1;
+  }
+  if (read_capture(f) < 0)
+    return 1;
+  if (events.empty()) {
+    fprintf(stderr, "no frames\n");
+    return 1;
+  }
+
+  // virtual main loop
+  uint16_t tx_speed = (lora_speed < 300) ? 300 : lora_speed;
+  uint32_t now = events[0].t;
+  size_t next_event = 0;
+  while (next_event < events.size() || *lora_digi_queue.frame) {
+    if (next_event < events.size() && events[next_event].t <= now) {
+      const rx_event ev = events[next_event++];
+      uint32_t t_after = now;
+      handle_rx(ev, now, &next_event, &t_after);
+      now = t_after;
+      continue;
+    }
+    if (*lora_digi_queue.frame) {
+      int due = digi_queue_due(&lora_digi_queue, lora_digipeating_mode, lora_cross_digipeating_mode, now);
+      // released held frame: cross digipeating now, too. Only cross digipeating (mode 2): the release is -1
+      if (due && lora_cross_digipeating_mode > 0 && lora_digi_queue.held && (due > 0 || lora_cross_digipeating_mode > 1))
+        now = send_cross(now, &next_event);
+      if (due > 0) {
+        now = lora_send(now, tx_speed, lora_digi_queue.frame, false, &next_event);
+        stat.sent++;
+      } else if (due < 0 && lora_cross_digipeating_mode < 2) {
+        print_time(now);
+        printf("   expired: %s\n", lora_digi_queue.frame);
+        stat.expired++;
+      }
+      if (due)
+        *lora_digi_queue.frame = 0;
+    }
+    // waitAvailableTimeout(100)
+    uint32_t next = now + 100;
+    if (next_event < events.size() && events[next_event].t < next && events[next_event].t > now)
+      next = events[next_event].t;
+    now = next;
+  }
+
+  uint32_t span = now - events[0].t;
+  if (!span)
+    span = 1;
+  printf("\n");
+  printf("duration           %lu s\n", (unsigned long ) span / 1000);
+  printf("frames heard       %lu (invalid %lu, blacklisted %lu, own %lu)\n", (unsigned long ) stat.frames, (unsigned long ) stat.invalid, (unsigned long ) stat.blacklisted, (unsigned long ) stat.own);
+  printf("frames lost        %lu while transmitting, %lu overwritten during csma\n", (unsigned long ) stat.lost_tx, (unsigned long ) stat.lost_csma);
+  printf("queued             %lu (%lu replaced a pending frame)\n", (unsigned long ) stat.queued, (unsigned long ) stat.replaced);
+  printf("sent               %lu main, %lu cross, %lu expired\n", (unsigned long ) stat.sent, (unsigned long ) stat.sent_cross, (unsigned long ) stat.expired);
+  printf("suppressed         %lu dropped, %lu held (%lu of them dropped)\n", (unsigned long ) stat.suppressed, (unsigned long ) stat.held, (unsigned long ) stat.held_cancelled);
+  printf("airtime heard      %llu ms (%.2f%%)\n", (unsigned long long ) stat.airtime_rx, 100.0 * stat.airtime_rx / span);
+  printf("airtime TX main    %llu ms (%.2f%%)\n", (unsigned long long ) stat.airtime_tx, 100.0 * stat.airtime_tx / span);
+  printf("airtime TX cross   %llu ms (%.2f%%)\n", (unsigned long long ) stat.airtime_tx_cross, 100.0 * stat.airtime_tx_cross / span);
+  printf("csma wait          %llu ms\n", (unsigned long long ) stat.csma_wait);
+  return 0;
+}
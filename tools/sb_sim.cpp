@@ -0,0 +1,378 @@
+/*
+ * Smart beaconing simulator. Runs on the host, much faster than real time.
+ *
+ * Replays recorded tracks (GPX, or NMEA logs with RMC sentences) through the smart
+ * beaconing code of the firmware (lib/SmartBeacon: sb_fix(), sb_due(), sb_sent()),
+ * with the track time instead of millis(). Prints the number of beacons, the airtime
+ * they take and how far the position last sent is off the real one between beacons,
+ * to compare sb_* settings on the routes a tracker actually drives.
+ *
+ * Build (from the project root):
+ *   g++ -O2 -o sb_sim -Ilib/SmartBeacon -Ilib/Digipeater -Ilib/NmeaStream tools/sb_sim.cpp lib/SmartBeacon/SmartBeacon.cpp lib/Digipeater/Digipeater.cpp lib/NmeaStream/NmeaStream.cpp
+ *
+ * Input: GPX track points with time (<trkpt lat=".." lon=".."><time>2021-06-14T10:00:00Z</time></trkpt>),
+ * or NMEA sentences, of which RMC with status A and a valid checksum are used. The format is told
+ * by the content.
+ *
+ * Usage:
+ *   sb_sim [-m min_interval] [-M max_interval] [-s min_speed] [-S max_speed] [-a angle] [-t turn_slope] [-T turn_time] [-k] [-r lora_speed] [-l len] [-g gap] [-v] [track...]
+ *     -m  sb_min_interval, s (60)
+ *     -M  sb_max_interval, s (360)
+ *     -s  sb_min_speed, km/h (0)
+ *     -S  sb_max_speed, km/h (30)
+ *     -a  sb_angle, degree (30)
+ *     -t  sb_turn_slope (26)
+ *     -T  sb_turn_time, s (30)
+ *     -k  interval like SB_ALGO_KENWOOD: min_interval * max_speed / speed. Default: linear in speed
+ *     -r  lora_speed 300, 240, 210, 180, 610, 1200 (300). Rate limit and airtime
+ *     -l  length of a beacon frame, bytes (50: compressed position with a short comment)
+ *     -g  no fix while the track has a gap longer than this, s (10)
+ *     -v  print every beacon
+ *
+ * Model: one fix per second (the GPS rate), positions interpolated between the track points.
+ * Speed and course are those of the RMC sentence, or from the track for GPX. A beacon is sent
+ * at the first fix it is due at; only beacons are sent (no other TX resets lastTX). Each track
+ * starts like after a boot. The position error is the distance from the last beacon to the
+ * position at each fix, until the next beacon.
+ */
+
+#include <SmartBeacon.h>
+#include <Digipeater.h>
+#include <NmeaStream.h>
+#include <ctype.h>
+#include <getopt.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#define BOOT_MS 10000           // millis() at the first fix
+
+struct point {
+  double t;                     // unix time, s
+  double lat;
+  double lon;
+  double speed;                 // km/h. < 0: from the track
+  double course;                // degree. < 0: from the track
+};
+
+struct result {
+  uint32_t fixes;               // one per second
+  uint32_t beacons;
+  uint32_t turns;               // of them due to a turn
+  std::vector<double> error;    // m, at each fix after the first beacon
+};
+
+static struct sb_params params = { 60000, 360000, 0, 30, 30, 26, 30, false };
+static uint16_t lora_speed = 300;
+static int frame_len = 50;
+static double max_gap = 10;
+static bool verbose = false;
+
+static double rad(double deg)
+{
+  return deg * M_PI / 180;
+}
+
+static double distance_m(double lat1, double lon1, double lat2, double lon2)
+{
+  double dlat = rad(lat2 - lat1);
+  double dlon = rad(lon2 - lon1);
+  double a = sin(dlat / 2) * sin(dlat / 2) + cos(rad(lat1)) * cos(rad(lat2)) * sin(dlon / 2) * sin(dlon / 2);
+  return 2 * 6371000.0 * atan2(sqrt(a), sqrt(1 - a));
+}
+
+static double bearing(double lat1, double lon1, double lat2, double lon2)
+{
+  double y = sin(rad(lon2 - lon1)) * cos(rad(lat2));
+  double x = cos(rad(lat1)) * sin(rad(lat2)) - sin(rad(lat1)) * cos(rad(lat2)) * cos(rad(lon2 - lon1));
+  double b = atan2(y, x) * 180 / M_PI;
+  return b < 0 ? b + 360 : b;
+}
+
+static bool read_file(const char *name, std::string &data)
+{
+  FILE *f = strcmp(name, "-") ? fopen(name, "r") : stdin;
+  char buf[4096];
+  size_t n;
+
+  if (!f) {
+    perror(name);
+    return false;
+  }
+  while ((n = fread(buf, 1, sizeof(buf), f)) > 0)
+    data.append(buf, n);
+  if (f != stdin)
+    fclose(f);
+  return true;
+}
+
+// 2021-06-14T10:00:00Z, 2021-06-14T10:00:00.500+02:00
+static bool parse_iso_time(const char *s, double *t)
+{
+  struct tm tm;
+  int n = 0;
+  double frac = 0;
+
+  memset(&tm, 0, sizeof(tm));
+  if (sscanf(s, "%d-%d-%dT%d:%d:%d%n", &tm.tm_year, &tm.tm_mon, &tm.tm_mday, &tm.tm_hour, &tm.tm_min, &tm.tm_sec, &n) != 6)
+    return false;
+  s += n;
+  if (*s == '.') {
+    char *end;
+    frac = strtod(s, &end);
+    s = end;
+  }
+  tm.tm_year -= 1900;
+  tm.tm_mon -= 1;
+  *t = timegm(&tm) + frac;
+  int oh, om;
+  if ((*s == '+' || *s == '-') && sscanf(s + 1, "%d:%d", &oh, &om) == 2)
+    *t -= (*s == '-' ? -1 : 1) * (oh * 3600 + om * 60);
+  return true;
+}
+
+static bool xml_attr(const char *tag, const char *tag_end, const char *name, double *v)
+{
+  size_t len = strlen(name);
+
+  for (const char *p = tag; p + len + 2 < tag_end; p++) {
+    if (strncmp(p, name, len) || p[len] != '=' || (p[len+1] != '"' && p[len+1] != '\'') || isalnum((unsigned char ) p[-1]))
+      continue;
+    *v = atof(p + len + 2);
+    return true;
+  }
+  return false;
+}
+
+static void parse_gpx(const std::string &data, std::vector<point> &track)
+{
+  const char *s = data.c_str();
+  const char *p;
+
+  while ((p = strstr(s, "<trkpt"))) {
+    const char *tag_end = strchr(p, '>');
+    const char *end = strstr(p, "</trkpt>");
+    if (!tag_end || !end)
+      break;
+    s = end + 8;
+    struct point pt = { 0, 0, 0, -1, -1 };
+    const char *tm = strstr(tag_end, "<time>");
+    if (!xml_attr(p, tag_end, "lat", &pt.lat) || !xml_attr(p, tag_end, "lon", &pt.lon) || !tm || tm > end ||
+        !parse_iso_time(tm + 6, &pt.t))
+      continue;
+    track.push_back(pt);
+  }
+}
+
+// ddmm.mmmm and hemisphere
+static double nmea_degree(const std::string &v, const std::string &hemi)
+{
+  double d = atof(v.c_str());
+  double deg = floor(d / 100) + fmod(d, 100) / 60;
+  return (hemi == "S" || hemi == "W") ? -deg : deg;
+}
+
+static void parse_rmc(const char *sentence, std::vector<point> &track)
+{
+  std::vector<std::string> f;
+  std::string field;
+
+  for (const char *p = sentence; *p && *p != '*'; p++) {
+    if (*p == ',') {
+      f.push_back(field);
+      field.clear();
+    } else {
+      field += *p;
+    }
+  }
+  f.push_back(field);
+  // $GPRMC,hhmmss.ss,A,lat,N,lon,E,knots,course,ddmmyy,...
+  if (f.size() < 10 || f[2] != "A" || f[1].size() < 6 || f[3].empty() || f[5].empty())
+    return;
+
+  struct tm tm;
+  memset(&tm, 0, sizeof(tm));
+  if (f[9].size() >= 6) {
+    tm.tm_mday = atoi(f[9].substr(0, 2).c_str());
+    tm.tm_mon = atoi(f[9].substr(2, 2).c_str()) - 1;
+    tm.tm_year = atoi(f[9].substr(4, 2).c_str()) + 100;
+  } else {
+    tm.tm_mday = 1;
+    tm.tm_year = 70;
+  }
+  tm.tm_hour = atoi(f[1].substr(0, 2).c_str());
+  tm.tm_min = atoi(f[1].substr(2, 2).c_str());
+  struct point pt;
+  pt.t = timegm(&tm) + atof(f[1].substr(4).c_str());
+  pt.lat = nmea_degree(f[3], f[4]);
+  pt.lon = nmea_degree(f[5], f[6]);
+  // TinyGPS reports 0 if the GPS leaves them empty
+  pt.speed = atof(f[7].c_str()) * 1.852;
+  pt.course = atof(f[8].c_str());
+  track.push_back(pt);
+}
+
+static void parse_nmea(const std::string &data, std::vector<point> &track)
+{
+  struct nmea_reader r;
+  const char *sentence;
+  size_t len;
+
+  nmea_reader_init(&r);
+  for (size_t i = 0; i < data.size(); i++) {
+    if ((sentence = nmea_reader_feed(&r, data[i], &len)) && nmea_sentence_type(sentence) == NMEA_RMC)
+      parse_rmc(sentence, track);
+  }
+  if (r.invalid)
+    fprintf(stderr, "%lu invalid NMEA sentences skipped\n", (unsigned long ) r.invalid);
+}
+
+static void simulate(const std::vector<point> &track, struct result &res)
+{
+  struct sb_state sb;
+  uint32_t min_gap = 6000000L / lora_speed;
+  uint32_t last_tx = 0;
+  double beacon_lat = 0, beacon_lon = 0;
+  size_t i = 0;
+
+  sb_init(&sb);
+  if (track.size() < 2)
+    return;
+  double t0 = ceil(track[0].t);
+  for (double t = t0; t <= track.back().t; t += 1) {
+    while (i + 2 < track.size() && track[i+1].t <= t)
+      i++;
+    const struct point &a = track[i];
+    const struct point &b = track[i+1];
+    double dt = b.t - a.t;
+    if (dt <= 0 || dt > max_gap || t < a.t)
+      continue;
+    double k = (t - a.t) / dt;
+    double lat = a.lat + (b.lat - a.lat) * k;
+    double lon = a.lon + (b.lon - a.lon) * k;
+    double d = distance_m(a.lat, a.lon, b.lat, b.lon);
+    double speed = a.speed >= 0 ? a.speed : d / dt * 3.6;
+    double course = a.course >= 0 ? a.course : (d > 0.5 ? bearing(a.lat, a.lon, b.lat, b.lon) : 0);
+    uint32_t now = BOOT_MS + (uint32_t ) ((t - t0) * 1000);
+
+    res.fixes++;
+    sb_fix(&sb, &params, speed, course, now, last_tx);
+    bool turn = sb.next_tx == 1;
+    if (sb_due(&sb, &params, now, last_tx, min_gap)) {
+      res.beacons++;
+      if (turn)
+        res.turns++;
+      if (verbose) {
+        time_t tt = (time_t ) t;
+        char ts[32];
+        strftime(ts, sizeof(ts), "%Y-%m-%d %H:%M:%S", gmtime(&tt));
+        printf("%s  %10.5f %10.5f  %5.1f km/h %5.1f deg  %5lus%s\n", ts, lat, lon, speed, course,
+          last_tx ? (unsigned long ) ((now - last_tx) / 1000) : 0UL, turn ? "  turn" : "");
+      }
+      beacon_lat = lat;
+      beacon_lon = lon;
+      last_tx = now;
+      sb_sent(&sb, &params);
+    }
+    if (last_tx)
+      res.error.push_back(distance_m(beacon_lat, beacon_lon, lat, lon));
+  }
+}
+
+static void report(const char *name, struct result &res)
+{
+  uint32_t airtime = lora_airtime_ms(lora_speed, frame_len);
+  double sum = 0;
+
+  std::sort(res.error.begin(), res.error.end());
+  for (size_t i = 0; i < res.error.size(); i++)
+    sum += res.error[i];
+  printf("%s\n", name);
+  printf("  time with fix      %lu s\n", (unsigned long ) res.fixes);
+  printf("  beacons            %lu (%lu on turns)", (unsigned long ) res.beacons, (unsigned long ) res.turns);
+  if (res.beacons)
+    printf(", every %.0f s", (double ) res.fixes / res.beacons);
+  printf("\n");
+  printf("  airtime            %lu ms (%lu ms per beacon, %.3f%% of the time)\n", (unsigned long ) res.beacons * airtime,
+    (unsigned long ) airtime, res.fixes ? 100.0 * res.beacons * airtime / (res.fixes * 1000.0) : 0);
+  if (res.error.empty())
+    return;
+  printf("  position error     mean %.0f m, median %.0f m, 95%% %.0f m, max %.0f m\n", sum / res.error.size(),
+    res.error[res.error.size() / 2], res.error[(size_t ) (res.error.size() * 0.95)], res.error.back());
+}
+
+int main(int argc, char **argv)
+{
+  struct result total = {};
+  int c;
+
+  while ((c = getopt(argc, argv, "m:M:s:S:a:t:T:kr:l:g:v")) != -1) {
+    switch (c) {
+    case 'm': params.min_interval = atoi(optarg) * 1000; break;
+    case 'M': params.max_interval = atoi(optarg) * 1000; break;
+    case 's': params.min_speed = atof(optarg); break;
+    case 'S': params.max_speed = atof(optarg); break;
+    case 'a': params.angle = atof(optarg); break;
+    case 't': params.turn_slope = atoi(optarg); break;
+    case 'T': params.turn_time = atoi(optarg); break;
+    case 'k': params.kenwood = true; break;
+    case 'r': lora_speed = atoi(optarg); break;
+    case 'l': frame_len = atoi(optarg); break;
+    case 'g': max_gap = atof(optarg); break;
+    case 'v': verbose = true; break;
+    default:
+      fprintf(stderr, "usage: %s [-m min_interval] [-M max_interval] [-s min_speed] [-S max_speed] [-a angle] [-t turn_slope] [-T turn_time] [-k] [-r lora_speed] [-l len] [-g gap] [-v] [track...]\n", argv[0]);
+      return 1;
+    }
+  }
+  if (lora_speed < 180 || frame_len < 1) {
+    fprintf(stderr, "bad lora_speed or frame length\n");
+    return 1;
+  }
+  // what the firmware makes of the settings
+  if (params.min_interval < 10000)
+    params.min_interval = 10000;
+  if (params.max_interval <= params.min_interval)
+    params.max_interval = params.min_interval + 1000;
+  if (params.max_speed <= params.min_speed)
+    params.max_speed = params.min_speed + 1;
+  if (params.max_interval < SB_FIRST_INTERVAL)
+    params.max_interval = SB_FIRST_INTERVAL;
+
+  int files = argc - optind;
+  for (int n = optind; n < argc || (n == optind && !files); n++) {
+    const char *name = files ? argv[n] : "-";
+    std::string data;
+    std::vector<point> track;
+    struct result res = {};
+
+    if (!read_file(name, data))
+      return 1;
+    if (data.find("<trkpt") != std::string::npos)
+      parse_gpx(data, track);
+    else
+      parse_nmea(data, track);
+    if (track.size() < 2) {
+      fprintf(stderr, "%s: no track\n", name);
+      continue;
+    }
+    // out of order points would be a jump back in time
+    std::stable_sort(track.begin(), track.end(), [](const point &a, const point &b) { return a.t < b.t; });
+    if (verbose)
+      printf("%s\n", name);
+    simulate(track, res);
+    report(name, res);
+    total.fixes += res.fixes;
+    total.beacons += res.beacons;
+    total.turns += res.turns;
+    total.error.insert(total.error.end(), res.error.begin(), res.error.end());
+  }
+  if (files > 1)
+    report("total", total);
+  return 0;
+}